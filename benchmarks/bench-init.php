@@ -1,11 +1,44 @@
 <?php
 
-$t = microtime( true );
-$n = 100000;
-for ( $i = 0; $i < $n; $i++ ) {
-	$timer = new ExcimerTimer;
-	$timer->setInterval( 1000 );
-	$timer->start();
+// Measure the cost of creating and starting timers. Destroyed timers are
+// returned to a per-thread pool, so the "reuse" case only needs to rearm an
+// existing timer, while the "fresh" case keeps all timers alive so that each
+// one needs a new timerlib timer.
+
+$n = intval( $argv[1] ?? 100000 );
+
+function bench( $name, $n, $fn ) {
+	$t = microtime( true );
+	$fn( $n );
+	$t = microtime( true ) - $t;
+	print str_pad( "$name:", 10 ) . round( $t / $n * 1e6, 3 ) . "us\n";
 }
-$t = microtime( true ) - $t;
-print round( $t / $n * 1e6, 3 ) . "us\n";
+
+bench( 'reuse', $n, static function ( $n ) {
+	for ( $i = 0; $i < $n; $i++ ) {
+		$timer = new ExcimerTimer;
+		$timer->setInterval( 1000 );
+		$timer->start();
+		$timer = null;
+	}
+} );
+
+bench( 'fresh', min( $n, 10000 ), static function ( $n ) {
+	$timers = [];
+	for ( $i = 0; $i < $n; $i++ ) {
+		$timer = new ExcimerTimer;
+		$timer->setInterval( 1000 );
+		$timer->start();
+		$timers[] = $timer;
+	}
+} );
+
+bench( 'profiler', $n, static function ( $n ) {
+	for ( $i = 0; $i < $n; $i++ ) {
+		$profiler = new ExcimerProfiler;
+		$profiler->setPeriod( 1000 );
+		$profiler->start();
+		$profiler->stop();
+		$profiler = null;
+	}
+} );
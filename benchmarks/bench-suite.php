@@ -0,0 +1,281 @@
+<?php
+
+// A reproducible benchmark suite for the sample capture and formatting paths.
+// Results are written as JSON, so that runs can be compared.
+//
+// Usage: php bench-suite.php [--filter=REGEX] [--sizes=1000,100000,1000000]
+//   [--repeat=N] [--output=FILE]
+//
+// Each result has a name, the parameters of the case, and the measured
+// metrics. Times are in nanoseconds and memory in bytes. For capture cases,
+// the time per sample comes from ExcimerProfiler::getStats(), so it only
+// covers the work done inside the timer interrupt.
+
+$options = getopt( '', [ 'filter:', 'sizes:', 'repeat:', 'output:' ] );
+$filter = $options['filter'] ?? null;
+$sizes = array_map( 'intval', explode( ',', $options['sizes'] ?? '1000,100000,1000000' ) );
+$repeat = max( 1, intval( $options['repeat'] ?? 3 ) );
+$output = $options['output'] ?? 'php://stdout';
+
+// Generate distinct functions for the wide workload
+const BENCH_WIDTH = 64;
+for ( $i = 0; $i < BENCH_WIDTH; $i++ ) {
+	eval( "function bench_wide_$i() { bench_spin( 200 ); }" );
+}
+
+function bench_now() {
+	return function_exists( 'hrtime' ) ? hrtime( true ) : (int)( microtime( true ) * 1e9 );
+}
+
+function bench_spin( $n ) {
+	$x = 0;
+	for ( $i = 0; $i < $n; $i++ ) {
+		$x += $i;
+	}
+	return $x;
+}
+
+function bench_deep( $depth ) {
+	if ( $depth > 0 ) {
+		bench_deep( $depth - 1 );
+	} else {
+		bench_spin( 1000 );
+	}
+}
+
+function bench_wide( $iteration ) {
+	$function = 'bench_wide_' . ( $iteration % BENCH_WIDTH );
+	$function();
+}
+
+function bench_recursive_a( $depth ) {
+	if ( $depth > 0 ) {
+		bench_recursive_b( $depth - 1 );
+	} else {
+		bench_spin( 1000 );
+	}
+}
+
+function bench_recursive_b( $depth ) {
+	bench_spin( 10 );
+	bench_recursive_a( $depth );
+}
+
+/**
+ * Get a workload callback, called repeatedly while the profiler runs
+ */
+function bench_workload( $shape, $depth ) {
+	switch ( $shape ) {
+		case 'deep':
+			return static function ( $i ) use ( $depth ) {
+				bench_deep( $depth );
+			};
+		case 'wide':
+			return static function ( $i ) {
+				bench_wide( $i );
+			};
+		case 'recursive':
+			// Vary the depth so that there are many similar stacks
+			return static function ( $i ) use ( $depth ) {
+				bench_recursive_a( $i % $depth );
+			};
+	}
+	throw new InvalidArgumentException( "Unknown shape $shape" );
+}
+
+/**
+ * Profile a workload until the log has the given number of entries
+ */
+function bench_collect( ExcimerProfiler $profiler, $workload, $size ) {
+	$profiler->start();
+	for ( $i = 0; count( $profiler->getLog() ) < $size; $i++ ) {
+		$workload( $i );
+	}
+	$profiler->stop();
+}
+
+function bench_new_profiler( $period = 1e-5 ) {
+	$profiler = new ExcimerProfiler;
+	$profiler->setEventType( EXCIMER_REAL );
+	$profiler->setPeriod( $period );
+	return $profiler;
+}
+
+function bench_median( array $values ) {
+	sort( $values );
+	$n = count( $values );
+	return $n % 2 ? $values[intdiv( $n, 2 )] : ( $values[$n / 2 - 1] + $values[$n / 2] ) / 2;
+}
+
+/**
+ * Time a function, returning the median wall time and the peak memory
+ * allocated above the starting usage
+ */
+function bench_time( $repeat, $fn ) {
+	$times = [];
+	$memory = 0;
+	for ( $i = 0; $i < $repeat; $i++ ) {
+		gc_collect_cycles();
+		if ( function_exists( 'memory_reset_peak_usage' ) ) {
+			memory_reset_peak_usage();
+		}
+		$base = memory_get_usage();
+		$t = bench_now();
+		$result = $fn();
+		$times[] = bench_now() - $t;
+		$memory = max( $memory, memory_get_peak_usage() - $base );
+		unset( $result );
+	}
+	return [ 'time_ns' => bench_median( $times ), 'memory_bytes' => $memory ];
+}
+
+$cases = [];
+
+// Capture cost per sample, by stack shape and depth
+foreach ( [ 'deep' => [ 10, 100, 1000 ], 'wide' => [ 1 ], 'recursive' => [ 10, 100 ] ] as $shape => $depths ) {
+	foreach ( $depths as $depth ) {
+		$cases["capture/$shape/$depth"] = static function () use ( $shape, $depth ) {
+			$profiler = bench_new_profiler();
+			bench_collect( $profiler, bench_workload( $shape, $depth ), 10000 );
+			$stats = $profiler->getStats();
+			$logStats = $stats['log'];
+			return [
+				'params' => [ 'shape' => $shape, 'depth' => $depth ],
+				'metrics' => [
+					'samples' => $stats['samples'],
+					'add_ns_per_sample' => $logStats['add_ns'] / max( 1, $stats['samples'] ),
+					'frames_walked_per_sample' => $logStats['frames_walked'] / max( 1, $stats['samples'] ),
+					'frames_cached_ratio' => $logStats['frames_cached'] / max( 1, $logStats['frames_walked'] ),
+					'frame_lookup_hit_ratio' => $logStats['frame_lookup_hits'] / max( 1, $logStats['frame_lookups'] ),
+					'frames_added' => $logStats['frames_added'],
+					'entry_bytes' => $logStats['entry_bytes'],
+					'frame_bytes' => $logStats['frame_bytes'],
+				],
+			];
+		};
+	}
+}
+
+// Formatting time and memory by log size
+foreach ( $sizes as $size ) {
+	$cases["format/$size"] = static function () use ( $size, $repeat ) {
+		$profiler = bench_new_profiler();
+		$workload = bench_workload( 'recursive', 20 );
+		bench_collect( $profiler, $workload, $size );
+		$log = $profiler->flush();
+		$metrics = [];
+		$formats = [
+			'collapsed' => static function () use ( $log ) {
+				return $log->formatCollapsed();
+			},
+			'speedscope_data' => static function () use ( $log ) {
+				return $log->getSpeedscopeData();
+			},
+			'speedscope' => static function () use ( $log ) {
+				return $log->formatSpeedscope();
+			},
+			'pprof' => static function () use ( $log ) {
+				return $log->formatPprof();
+			},
+			'aggregate' => static function () use ( $log ) {
+				return $log->aggregateByFunction();
+			},
+			'iterate' => static function () use ( $log ) {
+				$n = 0;
+				foreach ( $log as $entry ) {
+					$n += $entry->getEventCount();
+				}
+				return $n;
+			},
+		];
+		foreach ( $formats as $name => $fn ) {
+			$result = bench_time( $repeat, $fn );
+			$metrics["{$name}_time_ns"] = $result['time_ns'];
+			$metrics["{$name}_memory_bytes"] = $result['memory_bytes'];
+		}
+		$metrics['entries'] = count( $log );
+		$metrics['entry_bytes'] = $log->getStats()['entry_bytes'];
+		return [ 'params' => [ 'size' => $size ], 'metrics' => $metrics ];
+	};
+}
+
+// Flush callback rotation
+foreach ( [ 100, 1000, 10000 ] as $maxSamples ) {
+	$cases["flush/$maxSamples"] = static function () use ( $maxSamples ) {
+		$flushes = 0;
+		$profiler = bench_new_profiler();
+		$profiler->setFlushCallback( static function ( $log ) use ( &$flushes ) {
+			$log->formatCollapsed();
+			$flushes++;
+		}, $maxSamples );
+		$workload = bench_workload( 'deep', 20 );
+		$profiler->start();
+		for ( $i = 0; $flushes < 20; $i++ ) {
+			$workload( $i );
+		}
+		$profiler->stop();
+		$stats = $profiler->getStats();
+		return [
+			'params' => [ 'max_samples' => $maxSamples ],
+			'metrics' => [
+				'flushes' => $stats['flushes'],
+				'flush_ns_per_flush' => $stats['flush_ns'] / max( 1, $stats['flushes'] ),
+				'interrupt_ns_per_sample' => $stats['interrupt_ns'] / max( 1, $stats['samples'] ),
+			],
+		];
+	};
+}
+
+// Concurrent timers: delivered events and the cost seen by the main loop
+foreach ( [ 1, 10, 100, 1000 ] as $numTimers ) {
+	$cases["timers/$numTimers"] = static function () use ( $numTimers ) {
+		$events = 0;
+		$timers = [];
+		$t = bench_now();
+		for ( $i = 0; $i < $numTimers; $i++ ) {
+			$timer = new ExcimerTimer;
+			$timer->setPeriod( 1e-3 );
+			$timer->setCallback( static function ( $n ) use ( &$events ) {
+				$events += $n;
+			} );
+			$timer->start();
+			$timers[] = $timer;
+		}
+		$setup = bench_now() - $t;
+
+		$t = bench_now();
+		$iterations = 0;
+		while ( bench_now() - $t < 1e9 ) {
+			bench_spin( 100 );
+			$iterations++;
+		}
+		$elapsed = bench_now() - $t;
+		$timers = [];
+		return [
+			'params' => [ 'timers' => $numTimers ],
+			'metrics' => [
+				'setup_ns_per_timer' => $setup / $numTimers,
+				'events_per_second' => $events / ( $elapsed / 1e9 ),
+				'expected_events_per_second' => $numTimers * 1000,
+				'loop_iterations_per_second' => $iterations / ( $elapsed / 1e9 ),
+			],
+		];
+	};
+}
+
+$results = [];
+foreach ( $cases as $name => $case ) {
+	if ( $filter !== null && !preg_match( "/$filter/", $name ) ) {
+		continue;
+	}
+	fwrite( STDERR, "$name\n" );
+	$results[] = [ 'name' => $name ] + $case();
+}
+
+file_put_contents( $output, json_encode( [
+	'php_version' => PHP_VERSION,
+	'excimer_version' => phpversion( 'excimer' ),
+	'os' => PHP_OS,
+	'time' => date( DATE_ATOM ),
+	'results' => $results,
+], JSON_PRETTY_PRINT ) . "\n" );
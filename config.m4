@@ -16,6 +16,14 @@ if test "$PHP_EXCIMER" != "no"; then
       #include <pthread.h>
     ]])
 
+    AC_CHECK_DECL(pthread_sigqueue,[
+      AC_DEFINE(HAVE_PTHREAD_SIGQUEUE, 1, [Whether pthread_sigqueue is available])
+    ],,[[
+      #define _GNU_SOURCE 1
+      #include <signal.h>
+      #include <pthread.h>
+    ]])
+
     AC_CHECK_DECL(gettid,[
       AC_DEFINE(HAVE_GETTID, 1, [Whether gettid is available])
     ],,[[
@@ -50,6 +58,9 @@ if test "$PHP_EXCIMER" != "no"; then
     excimer_mutex.c \
     excimer_timer.c \
     excimer_log.c \
+    excimer_ring.c \
+    excimer_sink.c \
+    excimer_threads.c \
     timerlib/timerlib_common.c \
     $excimer_os_sources, $ext_shared)
 
@@ -29,6 +29,7 @@
 #include "ext/random/php_random.h"
 #endif
 #include "ext/standard/info.h"
+#include "Zend/zend_smart_str.h"
 
 #if PHP_VERSION_ID < 70200
 /* For spl_ce_Countable */
@@ -38,6 +39,9 @@
 #include "php_excimer.h"
 #include "excimer_timer.h"
 #include "excimer_log.h"
+#include "excimer_sink.h"
+#include "excimer_ring.h"
+#include "excimer_threads.h"
 
 #define EXCIMER_OBJ(type, object) \
 	((type ## _obj*)excimer_check_object(object, offsetof(type ## _obj, std), &type ## _handlers))
@@ -51,8 +55,70 @@
 
 #define EXCIMER_DEFAULT_PERIOD 0.1
 #define EXCIMER_BILLION 1000000000LL
+
+/** The number of samples between adjustments of an adaptive period */
+#define EXCIMER_ADAPT_SAMPLES 16
+
+/** The maximum ratio of an adaptive period to the configured period */
+#define EXCIMER_ADAPT_MAX_MULTIPLIER 1024
+
+/** The maximum number of windows kept by ExcimerProfiler::setFlushInterval() */
+#define EXCIMER_MAX_WINDOWS 100000
+
+/**
+ * The stages of degradation of a log which exceeds the memory limit. Each
+ * stage is entered if the log grows further while over the limit.
+ */
+/** The log is collected as configured */
+#define EXCIMER_MEMORY_FULL 0
+/** The log is in aggregate mode */
+#define EXCIMER_MEMORY_AGGREGATE 1
+/** The maximum stack depth is halved each time the log grows */
+#define EXCIMER_MEMORY_TRUNCATE 2
+/** No frames are added, and the events are reservoir sampled */
+#define EXCIMER_MEMORY_RESERVOIR 3
+
+/** The depth to which unlimited stacks are first truncated */
+#define EXCIMER_MEMORY_INITIAL_DEPTH 64
+
+/** The depth below which stacks are not truncated further */
+#define EXCIMER_MEMORY_MIN_DEPTH 8
 /* {{{ types */
 
+/**
+ * ExcimerProfiler_stats: overhead counters for the life of an ExcimerProfiler
+ */
+typedef struct {
+	/** The number of times the event handler was called */
+	zend_long samples;
+
+	/** The number of timer events delivered to the event handler */
+	zend_long events;
+
+	/** The overruns of timers which were destroyed when the event type changed */
+	zend_long old_overruns;
+
+	/** The time spent in the event handler, including flushing, in nanoseconds */
+	uint64_t interrupt_ns;
+
+	/** The number of logs flushed */
+	zend_long flushes;
+
+	/** The time spent calling the flush callback or submitting to the async sink, in nanoseconds */
+	uint64_t flush_ns;
+} ExcimerProfiler_stats;
+
+/**
+ * ExcimerProfiler_window: an aggregated log of a completed flush interval
+ */
+typedef struct {
+	/** The ExcimerLog, in aggregate mode */
+	zval z_log;
+
+	/** The start time of the interval, in nanoseconds since the epoch */
+	uint64_t start_ns;
+} ExcimerProfiler_window;
+
 /**
  * ExcimerProfiler_obj: underlying storage for ExcimerProfiler
  */
@@ -63,18 +129,139 @@ typedef struct {
 	/** The initial interval */
 	struct timespec initial;
 
-	/** The event type, either EXCIMER_CPU or EXCIMER_REAL */
+	/** The event type, EXCIMER_CPU, EXCIMER_REAL or EXCIMER_REAL_CPU */
 	zend_long event_type;
 
+	/** For EXCIMER_REAL_CPU, the thread CPU time at the previous sample, in nanoseconds */
+	uint64_t last_cpu_ns;
+
 	/** The currently-attached log */
 	zval z_log;
 
 	/** The flush callback. If this is set, max_samples will also be set. */
 	zval z_callback;
 
-	/** The maximum number of samples in z_log before z_callback is called. */
+	/**
+	 * The asynchronous flush target, or NULL. If this is set, z_callback is
+	 * null and max_samples is set.
+	 */
+	zend_string *async_target;
+
+	/** The asynchronous flush format, EXCIMER_FORMAT_COLLAPSED or EXCIMER_FORMAT_PPROF */
+	zend_long async_format;
+
+	/**
+	 * The maximum number of samples in z_log before z_callback is called
+	 * or the log is sent to async_target.
+	 */
 	zend_long max_samples;
 
+	/**
+	 * The flush interval in nanoseconds, or zero if the log is not flushed
+	 * by time. Intervals are aligned to the log epoch.
+	 */
+	uint64_t flush_interval;
+
+	/** The number of the interval containing the entries of z_log, counting from the epoch */
+	uint64_t flush_window;
+
+	/**
+	 * A ring of aggregated copies of the logs of the most recent intervals,
+	 * or NULL if windows are not kept
+	 */
+	ExcimerProfiler_window *windows;
+
+	/** The maximum number of elements of the "windows" array */
+	zend_long max_windows;
+
+	/** The index within "windows" of the oldest window */
+	zend_long windows_start;
+
+	/** The number of windows in use */
+	zend_long windows_size;
+
+	/**
+	 * An aggregated copy of the logs flushed so far in the current interval,
+	 * or undef. It becomes the window when the interval ends.
+	 */
+	zval z_window_log;
+
+	/**
+	 * The number of samples for which space is reserved when a new log is
+	 * created, or zero to grow the log on demand.
+	 */
+	zend_long expected_samples;
+
+	/**
+	 * Whether samples are written to the shared ring instead of the log. In
+	 * this mode the log only holds frames.
+	 */
+	int ring_enabled;
+
+	/** The ring stream ID of the current log, or zero if not yet allocated */
+	uint64_t ring_stream;
+
+	/**
+	 * The store indexes of the frames which were written to the ring in the
+	 * current stream. With a persistent frame store, only the frames which
+	 * samples reach are written, rather than every frame in the store.
+	 */
+	HashTable ring_frames_sent;
+
+	/** A buffer for the frames of a stack which are yet to be written */
+	uint32_t *ring_pending;
+
+	/** The number of allocated elements in ring_pending */
+	size_t ring_pending_capacity;
+
+	/**
+	 * The maximum fraction of the sampled time which may be spent in the
+	 * event handler, or zero to use a fixed period
+	 */
+	double max_overhead;
+
+	/**
+	 * The current timer period as a multiple of "period". Event counts are
+	 * scaled by this, so that they remain in units of the configured period.
+	 */
+	zend_long period_multiplier;
+
+	/** The number of samples in the current adaptation window */
+	zend_long adapt_samples;
+
+	/** The scaled event count of the current adaptation window */
+	zend_long adapt_events;
+
+	/** The time spent in the event handler in the current adaptation window, in nanoseconds */
+	uint64_t adapt_handler_ns;
+
+	/**
+	 * Whether the profiler samples all PHP threads in the process. This takes
+	 * effect when the profiler is started.
+	 */
+	int all_threads;
+
+	/**
+	 * The maximum request memory in bytes used by the entries and frames of
+	 * the current log, or zero for no limit
+	 */
+	zend_long memory_limit;
+
+	/** The degradation stage of the current log, EXCIMER_MEMORY_* */
+	int memory_stage;
+
+	/** The memory usage of the current log when the stage last changed */
+	size_t memory_stage_usage;
+
+	/** The aggregate option before the current log was degraded */
+	int saved_aggregate;
+
+	/** The maximum depth before the current log was degraded */
+	zend_long saved_max_depth;
+
+	/** Overhead counters */
+	ExcimerProfiler_stats stats;
+
 	/** Whether a parameter has changed that requires reinitialisation of the timer. */
 	int need_reinit;
 
@@ -158,10 +345,21 @@ typedef struct {
 /* }}} */
 
 /* {{{ static function declarations */
+static void ExcimerProfiler_set_period(ExcimerProfiler_obj *profiler, double period);
 static void ExcimerProfiler_start(ExcimerProfiler_obj *profiler);
 static void ExcimerProfiler_stop(ExcimerProfiler_obj *profiler);
 static void ExcimerProfiler_event(zend_long event_count, void *user_data);
 static void ExcimerProfiler_flush(ExcimerProfiler_obj *profiler, zval *zp_old_log);
+static void ExcimerProfiler_add_flush_time(ExcimerProfiler_obj *profiler,
+	struct timespec *start_ts);
+static void ExcimerProfiler_adapt_period(ExcimerProfiler_obj *profiler,
+	zend_long event_count, uint64_t handler_ns);
+static void ExcimerProfiler_check_memory(ExcimerProfiler_obj *profiler, excimer_log *log);
+static void ExcimerProfiler_write_ring(ExcimerProfiler_obj *profiler, excimer_log *log,
+	zend_long event_count, uint64_t timestamp);
+static void ExcimerProfiler_flush_window(ExcimerProfiler_obj *profiler);
+static void ExcimerProfiler_free_windows(ExcimerProfiler_obj *profiler);
+static void ExcimerProfiler_collect_threads(ExcimerProfiler_obj *profiler);
 
 static zend_object *ExcimerProfiler_new(zend_class_entry *ce);
 static void ExcimerProfiler_free_object(zend_object *object);
@@ -169,12 +367,26 @@ static void ExcimerProfiler_dtor(zend_object *object);
 static PHP_METHOD(ExcimerProfiler, setPeriod);
 static PHP_METHOD(ExcimerProfiler, setEventType);
 static PHP_METHOD(ExcimerProfiler, setMaxDepth);
+static PHP_METHOD(ExcimerProfiler, setAggregate);
+static PHP_METHOD(ExcimerProfiler, setCompact);
+static PHP_METHOD(ExcimerProfiler, setCoalesce);
+static PHP_METHOD(ExcimerProfiler, setInternalFrames);
+static PHP_METHOD(ExcimerProfiler, setGranularity);
+static PHP_METHOD(ExcimerProfiler, setMaxOverhead);
+static PHP_METHOD(ExcimerProfiler, setMemoryLimit);
 static PHP_METHOD(ExcimerProfiler, setFlushCallback);
 static PHP_METHOD(ExcimerProfiler, clearFlushCallback);
+static PHP_METHOD(ExcimerProfiler, setFlushInterval);
+static PHP_METHOD(ExcimerProfiler, getWindows);
+static PHP_METHOD(ExcimerProfiler, setAsyncFlush);
+static PHP_METHOD(ExcimerProfiler, setSharedRing);
+static PHP_METHOD(ExcimerProfiler, setExpectedSamples);
+static PHP_METHOD(ExcimerProfiler, setAllThreads);
 static PHP_METHOD(ExcimerProfiler, start);
 static PHP_METHOD(ExcimerProfiler, stop);
 static PHP_METHOD(ExcimerProfiler, getLog);
 static PHP_METHOD(ExcimerProfiler, flush);
+static PHP_METHOD(ExcimerProfiler, getStats);
 
 static zend_object *ExcimerLog_new(zend_class_entry *ce);
 static void ExcimerLog_free_object(zend_object *object);
@@ -187,6 +399,7 @@ static int ExcimerLog_count_elements(zend_object *object, zend_long *lp_count);
 #endif
 
 static void ExcimerLog_init_entry(zval *zp_dest, zval *zp_log, zend_long index);
+static void ExcimerLog_get_stats(excimer_log *log, zval *zp_dest);
 
 static void ExcimerLog_iterator_dtor(zend_object_iterator *iter);
 static int ExcimerLog_iterator_valid(zend_object_iterator *iter);
@@ -198,9 +411,17 @@ static void ExcimerLog_iterator_invalidate_current(zend_object_iterator *iter);
 
 static PHP_METHOD(ExcimerLog, __construct);
 static PHP_METHOD(ExcimerLog, formatCollapsed);
+static PHP_METHOD(ExcimerLog, formatPprof);
 static PHP_METHOD(ExcimerLog, getSpeedscopeData);
+static PHP_METHOD(ExcimerLog, formatSpeedscope);
 static PHP_METHOD(ExcimerLog, aggregateByFunction);
 static PHP_METHOD(ExcimerLog, getEventCount);
+static PHP_METHOD(ExcimerLog, getCpuTime);
+static PHP_METHOD(ExcimerLog, getStats);
+static PHP_METHOD(ExcimerLog, merge);
+static PHP_METHOD(ExcimerLog, mergeAll);
+static PHP_METHOD(ExcimerLog, serialize);
+static PHP_METHOD(ExcimerLog, fromString);
 static PHP_METHOD(ExcimerLog, current);
 static PHP_METHOD(ExcimerLog, key);
 static PHP_METHOD(ExcimerLog, next);
@@ -218,6 +439,7 @@ static void ExcimerLogEntry_free_object(zend_object *object);
 static PHP_METHOD(ExcimerLogEntry, __construct);
 static PHP_METHOD(ExcimerLogEntry, getTimestamp);
 static PHP_METHOD(ExcimerLogEntry, getEventCount);
+static PHP_METHOD(ExcimerLogEntry, getCpuTime);
 static PHP_METHOD(ExcimerLogEntry, getTrace);
 
 static zend_object *ExcimerTimer_new(zend_class_entry *ce);
@@ -236,6 +458,8 @@ static void ExcimerTimer_event(zend_long event_count, void *user_data);
 static int ExcimerTimer_set_callback(ExcimerTimer_obj *timer_obj, zval *zp_callback);
 
 static PHP_FUNCTION(excimer_set_timeout);
+static PHP_FUNCTION(excimer_ring_read);
+static PHP_FUNCTION(excimer_get_auto_profiler);
 /* }}} */
 
 static zend_class_entry *ExcimerProfiler_ce;
@@ -266,6 +490,38 @@ ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setMaxDepth, 0)
 	ZEND_ARG_INFO(0, max_depth)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setAggregate, 0)
+	ZEND_ARG_INFO(0, aggregate)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setCompact, 0)
+	ZEND_ARG_INFO(0, compact)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setCoalesce, 0)
+	ZEND_ARG_INFO(0, coalesce)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setInternalFrames, 0)
+	ZEND_ARG_INFO(0, enable)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setGranularity, 0)
+	ZEND_ARG_INFO(0, granularity)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setAllThreads, 0)
+	ZEND_ARG_INFO(0, enable)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setMemoryLimit, 0)
+	ZEND_ARG_INFO(0, bytes)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setMaxOverhead, 0)
+	ZEND_ARG_INFO(0, max_overhead)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setFlushCallback, 0)
 	ZEND_ARG_INFO(0, callback)
 	ZEND_ARG_INFO(0, max_samples)
@@ -274,6 +530,28 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_clearFlushCallback, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ExcimerProfiler_setFlushInterval, 0, 0, 1)
+	ZEND_ARG_INFO(0, interval)
+	ZEND_ARG_INFO(0, windows)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_getWindows, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ExcimerProfiler_setAsyncFlush, 0, 0, 2)
+	ZEND_ARG_INFO(0, target)
+	ZEND_ARG_INFO(0, max_samples)
+	ZEND_ARG_INFO(0, format)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setSharedRing, 0)
+	ZEND_ARG_INFO(0, enable)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setExpectedSamples, 0)
+	ZEND_ARG_INFO(0, expected_samples)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_start, 0)
 ZEND_END_ARG_INFO()
 
@@ -290,15 +568,24 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_flush, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_getStats, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog___construct, 0)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatCollapsed, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatPprof, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_getSpeedscopeData, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatSpeedscope, 0)
+ZEND_END_ARG_INFO()
+
 #if PHP_VERSION_ID < 70200
 ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO(arginfo_ExcimerLog_aggregateByFunction, IS_ARRAY, NULL, 0)
 #else
@@ -309,6 +596,31 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_getEventCount, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_getCpuTime, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_getStats, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_merge, 0)
+	ZEND_ARG_VARIADIC_INFO(0, others)
+ZEND_END_ARG_INFO()
+
+#if PHP_VERSION_ID >= 70200
+ZEND_BEGIN_ARG_WITH_RETURN_OBJ_INFO_EX(arginfo_ExcimerLog_mergeAll, 0, 1, ExcimerLog, 0)
+#else
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ExcimerLog_mergeAll, 0, 0, 1)
+#endif
+	ZEND_ARG_ARRAY_INFO(0, logs, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_serialize, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_fromString, 0)
+	ZEND_ARG_INFO(0, data)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_WITH_TENTATIVE_RETURN_TYPE_INFO_EX(arginfo_ExcimerLog_current, 0, 0, IS_MIXED, 0)
 ZEND_END_ARG_INFO()
 
@@ -353,6 +665,9 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLogEntry_getEventCount, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLogEntry_getCpuTime, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLogEntry_getTrace, 0)
 ZEND_END_ARG_INFO()
 
@@ -386,6 +701,13 @@ ZEND_BEGIN_ARG_INFO(arginfo_excimer_set_timeout, 0)
 	ZEND_ARG_INFO(0, interval)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_excimer_ring_read, 0, 0, 0)
+	ZEND_ARG_INFO(0, limit)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_excimer_get_auto_profiler, 0)
+ZEND_END_ARG_INFO()
+
 /* }}} */
 
 /** {{{ function entries */
@@ -393,12 +715,26 @@ static const zend_function_entry ExcimerProfiler_methods[] = {
 	PHP_ME(ExcimerProfiler, setPeriod, arginfo_ExcimerProfiler_setPeriod, 0)
 	PHP_ME(ExcimerProfiler, setEventType, arginfo_ExcimerProfiler_setEventType, 0)
 	PHP_ME(ExcimerProfiler, setMaxDepth, arginfo_ExcimerProfiler_setMaxDepth, 0)
+	PHP_ME(ExcimerProfiler, setAggregate, arginfo_ExcimerProfiler_setAggregate, 0)
+	PHP_ME(ExcimerProfiler, setCompact, arginfo_ExcimerProfiler_setCompact, 0)
+	PHP_ME(ExcimerProfiler, setCoalesce, arginfo_ExcimerProfiler_setCoalesce, 0)
+	PHP_ME(ExcimerProfiler, setInternalFrames, arginfo_ExcimerProfiler_setInternalFrames, 0)
+	PHP_ME(ExcimerProfiler, setGranularity, arginfo_ExcimerProfiler_setGranularity, 0)
+	PHP_ME(ExcimerProfiler, setMaxOverhead, arginfo_ExcimerProfiler_setMaxOverhead, 0)
+	PHP_ME(ExcimerProfiler, setMemoryLimit, arginfo_ExcimerProfiler_setMemoryLimit, 0)
 	PHP_ME(ExcimerProfiler, setFlushCallback, arginfo_ExcimerProfiler_setFlushCallback, 0)
 	PHP_ME(ExcimerProfiler, clearFlushCallback, arginfo_ExcimerProfiler_clearFlushCallback, 0)
+	PHP_ME(ExcimerProfiler, setFlushInterval, arginfo_ExcimerProfiler_setFlushInterval, 0)
+	PHP_ME(ExcimerProfiler, getWindows, arginfo_ExcimerProfiler_getWindows, 0)
+	PHP_ME(ExcimerProfiler, setAsyncFlush, arginfo_ExcimerProfiler_setAsyncFlush, 0)
+	PHP_ME(ExcimerProfiler, setSharedRing, arginfo_ExcimerProfiler_setSharedRing, 0)
+	PHP_ME(ExcimerProfiler, setExpectedSamples, arginfo_ExcimerProfiler_setExpectedSamples, 0)
+	PHP_ME(ExcimerProfiler, setAllThreads, arginfo_ExcimerProfiler_setAllThreads, 0)
 	PHP_ME(ExcimerProfiler, start, arginfo_ExcimerProfiler_start, 0)
 	PHP_ME(ExcimerProfiler, stop, arginfo_ExcimerProfiler_stop, 0)
 	PHP_ME(ExcimerProfiler, getLog, arginfo_ExcimerProfiler_getLog, 0)
 	PHP_ME(ExcimerProfiler, flush, arginfo_ExcimerProfiler_flush, 0)
+	PHP_ME(ExcimerProfiler, getStats, arginfo_ExcimerProfiler_getStats, 0)
 	PHP_FE_END
 };
 
@@ -406,9 +742,17 @@ static const zend_function_entry ExcimerLog_methods[] = {
 	PHP_ME(ExcimerLog, __construct, arginfo_ExcimerLog___construct,
 		ZEND_ACC_PRIVATE | ZEND_ACC_FINAL)
 	PHP_ME(ExcimerLog, formatCollapsed, arginfo_ExcimerLog_formatCollapsed, 0)
+	PHP_ME(ExcimerLog, formatPprof, arginfo_ExcimerLog_formatPprof, 0)
 	PHP_ME(ExcimerLog, getSpeedscopeData, arginfo_ExcimerLog_getSpeedscopeData, 0)
+	PHP_ME(ExcimerLog, formatSpeedscope, arginfo_ExcimerLog_formatSpeedscope, 0)
 	PHP_ME(ExcimerLog, aggregateByFunction, arginfo_ExcimerLog_aggregateByFunction, 0)
 	PHP_ME(ExcimerLog, getEventCount, arginfo_ExcimerLog_getEventCount, 0)
+	PHP_ME(ExcimerLog, getCpuTime, arginfo_ExcimerLog_getCpuTime, 0)
+	PHP_ME(ExcimerLog, getStats, arginfo_ExcimerLog_getStats, 0)
+	PHP_ME(ExcimerLog, merge, arginfo_ExcimerLog_merge, 0)
+	PHP_ME(ExcimerLog, mergeAll, arginfo_ExcimerLog_mergeAll, ZEND_ACC_STATIC)
+	PHP_ME(ExcimerLog, serialize, arginfo_ExcimerLog_serialize, 0)
+	PHP_ME(ExcimerLog, fromString, arginfo_ExcimerLog_fromString, ZEND_ACC_STATIC)
 	PHP_ME(ExcimerLog, current, arginfo_ExcimerLog_current, 0)
 	PHP_ME(ExcimerLog, key, arginfo_ExcimerLog_key, 0)
 	PHP_ME(ExcimerLog, next, arginfo_ExcimerLog_next, 0)
@@ -437,6 +781,7 @@ static const zend_function_entry ExcimerLogEntry_methods[] = {
 		ZEND_ACC_PRIVATE | ZEND_ACC_FINAL)
 	PHP_ME(ExcimerLogEntry, getTimestamp, arginfo_ExcimerLogEntry_getTimestamp, 0)
 	PHP_ME(ExcimerLogEntry, getEventCount, arginfo_ExcimerLogEntry_getEventCount, 0)
+	PHP_ME(ExcimerLogEntry, getCpuTime, arginfo_ExcimerLogEntry_getCpuTime, 0)
 	PHP_ME(ExcimerLogEntry, getTrace, arginfo_ExcimerLogEntry_getTrace, 0)
 	PHP_FE_END
 };
@@ -454,13 +799,94 @@ static const zend_function_entry ExcimerTimer_methods[] = {
 
 static const zend_function_entry excimer_functions[] = {
 	PHP_FE(excimer_set_timeout, arginfo_excimer_set_timeout)
+	PHP_FE(excimer_ring_read, arginfo_excimer_ring_read)
+	PHP_FE(excimer_get_auto_profiler, arginfo_excimer_get_auto_profiler)
 	PHP_FE_END
 };
 /* }}} */
 
 /* {{{ INI Settings */
+/**
+ * Parse the value of excimer.auto_event_type, returning -1 if it is invalid
+ */
+static zend_long excimer_parse_event_type(const char *value)
+{
+	if (!strcmp(value, "real")) {
+		return EXCIMER_REAL;
+	}
+#ifdef TIMERLIB_HAVE_CPU_CLOCK
+	if (!strcmp(value, "cpu")) {
+		return EXCIMER_CPU;
+	}
+	if (!strcmp(value, "real_cpu")) {
+		return EXCIMER_REAL_CPU;
+	}
+#endif
+	return -1;
+}
+
+/**
+ * Parse the value of excimer.auto_format, returning -1 if it is invalid
+ */
+static zend_long excimer_parse_format(const char *value)
+{
+	if (!strcmp(value, "collapsed")) {
+		return EXCIMER_FORMAT_COLLAPSED;
+	}
+	if (!strcmp(value, "pprof")) {
+		return EXCIMER_FORMAT_PPROF;
+	}
+	return -1;
+}
+
+static ZEND_INI_MH(OnUpdateAutoEventType)
+{
+	if (excimer_parse_event_type(ZSTR_VAL(new_value)) < 0) {
+		php_error_docref(NULL, E_WARNING, "Invalid excimer.auto_event_type \"%s\"",
+			ZSTR_VAL(new_value));
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+static ZEND_INI_MH(OnUpdateAutoFormat)
+{
+	if (excimer_parse_format(ZSTR_VAL(new_value)) < 0) {
+		php_error_docref(NULL, E_WARNING, "Invalid excimer.auto_format \"%s\"",
+			ZSTR_VAL(new_value));
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+static ZEND_INI_MH(OnUpdateAutoTarget)
+{
+	const char *error;
+
+	if (!ZSTR_LEN(new_value)) {
+		return SUCCESS;
+	}
+	error = excimer_sink_check_target(ZSTR_VAL(new_value));
+	if (error) {
+		php_error_docref(NULL, E_WARNING, "Invalid excimer.auto_target: %s", error);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
 PHP_INI_BEGIN()
 	PHP_INI_ENTRY("excimer.default_max_depth", "1000", PHP_INI_ALL, NULL)
+	PHP_INI_ENTRY("excimer.persistent_frames", "0", PHP_INI_SYSTEM, NULL)
+	PHP_INI_ENTRY("excimer.ring_path", "", PHP_INI_SYSTEM, NULL)
+	PHP_INI_ENTRY("excimer.ring_size", "4194304", PHP_INI_SYSTEM, NULL)
+	PHP_INI_ENTRY("excimer.auto_sample_rate", "0", PHP_INI_SYSTEM | PHP_INI_PERDIR, NULL)
+	PHP_INI_ENTRY("excimer.auto_period", "0.01", PHP_INI_SYSTEM | PHP_INI_PERDIR, NULL)
+	PHP_INI_ENTRY("excimer.auto_event_type", "real", PHP_INI_SYSTEM | PHP_INI_PERDIR,
+		OnUpdateAutoEventType)
+	PHP_INI_ENTRY("excimer.auto_target", "", PHP_INI_SYSTEM | PHP_INI_PERDIR,
+		OnUpdateAutoTarget)
+	PHP_INI_ENTRY("excimer.auto_format", "collapsed", PHP_INI_SYSTEM | PHP_INI_PERDIR,
+		OnUpdateAutoFormat)
 PHP_INI_END()
 /* }}} */
 
@@ -489,6 +915,28 @@ static inline void* excimer_check_object(zend_object *object, size_t offset, con
 	}
 }
 
+ZEND_DECLARE_MODULE_GLOBALS(excimer)
+
+/* {{{ PHP_GINIT_FUNCTION
+ */
+static PHP_GINIT_FUNCTION(excimer)
+{
+#if defined(COMPILE_DL_EXCIMER) && defined(ZTS)
+	ZEND_TSRMLS_CACHE_UPDATE();
+#endif
+	memset(excimer_globals, 0, sizeof(*excimer_globals));
+}
+/* }}} */
+
+/* {{{ PHP_GSHUTDOWN_FUNCTION
+ */
+static PHP_GSHUTDOWN_FUNCTION(excimer)
+{
+	excimer_timer_pool_shutdown();
+	excimer_log_shutdown_shared_store();
+}
+/* }}} */
+
 /* {{{ PHP_MINIT_FUNCTION
  */
 static PHP_MINIT_FUNCTION(excimer)
@@ -503,8 +951,21 @@ static PHP_MINIT_FUNCTION(excimer)
 	// This allows application code to detect and gracefully handle a lack of CPU profiling support.
 	#ifdef TIMERLIB_HAVE_CPU_CLOCK
 	REGISTER_LONG_CONSTANT("EXCIMER_CPU", EXCIMER_CPU, CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("EXCIMER_REAL_CPU", EXCIMER_REAL_CPU, CONST_CS | CONST_PERSISTENT);
 	#endif
 
+	REGISTER_LONG_CONSTANT("EXCIMER_FORMAT_COLLAPSED", EXCIMER_FORMAT_COLLAPSED,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("EXCIMER_FORMAT_PPROF", EXCIMER_FORMAT_PPROF,
+		CONST_CS | CONST_PERSISTENT);
+
+	REGISTER_LONG_CONSTANT("EXCIMER_GRANULARITY_FUNCTION", EXCIMER_GRANULARITY_FUNCTION,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("EXCIMER_GRANULARITY_LINE", EXCIMER_GRANULARITY_LINE,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("EXCIMER_GRANULARITY_OPLINE", EXCIMER_GRANULARITY_OPLINE,
+		CONST_CS | CONST_PERSISTENT);
+
 #define REGISTER_EXCIMER_CLASS(class_name) \
 	INIT_CLASS_ENTRY(ce, #class_name, class_name ## _methods); \
 	class_name ## _ce = zend_register_internal_class(&ce); \
@@ -536,6 +997,10 @@ static PHP_MINIT_FUNCTION(excimer)
 #undef REGISTER_EXCIMER_CLASS
 
 	excimer_timer_module_init();
+	excimer_threads_module_init();
+
+	/* On failure, a warning was raised and the ring is disabled */
+	excimer_ring_module_init(INI_STR("excimer.ring_path"), INI_INT("excimer.ring_size"));
 
 	return SUCCESS;
 }
@@ -546,16 +1011,92 @@ static PHP_MINIT_FUNCTION(excimer)
 static PHP_MSHUTDOWN_FUNCTION(excimer)
 {
 	UNREGISTER_INI_ENTRIES();
+	excimer_sink_shutdown();
+	excimer_ring_module_shutdown();
+	excimer_threads_module_shutdown();
 	excimer_timer_module_shutdown();
 	return SUCCESS;
 }
 /* }}} */
 
+/**
+ * Start a profiler for the current request, if auto-profiling is configured
+ * and the request is selected by excimer.auto_sample_rate. The log is sent to
+ * excimer.auto_target when the profiler is destroyed during request shutdown.
+ */
+static void excimer_auto_profile_start(void) /* {{{ */
+{
+	double rate = INI_FLT("excimer.auto_sample_rate");
+	char *target = INI_STR("excimer.auto_target");
+	ExcimerProfiler_obj *profiler;
+	double period;
+
+	if (rate <= 0 || !target || !*target) {
+		return;
+	}
+	if (rate < 1 && php_mt_rand() >= rate * UINT32_MAX) {
+		return;
+	}
+	period = INI_FLT("excimer.auto_period");
+	if (period <= 0) {
+		period = EXCIMER_DEFAULT_PERIOD;
+	}
+
+	object_init_ex(&EXCIMER_G(auto_profiler), ExcimerProfiler_ce);
+	profiler = EXCIMER_OBJ_Z(ExcimerProfiler, EXCIMER_G(auto_profiler));
+	ExcimerProfiler_set_period(profiler, period);
+	profiler->event_type = excimer_parse_event_type(INI_STR("excimer.auto_event_type"));
+	if (profiler->event_type < 0) {
+		profiler->event_type = EXCIMER_REAL;
+	}
+	EXCIMER_OBJ_Z(ExcimerLog, profiler->z_log)->log.has_cpu_time =
+		profiler->event_type == EXCIMER_REAL_CPU;
+	profiler->async_target = zend_string_init(target, strlen(target), 0);
+	profiler->async_format = excimer_parse_format(INI_STR("excimer.auto_format"));
+	if (profiler->async_format < 0) {
+		profiler->async_format = EXCIMER_FORMAT_COLLAPSED;
+	}
+	ExcimerProfiler_start(profiler);
+}
+/* }}} */
+
+/**
+ * Stop and release the automatic profiler. If its destructor has not yet been
+ * called, this flushes the log to the target.
+ */
+static void excimer_auto_profile_stop(void) /* {{{ */
+{
+	if (Z_TYPE(EXCIMER_G(auto_profiler)) == IS_OBJECT) {
+		ExcimerProfiler_stop(EXCIMER_OBJ_Z(ExcimerProfiler, EXCIMER_G(auto_profiler)));
+		zval_ptr_dtor(&EXCIMER_G(auto_profiler));
+		ZVAL_UNDEF(&EXCIMER_G(auto_profiler));
+	}
+}
+/* }}} */
+
 /* {{{ PHP_RINIT_FUNCTION
  */
 static PHP_RINIT_FUNCTION(excimer)
 {
 	excimer_timer_thread_init();
+	excimer_threads_request_init();
+	excimer_log_request_init();
+	excimer_auto_profile_start();
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ PHP_RSHUTDOWN_FUNCTION
+ */
+static PHP_RSHUTDOWN_FUNCTION(excimer)
+{
+	excimer_auto_profile_stop();
+	excimer_threads_request_shutdown();
+	if (EXCIMER_G(ring_reader_locked)) {
+		/* excimer_ring_read() was interrupted by a fatal error */
+		excimer_ring_unlock_reader();
+		EXCIMER_G(ring_reader_locked) = 0;
+	}
 	return SUCCESS;
 }
 /* }}} */
@@ -595,7 +1136,12 @@ static zend_object *ExcimerProfiler_new(zend_class_entry *ce) /* {{{ */
 	log_obj->log.epoch = timerlib_timespec_to_ns(&now_ts);
 
 	ZVAL_NULL(&profiler->z_callback);
+	ZVAL_UNDEF(&profiler->z_window_log);
+	zend_hash_init(&profiler->ring_frames_sent, 0, NULL, NULL, 0);
+	profiler->ring_pending = NULL;
+	profiler->ring_pending_capacity = 0;
 	profiler->event_type = EXCIMER_REAL;
+	profiler->period_multiplier = 1;
 	profiler->need_reinit = 1;
 
 	// Stagger start time
@@ -613,12 +1159,22 @@ static void ExcimerProfiler_free_object(zend_object *object) /* {{{ */
 	ExcimerProfiler_obj *profiler = EXCIMER_OBJ(ExcimerProfiler, object);
 
 	if (profiler->timer.is_valid) {
+		excimer_threads_release(&profiler->timer);
 		excimer_timer_destroy(&profiler->timer);
 	}
 	zval_ptr_dtor(&profiler->z_log);
 	ZVAL_UNDEF(&profiler->z_log);
 	zval_ptr_dtor(&profiler->z_callback);
 	ZVAL_UNDEF(&profiler->z_callback);
+	if (profiler->async_target) {
+		zend_string_release(profiler->async_target);
+		profiler->async_target = NULL;
+	}
+	ExcimerProfiler_free_windows(profiler);
+	zend_hash_destroy(&profiler->ring_frames_sent);
+	if (profiler->ring_pending) {
+		efree(profiler->ring_pending);
+	}
 	zend_object_std_dtor(object);
 }
 /* }}} */
@@ -629,6 +1185,7 @@ static void ExcimerProfiler_dtor(zend_object *object) /* {{{ */
 	ExcimerLog_obj *log_obj = EXCIMER_OBJ_Z(ExcimerLog, profiler->z_log);
 	zval z_old_log;
 
+	ExcimerProfiler_collect_threads(profiler);
 	if (log_obj->log.entries_size) {
 		ExcimerProfiler_flush(profiler, &z_old_log);
 		zval_ptr_dtor(&z_old_log);
@@ -640,21 +1197,27 @@ static void ExcimerProfiler_dtor(zend_object *object) /* {{{ */
  */
 static PHP_METHOD(ExcimerProfiler, setPeriod)
 {
-	double period, initial;
+	double period;
 	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
 
 	ZEND_PARSE_PARAMETERS_START(1, 1)
 		Z_PARAM_DOUBLE(period)
 	ZEND_PARSE_PARAMETERS_END();
 
+	ExcimerProfiler_set_period(profiler, period);
+}
+/* }}} */
+
+static void ExcimerProfiler_set_period(ExcimerProfiler_obj *profiler, double period) /* {{{ */
+{
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+
 	// Stagger start time
-	initial = php_mt_rand() * period / UINT32_MAX;
+	double initial = php_mt_rand() * period / UINT32_MAX;
 
 	timerlib_timespec_from_double(&profiler->period, period);
 	timerlib_timespec_from_double(&profiler->initial, initial);
-
-	ExcimerLog_obj *log = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
-	log->log.period = period * EXCIMER_BILLION;
+	log_obj->log.period = period * EXCIMER_BILLION;
 }
 /* }}} */
 
@@ -669,13 +1232,22 @@ static PHP_METHOD(ExcimerProfiler, setEventType)
 		Z_PARAM_LONG(event_type)
 	ZEND_PARSE_PARAMETERS_END();
 
-	if (event_type != EXCIMER_CPU && event_type != EXCIMER_REAL) {
+	/* EXCIMER_REAL_CPU needs a CPU clock to measure the time between samples */
+	if (event_type != EXCIMER_CPU && event_type != EXCIMER_REAL
+#ifdef TIMERLIB_HAVE_CPU_CLOCK
+		&& event_type != EXCIMER_REAL_CPU
+#endif
+		)
+	{
 		php_error_docref(NULL, E_WARNING, "Invalid event type");
 		return;
 	}
 
 	profiler->event_type = event_type;
 	profiler->need_reinit = 1;
+
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	log_obj->log.has_cpu_time = event_type == EXCIMER_REAL_CPU;
 }
 /* }}} */
 
@@ -691,47 +1263,347 @@ static PHP_METHOD(ExcimerProfiler, setMaxDepth)
 
 	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
 	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	profiler->saved_max_depth = max_depth;
 	excimer_log_set_max_depth(&log_obj->log, max_depth);
 }
 /* }}} */
 
-/* {{{ proto void ExcimerProfiler::setFlushCallback(callable callback, mixed max_samples)
+/* {{{ proto void ExcimerProfiler::setAggregate(bool aggregate)
  */
-static PHP_METHOD(ExcimerProfiler, setFlushCallback)
+static PHP_METHOD(ExcimerProfiler, setAggregate)
 {
-	zval *z_callback;
-	zend_long max_samples;
-	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
-	char *is_callable_error;
+	zend_bool aggregate;
 
-	ZEND_PARSE_PARAMETERS_START(2, 2)
-		Z_PARAM_ZVAL(z_callback)
-		Z_PARAM_LONG(max_samples)
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL(aggregate)
 	ZEND_PARSE_PARAMETERS_END();
 
-	if (!zend_is_callable_ex(z_callback, NULL, 0, NULL, NULL, &is_callable_error)) {
-		php_error_docref(NULL, E_WARNING, "flush callback is not callable: %s",
-				is_callable_error);
-		return;
-	}
-
-	ZVAL_COPY(&profiler->z_callback, z_callback);
-	profiler->max_samples = max_samples;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	profiler->saved_aggregate = aggregate;
+	excimer_log_set_aggregate(&log_obj->log, aggregate);
 }
 /* }}} */
 
-/* {{{ proto void ExcimerProfiler::clearFlushCallback()
+/* {{{ proto void ExcimerProfiler::setCompact(bool compact)
  */
-static PHP_METHOD(ExcimerProfiler, clearFlushCallback)
+static PHP_METHOD(ExcimerProfiler, setCompact)
 {
+	zend_bool compact;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL(compact)
+	ZEND_PARSE_PARAMETERS_END();
+
 	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
-	zval_ptr_dtor(&profiler->z_callback);
-	ZVAL_NULL(&profiler->z_callback);
-	profiler->max_samples = 0;
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	excimer_log_set_compact(&log_obj->log, compact);
 }
 /* }}} */
 
-/* {{{ proto void ExcimerProfiler::start()
+/* {{{ proto void ExcimerProfiler::setCoalesce(bool coalesce)
+ */
+static PHP_METHOD(ExcimerProfiler, setCoalesce)
+{
+	zend_bool coalesce;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL(coalesce)
+	ZEND_PARSE_PARAMETERS_END();
+
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	excimer_log_set_coalesce(&log_obj->log, coalesce);
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setInternalFrames(bool enable)
+ */
+static PHP_METHOD(ExcimerProfiler, setInternalFrames)
+{
+	zend_bool enable;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL(enable)
+	ZEND_PARSE_PARAMETERS_END();
+
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	excimer_log_set_internal_frames(&log_obj->log, enable);
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setGranularity(int granularity)
+ */
+static PHP_METHOD(ExcimerProfiler, setGranularity)
+{
+	zend_long granularity;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_LONG(granularity)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (granularity != EXCIMER_GRANULARITY_FUNCTION && granularity != EXCIMER_GRANULARITY_LINE
+		&& granularity != EXCIMER_GRANULARITY_OPLINE)
+	{
+		php_error_docref(NULL, E_WARNING, "Invalid granularity");
+		return;
+	}
+
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	excimer_log_set_granularity(&log_obj->log, (int)granularity);
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setMaxOverhead(float max_overhead)
+ */
+static PHP_METHOD(ExcimerProfiler, setMaxOverhead)
+{
+	double max_overhead;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_DOUBLE(max_overhead)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (max_overhead < 0 || max_overhead >= 1) {
+		php_error_docref(NULL, E_WARNING, "The maximum overhead must be at least 0 and less than 1");
+		return;
+	}
+	profiler->max_overhead = max_overhead;
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setMemoryLimit(int bytes)
+ */
+static PHP_METHOD(ExcimerProfiler, setMemoryLimit)
+{
+	zend_long bytes;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_LONG(bytes)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (bytes < 0) {
+		php_error_docref(NULL, E_WARNING, "The memory limit must not be negative");
+		return;
+	}
+	profiler->memory_limit = bytes;
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setFlushCallback(callable callback, mixed max_samples)
+ */
+static PHP_METHOD(ExcimerProfiler, setFlushCallback)
+{
+	zval *z_callback;
+	zend_long max_samples;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	char *is_callable_error;
+
+	ZEND_PARSE_PARAMETERS_START(2, 2)
+		Z_PARAM_ZVAL(z_callback)
+		Z_PARAM_LONG(max_samples)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!zend_is_callable_ex(z_callback, NULL, 0, NULL, NULL, &is_callable_error)) {
+		php_error_docref(NULL, E_WARNING, "flush callback is not callable: %s",
+				is_callable_error);
+		return;
+	}
+
+	zval_ptr_dtor(&profiler->z_callback);
+	ZVAL_COPY(&profiler->z_callback, z_callback);
+	if (profiler->async_target) {
+		zend_string_release(profiler->async_target);
+		profiler->async_target = NULL;
+	}
+	profiler->max_samples = max_samples;
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::clearFlushCallback()
+ */
+static PHP_METHOD(ExcimerProfiler, clearFlushCallback)
+{
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	zval_ptr_dtor(&profiler->z_callback);
+	ZVAL_NULL(&profiler->z_callback);
+	if (profiler->async_target) {
+		zend_string_release(profiler->async_target);
+		profiler->async_target = NULL;
+	}
+	profiler->max_samples = 0;
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setFlushInterval(float interval, int windows = 0)
+ */
+static PHP_METHOD(ExcimerProfiler, setFlushInterval)
+{
+	double interval;
+	zend_long windows = 0;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(1, 2)
+		Z_PARAM_DOUBLE(interval)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(windows)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (windows < 0 || windows > EXCIMER_MAX_WINDOWS) {
+		php_error_docref(NULL, E_WARNING, "The number of windows must be between 0 and %d",
+			EXCIMER_MAX_WINDOWS);
+		return;
+	}
+
+	ExcimerProfiler_free_windows(profiler);
+	if (interval > 0) {
+		struct timespec now_ts;
+		ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+
+		profiler->flush_interval = (uint64_t)(interval * EXCIMER_BILLION);
+		if (!profiler->flush_interval) {
+			profiler->flush_interval = 1;
+		}
+		timerlib_clock_get_time(TIMERLIB_REAL, &now_ts);
+		profiler->flush_window = (timerlib_timespec_to_ns(&now_ts) - log_obj->log.epoch)
+			/ profiler->flush_interval;
+		if (windows) {
+			profiler->windows = safe_emalloc(windows, sizeof(ExcimerProfiler_window), 0);
+			profiler->max_windows = windows;
+		}
+	} else {
+		profiler->flush_interval = 0;
+	}
+}
+/* }}} */
+
+/* {{{ proto array ExcimerProfiler::getWindows()
+ */
+static PHP_METHOD(ExcimerProfiler, getWindows)
+{
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	zend_long i;
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	array_init_size(return_value, (uint32_t)profiler->windows_size);
+	for (i = 0; i < profiler->windows_size; i++) {
+		ExcimerProfiler_window *window =
+			&profiler->windows[(profiler->windows_start + i) % profiler->max_windows];
+		zval z_window;
+
+		array_init(&z_window);
+		add_assoc_double(&z_window, "start", window->start_ns / 1e9);
+		add_assoc_double(&z_window, "end", (window->start_ns + profiler->flush_interval) / 1e9);
+		Z_ADDREF(window->z_log);
+		add_assoc_zval(&z_window, "log", &window->z_log);
+		add_next_index_zval(return_value, &z_window);
+	}
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setAsyncFlush(string target, int max_samples, int format = EXCIMER_FORMAT_COLLAPSED)
+ */
+static PHP_METHOD(ExcimerProfiler, setAsyncFlush)
+{
+	zend_string *target;
+	zend_long max_samples;
+	zend_long format = EXCIMER_FORMAT_COLLAPSED;
+	const char *error;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(2, 3)
+		Z_PARAM_PATH_STR(target)
+		Z_PARAM_LONG(max_samples)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(format)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (format != EXCIMER_FORMAT_COLLAPSED && format != EXCIMER_FORMAT_PPROF) {
+		php_error_docref(NULL, E_WARNING, "Invalid format");
+		return;
+	}
+	error = excimer_sink_check_target(ZSTR_VAL(target));
+	if (error) {
+		php_error_docref(NULL, E_WARNING, "%s", error);
+		return;
+	}
+
+	zval_ptr_dtor(&profiler->z_callback);
+	ZVAL_NULL(&profiler->z_callback);
+	if (profiler->async_target) {
+		zend_string_release(profiler->async_target);
+	}
+	profiler->async_target = zend_string_copy(target);
+	profiler->async_format = format;
+	profiler->max_samples = max_samples;
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setSharedRing(bool enable)
+ */
+static PHP_METHOD(ExcimerProfiler, setSharedRing)
+{
+	zend_bool enable;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL(enable)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (enable && !excimer_ring_is_enabled()) {
+		php_error_docref(NULL, E_WARNING, "The shared ring is not available, "
+			"excimer.ring_path must be set");
+		return;
+	}
+	profiler->ring_enabled = enable;
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setExpectedSamples(int expected_samples)
+ */
+static PHP_METHOD(ExcimerProfiler, setExpectedSamples)
+{
+	zend_long expected_samples;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_LONG(expected_samples)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (expected_samples < 0) {
+		php_error_docref(NULL, E_WARNING, "The expected sample count must not be negative");
+		return;
+	}
+
+	profiler->expected_samples = expected_samples;
+
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	excimer_log_reserve(&log_obj->log, expected_samples, 0);
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setAllThreads(bool enable)
+ */
+static PHP_METHOD(ExcimerProfiler, setAllThreads)
+{
+	zend_bool enable;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL(enable)
+	ZEND_PARSE_PARAMETERS_END();
+
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	profiler->all_threads = enable;
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::start()
  */
 static PHP_METHOD(ExcimerProfiler, start)
 {
@@ -740,101 +1612,459 @@ static PHP_METHOD(ExcimerProfiler, start)
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
 
-	if (profiler->timer.is_running) {
-		ExcimerProfiler_stop(profiler);
+	if (profiler->timer.is_running) {
+		ExcimerProfiler_stop(profiler);
+	}
+	ExcimerProfiler_start(profiler);
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::stop()
+ */
+static PHP_METHOD(ExcimerProfiler, stop)
+{
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	ExcimerProfiler_stop(profiler);
+}
+/* }}} */
+
+/* {{{ proto ExcimerLog ExcimerProfiler::getLog()
+ */
+static PHP_METHOD(ExcimerProfiler, getLog)
+{
+	ExcimerProfiler_obj * profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	ExcimerProfiler_collect_threads(profiler);
+	RETURN_ZVAL(&profiler->z_log, 1, 0);
+}
+/* }}} */
+
+/* {{{ proto ExcimerLog ExcimerProfiler::flush() */
+static PHP_METHOD(ExcimerProfiler, flush)
+{
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	ExcimerProfiler_collect_threads(profiler);
+	ExcimerProfiler_flush(profiler, return_value);
+}
+/* }}} */
+
+/* {{{ proto array ExcimerProfiler::getStats()
+ */
+static PHP_METHOD(ExcimerProfiler, getStats)
+{
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	zval z_log_stats;
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	array_init(return_value);
+	add_assoc_long(return_value, "samples", profiler->stats.samples);
+	add_assoc_long(return_value, "events", profiler->stats.events);
+	add_assoc_long(return_value, "overruns",
+		profiler->stats.old_overruns + excimer_timer_get_overrun_count(&profiler->timer));
+	add_assoc_long(return_value, "interrupt_ns", (zend_long)profiler->stats.interrupt_ns);
+	add_assoc_long(return_value, "flushes", profiler->stats.flushes);
+	add_assoc_long(return_value, "flush_ns", (zend_long)profiler->stats.flush_ns);
+	add_assoc_long(return_value, "memory_stage", profiler->memory_stage);
+
+	ExcimerLog_get_stats(&log_obj->log, &z_log_stats);
+	add_assoc_zval(return_value, "log", &z_log_stats);
+}
+/* }}} */
+
+static void ExcimerProfiler_start(ExcimerProfiler_obj *profiler) /* {{{ */
+{
+	if (profiler->all_threads && profiler->event_type != EXCIMER_REAL) {
+		php_error_docref(NULL, E_WARNING,
+			"Sampling all threads requires the EXCIMER_REAL event type");
+		return;
+	}
+	if (profiler->need_reinit || !profiler->timer.is_valid) {
+		if (profiler->timer.is_valid) {
+			profiler->stats.old_overruns += excimer_timer_get_overrun_count(&profiler->timer);
+			excimer_threads_release(&profiler->timer);
+			excimer_timer_destroy(&profiler->timer);
+		}
+		/* EXCIMER_REAL_CPU samples on the real clock */
+		if (excimer_timer_init(&profiler->timer,
+			profiler->event_type == EXCIMER_REAL_CPU ? EXCIMER_REAL : profiler->event_type,
+			ExcimerProfiler_event,
+			(void*)profiler) == FAILURE)
+		{
+			/* Error message already sent */
+			return;
+		}
+		profiler->need_reinit = 0;
+	}
+	if (profiler->all_threads) {
+		excimer_log *log = &EXCIMER_OBJ_Z(ExcimerLog, profiler->z_log)->log;
+		excimer_threads_options options;
+
+		options.period = log->period;
+		options.max_depth = log->max_depth;
+		options.granularity = log->granularity;
+		options.internal_frames = log->internal_frames;
+		options.aggregate = log->aggregate;
+		options.coalesce = log->coalesce;
+		options.has_cpu_time = log->has_cpu_time;
+		if (excimer_threads_start(&profiler->timer, &options) == FAILURE) {
+			return;
+		}
+	} else {
+		excimer_threads_release(&profiler->timer);
+	}
+	if (profiler->event_type == EXCIMER_REAL_CPU) {
+		struct timespec cpu_ts;
+		timerlib_clock_get_time(TIMERLIB_CPU, &cpu_ts);
+		profiler->last_cpu_ns = timerlib_timespec_to_ns(&cpu_ts);
+	}
+	profiler->period_multiplier = 1;
+	profiler->adapt_samples = 0;
+	profiler->adapt_events = 0;
+	profiler->adapt_handler_ns = 0;
+	excimer_timer_start(&profiler->timer,
+			&profiler->period,
+			&profiler->initial);
+}
+/* }}} */
+
+static void ExcimerProfiler_stop(ExcimerProfiler_obj *profiler) /* {{{ */
+{
+	if (profiler->timer.is_valid) {
+		excimer_timer_stop(&profiler->timer);
+		excimer_threads_stop(&profiler->timer);
+	}
+}
+/* }}} */
+
+/**
+ * Merge the samples queued by other threads into the current log, if the
+ * profiler samples all threads
+ */
+static void ExcimerProfiler_collect_threads(ExcimerProfiler_obj *profiler) /* {{{ */
+{
+	if (profiler->all_threads && profiler->timer.is_valid) {
+		excimer_threads_collect(&profiler->timer,
+			&EXCIMER_OBJ_Z(ExcimerLog, profiler->z_log)->log);
+	}
+}
+/* }}} */
+
+static void ExcimerProfiler_event(zend_long event_count, void *user_data) /* {{{ */
+{
+	uint64_t now_ns, add_ns, cpu_time = 0;
+	struct timespec now_ts;
+	ExcimerProfiler_obj *profiler = (ExcimerProfiler_obj*)user_data;
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+	excimer_log *log;
+
+	log = &log_obj->log;
+
+	timerlib_clock_get_time(TIMERLIB_REAL, &now_ts);
+	now_ns = timerlib_timespec_to_ns(&now_ts);
+
+	profiler->stats.samples++;
+	profiler->stats.events += event_count;
+
+	if (profiler->event_type == EXCIMER_REAL_CPU) {
+		struct timespec cpu_ts;
+		uint64_t cpu_ns;
+
+		timerlib_clock_get_time(TIMERLIB_CPU, &cpu_ts);
+		cpu_ns = timerlib_timespec_to_ns(&cpu_ts);
+		cpu_time = cpu_ns - profiler->last_cpu_ns;
+		profiler->last_cpu_ns = cpu_ns;
+	}
+
+	/* Keep the event count in units of the configured period */
+	event_count *= profiler->period_multiplier;
+
+	/* Rotate the log at interval boundaries, before adding the sample
+	 * which is in the new interval */
+	if (profiler->flush_interval && !profiler->ring_enabled) {
+		uint64_t window = (now_ns - log->epoch) / profiler->flush_interval;
+		if (window != profiler->flush_window) {
+			if (log->entries_size || Z_TYPE(profiler->z_window_log) == IS_OBJECT) {
+				ExcimerProfiler_flush_window(profiler);
+				log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+				log = &log_obj->log;
+			}
+			profiler->flush_window = window;
+		}
+	}
+
+	if (profiler->ring_enabled) {
+		ExcimerProfiler_write_ring(profiler, log, event_count, now_ns);
+	} else {
+		if (profiler->all_threads) {
+			/* The root index is a frame of the store, so it is set again
+			 * for each new log */
+			if (!log->root_index) {
+				log->root_index = excimer_log_get_thread_frame(log, excimer_threads_get_id());
+			}
+			excimer_threads_collect(&profiler->timer, log);
+		}
+		excimer_log_add(log, EG(current_execute_data), event_count, now_ns, cpu_time);
+		if (profiler->memory_limit) {
+			ExcimerProfiler_check_memory(profiler, log);
+		}
+	}
+
+	timerlib_clock_get_time(TIMERLIB_REAL, &now_ts);
+	add_ns = timerlib_timespec_to_ns(&now_ts) - now_ns;
+	log->stats.add_ns += add_ns;
+	profiler->stats.interrupt_ns += add_ns;
+
+	if (profiler->max_overhead > 0) {
+		ExcimerProfiler_adapt_period(profiler, event_count, add_ns);
+	}
+
+	/* Count samples rather than entries, which may be aggregated */
+	if (!profiler->ring_enabled && profiler->max_samples
+		&& log->stats.samples >= (uint64_t)profiler->max_samples)
+	{
+		zval z_old_log;
+		uint64_t flush_start_ns = profiler->stats.flush_ns;
+
+		ExcimerProfiler_flush(profiler, &z_old_log);
+		zval_ptr_dtor(&z_old_log);
+		profiler->stats.interrupt_ns += profiler->stats.flush_ns - flush_start_ns;
 	}
-	ExcimerProfiler_start(profiler);
 }
 /* }}} */
 
-/* {{{ proto void ExcimerProfiler::stop()
+/**
+ * Merge a log which is being flushed into the window of the current interval
  */
-static PHP_METHOD(ExcimerProfiler, stop)
+static void ExcimerProfiler_add_to_window(ExcimerProfiler_obj *profiler, excimer_log *log) /* {{{ */
 {
-	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
-
-	ZEND_PARSE_PARAMETERS_START(0, 0);
-	ZEND_PARSE_PARAMETERS_END();
+	excimer_log *window_log;
 
-	ExcimerProfiler_stop(profiler);
+	/* Copy the log rather than aggregating it in place, since the flush
+	 * callback may keep it */
+	if (Z_TYPE(profiler->z_window_log) != IS_OBJECT) {
+		object_init_ex(&profiler->z_window_log, ExcimerLog_ce);
+		window_log = &EXCIMER_OBJ_Z(ExcimerLog, profiler->z_window_log)->log;
+		excimer_log_copy_options(window_log, log);
+		excimer_log_set_aggregate(window_log, 1);
+	} else {
+		window_log = &EXCIMER_OBJ_Z(ExcimerLog, profiler->z_window_log)->log;
+	}
+	excimer_log_merge(window_log, log);
 }
 /* }}} */
 
-/* {{{ proto ExcimerLog ExcimerProfiler::getLog()
+/**
+ * Flush the log of the completed interval, and move the aggregated samples
+ * of the interval into the windows if they are enabled
  */
-static PHP_METHOD(ExcimerProfiler, getLog)
+static void ExcimerProfiler_flush_window(ExcimerProfiler_obj *profiler) /* {{{ */
 {
-	ExcimerProfiler_obj * profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
 
-	ZEND_PARSE_PARAMETERS_START(0, 0);
-	ZEND_PARSE_PARAMETERS_END();
+	if (log_obj->log.entries_size) {
+		zval z_old_log;
+		uint64_t flush_start_ns = profiler->stats.flush_ns;
 
-	RETURN_ZVAL(&profiler->z_log, 1, 0);
+		ExcimerProfiler_flush(profiler, &z_old_log);
+		zval_ptr_dtor(&z_old_log);
+		profiler->stats.interrupt_ns += profiler->stats.flush_ns - flush_start_ns;
+	}
+
+	/* The callback may have disabled the windows */
+	if (profiler->windows && Z_TYPE(profiler->z_window_log) == IS_OBJECT) {
+		ExcimerProfiler_window *window;
+
+		if (profiler->windows_size == profiler->max_windows) {
+			window = &profiler->windows[profiler->windows_start];
+			zval_ptr_dtor(&window->z_log);
+			profiler->windows_start = (profiler->windows_start + 1) % profiler->max_windows;
+		} else {
+			window = &profiler->windows[
+				(profiler->windows_start + profiler->windows_size++) % profiler->max_windows];
+		}
+		window->start_ns = profiler->flush_window * profiler->flush_interval;
+		ZVAL_COPY_VALUE(&window->z_log, &profiler->z_window_log);
+		ZVAL_UNDEF(&profiler->z_window_log);
+	}
 }
 /* }}} */
 
-/* {{{ proto ExcimerLog ExcimerProfiler::flush() */
-static PHP_METHOD(ExcimerProfiler, flush)
+static void ExcimerProfiler_free_windows(ExcimerProfiler_obj *profiler) /* {{{ */
 {
-	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
-
-	ZEND_PARSE_PARAMETERS_START(0, 0);
-	ZEND_PARSE_PARAMETERS_END();
+	zend_long i;
 
-	ExcimerProfiler_flush(profiler, return_value);
+	zval_ptr_dtor(&profiler->z_window_log);
+	ZVAL_UNDEF(&profiler->z_window_log);
+	if (!profiler->windows) {
+		return;
+	}
+	for (i = 0; i < profiler->windows_size; i++) {
+		zval_ptr_dtor(&profiler->windows[(profiler->windows_start + i) % profiler->max_windows].z_log);
+	}
+	efree(profiler->windows);
+	profiler->windows = NULL;
+	profiler->max_windows = 0;
+	profiler->windows_start = 0;
+	profiler->windows_size = 0;
 }
 /* }}} */
 
-static void ExcimerProfiler_start(ExcimerProfiler_obj *profiler) /* {{{ */
+static void ExcimerProfiler_adapt_period(ExcimerProfiler_obj *profiler,
+	zend_long event_count, uint64_t handler_ns) /* {{{ */
 {
-	if (profiler->need_reinit || !profiler->timer.is_valid) {
-		if (profiler->timer.is_valid) {
-			excimer_timer_destroy(&profiler->timer);
-		}
-		if (excimer_timer_init(&profiler->timer,
-			profiler->event_type,
-			ExcimerProfiler_event,
-			(void*)profiler) == FAILURE)
-		{
-			/* Error message already sent */
-			return;
-		}
-		profiler->need_reinit = 0;
+	struct timespec period;
+	double overhead;
+	zend_long multiplier = profiler->period_multiplier;
+
+	profiler->adapt_handler_ns += handler_ns;
+	profiler->adapt_events += event_count;
+	if (++profiler->adapt_samples < EXCIMER_ADAPT_SAMPLES) {
+		return;
 	}
-	excimer_timer_start(&profiler->timer,
-			&profiler->period,
-			&profiler->initial);
+
+	/* Compare the handler time to the time covered by the samples */
+	overhead = (double)profiler->adapt_handler_ns
+		/ ((double)profiler->adapt_events * timerlib_timespec_to_ns(&profiler->period));
+	profiler->adapt_samples = 0;
+	profiler->adapt_events = 0;
+	profiler->adapt_handler_ns = 0;
+
+	if (overhead > profiler->max_overhead && multiplier < EXCIMER_ADAPT_MAX_MULTIPLIER) {
+		multiplier *= 2;
+	} else if (overhead < profiler->max_overhead / 4 && multiplier > 1) {
+		multiplier /= 2;
+	} else {
+		return;
+	}
+	profiler->period_multiplier = multiplier;
+	if (profiler->all_threads) {
+		excimer_threads_set_period_multiplier(&profiler->timer, multiplier);
+	}
+	timerlib_timespec_from_double(&period,
+		timerlib_timespec_to_double(&profiler->period) * multiplier);
+	excimer_timer_start(&profiler->timer, &period, &period);
 }
 /* }}} */
 
-static void ExcimerProfiler_stop(ExcimerProfiler_obj *profiler) /* {{{ */
+/**
+ * If the log exceeds the memory limit and has grown since the stage last
+ * changed, degrade it to the next stage. The stage is reset when the log is
+ * flushed.
+ */
+static void ExcimerProfiler_check_memory(ExcimerProfiler_obj *profiler, excimer_log *log) /* {{{ */
 {
-	if (profiler->timer.is_valid) {
-		excimer_timer_stop(&profiler->timer);
+	size_t usage = excimer_log_get_memory_usage(log);
+
+	if (usage <= (size_t)profiler->memory_limit || usage <= profiler->memory_stage_usage) {
+		return;
+	}
+	switch (profiler->memory_stage) {
+		case EXCIMER_MEMORY_FULL:
+			profiler->saved_aggregate = log->aggregate;
+			profiler->saved_max_depth = log->max_depth;
+			excimer_log_set_aggregate(log, 1);
+			excimer_log_trim(log);
+			profiler->memory_stage = EXCIMER_MEMORY_AGGREGATE;
+			break;
+
+		case EXCIMER_MEMORY_AGGREGATE:
+		case EXCIMER_MEMORY_TRUNCATE:
+			if (!log->max_depth || log->max_depth > EXCIMER_MEMORY_MIN_DEPTH) {
+				/* Halving the default depth of 1000 would not affect typical
+				 * stacks, so start from the initial depth */
+				excimer_log_set_max_depth(log,
+					!log->max_depth || log->max_depth > EXCIMER_MEMORY_INITIAL_DEPTH
+					? EXCIMER_MEMORY_INITIAL_DEPTH
+					: MAX(log->max_depth / 2, EXCIMER_MEMORY_MIN_DEPTH));
+				profiler->memory_stage = EXCIMER_MEMORY_TRUNCATE;
+			} else {
+				excimer_log_start_reservoir(log);
+				profiler->memory_stage = EXCIMER_MEMORY_RESERVOIR;
+			}
+			break;
+
+		default:
+			/* No frames or events are added now */
+			return;
 	}
+	profiler->memory_stage_usage = excimer_log_get_memory_usage(log);
 }
 /* }}} */
 
-static void ExcimerProfiler_event(zend_long event_count, void *user_data) /* {{{ */
+static void ExcimerProfiler_write_ring(ExcimerProfiler_obj *profiler, excimer_log *log,
+	zend_long event_count, uint64_t timestamp) /* {{{ */
 {
-	uint64_t now_ns;
-	struct timespec now_ts;
-	ExcimerProfiler_obj *profiler = (ExcimerProfiler_obj*)user_data;
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
-	excimer_log *log;
+	uint32_t frame_index = excimer_log_capture(log, EG(current_execute_data));
+	excimer_ring_sample sample;
 
-	log = &log_obj->log;
+	uint32_t i;
+	size_t num_pending = 0;
 
-	timerlib_clock_get_time(TIMERLIB_REAL, &now_ts);
-	now_ns = timerlib_timespec_to_ns(&now_ts);
+	if (!profiler->ring_stream) {
+		profiler->ring_stream = excimer_ring_new_stream();
+		zend_hash_clean(&profiler->ring_frames_sent);
+	}
 
-	excimer_log_add(log, EG(current_execute_data), event_count, now_ns);
+	/* Find the frames of the stack which were not yet written in this
+	 * stream, from the leaf up to the first one which was */
+	for (i = frame_index; i && !zend_hash_index_exists(&profiler->ring_frames_sent, i);
+		i = excimer_log_get_frame(log, i)->prev_index)
+	{
+		if (num_pending == profiler->ring_pending_capacity) {
+			profiler->ring_pending_capacity = profiler->ring_pending_capacity
+				? profiler->ring_pending_capacity * 2 : 64;
+			profiler->ring_pending = safe_erealloc(profiler->ring_pending,
+				profiler->ring_pending_capacity, sizeof(uint32_t), 0);
+		}
+		profiler->ring_pending[num_pending++] = i;
+	}
 
-	if (profiler->max_samples && log->entries_size >= profiler->max_samples) {
-		zval z_old_log;
-		ExcimerProfiler_flush(profiler, &z_old_log);
-		zval_ptr_dtor(&z_old_log);
+	/* Write them, callers first. If the ring is full, the sample is dropped
+	 * and the remaining frames are retried next time. */
+	while (num_pending) {
+		uint32_t index = profiler->ring_pending[--num_pending];
+		excimer_log_frame *frame = excimer_log_get_frame(log, index);
+		zend_string *name = excimer_log_get_frame_name(log, index);
+		excimer_ring_frame ring_frame;
+
+		memset(&ring_frame, 0, sizeof(ring_frame));
+		ring_frame.stream = profiler->ring_stream;
+		ring_frame.frame_id = index;
+		ring_frame.prev_id = frame->prev_index;
+		ring_frame.lineno = frame->lineno;
+		ring_frame.closure_line = frame->closure_line;
+		ring_frame.name_length = ZSTR_LEN(name);
+		ring_frame.filename_length = frame->filename ? ZSTR_LEN(frame->filename) : 0;
+		if (excimer_ring_write(EXCIMER_RING_FRAME, &ring_frame, sizeof(ring_frame),
+			ZSTR_VAL(name), ZSTR_LEN(name),
+			frame->filename ? ZSTR_VAL(frame->filename) : NULL,
+			ring_frame.filename_length) == FAILURE)
+		{
+			return;
+		}
+		zend_hash_index_add_empty_element(&profiler->ring_frames_sent, index);
 	}
+
+	memset(&sample, 0, sizeof(sample));
+	sample.stream = profiler->ring_stream;
+	sample.frame_id = frame_index;
+	sample.event_count = event_count;
+	sample.timestamp = timestamp;
+	excimer_ring_write(EXCIMER_RING_SAMPLE, &sample, sizeof(sample), NULL, 0, NULL, 0);
 }
 /* }}} */
 
@@ -842,22 +2072,63 @@ static void ExcimerProfiler_flush(ExcimerProfiler_obj *profiler, zval *zp_old_lo
 {
 	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
 	excimer_log *log = &log_obj->log;
+	excimer_log *new_log;
 
 	zend_fcall_info fci;
 	zend_fcall_info_cache fcc;
 	char *is_callable_error = NULL;
 	zval retval;
 	int status;
+	struct timespec start_ts;
 
 	/* Rotate the log */
 	ZVAL_COPY(zp_old_log, &profiler->z_log);
 	Z_DELREF(profiler->z_log);
 	object_init_ex(&profiler->z_log, ExcimerLog_ce);
-	excimer_log_copy_options(&EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log)->log, log);
+	new_log = &EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log)->log;
+	excimer_log_copy_options(new_log, log);
+
+	/* Samples flushed before the end of the interval belong to its window */
+	if (profiler->windows && log->entries_size) {
+		ExcimerProfiler_add_to_window(profiler, log);
+	}
+
+	/* Undo any degradation for the memory limit */
+	if (profiler->memory_stage != EXCIMER_MEMORY_FULL) {
+		excimer_log_set_aggregate(new_log, profiler->saved_aggregate);
+		excimer_log_set_max_depth(new_log, profiler->saved_max_depth);
+		profiler->memory_stage = EXCIMER_MEMORY_FULL;
+	}
+	profiler->memory_stage_usage = 0;
+
+	/* Frame IDs in the ring are only valid within a stream */
+	profiler->ring_stream = 0;
+
+	/* Pre-size the new log, assuming it will have a similar number of
+	 * unique frames as the old one */
+	if (profiler->expected_samples) {
+		excimer_log_reserve(new_log, profiler->expected_samples, log->store->frames_size);
+	}
+
+	profiler->stats.flushes++;
+	if (profiler->async_target) {
+		/* The old log is copied, so it may be freed as soon as the caller
+		 * is done with it */
+		timerlib_clock_get_time(TIMERLIB_REAL, &start_ts);
+		if (log->entries_size
+			&& excimer_sink_submit(log, profiler->async_format,
+				ZSTR_VAL(profiler->async_target)) == FAILURE)
+		{
+			php_error(E_WARNING, "ExcimerProfiler async flush queue is full, samples were dropped");
+		}
+		ExcimerProfiler_add_flush_time(profiler, &start_ts);
+		return;
+	}
 
 	if (Z_ISNULL(profiler->z_callback)) {
 		return;
 	}
+	timerlib_clock_get_time(TIMERLIB_REAL, &start_ts);
 
 	/* Prepare to call the flush callback */
 	if (zend_fcall_info_init(&profiler->z_callback, 0, &fci, &fcc, NULL,
@@ -878,6 +2149,17 @@ static void ExcimerProfiler_flush(ExcimerProfiler_obj *profiler, zval *zp_old_lo
 		zval_ptr_dtor(&retval);
 	}
 	zend_fcall_info_args_clear(&fci, 1);
+	ExcimerProfiler_add_flush_time(profiler, &start_ts);
+}
+/* }}} */
+
+static void ExcimerProfiler_add_flush_time(ExcimerProfiler_obj *profiler,
+	struct timespec *start_ts) /* {{{ */
+{
+	struct timespec now_ts;
+
+	timerlib_clock_get_time(TIMERLIB_REAL, &now_ts);
+	profiler->stats.flush_ns += timerlib_timespec_to_ns(&now_ts) - timerlib_timespec_to_ns(start_ts);
 }
 /* }}} */
 
@@ -1064,6 +2346,15 @@ static PHP_METHOD(ExcimerLog, formatCollapsed)
 }
 /* }}} */
 
+/* {{{ proto string ExcimerLog::formatPprof()
+ */
+static PHP_METHOD(ExcimerLog, formatPprof)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	RETURN_STR(excimer_log_format_pprof(&log_obj->log));
+}
+/* }}} */
+
 /* {{{ proto string ExcimerLog::getSpeedscopeData()
  */
 static PHP_METHOD(ExcimerLog, getSpeedscopeData)
@@ -1073,6 +2364,15 @@ static PHP_METHOD(ExcimerLog, getSpeedscopeData)
 }
 /* }}} */
 
+/* {{{ proto string ExcimerLog::formatSpeedscope()
+ */
+static PHP_METHOD(ExcimerLog, formatSpeedscope)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	RETURN_STR(excimer_log_format_speedscope(&log_obj->log));
+}
+/* }}} */
+
 /* {{{ proto string ExcimerLog::aggregateByFunction()
  */
 static PHP_METHOD(ExcimerLog, aggregateByFunction)
@@ -1091,6 +2391,161 @@ static PHP_METHOD(ExcimerLog, getEventCount)
 }
 /* }}} */
 
+/* {{{ proto float ExcimerLog::getCpuTime()
+ */
+static PHP_METHOD(ExcimerLog, getCpuTime)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	RETURN_DOUBLE(log_obj->log.cpu_time / 1e9);
+}
+/* }}} */
+
+/* {{{ proto array ExcimerLog::getStats()
+ */
+static PHP_METHOD(ExcimerLog, getStats)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	ExcimerLog_get_stats(&log_obj->log, return_value);
+}
+/* }}} */
+
+/**
+ * Get the log from a zval which may be a reference to an ExcimerLog, or NULL
+ * if it is not an ExcimerLog
+ */
+static excimer_log *ExcimerLog_from_zval(zval *zp_log) /* {{{ */
+{
+	ZVAL_DEREF(zp_log);
+	if (Z_TYPE_P(zp_log) != IS_OBJECT
+		|| !instanceof_function(Z_OBJCE_P(zp_log), ExcimerLog_ce))
+	{
+		return NULL;
+	}
+	return &EXCIMER_OBJ_ZP(ExcimerLog, zp_log)->log;
+}
+/* }}} */
+
+/* {{{ proto void ExcimerLog::merge(ExcimerLog ...$others)
+ */
+static PHP_METHOD(ExcimerLog, merge)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	zval *others = NULL;
+	int num_others = 0, i;
+
+	ZEND_PARSE_PARAMETERS_START(0, -1)
+		Z_PARAM_VARIADIC('*', others, num_others)
+	ZEND_PARSE_PARAMETERS_END();
+
+	for (i = 0; i < num_others; i++) {
+		if (!ExcimerLog_from_zval(&others[i])) {
+			php_error_docref(NULL, E_WARNING, "Argument %d must be an ExcimerLog", i + 1);
+			return;
+		}
+	}
+	for (i = 0; i < num_others; i++) {
+		excimer_log_merge(&log_obj->log, ExcimerLog_from_zval(&others[i]));
+	}
+}
+/* }}} */
+
+/* {{{ proto ExcimerLog ExcimerLog::mergeAll(array $logs)
+ */
+static PHP_METHOD(ExcimerLog, mergeAll)
+{
+	HashTable *ht_logs;
+	ExcimerLog_obj *dest_obj;
+	zval *zp_log;
+	uint32_t i = 0;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_ARRAY_HT(ht_logs)
+	ZEND_PARSE_PARAMETERS_END();
+
+	ZEND_HASH_FOREACH_VAL(ht_logs, zp_log) {
+		if (!ExcimerLog_from_zval(zp_log)) {
+			php_error_docref(NULL, E_WARNING, "The array must contain only ExcimerLog objects");
+			return;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	object_init_ex(return_value, ExcimerLog_ce);
+	dest_obj = EXCIMER_OBJ_ZP(ExcimerLog, return_value);
+	ZEND_HASH_FOREACH_VAL(ht_logs, zp_log) {
+		excimer_log *src = ExcimerLog_from_zval(zp_log);
+		if (i++ == 0) {
+			excimer_log_copy_options(&dest_obj->log, src);
+		}
+		excimer_log_merge(&dest_obj->log, src);
+	} ZEND_HASH_FOREACH_END();
+}
+/* }}} */
+
+/* {{{ proto string ExcimerLog::serialize()
+ */
+static PHP_METHOD(ExcimerLog, serialize)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	RETURN_STR(excimer_log_serialize(&log_obj->log));
+}
+/* }}} */
+
+/* {{{ proto ExcimerLog|false ExcimerLog::fromString(string $data)
+ */
+static PHP_METHOD(ExcimerLog, fromString)
+{
+	zend_string *data;
+	const char *error;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_STR(data)
+	ZEND_PARSE_PARAMETERS_END();
+
+	object_init_ex(return_value, ExcimerLog_ce);
+	error = excimer_log_unserialize(&EXCIMER_OBJ_ZP(ExcimerLog, return_value)->log,
+		ZSTR_VAL(data), ZSTR_LEN(data));
+	if (error) {
+		php_error_docref(NULL, E_WARNING, "%s", error);
+		zval_ptr_dtor(return_value);
+		RETURN_FALSE;
+	}
+}
+/* }}} */
+
+static void ExcimerLog_get_stats(excimer_log *log, zval *zp_dest) /* {{{ */
+{
+	excimer_log_stats *stats = &log->stats;
+
+	array_init(zp_dest);
+	add_assoc_long(zp_dest, "entries", (zend_long)log->entries_size);
+	add_assoc_long(zp_dest, "events", log->event_count);
+	add_assoc_long(zp_dest, "add_ns", (zend_long)stats->add_ns);
+	add_assoc_long(zp_dest, "frames_walked", (zend_long)stats->frames_walked);
+	add_assoc_long(zp_dest, "frames_cached", (zend_long)stats->frames_cached);
+	add_assoc_long(zp_dest, "frame_lookups", (zend_long)stats->frame_lookups);
+	add_assoc_long(zp_dest, "frame_lookup_hits", (zend_long)stats->frame_lookup_hits);
+	add_assoc_long(zp_dest, "frames_added", (zend_long)stats->frames_added);
+	add_assoc_long(zp_dest, "samples", (zend_long)stats->samples);
+	add_assoc_long(zp_dest, "samples_coalesced", (zend_long)stats->samples_coalesced);
+	add_assoc_long(zp_dest, "events_replaced", (zend_long)stats->events_replaced);
+	add_assoc_long(zp_dest, "events_dropped", (zend_long)stats->events_dropped);
+	add_assoc_long(zp_dest, "entry_bytes", (zend_long)excimer_log_get_entry_bytes(log));
+	add_assoc_long(zp_dest, "frame_bytes", (zend_long)excimer_log_get_frame_bytes(log));
+}
+/* }}} */
+
 /* {{{ proto array ExcimerLog::current()
  */
 static PHP_METHOD(ExcimerLog, current)
@@ -1293,6 +2748,21 @@ static PHP_METHOD(ExcimerLogEntry, getEventCount)
 }
 /* }}} */
 
+/* {{{ proto float ExcimerLogEntry::getCpuTime()
+ */
+static PHP_METHOD(ExcimerLogEntry, getCpuTime)
+{
+	ExcimerLogEntry_obj *entry_obj = EXCIMER_OBJ_ZP(ExcimerLogEntry, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &entry_obj->z_log);
+	excimer_log_entry *entry = excimer_log_get_entry(&log_obj->log, entry_obj->index);
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	RETURN_DOUBLE(entry->cpu_time / 1e9);
+}
+/* }}} */
+
 /* {{{ proto array ExcimerLogEntry::getTrace()
  */
 static PHP_METHOD(ExcimerLogEntry, getTrace)
@@ -1548,6 +3018,98 @@ PHP_FUNCTION(excimer_set_timeout)
 }
 /* }}} */
 
+static void excimer_ring_read_record(uint32_t type, const char *payload,
+	size_t length, void *arg) /* {{{ */
+{
+	zval *zp_records = (zval*)arg;
+	zval z_record;
+
+	array_init(&z_record);
+	if (type == EXCIMER_RING_FRAME && length >= sizeof(excimer_ring_frame)) {
+		excimer_ring_frame frame;
+		memcpy(&frame, payload, sizeof(frame));
+		if (sizeof(frame) + frame.name_length + frame.filename_length > length) {
+			zval_ptr_dtor(&z_record);
+			return;
+		}
+		add_assoc_string(&z_record, "type", "frame");
+		add_assoc_long(&z_record, "stream", (zend_long)frame.stream);
+		add_assoc_long(&z_record, "id", frame.frame_id);
+		add_assoc_long(&z_record, "prev_id", frame.prev_id);
+		add_assoc_stringl(&z_record, "name",
+			(char*)payload + sizeof(frame), frame.name_length);
+		add_assoc_stringl(&z_record, "file",
+			(char*)payload + sizeof(frame) + frame.name_length, frame.filename_length);
+		add_assoc_long(&z_record, "line", frame.lineno);
+		if (frame.closure_line) {
+			add_assoc_long(&z_record, "closure_line", frame.closure_line);
+		}
+	} else if (type == EXCIMER_RING_SAMPLE && length >= sizeof(excimer_ring_sample)) {
+		excimer_ring_sample sample;
+		memcpy(&sample, payload, sizeof(sample));
+		add_assoc_string(&z_record, "type", "sample");
+		add_assoc_long(&z_record, "stream", (zend_long)sample.stream);
+		add_assoc_long(&z_record, "id", sample.frame_id);
+		add_assoc_long(&z_record, "event_count", sample.event_count);
+		add_assoc_long(&z_record, "timestamp", (zend_long)sample.timestamp);
+	} else {
+		/* Unknown record type */
+		zval_ptr_dtor(&z_record);
+		return;
+	}
+	add_next_index_zval(zp_records, &z_record);
+}
+/* }}} */
+
+/* {{{ proto ExcimerProfiler|null excimer_get_auto_profiler()
+ */
+PHP_FUNCTION(excimer_get_auto_profiler)
+{
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (Z_TYPE(EXCIMER_G(auto_profiler)) == IS_OBJECT) {
+		RETURN_ZVAL(&EXCIMER_G(auto_profiler), 1, 0);
+	}
+	RETURN_NULL();
+}
+/* }}} */
+
+/* {{{ proto array|false excimer_ring_read(int limit = 0)
+ */
+PHP_FUNCTION(excimer_ring_read)
+{
+	zend_long limit = 0;
+	zend_long i;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(limit)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (!excimer_ring_is_enabled()) {
+		php_error_docref(NULL, E_WARNING, "The shared ring is not available, "
+			"excimer.ring_path must be set");
+		RETURN_FALSE;
+	}
+
+	if (excimer_ring_lock_reader() == FAILURE) {
+		php_error_docref(NULL, E_WARNING, "The shared ring is being read by another process");
+		RETURN_FALSE;
+	}
+	EXCIMER_G(ring_reader_locked) = 1;
+
+	array_init(return_value);
+	for (i = 0; limit <= 0 || i < limit; i++) {
+		if (!excimer_ring_read(excimer_ring_read_record, return_value)) {
+			break;
+		}
+	}
+	excimer_ring_unlock_reader();
+	EXCIMER_G(ring_reader_locked) = 0;
+}
+/* }}} */
+
 static const zend_module_dep excimer_deps[] = {
 #if PHP_VERSION_ID < 70200
 	ZEND_MOD_REQUIRED("spl")
@@ -1565,10 +3127,12 @@ zend_module_entry excimer_module_entry = {
 	PHP_MINIT(excimer),
 	PHP_MSHUTDOWN(excimer),
 	PHP_RINIT(excimer),
-	NULL, /* RSHUTDOWN */
+	PHP_RSHUTDOWN(excimer),
 	PHP_MINFO(excimer),
 	PHP_EXCIMER_VERSION,
-	NO_MODULE_GLOBALS,
+	PHP_MODULE_GLOBALS(excimer),
+	PHP_GINIT(excimer),
+	PHP_GSHUTDOWN(excimer),
 	ZEND_MODULE_POST_ZEND_DEACTIVATE_N(excimer),
 	STANDARD_MODULE_PROPERTIES_EX
 };
@@ -19,6 +19,11 @@ enum {
 	/** Event type: real, wall-clock time */
 	EXCIMER_REAL,
 	/** Event type: CPU time */
-	EXCIMER_CPU
+	EXCIMER_CPU,
+	/**
+	 * Event type: real, wall-clock time, also recording the thread CPU time
+	 * elapsed between samples. This is only supported by ExcimerProfiler.
+	 */
+	EXCIMER_REAL_CPU
 };
 #endif
\ No newline at end of file
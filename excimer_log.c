@@ -13,22 +13,43 @@
  * limitations under the License.
  */
 
+#include <math.h>
 #include "php.h"
 #include "Zend/zend_smart_str.h"
+#if PHP_VERSION_ID < 80400
+#include "ext/standard/php_mt_rand.h"
+#else
+#include "ext/random/php_random.h"
+#endif
 #include "php_excimer.h"
 #include "excimer_log.h"
 
 static const char excimer_log_truncated_name[] = "excimer_truncated";
 static const char excimer_log_fake_filename[] = "excimer fake file";
 
+/** The initial number of elements allocated when an array first grows */
+#define EXCIMER_LOG_MIN_CAPACITY 16
+
+/** The initial number of slots in the frame hashtable. Must be a power of two. */
+#define EXCIMER_LOG_MIN_FRAME_SLOTS 64
+
+static uint32_t excimer_log_capture_stack(excimer_log *log,
+		zend_execute_data *execute_data);
+static void excimer_log_name_cache_destroy(excimer_log_name_cache *cache);
 static uint32_t excimer_log_find_or_add_frame(excimer_log *log,
-		zend_execute_data *execute_data, zend_long depth);
+		zend_execute_data *execute_data, uint32_t prev_index);
+static void excimer_log_free_blocks(excimer_log *log);
+static void excimer_log_free_leaf_entries(excimer_log *log);
+static void excimer_log_free_reservoir_tree(excimer_log *log);
 
 /* {{{ Compatibility functions and macros */
 
 #if PHP_VERSION_ID >= 70300
 #define excimer_log_new_array zend_new_array
+#define excimer_log_array_addref GC_ADDREF
 #else
+#define excimer_log_array_addref(ht) (++GC_REFCOUNT(ht))
+
 static inline HashTable *excimer_log_new_array(uint32_t nSize)
 {
 	HashTable *ht = emalloc(sizeof(HashTable));
@@ -77,6 +98,14 @@ static void excimer_log_smart_str_append_printf(smart_str *dest, const char *for
 #define excimer_log_known_string(index) CG(known_strings)[index]
 #endif
 
+#if PHP_VERSION_ID >= 70300
+#define excimer_log_string_make_permanent(str) \
+	GC_ADD_FLAGS(str, IS_STR_INTERNED | IS_STR_PERMANENT)
+#else
+#define excimer_log_string_make_permanent(str) \
+	(GC_FLAGS(str) |= IS_STR_INTERNED | IS_STR_PERMANENT)
+#endif
+
 #if PHP_VERSION_ID >= 80100
 #define excimer_log_add_assoc_array add_assoc_array
 #else
@@ -90,15 +119,337 @@ static inline void excimer_log_add_assoc_array(zval *dest, const char *key, Hash
 
 /* }}} */
 
+/**
+ * Reallocate an array so that it can hold at least the given number of
+ * elements. The capacity is at least doubled, so that appending to the array
+ * takes amortized constant time.
+ *
+ * @param ptr The current array, or NULL
+ * @param capacity The current capacity of the array, to be updated
+ * @param needed The required number of elements
+ * @param elem_size The size of each element
+ * @param persistent Whether the array is in persistent memory
+ * @return The new array
+ */
+static void *excimer_log_grow(void *ptr, size_t *capacity, size_t needed, size_t elem_size,
+	int persistent)
+{
+	size_t new_capacity = *capacity ? *capacity : EXCIMER_LOG_MIN_CAPACITY;
+	while (new_capacity < needed) {
+		if (new_capacity > SIZE_MAX / 2) {
+			/* Probably unreachable */
+			zend_error_noreturn(E_ERROR, "Excimer log is too large");
+		}
+		new_capacity *= 2;
+	}
+	ptr = safe_perealloc(ptr, new_capacity, elem_size, 0, persistent);
+	*capacity = new_capacity;
+	return ptr;
+}
+
+/**
+ * Get a pointer to a new uninitialised frame at the end of the frames array
+ */
+static excimer_log_frame *excimer_log_append_frame(excimer_log *log)
+{
+	if (log->store->frames_size >= log->store->frames_capacity) {
+		log->store->frames = excimer_log_grow(log->store->frames, &log->store->frames_capacity,
+			log->store->frames_size + 1, sizeof(excimer_log_frame), log->store->persistent);
+	}
+	return &log->store->frames[log->store->frames_size++];
+}
+
+/**
+ * Compute the hash of a frame key. For an internal function frame, which has
+ * no filename, the key string is the function name, mixed with the class
+ * name if there is one.
+ */
+static inline uint32_t excimer_log_frame_hash(zend_string *key, zend_string *class_name,
+	uint32_t lineno, uint32_t opline, uint32_t prev_index)
+{
+	uint64_t h = ZSTR_HASH(key);
+	if (class_name) {
+		h = h * 31 + ZSTR_HASH(class_name);
+	}
+	h = h * 31 + opline;
+	h ^= ((uint64_t)lineno << 32) | prev_index;
+	h *= UINT64_C(0x9e3779b97f4a7c15);
+	return (uint32_t)(h >> 32);
+}
+
+static inline int excimer_log_optional_string_equals(zend_string *a, zend_string *b)
+{
+	return a == b || (a && b && zend_string_equals(a, b));
+}
+
+/**
+ * Find the slot in the frame hashtable which either holds the frame with the
+ * given key, or is the empty slot at which it should be inserted. For user
+ * code, the key is the filename, line number, opline index and caller. Internal function
+ * frames have no filename, so the function and class name are compared
+ * instead.
+ */
+static excimer_log_frame_slot *excimer_log_find_frame_slot(excimer_log *log,
+	uint32_t hash, zend_string *filename, zend_string *function_name,
+	zend_string *class_name, uint32_t lineno, uint32_t opline, uint32_t prev_index)
+{
+	excimer_log_frame_table *table = &log->store->reverse_frames;
+	uint32_t mask = table->size - 1;
+	uint32_t i = hash & mask;
+
+	while (1) {
+		excimer_log_frame_slot *slot = &table->slots[i];
+		if (!slot->frame_index) {
+			return slot;
+		}
+		if (slot->hash == hash) {
+			excimer_log_frame *frame = &log->store->frames[slot->frame_index];
+			if (frame->lineno == lineno
+				&& frame->opline == opline
+				&& frame->prev_index == prev_index
+				&& (filename
+					? frame->filename && zend_string_equals(frame->filename, filename)
+					: !frame->filename
+						&& excimer_log_optional_string_equals(frame->function_name, function_name)
+						&& excimer_log_optional_string_equals(frame->class_name, class_name)))
+			{
+				return slot;
+			}
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+/**
+ * Double the size of the frame hashtable
+ */
+static void excimer_log_grow_frame_table(excimer_log_frame_table *table, int persistent)
+{
+	excimer_log_frame_slot *old_slots = table->slots;
+	uint32_t old_size = table->size;
+	uint32_t mask, i;
+
+	if (old_size > UINT32_MAX / 2) {
+		/* Probably unreachable */
+		zend_error_noreturn(E_ERROR, "Too many Excimer frames");
+	}
+	table->size = old_size * 2;
+	table->slots = safe_pemalloc(table->size, sizeof(excimer_log_frame_slot), 0, persistent);
+	memset(table->slots, 0, table->size * sizeof(excimer_log_frame_slot));
+	mask = table->size - 1;
+
+	for (i = 0; i < old_size; i++) {
+		if (old_slots[i].frame_index) {
+			uint32_t j = old_slots[i].hash & mask;
+			while (table->slots[j].frame_index) {
+				j = (j + 1) & mask;
+			}
+			table->slots[j] = old_slots[i];
+		}
+	}
+	pefree(old_slots, persistent);
+}
+
+/**
+ * Fill an empty slot returned by excimer_log_find_frame_slot(), and grow the
+ * table if necessary. The slot pointer is invalid after this returns.
+ */
+static void excimer_log_fill_frame_slot(excimer_log *log, excimer_log_frame_slot *slot,
+	uint32_t hash, uint32_t frame_index)
+{
+	excimer_log_frame_table *table = &log->store->reverse_frames;
+	slot->hash = hash;
+	slot->frame_index = frame_index;
+	table->used++;
+	/* Keep the load factor at or below 0.5 */
+	if (table->used * 2 > table->size) {
+		excimer_log_grow_frame_table(table, log->store->persistent);
+	}
+}
+
+static void excimer_log_free_persistent_string(zval *zp)
+{
+	pefree(Z_PTR_P(zp), 1);
+}
+
+static void excimer_log_store_init(excimer_log_frame_store *store, int persistent,
+	size_t max_frames)
+{
+	store->frames = pecalloc(1, sizeof(excimer_log_frame), persistent);
+	store->frames_size = 1;
+	store->frames_capacity = 1;
+	store->reverse_frames.size = EXCIMER_LOG_MIN_FRAME_SLOTS;
+	store->reverse_frames.used = 0;
+	store->reverse_frames.slots = pecalloc(EXCIMER_LOG_MIN_FRAME_SLOTS,
+		sizeof(excimer_log_frame_slot), persistent);
+	store->truncation_index = 0;
+	store->persistent = persistent;
+	store->refcount = 0;
+	store->max_frames = max_frames;
+	if (persistent) {
+		zend_hash_init(&store->strings, 0, NULL, excimer_log_free_persistent_string, 1);
+	}
+}
+
+static void excimer_log_store_destroy(excimer_log_frame_store *store)
+{
+	if (store->persistent) {
+		/* The strings are either permanent or owned by store->strings */
+		zend_hash_destroy(&store->strings);
+	} else {
+		size_t i;
+		for (i = 0; i < store->frames_size; i++) {
+			if (store->frames[i].filename) {
+				zend_string_delref(store->frames[i].filename);
+			}
+			if (store->frames[i].class_name) {
+				zend_string_delref(store->frames[i].class_name);
+			}
+			if (store->frames[i].function_name) {
+				zend_string_delref(store->frames[i].function_name);
+			}
+		}
+	}
+	pefree(store->frames, store->persistent);
+	pefree(store->reverse_frames.slots, store->persistent);
+}
+
+/**
+ * Get a string which will live as long as the store. If the caller knows
+ * that the original string lives as long as the process, for example the
+ * name of an internal function, and it is an interned permanent string, it
+ * is used directly. Other strings are copied into the store once. Strings in
+ * opcache shared memory are permanent but not safe to reference, since
+ * opcache frees them on restart.
+ */
+static zend_string *excimer_log_store_string(excimer_log_frame_store *store,
+	const char *str, size_t length, zend_string *orig)
+{
+	zend_string *copy;
+
+	if (orig && ZSTR_IS_INTERNED(orig) && (GC_FLAGS(orig) & IS_STR_PERMANENT)) {
+		return orig;
+	}
+	copy = zend_hash_str_find_ptr(&store->strings, str, length);
+	if (copy) {
+		return copy;
+	}
+	/* Mark the copy as interned, so that it is not refcounted when it is
+	 * returned to userspace. It is freed when the store is destroyed. */
+	copy = zend_string_init(str, length, 1);
+	zend_string_hash_val(copy);
+	excimer_log_string_make_permanent(copy);
+	zend_hash_str_add_new_ptr(&store->strings, str, length, copy);
+	return copy;
+}
+
+/**
+ * Copy a string into the store, or reference it if it lives as long as the
+ * process
+ */
+static inline zend_string *excimer_log_store_zstr(excimer_log_frame_store *store,
+	zend_string *str, int process_lifetime)
+{
+	return str
+		? excimer_log_store_string(store, ZSTR_VAL(str), ZSTR_LEN(str),
+			process_lifetime ? str : NULL)
+		: NULL;
+}
+
+/**
+ * Get the store for a new log. If excimer.persistent_frames is set, this is
+ * the shared store of the thread.
+ */
+static excimer_log_frame_store *excimer_log_acquire_store(void)
+{
+	zend_long max_frames = zend_ini_long_literal("excimer.persistent_frames");
+	excimer_log_frame_store *store;
+
+	if (max_frames <= 0) {
+		store = emalloc(sizeof(excimer_log_frame_store));
+		excimer_log_store_init(store, 0, 0);
+	} else {
+		store = EXCIMER_G(frame_store);
+		if (!store) {
+			store = pemalloc(sizeof(excimer_log_frame_store), 1);
+			excimer_log_store_init(store, 1, max_frames);
+			EXCIMER_G(frame_store) = store;
+		}
+	}
+	store->refcount++;
+	return store;
+}
+
+static void excimer_log_release_store(excimer_log_frame_store *store)
+{
+	if (--store->refcount == 0 && !store->persistent) {
+		excimer_log_store_destroy(store);
+		efree(store);
+	}
+}
+
+void excimer_log_request_init(void)
+{
+	excimer_log_frame_store *store = EXCIMER_G(frame_store);
+
+	/* Strings from the store may be referenced by any zval, so the store
+	 * can only be emptied between requests */
+	if (store && !store->refcount && store->frames_size >= store->max_frames) {
+		size_t max_frames = store->max_frames;
+		excimer_log_store_destroy(store);
+		excimer_log_store_init(store, 1, max_frames);
+	}
+}
+
+void excimer_log_shutdown_shared_store(void)
+{
+	excimer_log_frame_store *store = EXCIMER_G(frame_store);
+	if (store) {
+		excimer_log_store_destroy(store);
+		pefree(store, 1);
+		EXCIMER_G(frame_store) = NULL;
+	}
+}
+
 void excimer_log_init(excimer_log *log)
 {
 	log->entries_size = 0;
+	log->entries_capacity = 0;
 	log->entries = NULL;
-	log->frames = ecalloc(1, sizeof(excimer_log_frame));
-	log->frames_size = 1;
-	log->reverse_frames = excimer_log_new_array(0);
+	log->store = excimer_log_acquire_store();
+	log->stack = NULL;
+	log->stack_size = 0;
+	log->stack_capacity = 0;
+	log->stack_base = 0;
+	log->root_index = 0;
+	memset(&log->frame_names, 0, sizeof(log->frame_names));
+	memset(&log->raw_frame_names, 0, sizeof(log->raw_frame_names));
 	log->epoch = 0;
 	log->event_count = 0;
+	log->has_cpu_time = 0;
+	log->cpu_time = 0;
+	log->internal_frames = 0;
+	log->granularity = EXCIMER_GRANULARITY_LINE;
+	log->aggregate = 0;
+	log->leaf_entries = NULL;
+	log->leaf_entries_capacity = 0;
+	log->leaf_entry_table = NULL;
+	log->coalesce = 0;
+	log->compact = 0;
+	log->blocks = NULL;
+	log->blocks_size = 0;
+	log->blocks_capacity = 0;
+	log->blocks_data_bytes = 0;
+	log->decoded = NULL;
+	log->decoded_block = 0;
+	log->reservoir_size = 0;
+	log->reservoir_seen = 0;
+	log->reservoir_next = 0;
+	log->reservoir_w = 0;
+	log->reservoir_tree = NULL;
+	log->reservoir_tree_size = 0;
+	log->frames_frozen = 0;
+	memset(&log->stats, 0, sizeof(log->stats));
 }
 
 void excimer_log_destroy(excimer_log *log)
@@ -106,324 +457,2106 @@ void excimer_log_destroy(excimer_log *log)
 	if (log->entries) {
 		efree(log->entries);
 	}
-	if (log->frames) {
-		int i;
-		for (i = 0; i < log->frames_size; i++) {
-			if (log->frames[i].filename) {
-				zend_string_delref(log->frames[i].filename);
-			}
-			if (log->frames[i].class_name) {
-				zend_string_delref(log->frames[i].class_name);
-			}
-			if (log->frames[i].function_name) {
-				zend_string_delref(log->frames[i].function_name);
-			}
-		}
-		efree(log->frames);
+	excimer_log_release_store(log->store);
+	excimer_log_name_cache_destroy(&log->frame_names);
+	excimer_log_name_cache_destroy(&log->raw_frame_names);
+	if (log->stack) {
+		efree(log->stack);
 	}
-	zend_hash_destroy(log->reverse_frames);
-	efree(log->reverse_frames);
+	excimer_log_free_leaf_entries(log);
+	excimer_log_free_reservoir_tree(log);
+	excimer_log_free_blocks(log);
 }
 
-void excimer_log_set_max_depth(excimer_log *log, zend_long depth)
+static inline int excimer_log_is_compact(excimer_log *log)
 {
-	log->max_depth = depth;
+	return log->compact && !log->aggregate;
 }
 
-void excimer_log_copy_options(excimer_log *dest, excimer_log  *src)
+static inline uint64_t excimer_log_zigzag_encode(int64_t value)
 {
-	dest->max_depth = src->max_depth;
-	dest->epoch = src->epoch;
-	dest->period = src->period;
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
 }
 
-void excimer_log_add(excimer_log *log, zend_execute_data *execute_data,
-	zend_long event_count, uint64_t timestamp)
+static inline int64_t excimer_log_zigzag_decode(uint64_t value)
 {
-	uint32_t frame_index = excimer_log_find_or_add_frame(log, execute_data, 0);
-	excimer_log_entry *entry;
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
 
-	log->entries = safe_erealloc(log->entries, log->entries_size + 1,
-		sizeof(excimer_log_entry), 0);
-	entry = &log->entries[log->entries_size++];
-	entry->frame_index = frame_index;
-	entry->event_count = event_count;
-	log->event_count += event_count;
-	entry->timestamp = timestamp;
+static void excimer_log_block_append_varint(excimer_log_block *block, uint64_t value)
+{
+	if (block->data_size + 10 > block->data_capacity) {
+		block->data = excimer_log_grow(block->data, &block->data_capacity,
+			block->data_size + 10, 1, 0);
+	}
+	while (value >= 0x80) {
+		block->data[block->data_size++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	block->data[block->data_size++] = (unsigned char)value;
 }
 
-static uint32_t excimer_log_get_truncation_marker(excimer_log *log) {
-	zval* zp_index;
-	zval z_new_index;
-	excimer_log_frame *p_frame;
-	
-	zp_index = zend_hash_str_find(log->reverse_frames,
-		excimer_log_truncated_name, sizeof(excimer_log_truncated_name) - 1);
-	if (zp_index) {
-		return excimer_safe_uint32(Z_LVAL_P(zp_index));
-	}
-
-	ZVAL_LONG(&z_new_index, log->frames_size);
-	zend_hash_str_add(log->reverse_frames,
-		excimer_log_truncated_name, sizeof(excimer_log_truncated_name) - 1,
-		&z_new_index);
-	log->frames = safe_erealloc(log->frames, log->frames_size + 1,
-		sizeof(excimer_log_frame), 0);
-	p_frame = &log->frames[log->frames_size++];
-
-	p_frame->filename = zend_string_init(excimer_log_fake_filename,
-		sizeof(excimer_log_fake_filename) - 1, 0);
-	p_frame->lineno = 1;
-	p_frame->closure_line = 0;
-	p_frame->class_name = NULL;
-	p_frame->function_name = zend_string_init(excimer_log_truncated_name,
-		sizeof(excimer_log_truncated_name) - 1, 0);
-	p_frame->prev_index = 0;
+static inline uint64_t excimer_log_read_varint(const unsigned char **pp)
+{
+	const unsigned char *p = *pp;
+	uint64_t value = 0;
+	int shift = 0;
 
-	return excimer_safe_uint32(Z_LVAL(z_new_index));
+	while (*p & 0x80) {
+		value |= (uint64_t)(*p++ & 0x7f) << shift;
+		shift += 7;
+	}
+	value |= (uint64_t)*p++ << shift;
+	*pp = p;
+	return value;
 }
 
-static uint32_t excimer_log_find_or_add_frame(excimer_log *log,
-	zend_execute_data *execute_data, zend_long depth)
+/**
+ * Encode an entry at the end of a block
+ *
+ * @param block The block
+ * @param frame_index The leaf frame index
+ * @param event_count The event count
+ * @param delta The zigzag-encoded time since the previous entry
+ * @param cpu_time The CPU time, or zero
+ */
+static void excimer_log_block_append_entry(excimer_log_block *block, uint32_t frame_index,
+	zend_long event_count, uint64_t delta, uint64_t cpu_time)
 {
-	uint32_t prev_index;
-	if (!execute_data) {
-		return 0;
-	} else if (!execute_data->prev_execute_data) {
-		prev_index = 0;
-	} else if (log->max_depth && depth >= log->max_depth) {
-		prev_index = excimer_log_get_truncation_marker(log);
-	} else {
-		prev_index = excimer_log_find_or_add_frame(log,
-			execute_data->prev_execute_data, depth + 1);
+	block->last_offset = block->data_size;
+	excimer_log_block_append_varint(block, ((uint64_t)frame_index << 2)
+		| (event_count != 1) | ((cpu_time != 0) << 1));
+	if (event_count != 1) {
+		excimer_log_block_append_varint(block, excimer_log_zigzag_encode(event_count));
+	}
+	excimer_log_block_append_varint(block, delta);
+	if (cpu_time) {
+		excimer_log_block_append_varint(block, cpu_time);
 	}
-	if (!execute_data->func
-		|| !ZEND_USER_CODE(execute_data->func->common.type))
+}
+
+/**
+ * Append an entry to the last block of a compact log, starting a new block
+ * if it is full
+ */
+static void excimer_log_compact_append(excimer_log *log, uint32_t frame_index,
+	zend_long event_count, uint64_t timestamp, uint64_t cpu_time)
+{
+	excimer_log_block *block;
+	size_t old_capacity;
+
+	if (!log->blocks_size
+		|| log->blocks[log->blocks_size - 1].num_entries >= EXCIMER_LOG_BLOCK_ENTRIES)
 	{
-		return prev_index;
+		if (log->blocks_size >= log->blocks_capacity) {
+			log->blocks = excimer_log_grow(log->blocks, &log->blocks_capacity,
+				log->blocks_size + 1, sizeof(excimer_log_block), 0);
+		}
+		block = &log->blocks[log->blocks_size++];
+		memset(block, 0, sizeof(excimer_log_block));
+		block->first_timestamp = timestamp;
+		block->last_timestamp = timestamp;
 	} else {
-		zend_function *func = execute_data->func;
-		excimer_log_frame frame = {NULL};
-		smart_str ss_key = {NULL};
-		zend_string *str_key;
-		zval* zp_index;
+		block = &log->blocks[log->blocks_size - 1];
+	}
+	if (log->decoded_block == log->blocks_size) {
+		log->decoded_block = 0;
+	}
 
-		frame.filename = func->op_array.filename;
-		zend_string_addref(frame.filename);
+	old_capacity = block->data_capacity;
+	excimer_log_block_append_entry(block, frame_index, event_count,
+		excimer_log_zigzag_encode((int64_t)(timestamp - block->last_timestamp)), cpu_time);
+	block->last_timestamp = timestamp;
+	block->num_entries++;
+	log->blocks_data_bytes += block->data_capacity - old_capacity;
+}
 
-		if (func->common.scope && func->common.scope->name) {
-			frame.class_name = func->common.scope->name;
-			zend_string_addref(frame.class_name);
-		}
+/**
+ * If the last entry of a compact log has the given leaf frame, add the
+ * sample to it, re-encoding it in place. The entry keeps its timestamp.
+ *
+ * @return Whether the sample was added
+ */
+static int excimer_log_compact_coalesce(excimer_log *log, uint32_t frame_index,
+	zend_long event_count, uint64_t cpu_time)
+{
+	excimer_log_block *block;
+	const unsigned char *p;
+	uint64_t value, delta;
+	size_t old_capacity;
 
-		if (func->common.function_name) {
-			frame.function_name = func->common.function_name;
-			zend_string_addref(frame.function_name);
+	if (!log->blocks_size) {
+		return 0;
+	}
+	block = &log->blocks[log->blocks_size - 1];
+	p = block->data + block->last_offset;
+	value = excimer_log_read_varint(&p);
+	if ((uint32_t)(value >> 2) != frame_index) {
+		return 0;
+	}
+	event_count += (value & 1)
+		? (zend_long)excimer_log_zigzag_decode(excimer_log_read_varint(&p)) : 1;
+	delta = excimer_log_read_varint(&p);
+	if (value & 2) {
+		cpu_time += excimer_log_read_varint(&p);
+	}
+
+	old_capacity = block->data_capacity;
+	block->data_size = block->last_offset;
+	excimer_log_block_append_entry(block, frame_index, event_count, delta, cpu_time);
+	log->blocks_data_bytes += block->data_capacity - old_capacity;
+	if (log->decoded_block == log->blocks_size) {
+		log->decoded_block = 0;
+	}
+	return 1;
+}
+
+/**
+ * Decode a block of a compact log into log->decoded
+ */
+static excimer_log_entry *excimer_log_decode_block(excimer_log *log, size_t block_index)
+{
+	excimer_log_block *block = &log->blocks[block_index];
+	const unsigned char *p = block->data;
+	uint64_t timestamp = block->first_timestamp;
+	uint32_t i;
+
+	if (log->decoded_block == block_index + 1) {
+		return log->decoded;
+	}
+	if (!log->decoded) {
+		log->decoded = safe_emalloc(EXCIMER_LOG_BLOCK_ENTRIES, sizeof(excimer_log_entry), 0);
+	}
+	for (i = 0; i < block->num_entries; i++) {
+		excimer_log_entry *entry = &log->decoded[i];
+		uint64_t value = excimer_log_read_varint(&p);
+
+		entry->frame_index = (uint32_t)(value >> 2);
+		entry->event_count = (value & 1)
+			? (zend_long)excimer_log_zigzag_decode(excimer_log_read_varint(&p)) : 1;
+		timestamp += (uint64_t)excimer_log_zigzag_decode(excimer_log_read_varint(&p));
+		entry->timestamp = timestamp;
+		entry->cpu_time = (value & 2) ? excimer_log_read_varint(&p) : 0;
+	}
+	log->decoded_block = block_index + 1;
+	return log->decoded;
+}
+
+static void excimer_log_free_blocks(excimer_log *log)
+{
+	size_t i;
+
+	for (i = 0; i < log->blocks_size; i++) {
+		if (log->blocks[i].data) {
+			efree(log->blocks[i].data);
 		}
+	}
+	if (log->blocks) {
+		efree(log->blocks);
+	}
+	if (log->decoded) {
+		efree(log->decoded);
+	}
+	log->blocks = NULL;
+	log->blocks_size = 0;
+	log->blocks_capacity = 0;
+	log->blocks_data_bytes = 0;
+	log->decoded = NULL;
+	log->decoded_block = 0;
+}
 
-		if (func->op_array.fn_flags & ZEND_ACC_CLOSURE) {
-			frame.closure_line = func->op_array.line_start;
+/**
+ * Convert the existing entries to or from compact storage
+ */
+static void excimer_log_convert_storage(excimer_log *log, int to_compact)
+{
+	size_t i;
+
+	if (!log->entries_size) {
+		return;
+	}
+	if (to_compact) {
+		for (i = 0; i < log->entries_size; i++) {
+			excimer_log_entry *entry = &log->entries[i];
+			excimer_log_compact_append(log, entry->frame_index, entry->event_count,
+				entry->timestamp, entry->cpu_time);
+		}
+		efree(log->entries);
+		log->entries = NULL;
+		log->entries_capacity = 0;
+	} else {
+		log->entries = safe_erealloc(log->entries, log->entries_size,
+			sizeof(excimer_log_entry), 0);
+		log->entries_capacity = log->entries_size;
+		for (i = 0; i < log->blocks_size; i++) {
+			memcpy(&log->entries[i * EXCIMER_LOG_BLOCK_ENTRIES],
+				excimer_log_decode_block(log, i),
+				log->blocks[i].num_entries * sizeof(excimer_log_entry));
 		}
+		excimer_log_free_blocks(log);
+	}
+}
 
-		frame.lineno = execute_data->opline->lineno;
-		frame.prev_index = prev_index;
+void excimer_log_set_compact(excimer_log *log, int compact)
+{
+	compact = compact ? 1 : 0;
+	if (compact == log->compact) {
+		return;
+	}
+	if (!log->aggregate) {
+		excimer_log_convert_storage(log, compact);
+	}
+	log->compact = compact;
+}
 
-		/* Make a key for reverse lookup */
-		smart_str_append(&ss_key, frame.filename);
-		smart_str_appendc(&ss_key, '\0');
-		excimer_log_smart_str_append_printf(&ss_key, "%d", frame.lineno);
-		smart_str_appendc(&ss_key, '\0');
-		excimer_log_smart_str_append_printf(&ss_key, "%d", frame.prev_index);
-		str_key = excimer_log_smart_str_extract(&ss_key);
+void excimer_log_set_max_depth(excimer_log *log, zend_long depth)
+{
+	log->max_depth = depth;
+	/* The cached stack may have been truncated at a different depth */
+	log->stack_size = 0;
+}
 
-		/* Look for a matching frame in the reverse hashtable */
-		zp_index = zend_hash_find(log->reverse_frames, str_key);
-		if (zp_index) {
-			zend_string_free(str_key);
-			zend_string_delref(frame.filename);
-			if (frame.class_name) {
-				zend_string_delref(frame.class_name);
-			}
-			if (frame.function_name) {
-				zend_string_delref(frame.function_name);
+void excimer_log_set_granularity(excimer_log *log, int granularity)
+{
+	log->granularity = granularity;
+	log->stack_size = 0;
+}
+
+void excimer_log_set_internal_frames(excimer_log *log, int enable)
+{
+	log->internal_frames = enable;
+	/* The cached stack levels were resolved with the old setting */
+	log->stack_size = 0;
+}
+
+/* Grow the leaf entry map of an aggregate log to cover the given frame index */
+static void excimer_log_grow_leaf_entries(excimer_log *log, uint32_t frame_index)
+{
+	size_t old_capacity = log->leaf_entries_capacity;
+
+	log->leaf_entries = excimer_log_grow(log->leaf_entries, &log->leaf_entries_capacity,
+		(size_t)frame_index + 1, sizeof(uint32_t), 0);
+	memset(log->leaf_entries + old_capacity, 0,
+		(log->leaf_entries_capacity - old_capacity) * sizeof(uint32_t));
+}
+
+/**
+ * Get the index within "entries" plus one of the aggregated entry with the
+ * given leaf frame, or zero if there is none
+ */
+static inline uint32_t excimer_log_get_leaf_entry(excimer_log *log, uint32_t frame_index)
+{
+	zval *zp_entry;
+
+	if (!log->store->persistent) {
+		return frame_index < log->leaf_entries_capacity ? log->leaf_entries[frame_index] : 0;
+	}
+	zp_entry = log->leaf_entry_table
+		? zend_hash_index_find(log->leaf_entry_table, frame_index) : NULL;
+	return zp_entry ? (uint32_t)Z_LVAL_P(zp_entry) : 0;
+}
+
+/**
+ * Set the entry index plus one of a leaf frame, or remove the frame from the
+ * leaf entry map if it is zero
+ */
+static void excimer_log_set_leaf_entry(excimer_log *log, uint32_t frame_index, uint32_t value)
+{
+	zval z_value;
+
+	if (!log->store->persistent) {
+		if (frame_index >= log->leaf_entries_capacity) {
+			if (!value) {
+				return;
 			}
+			excimer_log_grow_leaf_entries(log, frame_index);
+		}
+		log->leaf_entries[frame_index] = value;
+		return;
+	}
+	if (!value) {
+		if (log->leaf_entry_table) {
+			zend_hash_index_del(log->leaf_entry_table, frame_index);
+		}
+		return;
+	}
+	if (!log->leaf_entry_table) {
+		log->leaf_entry_table = emalloc(sizeof(HashTable));
+		zend_hash_init(log->leaf_entry_table, 8, NULL, NULL, 0);
+	}
+	ZVAL_LONG(&z_value, value);
+	zend_hash_index_update(log->leaf_entry_table, frame_index, &z_value);
+}
 
-			return excimer_safe_uint32(Z_LVAL_P(zp_index));
-		} else {
-			zval z_new_index;
+static void excimer_log_free_leaf_entries(excimer_log *log)
+{
+	if (log->leaf_entries) {
+		efree(log->leaf_entries);
+		log->leaf_entries = NULL;
+		log->leaf_entries_capacity = 0;
+	}
+	if (log->leaf_entry_table) {
+		zend_hash_destroy(log->leaf_entry_table);
+		efree(log->leaf_entry_table);
+		log->leaf_entry_table = NULL;
+	}
+}
 
-			/* Create a new entry in the array and reverse hashtable */
-			ZVAL_LONG(&z_new_index, log->frames_size);
-			zend_hash_add(log->reverse_frames, str_key, &z_new_index);
-			log->frames = safe_erealloc(log->frames, log->frames_size + 1,
-				sizeof(excimer_log_frame), 0);
-			memcpy(&log->frames[log->frames_size++], &frame, sizeof(excimer_log_frame));
+/**
+ * Estimate the memory used by a hashtable of scalars, or zero if it is NULL
+ */
+static inline size_t excimer_log_get_hash_bytes(HashTable *ht)
+{
+	return ht ? zend_hash_num_elements(ht) * (sizeof(Bucket) + sizeof(uint32_t)) : 0;
+}
 
-			zend_string_delref(str_key);
-			return excimer_safe_uint32(Z_LVAL(z_new_index));
+void excimer_log_set_aggregate(excimer_log *log, int aggregate)
+{
+	size_t i, n = 0;
+
+	if (!aggregate) {
+		log->reservoir_size = 0;
+		log->reservoir_seen = 0;
+		log->frames_frozen = 0;
+		excimer_log_free_reservoir_tree(log);
+		excimer_log_free_leaf_entries(log);
+		if (log->aggregate && log->compact) {
+			excimer_log_convert_storage(log, 1);
+		}
+		log->aggregate = 0;
+		return;
+	}
+	if (log->aggregate) {
+		return;
+	}
+	if (log->compact) {
+		excimer_log_convert_storage(log, 0);
+	}
+	log->aggregate = 1;
+	if (!log->entries_size) {
+		return;
+	}
+
+	/* Merge existing entries in place, keeping the first of each leaf */
+	if (!log->store->persistent) {
+		excimer_log_grow_leaf_entries(log, log->store->frames_size);
+	}
+	for (i = 0; i < log->entries_size; i++) {
+		excimer_log_entry *entry = &log->entries[i];
+		uint32_t entry_index = excimer_log_get_leaf_entry(log, entry->frame_index);
+		if (entry_index) {
+			log->entries[entry_index - 1].event_count += entry->event_count;
+			log->entries[entry_index - 1].cpu_time += entry->cpu_time;
+		} else {
+			log->entries[n] = *entry;
+			excimer_log_set_leaf_entry(log, entry->frame_index, ++n);
+		}
+	}
+	log->entries_size = n;
+}
+
+void excimer_log_set_coalesce(excimer_log *log, int coalesce)
+{
+	log->coalesce = coalesce ? 1 : 0;
+}
+
+void excimer_log_copy_options(excimer_log *dest, excimer_log  *src)
+{
+	dest->max_depth = src->max_depth;
+	dest->epoch = src->epoch;
+	dest->period = src->period;
+	dest->aggregate = src->aggregate;
+	dest->coalesce = src->coalesce;
+	dest->compact = src->compact;
+	dest->has_cpu_time = src->has_cpu_time;
+	dest->internal_frames = src->internal_frames;
+	dest->granularity = src->granularity;
+}
+
+size_t excimer_log_get_entry_bytes(excimer_log *log)
+{
+	size_t bytes = log->entries_capacity * sizeof(excimer_log_entry)
+		+ log->leaf_entries_capacity * sizeof(uint32_t)
+		+ excimer_log_get_hash_bytes(log->leaf_entry_table)
+		+ (log->reservoir_tree ? (log->reservoir_tree_size + 1) * sizeof(zend_long) : 0)
+		+ log->blocks_capacity * sizeof(excimer_log_block)
+		+ log->blocks_data_bytes;
+
+	if (log->decoded) {
+		bytes += EXCIMER_LOG_BLOCK_ENTRIES * sizeof(excimer_log_entry);
+	}
+	return bytes;
+}
+
+size_t excimer_log_get_frame_bytes(excimer_log *log)
+{
+	return log->store->frames_capacity * sizeof(excimer_log_frame)
+		+ log->store->reverse_frames.size * sizeof(excimer_log_frame_slot);
+}
+
+/**
+ * Get the number of bytes used by a frame name cache
+ */
+static size_t excimer_log_get_name_cache_bytes(excimer_log_name_cache *cache)
+{
+	return cache->size * sizeof(zend_string*)
+		+ excimer_log_get_hash_bytes(cache->table)
+		+ cache->string_bytes;
+}
+
+size_t excimer_log_get_memory_usage(excimer_log *log)
+{
+	return excimer_log_get_entry_bytes(log)
+		+ (log->store->persistent ? 0 : excimer_log_get_frame_bytes(log))
+		+ excimer_log_get_name_cache_bytes(&log->frame_names)
+		+ excimer_log_get_name_cache_bytes(&log->raw_frame_names)
+		+ log->stack_capacity * sizeof(excimer_log_stack_frame);
+}
+
+void excimer_log_trim(excimer_log *log)
+{
+	if (log->entries_capacity <= log->entries_size) {
+		return;
+	}
+	if (log->entries_size) {
+		log->entries = safe_erealloc(log->entries, log->entries_size,
+			sizeof(excimer_log_entry), 0);
+	} else {
+		efree(log->entries);
+		log->entries = NULL;
+	}
+	log->entries_capacity = log->entries_size;
+}
+
+/* {{{ Reservoir sampling */
+
+static void excimer_log_free_reservoir_tree(excimer_log *log)
+{
+	if (log->reservoir_tree) {
+		efree(log->reservoir_tree);
+		log->reservoir_tree = NULL;
+	}
+	log->reservoir_tree_size = 0;
+}
+
+/**
+ * Add a delta to the event count of the entry with the given index in the
+ * Fenwick tree
+ */
+static void excimer_log_reservoir_tree_add(excimer_log *log, size_t index, zend_long delta)
+{
+	size_t i;
+	for (i = index + 1; i <= log->reservoir_tree_size; i += i & -i) {
+		log->reservoir_tree[i] += delta;
+	}
+}
+
+/**
+ * Rebuild the Fenwick tree from the entries, with room for at least the
+ * given number of entries
+ */
+static void excimer_log_reservoir_tree_build(excimer_log *log, size_t capacity)
+{
+	size_t size = EXCIMER_LOG_MIN_CAPACITY, i;
+
+	while (size < capacity) {
+		size *= 2;
+	}
+	excimer_log_free_reservoir_tree(log);
+	log->reservoir_tree = safe_emalloc(size + 1, sizeof(zend_long), 0);
+	memset(log->reservoir_tree, 0, (size + 1) * sizeof(zend_long));
+	log->reservoir_tree_size = size;
+	for (i = 1; i <= size; i++) {
+		size_t parent = i + (i & -i);
+		if (i <= log->entries_size) {
+			log->reservoir_tree[i] += log->entries[i - 1].event_count;
+		}
+		if (parent <= size) {
+			log->reservoir_tree[parent] += log->reservoir_tree[i];
+		}
+	}
+}
+
+/**
+ * Update the Fenwick tree for an entry appended with the given event count
+ */
+static void excimer_log_reservoir_tree_append(excimer_log *log, zend_long event_count)
+{
+	if (log->entries_size > log->reservoir_tree_size) {
+		excimer_log_reservoir_tree_build(log, log->reservoir_tree_size * 2);
+	} else {
+		excimer_log_reservoir_tree_add(log, log->entries_size - 1, event_count);
+	}
+}
+
+/**
+ * Find the index of the entry containing the kept event with the given
+ * position, counting from zero through the entries in order
+ */
+static size_t excimer_log_reservoir_tree_find(excimer_log *log, zend_long position)
+{
+	size_t index = 0, step;
+
+	for (step = log->reservoir_tree_size; step; step >>= 1) {
+		if (index + step <= log->reservoir_tree_size
+			&& log->reservoir_tree[index + step] <= position)
+		{
+			index += step;
+			position -= log->reservoir_tree[index];
+		}
+	}
+	return index;
+}
+
+/**
+ * Get the logarithm of a random number in the open interval (0, 1)
+ */
+static double excimer_log_random_log(void)
+{
+	return log(((double)php_mt_rand() + 0.5) / 4294967296.0);
+}
+
+/**
+ * Choose the position of the next event to accept after the current one,
+ * as in Algorithm L, updating W
+ */
+static void excimer_log_reservoir_skip(excimer_log *log)
+{
+	double skip;
+
+	log->reservoir_w *= exp(excimer_log_random_log() / (double)log->reservoir_size);
+	skip = floor(excimer_log_random_log() / log1p(-log->reservoir_w));
+	if (!(skip < (double)(UINT64_MAX - log->reservoir_next - 1))) {
+		log->reservoir_next = UINT64_MAX;
+	} else {
+		log->reservoir_next += (uint64_t)skip + 1;
+	}
+}
+
+void excimer_log_start_reservoir(excimer_log *log)
+{
+	excimer_log_set_aggregate(log, 1);
+	log->reservoir_size = (uint64_t)MAX(log->event_count, 1);
+	log->reservoir_seen = (uint64_t)log->event_count;
+	log->frames_frozen = 1;
+	excimer_log_reservoir_tree_build(log, log->entries_size);
+	if (log->reservoir_seen >= log->reservoir_size) {
+		/* The reservoir is already full, so skip from the first event */
+		log->reservoir_w = 1;
+		log->reservoir_next = log->reservoir_seen - 1;
+		excimer_log_reservoir_skip(log);
+	}
+}
+
+/**
+ * Remove one kept event from the log, choosing the entry in proportion to
+ * its event count
+ */
+static void excimer_log_reservoir_evict(excimer_log *log)
+{
+	size_t i = excimer_log_reservoir_tree_find(log,
+		php_mt_rand_range(0, log->event_count - 1));
+	size_t last = log->entries_size - 1;
+	excimer_log_entry *entry = &log->entries[i];
+	uint64_t cpu_time;
+
+	cpu_time = entry->cpu_time / (uint64_t)entry->event_count;
+	entry->event_count--;
+	entry->cpu_time -= cpu_time;
+	log->event_count--;
+	log->cpu_time -= cpu_time;
+	excimer_log_reservoir_tree_add(log, i, -1);
+	if (entry->event_count) {
+		return;
+	}
+
+	/* Move the last entry into the emptied one's place */
+	log->cpu_time -= entry->cpu_time;
+	excimer_log_set_leaf_entry(log, entry->frame_index, 0);
+	if (i != last) {
+		*entry = log->entries[last];
+		excimer_log_set_leaf_entry(log, entry->frame_index, i + 1);
+		excimer_log_reservoir_tree_add(log, i, entry->event_count);
+		excimer_log_reservoir_tree_add(log, last, -entry->event_count);
+	}
+	log->entries_size--;
+}
+
+/**
+ * Pass the events of a sample through the reservoir, evicting a kept event
+ * for each one accepted once the reservoir is full. The cost is proportional
+ * to the number of events accepted, not the number offered.
+ *
+ * @return The number of the sample's events which should be added
+ */
+static zend_long excimer_log_reservoir_sample(excimer_log *log, zend_long event_count)
+{
+	uint64_t end = log->reservoir_seen + (uint64_t)event_count;
+	uint64_t fill = 0, replaced = 0;
+	zend_long accepted = 0;
+
+	if (log->reservoir_seen < log->reservoir_size) {
+		fill = MIN((uint64_t)event_count, log->reservoir_size - log->reservoir_seen);
+		accepted = (zend_long)fill;
+		log->reservoir_seen += fill;
+		if (log->reservoir_seen == log->reservoir_size) {
+			log->reservoir_w = 1;
+			log->reservoir_next = log->reservoir_seen - 1;
+			excimer_log_reservoir_skip(log);
+		}
+	}
+	while (log->reservoir_next < end) {
+		zend_long kept = log->event_count + accepted;
+		replaced++;
+		/* The sample's own accepted events are candidates for eviction too */
+		if (!kept || php_mt_rand_range(0, kept - 1) < log->event_count) {
+			if (log->event_count) {
+				excimer_log_reservoir_evict(log);
+			}
+			accepted++;
+		}
+		excimer_log_reservoir_skip(log);
+	}
+	log->reservoir_seen = end;
+	log->stats.events_replaced += replaced;
+	log->stats.events_dropped += (uint64_t)event_count - fill - replaced;
+	return accepted;
+}
+
+/* }}} */
+
+void excimer_log_reserve(excimer_log *log, size_t entries, size_t frames)
+{
+	if (excimer_log_is_compact(log)) {
+		entries = 0;
+	}
+	if (entries > log->entries_capacity) {
+		log->entries = safe_erealloc(log->entries, entries, sizeof(excimer_log_entry), 0);
+		log->entries_capacity = entries;
+	}
+	/* A shared store has probably already grown to its working size */
+	if (frames > log->store->frames_capacity && !log->store->persistent) {
+		log->store->frames = safe_erealloc(log->store->frames, frames, sizeof(excimer_log_frame), 0);
+		log->store->frames_capacity = frames;
+	}
+}
+
+/**
+ * Append an entry with the given leaf frame, or in aggregate mode, add to
+ * the existing entry with that leaf
+ */
+static void excimer_log_append_entry(excimer_log *log, uint32_t frame_index,
+	zend_long event_count, uint64_t timestamp, uint64_t cpu_time)
+{
+	excimer_log_entry *entry;
+
+	if (log->aggregate) {
+		uint32_t entry_index;
+
+		if (log->reservoir_size) {
+			zend_long accepted = excimer_log_reservoir_sample(log, event_count);
+			if (!accepted) {
+				return;
+			}
+			if (accepted < event_count) {
+				cpu_time = (uint64_t)((double)cpu_time * accepted / event_count);
+			}
+			event_count = accepted;
+		}
+		entry_index = excimer_log_get_leaf_entry(log, frame_index);
+		if (entry_index) {
+			entry = &log->entries[entry_index - 1];
+			entry->event_count += event_count;
+			entry->cpu_time += cpu_time;
+			log->event_count += event_count;
+			log->cpu_time += cpu_time;
+			if (log->reservoir_tree) {
+				excimer_log_reservoir_tree_add(log, entry_index - 1, event_count);
+			}
+			return;
+		}
+	}
+
+	if (excimer_log_is_compact(log)) {
+		if (log->coalesce && excimer_log_compact_coalesce(log, frame_index, event_count, cpu_time)) {
+			log->stats.samples_coalesced++;
+		} else {
+			excimer_log_compact_append(log, frame_index, event_count, timestamp, cpu_time);
+			log->entries_size++;
+		}
+		log->event_count += event_count;
+		log->cpu_time += cpu_time;
+		return;
+	}
+
+	if (log->coalesce && log->entries_size
+		&& log->entries[log->entries_size - 1].frame_index == frame_index)
+	{
+		entry = &log->entries[log->entries_size - 1];
+		entry->event_count += event_count;
+		entry->cpu_time += cpu_time;
+		log->event_count += event_count;
+		log->cpu_time += cpu_time;
+		log->stats.samples_coalesced++;
+		return;
+	}
+
+	if (log->entries_size >= log->entries_capacity) {
+		log->entries = excimer_log_grow(log->entries, &log->entries_capacity,
+			log->entries_size + 1, sizeof(excimer_log_entry), 0);
+	}
+	entry = &log->entries[log->entries_size++];
+	entry->frame_index = frame_index;
+	entry->event_count = event_count;
+	log->event_count += event_count;
+	entry->timestamp = timestamp;
+	entry->cpu_time = cpu_time;
+	log->cpu_time += cpu_time;
+	if (log->aggregate) {
+		excimer_log_set_leaf_entry(log, frame_index, log->entries_size);
+		if (log->reservoir_tree) {
+			excimer_log_reservoir_tree_append(log, event_count);
+		}
+	}
+}
+
+void excimer_log_add(excimer_log *log, zend_execute_data *execute_data,
+	zend_long event_count, uint64_t timestamp, uint64_t cpu_time)
+{
+	excimer_log_append_entry(log, excimer_log_capture_stack(log, execute_data),
+		event_count, timestamp, cpu_time);
+	log->stats.samples++;
+}
+
+uint32_t excimer_log_capture(excimer_log *log, zend_execute_data *execute_data)
+{
+	return excimer_log_capture_stack(log, execute_data);
+}
+
+static uint32_t excimer_log_get_truncation_marker(excimer_log *log) {
+	excimer_log_frame *p_frame;
+
+	if (log->store->truncation_index) {
+		return log->store->truncation_index;
+	}
+
+	log->store->truncation_index = excimer_safe_uint32(log->store->frames_size);
+	p_frame = excimer_log_append_frame(log);
+
+	if (log->store->persistent) {
+		p_frame->filename = excimer_log_store_string(log->store, excimer_log_fake_filename,
+			sizeof(excimer_log_fake_filename) - 1, NULL);
+		p_frame->function_name = excimer_log_store_string(log->store, excimer_log_truncated_name,
+			sizeof(excimer_log_truncated_name) - 1, NULL);
+	} else {
+		p_frame->filename = zend_string_init(excimer_log_fake_filename,
+			sizeof(excimer_log_fake_filename) - 1, 0);
+		p_frame->function_name = zend_string_init(excimer_log_truncated_name,
+			sizeof(excimer_log_truncated_name) - 1, 0);
+	}
+	p_frame->lineno = 1;
+	p_frame->opline = 0;
+	p_frame->closure_line = 0;
+	p_frame->class_name = NULL;
+	p_frame->prev_index = 0;
+
+	return log->store->truncation_index;
+}
+
+/**
+ * Check whether the stack is the same as the cached stack. Levels are
+ * compared from the leaf, since that is where a stack usually changes, so a
+ * changed stack is normally detected without walking it.
+ */
+static int excimer_log_stack_unchanged(excimer_log *log, zend_execute_data *execute_data)
+{
+	zend_execute_data *ed = execute_data;
+	excimer_log_stack_frame *sf;
+	size_t i = log->stack_size;
+	int compare_opline = log->granularity != EXCIMER_GRANULARITY_FUNCTION;
+
+	if (!i) {
+		return 0;
+	}
+	while (i > 0) {
+		sf = &log->stack[--i];
+		if (!ed || sf->execute_data != ed || sf->func != ed->func
+			|| (compare_opline && sf->opline != ed->opline))
+		{
+			return 0;
+		}
+		ed = ed->prev_execute_data;
+	}
+	/* A complete stack must still be complete, and a truncated one still truncated */
+	if (log->stack_base == log->root_index) {
+		return ed == NULL;
+	}
+	return ed != NULL && log->stack_base == log->store->truncation_index;
+}
+
+/**
+ * Find or add the frames for the current stack, returning the index of the
+ * leaf frame.
+ *
+ * Consecutive samples usually share most of the stack, so the previous stack
+ * is cached, and only the levels above the longest unchanged prefix starting
+ * at the root are resolved. A level is unchanged if its execute_data, func
+ * and opline pointers are all the same as before. With function granularity,
+ * the opline is not compared, since it does not affect the frame. Comparison
+ * starts from the root because a frame with matching pointers may have been
+ * popped and pushed again with a caller at a different opline.
+ */
+static uint32_t excimer_log_capture_stack(excimer_log *log,
+	zend_execute_data *execute_data)
+{
+	zend_execute_data *ed;
+	excimer_log_stack_frame *sf;
+	size_t n = 0, common, i;
+	uint32_t base = log->root_index;
+	uint32_t prev_index;
+
+	/* If nothing changed since the previous sample, reuse its leaf */
+	if (excimer_log_stack_unchanged(log, execute_data)) {
+		log->stats.frames_walked += log->stack_size;
+		log->stats.frames_cached += log->stack_size;
+		return log->stack[log->stack_size - 1].frame_index;
+	}
+
+	/* Count the levels, applying the depth limit */
+	for (ed = execute_data; ed; ed = ed->prev_execute_data) {
+		n++;
+		if (log->max_depth && n > log->max_depth && ed->prev_execute_data) {
+			base = excimer_log_get_truncation_marker(log);
+			break;
+		}
+	}
+
+	if (n > log->stack_capacity) {
+		log->stack = excimer_log_grow(log->stack, &log->stack_capacity,
+			n, sizeof(excimer_log_stack_frame), 0);
+	}
+
+	/* Store the new stack, finding the first level which changed */
+	common = base == log->stack_base ? MIN(n, log->stack_size) : 0;
+	for (ed = execute_data, i = n; i > 0; ed = ed->prev_execute_data) {
+		sf = &log->stack[--i];
+		if (i < common
+			&& (sf->execute_data != ed || sf->func != ed->func
+				|| (sf->opline != ed->opline && log->granularity != EXCIMER_GRANULARITY_FUNCTION)))
+		{
+			common = i;
+		}
+		sf->execute_data = ed;
+		sf->func = ed->func;
+		sf->opline = ed->opline;
+	}
+
+	/* Resolve the changed levels */
+	prev_index = common ? log->stack[common - 1].frame_index : base;
+	for (i = common; i < n; i++) {
+		sf = &log->stack[i];
+		prev_index = excimer_log_find_or_add_frame(log, sf->execute_data, prev_index);
+		sf->frame_index = prev_index;
+	}
+
+	log->stack_size = n;
+	log->stack_base = base;
+	log->stats.frames_walked += n;
+	log->stats.frames_cached += common;
+	return prev_index;
+}
+
+/**
+ * Find or add a single frame, given the index of its caller. If the frame is
+ * not user code, and internal frames are not enabled or the frame is not a
+ * function call, the caller's index is returned.
+ */
+static uint32_t excimer_log_find_or_add_frame(excimer_log *log,
+	zend_execute_data *execute_data, uint32_t prev_index)
+{
+	int is_user;
+
+	if (!execute_data->func) {
+		return prev_index;
+	}
+	is_user = ZEND_USER_CODE(execute_data->func->common.type);
+	if (!is_user && (!log->internal_frames || !execute_data->func->common.function_name)) {
+		return prev_index;
+	} else {
+		zend_function *func = execute_data->func;
+		zend_string *filename = is_user ? func->op_array.filename : NULL;
+		zend_string *scope_name = func->common.scope ? func->common.scope->name : NULL;
+		uint32_t lineno = 0, opline = 0, hash;
+		excimer_log_frame_slot *slot;
+		excimer_log_frame frame = {NULL};
+		uint32_t frame_index;
+
+		if (!is_user) {
+			hash = excimer_log_frame_hash(func->common.function_name, scope_name, 0, 0, prev_index);
+		} else {
+			if (log->granularity == EXCIMER_GRANULARITY_FUNCTION) {
+				lineno = func->op_array.line_start;
+			} else {
+				lineno = execute_data->opline->lineno;
+				if (log->granularity == EXCIMER_GRANULARITY_OPLINE) {
+					opline = (uint32_t)(execute_data->opline - func->op_array.opcodes);
+				}
+			}
+			hash = excimer_log_frame_hash(filename, NULL, lineno, opline, prev_index);
+		}
+
+		/* Look for a matching frame in the reverse hashtable */
+		log->stats.frame_lookups++;
+		slot = excimer_log_find_frame_slot(log, hash, filename, func->common.function_name,
+			scope_name, lineno, opline, prev_index);
+		if (slot->frame_index) {
+			log->stats.frame_lookup_hits++;
+			return slot->frame_index;
+		}
+		if (log->frames_frozen
+			|| (log->store->max_frames && log->store->frames_size >= log->store->max_frames))
+		{
+			return excimer_log_get_truncation_marker(log);
+		}
+
+		/* Create a new entry in the array and reverse hashtable */
+		frame.filename = filename;
+		frame.class_name = scope_name;
+		if (func->common.function_name) {
+			frame.function_name = func->common.function_name;
+		}
+		if (log->store->persistent) {
+			/* Only internal functions and classes are registered for the
+			 * life of the process. User code names may be in opcache. */
+			frame.filename = excimer_log_store_zstr(log->store, frame.filename, 0);
+			frame.class_name = excimer_log_store_zstr(log->store, frame.class_name,
+				func->common.scope && func->common.scope->type == ZEND_INTERNAL_CLASS);
+			frame.function_name = excimer_log_store_zstr(log->store, frame.function_name,
+				func->type == ZEND_INTERNAL_FUNCTION);
+		} else {
+			if (frame.filename) {
+				zend_string_addref(frame.filename);
+			}
+			if (frame.class_name) {
+				zend_string_addref(frame.class_name);
+			}
+			if (frame.function_name) {
+				zend_string_addref(frame.function_name);
+			}
+		}
+
+		if (is_user && (func->op_array.fn_flags & ZEND_ACC_CLOSURE)) {
+			frame.closure_line = func->op_array.line_start;
+		}
+
+		frame.lineno = lineno;
+		frame.opline = opline;
+		frame.prev_index = prev_index;
+
+		frame_index = excimer_safe_uint32(log->store->frames_size);
+		memcpy(excimer_log_append_frame(log), &frame, sizeof(excimer_log_frame));
+		log->stats.frames_added++;
+		excimer_log_fill_frame_slot(log, slot, hash, frame_index);
+		return frame_index;
+	}
+}
+
+/**
+ * Find or add a frame in the destination log equivalent to a frame from
+ * another store, given the destination index of its caller
+ */
+static uint32_t excimer_log_import_frame(excimer_log *dest, excimer_log_frame *src_frame,
+	uint32_t prev_index)
+{
+	excimer_log_frame_store *store = dest->store;
+	excimer_log_frame frame = *src_frame;
+	excimer_log_frame_slot *slot;
+	uint32_t hash, frame_index;
+
+	hash = frame.filename
+		? excimer_log_frame_hash(frame.filename, NULL, frame.lineno, frame.opline, prev_index)
+		: excimer_log_frame_hash(frame.function_name, frame.class_name, 0, 0, prev_index);
+	slot = excimer_log_find_frame_slot(dest, hash, frame.filename, frame.function_name,
+		frame.class_name, frame.lineno, frame.opline, prev_index);
+	if (slot->frame_index) {
+		return slot->frame_index;
+	}
+	if (dest->frames_frozen || (store->max_frames && store->frames_size >= store->max_frames)) {
+		return excimer_log_get_truncation_marker(dest);
+	}
+
+	if (store->persistent) {
+		/* The origin of the strings is unknown, so copy them */
+		frame.filename = excimer_log_store_zstr(store, frame.filename, 0);
+		frame.class_name = excimer_log_store_zstr(store, frame.class_name, 0);
+		frame.function_name = excimer_log_store_zstr(store, frame.function_name, 0);
+	} else {
+		if (frame.filename) {
+			zend_string_addref(frame.filename);
+		}
+		if (frame.class_name) {
+			zend_string_addref(frame.class_name);
+		}
+		if (frame.function_name) {
+			zend_string_addref(frame.function_name);
+		}
+	}
+	frame.prev_index = prev_index;
+
+	frame_index = excimer_safe_uint32(store->frames_size);
+	memcpy(excimer_log_append_frame(dest), &frame, sizeof(excimer_log_frame));
+	dest->stats.frames_added++;
+	excimer_log_fill_frame_slot(dest, slot, hash, frame_index);
+	return frame_index;
+}
+
+/* {{{ Local frames */
+
+/**
+ * The frames used by the entries of a log, directly or as callers, numbered
+ * densely from 1 in store order. A persistent store may hold many more
+ * frames than any one log uses, so exporters size their per-frame arrays by
+ * local index rather than by store index. A caller still has a lower index
+ * than its callees.
+ */
+typedef struct _excimer_log_local_frames {
+	/** The number of local frames, including frame zero which is not a real frame */
+	uint32_t size;
+
+	/** The store index of each local frame */
+	uint32_t *store_indexes;
+
+	/** The local index of the caller of each local frame */
+	uint32_t *prev_indexes;
+
+	/**
+	 * The local index of each store index, or zero if the frame is unused.
+	 * This is NULL if the store is persistent.
+	 */
+	uint32_t *dense_indexes;
+
+	/** The local index of each used store index, if the store is persistent */
+	HashTable sparse_indexes;
+} excimer_log_local_frames;
+
+static int excimer_log_compare_uint32(const void *a, const void *b)
+{
+	uint32_t value_a = *(const uint32_t*)a;
+	uint32_t value_b = *(const uint32_t*)b;
+	return value_a < value_b ? -1 : (value_a > value_b);
+}
+
+/**
+ * Get the local index of a store index, or zero if the frame is unused
+ */
+static inline uint32_t excimer_log_local_index(excimer_log_local_frames *local,
+	uint32_t frame_index)
+{
+	zval *zp_index;
+
+	if (local->dense_indexes) {
+		return local->dense_indexes[frame_index];
+	}
+	zp_index = zend_hash_index_find(&local->sparse_indexes, frame_index);
+	return zp_index ? (uint32_t)Z_LVAL_P(zp_index) : 0;
+}
+
+static void excimer_log_local_frames_init(excimer_log_local_frames *local, excimer_log *log)
+{
+	excimer_log_frame_store *store = log->store;
+	uint32_t size = 1;
+	size_t i;
+	zval z_index;
+
+	/* Mark the leaf frames and their callers, stopping at one already marked */
+	if (store->persistent) {
+		local->dense_indexes = NULL;
+		zend_hash_init(&local->sparse_indexes, 0, NULL, NULL, 0);
+		ZVAL_LONG(&z_index, 0);
+		for (i = 0; i < log->entries_size; i++) {
+			uint32_t frame_index = excimer_log_get_entry(log, i)->frame_index;
+			while (frame_index && zend_hash_index_add(&local->sparse_indexes, frame_index, &z_index)) {
+				frame_index = store->frames[frame_index].prev_index;
+			}
+		}
+	} else {
+		local->dense_indexes = ecalloc(store->frames_size, sizeof(uint32_t));
+		for (i = 0; i < log->entries_size; i++) {
+			uint32_t frame_index = excimer_log_get_entry(log, i)->frame_index;
+			while (frame_index && !local->dense_indexes[frame_index]) {
+				local->dense_indexes[frame_index] = 1;
+				frame_index = store->frames[frame_index].prev_index;
+			}
+		}
+	}
+
+	/* Number the marked frames in store order */
+	if (store->persistent) {
+		zend_ulong frame_index;
+
+		local->store_indexes = safe_emalloc(zend_hash_num_elements(&local->sparse_indexes) + 1,
+			sizeof(uint32_t), 0);
+		ZEND_HASH_FOREACH_NUM_KEY(&local->sparse_indexes, frame_index) {
+			local->store_indexes[size++] = (uint32_t)frame_index;
+		} ZEND_HASH_FOREACH_END();
+		qsort(local->store_indexes + 1, size - 1, sizeof(uint32_t), excimer_log_compare_uint32);
+		for (i = 1; i < size; i++) {
+			ZVAL_LONG(&z_index, i);
+			zend_hash_index_update(&local->sparse_indexes, local->store_indexes[i], &z_index);
+		}
+	} else {
+		local->store_indexes = safe_emalloc(store->frames_size, sizeof(uint32_t), 0);
+		for (i = 1; i < store->frames_size; i++) {
+			if (local->dense_indexes[i]) {
+				local->dense_indexes[i] = size;
+				local->store_indexes[size++] = (uint32_t)i;
+			}
+		}
+	}
+	local->store_indexes[0] = 0;
+	local->size = size;
+
+	local->prev_indexes = safe_emalloc(size, sizeof(uint32_t), 0);
+	local->prev_indexes[0] = 0;
+	for (i = 1; i < size; i++) {
+		local->prev_indexes[i] = excimer_log_local_index(local,
+			store->frames[local->store_indexes[i]].prev_index);
+	}
+}
+
+static void excimer_log_local_frames_destroy(excimer_log_local_frames *local)
+{
+	if (local->dense_indexes) {
+		efree(local->dense_indexes);
+	} else {
+		zend_hash_destroy(&local->sparse_indexes);
+	}
+	efree(local->store_indexes);
+	efree(local->prev_indexes);
+}
+
+/* }}} */
+
+void excimer_log_merge(excimer_log *dest, excimer_log *src)
+{
+	excimer_log_frame_store *src_store = src->store;
+	zend_long n = src->entries_size, i;
+	excimer_log_local_frames local;
+	uint32_t *map = NULL;
+
+	/* Logs sharing a store already agree on frame indexes. Otherwise, map
+	 * each source frame used by the entries to the destination. A frame
+	 * always comes after its caller, so a single pass in order suffices. */
+	if (src_store != dest->store) {
+		uint32_t j;
+		excimer_log_local_frames_init(&local, src);
+		map = safe_emalloc(local.size, sizeof(uint32_t), 0);
+		map[0] = 0;
+		for (j = 1; j < local.size; j++) {
+			uint32_t frame_index = local.store_indexes[j];
+			if (frame_index == src_store->truncation_index) {
+				map[j] = excimer_log_get_truncation_marker(dest);
+			} else {
+				map[j] = excimer_log_import_frame(dest, &src_store->frames[frame_index],
+					map[local.prev_indexes[j]]);
+			}
+		}
+	}
+
+	if (!excimer_log_is_compact(dest) && !dest->aggregate
+		&& dest->entries_size + n > dest->entries_capacity)
+	{
+		dest->entries = excimer_log_grow(dest->entries, &dest->entries_capacity,
+			dest->entries_size + n, sizeof(excimer_log_entry), 0);
+	}
+	if (src->has_cpu_time) {
+		dest->has_cpu_time = 1;
+	}
+	dest->stats.samples += src->stats.samples;
+	for (i = 0; i < n; i++) {
+		/* Copy the entry, since appending to a compact log may overwrite
+		 * the decoded block, and src may be dest */
+		excimer_log_entry entry = *excimer_log_get_entry(src, i);
+		excimer_log_append_entry(dest,
+			map ? map[excimer_log_local_index(&local, entry.frame_index)] : entry.frame_index,
+			entry.event_count, entry.timestamp, entry.cpu_time);
+	}
+	if (map) {
+		efree(map);
+		excimer_log_local_frames_destroy(&local);
+	}
+}
+
+uint32_t excimer_log_get_thread_frame(excimer_log *log, zend_long thread_id)
+{
+	excimer_log_frame frame = {NULL};
+	uint32_t frame_index;
+
+	frame.function_name = strpprintf(0, "{thread:" ZEND_LONG_FMT "}", thread_id);
+	frame_index = excimer_log_import_frame(log, &frame, 0);
+	zend_string_release(frame.function_name);
+	return frame_index;
+}
+
+zend_long excimer_log_get_size(excimer_log *log)
+{
+	return log->entries_size;
+}
+
+excimer_log_entry *excimer_log_get_entry(excimer_log *log, zend_long i)
+{
+	if (i >= 0 && i < log->entries_size) {
+		if (excimer_log_is_compact(log)) {
+			return &excimer_log_decode_block(log, i / EXCIMER_LOG_BLOCK_ENTRIES)
+				[i % EXCIMER_LOG_BLOCK_ENTRIES];
+		}
+		return &log->entries[i];
+	} else {
+		return NULL;
+	}
+}
+
+excimer_log_frame *excimer_log_get_frame(excimer_log *log, zend_long i)
+{
+	if (i > 0 && i < log->store->frames_size) {
+		return &log->store->frames[i];
+	} else {
+		return NULL;
+	}
+}
+
+static void excimer_log_append_no_spaces(smart_str *dest, zend_string *src)
+{
+	size_t new_len = smart_str_alloc(dest, ZSTR_LEN(src), 0);
+	size_t prev_len = ZSTR_LEN(dest->s);
+	size_t i;
+	for (i = 0; i < ZSTR_LEN(src); i++) {
+		char c = ZSTR_VAL(src)[i];
+		if (c == ' ' || c == '\0') {
+			c = '_';
+		}
+		ZSTR_VAL(dest->s)[prev_len + i] = c;
+	}
+	ZSTR_LEN(dest->s) = new_len;
+}
+
+static void excimer_log_append_frame_name(smart_str *ss, excimer_log_frame *frame) {
+	if (frame->closure_line != 0) {
+		/* Annotate anonymous functions with their source location.
+		 * Example: {closure:/path/to/file.php(123)}
+		 */
+		smart_str_appends(ss, "{closure:");
+		excimer_log_append_no_spaces(ss, frame->filename);
+		excimer_log_smart_str_append_printf(ss, "(%d)}", frame->closure_line);
+	} else if (frame->function_name == NULL) {
+		/* For file-scope code, use the file name */
+		excimer_log_append_no_spaces(ss, frame->filename);
+	} else {
+		if (frame->class_name) {
+			excimer_log_append_no_spaces(ss, frame->class_name);
+			smart_str_appends(ss, "::");
+		}
+		excimer_log_append_no_spaces(ss, frame->function_name);
+	}
+}
+
+/**
+ * Append the human-readable name of a frame, as used by ExcimerLog::aggregateByFunction()
+ */
+static void excimer_log_append_raw_frame_name(smart_str *ss, excimer_log_frame *frame) {
+	if (frame->closure_line != 0) {
+		/* Annotate anonymous functions with their source location.
+		 * Example: {closure:/path/to/file.php(123)}
+		 */
+		smart_str_appends(ss, "{closure:");
+		smart_str_append(ss, frame->filename);
+		excimer_log_smart_str_append_printf(ss, "(%d)}", frame->closure_line);
+	} else if (frame->function_name == NULL) {
+		/* For file-scope code, use the file name */
+		smart_str_append(ss, frame->filename);
+	} else {
+		if (frame->class_name) {
+			smart_str_append(ss, frame->class_name);
+			smart_str_appends(ss, "::");
+		}
+		smart_str_append(ss, frame->function_name);
+	}
+}
+
+/**
+ * Get a frame name from one of the name caches, formatting it if necessary
+ */
+static zend_string *excimer_log_get_cached_name(excimer_log *log,
+	excimer_log_name_cache *cache, uint32_t frame_index,
+	void (*append_name)(smart_str *, excimer_log_frame *))
+{
+	if (log->store->persistent) {
+		zval *zp_name, z_name;
+		smart_str ss = {NULL};
+
+		if (!cache->table) {
+			cache->table = excimer_log_new_array(0);
+		}
+		zp_name = zend_hash_index_find(cache->table, frame_index);
+		if (zp_name) {
+			return Z_STR_P(zp_name);
+		}
+		append_name(&ss, &log->store->frames[frame_index]);
+		ZVAL_STR(&z_name, excimer_log_smart_str_extract(&ss));
+		zend_hash_index_add_new(cache->table, frame_index, &z_name);
+		cache->string_bytes += ZSTR_LEN(Z_STR(z_name)) + sizeof(zend_string);
+		return Z_STR(z_name);
+	}
+	if (cache->size < log->store->frames_size) {
+		/* The log has grown since the cache was last used */
+		cache->names = safe_erealloc(cache->names, log->store->frames_size, sizeof(zend_string*), 0);
+		memset(&cache->names[cache->size], 0,
+			(log->store->frames_size - cache->size) * sizeof(zend_string*));
+		cache->size = log->store->frames_size;
+	}
+	if (!cache->names[frame_index]) {
+		smart_str ss = {NULL};
+		append_name(&ss, &log->store->frames[frame_index]);
+		cache->names[frame_index] = excimer_log_smart_str_extract(&ss);
+		cache->string_bytes += ZSTR_LEN(cache->names[frame_index]) + sizeof(zend_string);
+	}
+	return cache->names[frame_index];
+}
+
+zend_string *excimer_log_get_frame_name(excimer_log *log, uint32_t frame_index)
+{
+	return excimer_log_get_cached_name(log, &log->frame_names, frame_index,
+		excimer_log_append_frame_name);
+}
+
+/**
+ * Get the human-readable name of a frame. The string is owned by the log.
+ */
+static zend_string *excimer_log_get_raw_frame_name(excimer_log *log, uint32_t frame_index)
+{
+	return excimer_log_get_cached_name(log, &log->raw_frame_names, frame_index,
+		excimer_log_append_raw_frame_name);
+}
+
+static void excimer_log_name_cache_destroy(excimer_log_name_cache *cache)
+{
+	size_t i;
+	for (i = 0; i < cache->size; i++) {
+		if (cache->names[i]) {
+			zend_string_release(cache->names[i]);
+		}
+	}
+	if (cache->names) {
+		efree(cache->names);
+	}
+	if (cache->table) {
+		zend_array_destroy(cache->table);
+	}
+}
+
+/* {{{ Entry columns */
+
+/**
+ * The entries of a log split into dense columns, so that exporters can make
+ * simple passes over the fields they need. A compact log is decoded once,
+ * rather than once per pass.
+ */
+typedef struct _excimer_log_columns {
+	/** The number of entries */
+	size_t size;
+
+	/** The local frame index of each entry */
+	uint32_t *frame_indexes;
+
+	/** The event count of each entry */
+	zend_long *event_counts;
+
+	/** The timestamp of the first entry, or zero if there are none */
+	uint64_t first_timestamp;
+
+	/** The timestamp of the last entry, or zero if there are none */
+	uint64_t last_timestamp;
+} excimer_log_columns;
+
+static void excimer_log_columns_init(excimer_log_columns *cols, excimer_log *log,
+	excimer_log_local_frames *local)
+{
+	size_t i, n = log->entries_size;
+	uint32_t *frame_indexes = safe_emalloc(n, sizeof(uint32_t), 0);
+	zend_long *event_counts = safe_emalloc(n, sizeof(zend_long), 0);
+
+	if (excimer_log_is_compact(log)) {
+		for (i = 0; i < n; i++) {
+			excimer_log_entry *entry = excimer_log_get_entry(log, i);
+			frame_indexes[i] = excimer_log_local_index(local, entry->frame_index);
+			event_counts[i] = entry->event_count;
+		}
+	} else if (local->dense_indexes) {
+		const uint32_t *restrict dense_indexes = local->dense_indexes;
+		excimer_log_entry *entries = log->entries;
+		for (i = 0; i < n; i++) {
+			frame_indexes[i] = dense_indexes[entries[i].frame_index];
+			event_counts[i] = entries[i].event_count;
+		}
+	} else {
+		excimer_log_entry *entries = log->entries;
+		for (i = 0; i < n; i++) {
+			frame_indexes[i] = excimer_log_local_index(local, entries[i].frame_index);
+			event_counts[i] = entries[i].event_count;
+		}
+	}
+
+	cols->size = n;
+	cols->frame_indexes = frame_indexes;
+	cols->event_counts = event_counts;
+	cols->first_timestamp = n ? excimer_log_get_entry(log, 0)->timestamp : 0;
+	cols->last_timestamp = n ? excimer_log_get_entry(log, n - 1)->timestamp : 0;
+}
+
+static void excimer_log_columns_destroy(excimer_log_columns *cols)
+{
+	efree(cols->frame_indexes);
+	efree(cols->event_counts);
+}
+
+/**
+ * Convert the event count column to weights in nanoseconds, in place
+ */
+static void excimer_log_columns_to_weights(excimer_log_columns *cols, zend_long period)
+{
+	zend_long *restrict counts = cols->event_counts;
+	size_t i, n = cols->size;
+
+	for (i = 0; i < n; i++) {
+		counts[i] *= period;
+	}
+}
+
+/**
+ * Sum the event count column by local frame index
+ *
+ * @param cols The columns of the log
+ * @param num_frames The number of local frames
+ * @return A new array of counts indexed by local frame index, owned by the caller
+ */
+static zend_long *excimer_log_columns_histogram(excimer_log_columns *cols, uint32_t num_frames)
+{
+	zend_long *restrict counts = ecalloc(num_frames, sizeof(zend_long));
+	const uint32_t *restrict frame_indexes = cols->frame_indexes;
+	const zend_long *restrict event_counts = cols->event_counts;
+	size_t i, n = cols->size;
+
+	for (i = 0; i < n; i++) {
+		counts[frame_indexes[i]] += event_counts[i];
+	}
+	return counts;
+}
+
+/**
+ * Collect the distinct leaf frames of the frame index column
+ *
+ * @param cols The columns of the log
+ * @param num_frames The number of local frames
+ * @param[out] leaves An array with space for num_frames elements, which will
+ *   be filled with the distinct leaf frames in the order of their first
+ *   appearance
+ * @return The number of leaf frames
+ */
+static uint32_t excimer_log_columns_leaves(excimer_log_columns *cols, uint32_t num_frames,
+	uint32_t *leaves)
+{
+	zend_bool *is_leaf = ecalloc(num_frames, sizeof(zend_bool));
+	uint32_t num_leaves = 0;
+	size_t i;
+
+	for (i = 0; i < cols->size; i++) {
+		uint32_t frame_index = cols->frame_indexes[i];
+		if (!is_leaf[frame_index]) {
+			is_leaf[frame_index] = 1;
+			leaves[num_leaves++] = frame_index;
+		}
+	}
+	efree(is_leaf);
+	return num_leaves;
+}
+
+/* }}} */
+
+zend_string *excimer_log_format_collapsed(excimer_log *log)
+{
+	size_t i;
+	uint32_t num_leaves;
+	zval *zp_count;
+	zval z_count;
+	zend_string *str_line;
+	smart_str ss_out = {NULL};
+	HashTable lines_storage;
+	HashTable *ht_lines = &lines_storage;
+	excimer_log_local_frames local;
+	excimer_log_columns cols;
+	zend_long *frame_counts;
+	uint32_t *leaves;
+	/* The line for each local frame */
+	zend_string **frame_lines;
+
+	memset(ht_lines, 0, sizeof(HashTable));
+	zend_hash_init(ht_lines, 0, NULL, NULL, 0);
+
+	/* Collate frame counts, remembering the order in which leaves appear */
+	excimer_log_local_frames_init(&local, log);
+	excimer_log_columns_init(&cols, log, &local);
+	frame_counts = excimer_log_columns_histogram(&cols, local.size);
+	leaves = safe_emalloc(local.size, sizeof(uint32_t), 0);
+	num_leaves = excimer_log_columns_leaves(&cols, local.size, leaves);
+	excimer_log_columns_destroy(&cols);
+
+	/* Build the line for each frame from the line of its caller, which is
+	 * always at a lower index. A sample with no user frames has an empty
+	 * line. */
+	frame_lines = safe_emalloc(local.size, sizeof(zend_string*), 0);
+	frame_lines[0] = ZSTR_EMPTY_ALLOC();
+	for (i = 1; i < local.size; i++) {
+		uint32_t prev_index = local.prev_indexes[i];
+		zend_string *str_name = excimer_log_get_frame_name(log, local.store_indexes[i]);
+		if (prev_index) {
+			zend_string *str_prefix = frame_lines[prev_index];
+			str_line = zend_string_alloc(ZSTR_LEN(str_prefix) + 1 + ZSTR_LEN(str_name), 0);
+			memcpy(ZSTR_VAL(str_line), ZSTR_VAL(str_prefix), ZSTR_LEN(str_prefix));
+			ZSTR_VAL(str_line)[ZSTR_LEN(str_prefix)] = ';';
+			memcpy(ZSTR_VAL(str_line) + ZSTR_LEN(str_prefix) + 1,
+				ZSTR_VAL(str_name), ZSTR_LEN(str_name) + 1);
+			frame_lines[i] = str_line;
+		} else {
+			frame_lines[i] = zend_string_copy(str_name);
+		}
+	}
+
+	/* Deduplicate frames that differ only in hidden line numbers */
+	for (i = 0; i < num_leaves; i++) {
+		uint32_t frame_index = leaves[i];
+		/* ht_lines[line] += count */
+		zp_count = zend_hash_find(ht_lines, frame_lines[frame_index]);
+		if (!zp_count) {
+			ZVAL_LONG(&z_count, 0);
+			zp_count = zend_hash_add(ht_lines, frame_lines[frame_index], &z_count);
+		}
+		Z_LVAL_P(zp_count) += frame_counts[frame_index];
+	}
+
+	/* Concatenate lines */
+	ZEND_HASH_FOREACH_STR_KEY_VAL(ht_lines, str_line, zp_count) {
+		smart_str_append(&ss_out, str_line);
+		excimer_log_smart_str_append_printf(&ss_out, " " ZEND_LONG_FMT "\n", Z_LVAL_P(zp_count));
+	}
+	ZEND_HASH_FOREACH_END();
+
+	zend_hash_destroy(ht_lines);
+	for (i = 0; i < local.size; i++) {
+		zend_string_release(frame_lines[i]);
+	}
+	efree(frame_lines);
+	efree(leaves);
+	efree(frame_counts);
+	excimer_log_local_frames_destroy(&local);
+	return excimer_log_smart_str_extract(&ss_out);
+}
+
+/* {{{ Log snapshots */
+
+/**
+ * A slot in an excimer_log_id_map
+ */
+typedef struct _excimer_log_id_slot {
+	/** The key */
+	uint64_t key;
+
+	/** The ID, or zero if the slot is empty */
+	uint32_t id;
+} excimer_log_id_slot;
+
+/**
+ * An open-addressing hashtable which assigns sequential IDs, starting from 1,
+ * to 64-bit keys. Snapshots may be formatted outside of a request, so this
+ * is used instead of a Zend hashtable. The table does not grow, the expected
+ * number of keys must be given in advance.
+ */
+typedef struct _excimer_log_id_map {
+	/** The array of slots */
+	excimer_log_id_slot *slots;
+
+	/** The number of slots. This is always a power of two. */
+	uint32_t size;
+
+	/** The number of IDs assigned */
+	uint32_t used;
+} excimer_log_id_map;
+
+static void excimer_log_id_map_init(excimer_log_id_map *map, size_t max_keys)
+{
+	size_t size = EXCIMER_LOG_MIN_FRAME_SLOTS;
+	while (size < max_keys * 2) {
+		size *= 2;
+	}
+	map->slots = pecalloc(size, sizeof(excimer_log_id_slot), 1);
+	map->size = size;
+	map->used = 0;
+}
+
+static void excimer_log_id_map_destroy(excimer_log_id_map *map)
+{
+	pefree(map->slots, 1);
+	map->slots = NULL;
+}
+
+static inline uint64_t excimer_log_id_key(uint32_t a, uint32_t b)
+{
+	return ((uint64_t)a << 32) | b;
+}
+
+/**
+ * Get the ID of a key, assigning a new ID if the key was not yet seen.
+ *
+ * @param map The map
+ * @param key The key
+ * @param is_new This will be set to 1 if a new ID was assigned, 0 otherwise
+ * @return The ID
+ */
+static uint32_t excimer_log_id_map_get(excimer_log_id_map *map, uint64_t key, int *is_new)
+{
+	uint32_t mask = map->size - 1;
+	uint32_t i = (uint32_t)((key * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & mask;
+
+	while (map->slots[i].id) {
+		if (map->slots[i].key == key) {
+			*is_new = 0;
+			return map->slots[i].id;
+		}
+		i = (i + 1) & mask;
+	}
+	map->slots[i].key = key;
+	map->slots[i].id = ++map->used;
+	*is_new = 1;
+	return map->slots[i].id;
+}
+
+static uint32_t excimer_log_snapshot_add_string(excimer_log_snapshot *snapshot,
+	HashTable *string_ids, zend_string *str)
+{
+	zval *zp_id = zend_hash_find(string_ids, str);
+	zval z_id;
+
+	if (zp_id) {
+		return Z_LVAL_P(zp_id);
+	}
+	ZVAL_LONG(&z_id, snapshot->num_strings);
+	zend_hash_add_new(string_ids, str, &z_id);
+	smart_str_appendl_ex(&snapshot->string_data, ZSTR_VAL(str), ZSTR_LEN(str), 1);
+	snapshot->num_strings++;
+	snapshot->string_offsets[snapshot->num_strings] =
+		excimer_log_smart_str_get_len(&snapshot->string_data);
+	return Z_LVAL(z_id);
+}
+
+static inline const char *excimer_log_snapshot_get_string(excimer_log_snapshot *snapshot,
+	uint32_t index, size_t *length)
+{
+	size_t offset = snapshot->string_offsets[index];
+	*length = snapshot->string_offsets[index + 1] - offset;
+	return snapshot->string_data.s ? ZSTR_VAL(snapshot->string_data.s) + offset : "";
+}
+
+excimer_log_snapshot *excimer_log_snapshot_create(excimer_log *log)
+{
+	excimer_log_snapshot *snapshot = pecalloc(1, sizeof(excimer_log_snapshot), 1);
+	excimer_log_local_frames local;
+	/* The index of each local frame in the samples array, plus one */
+	uint32_t *frame_samples;
+	size_t num_used;
+	HashTable string_ids;
+	size_t i;
+
+	/* The frames of the snapshot are the local frames */
+	excimer_log_local_frames_init(&local, log);
+	num_used = local.size;
+	frame_samples = ecalloc(num_used, sizeof(uint32_t));
+	zend_hash_init(&string_ids, 0, NULL, NULL, 0);
+
+	/* Each frame adds at most two strings, plus the empty string */
+	snapshot->string_offsets = safe_pemalloc(num_used, 2 * sizeof(uint32_t),
+		2 * sizeof(uint32_t), 1);
+	snapshot->string_offsets[0] = 0;
+	excimer_log_snapshot_add_string(snapshot, &string_ids, ZSTR_EMPTY_ALLOC());
+
+	/* Copy the used frames */
+	snapshot->frames = safe_pemalloc(num_used, sizeof(excimer_log_snapshot_frame), 0, 1);
+	memset(&snapshot->frames[0], 0, sizeof(excimer_log_snapshot_frame));
+	snapshot->frames_size = num_used;
+	for (i = 1; i < num_used; i++) {
+		excimer_log_frame *frame = &log->store->frames[local.store_indexes[i]];
+		excimer_log_snapshot_frame *s_frame = &snapshot->frames[i];
+
+		s_frame->name = excimer_log_snapshot_add_string(snapshot, &string_ids,
+			excimer_log_get_frame_name(log, local.store_indexes[i]));
+		s_frame->filename = excimer_log_snapshot_add_string(snapshot, &string_ids,
+			frame->filename ? frame->filename : ZSTR_EMPTY_ALLOC());
+		s_frame->lineno = frame->lineno;
+		s_frame->closure_line = frame->closure_line;
+		s_frame->prev_index = local.prev_indexes[i];
+	}
+
+	/* Aggregate the entries by leaf frame, in the order of first appearance */
+	snapshot->samples = safe_pemalloc(num_used, sizeof(excimer_log_snapshot_sample), 0, 1);
+	for (i = 0; i < log->entries_size; i++) {
+		excimer_log_entry *entry = excimer_log_get_entry(log, i);
+		uint32_t frame_index = excimer_log_local_index(&local, entry->frame_index);
+		uint32_t sample_index = frame_samples[frame_index];
+		if (!sample_index) {
+			sample_index = ++snapshot->samples_size;
+			frame_samples[frame_index] = sample_index;
+			snapshot->samples[sample_index - 1].frame_index = frame_index;
+			snapshot->samples[sample_index - 1].count = 0;
+			snapshot->samples[sample_index - 1].cpu_time = 0;
+		}
+		snapshot->samples[sample_index - 1].count += entry->event_count;
+		snapshot->samples[sample_index - 1].cpu_time += entry->cpu_time;
+	}
+
+	snapshot->period = log->period;
+	snapshot->has_cpu_time = log->has_cpu_time;
+	if (log->entries_size) {
+		/* Entries are decoded into a shared buffer, so copy each value out */
+		uint64_t first_timestamp = excimer_log_get_entry(log, 0)->timestamp;
+		snapshot->duration = excimer_log_get_entry(log, log->entries_size - 1)->timestamp
+			- first_timestamp;
+	}
+
+	zend_hash_destroy(&string_ids);
+	efree(frame_samples);
+	excimer_log_local_frames_destroy(&local);
+	return snapshot;
+}
+
+void excimer_log_snapshot_destroy(excimer_log_snapshot *snapshot)
+{
+	smart_str_free_ex(&snapshot->string_data, 1);
+	pefree(snapshot->string_offsets, 1);
+	pefree(snapshot->frames, 1);
+	pefree(snapshot->samples, 1);
+	pefree(snapshot, 1);
+}
+
+void excimer_log_snapshot_format_collapsed(excimer_log_snapshot *snapshot,
+	smart_str *dest, int persistent)
+{
+	size_t n = snapshot->frames_size;
+	size_t i;
+	uint32_t num_lines = 0;
+	excimer_log_id_map node_ids;
+	/* The node of each frame. A node is a unique sequence of names, so
+	 * frames which differ only in their line numbers share a node. Node 0
+	 * is the empty stack. */
+	uint32_t *frame_nodes = safe_pemalloc(n, sizeof(uint32_t), 0, 1);
+	uint32_t *node_names = safe_pemalloc(n, sizeof(uint32_t), 0, 1);
+	uint32_t *node_parents = safe_pemalloc(n, sizeof(uint32_t), 0, 1);
+	/* The line index of each node plus one, or zero if it has no line */
+	uint32_t *node_lines = pecalloc(n, sizeof(uint32_t), 1);
+	uint32_t *line_nodes = safe_pemalloc(n, sizeof(uint32_t), 0, 1);
+	zend_long *line_counts = pecalloc(n, sizeof(zend_long), 1);
+	uint32_t *chain = safe_pemalloc(n, sizeof(uint32_t), 0, 1);
+
+	excimer_log_id_map_init(&node_ids, n);
+
+	frame_nodes[0] = 0;
+	for (i = 1; i < n; i++) {
+		excimer_log_snapshot_frame *frame = &snapshot->frames[i];
+		uint32_t parent = frame_nodes[frame->prev_index];
+		int is_new;
+		uint32_t node = excimer_log_id_map_get(&node_ids,
+			excimer_log_id_key(frame->name, parent), &is_new);
+		if (is_new) {
+			node_names[node] = frame->name;
+			node_parents[node] = parent;
+		}
+		frame_nodes[i] = node;
+	}
+
+	for (i = 0; i < snapshot->samples_size; i++) {
+		uint32_t node = frame_nodes[snapshot->samples[i].frame_index];
+		if (!node_lines[node]) {
+			line_nodes[num_lines] = node;
+			node_lines[node] = ++num_lines;
+		}
+		line_counts[node_lines[node] - 1] += snapshot->samples[i].count;
+	}
+
+	for (i = 0; i < num_lines; i++) {
+		uint32_t node = line_nodes[i];
+		uint32_t depth = 0;
+
+		while (node) {
+			chain[depth++] = node;
+			node = node_parents[node];
+		}
+		while (depth--) {
+			size_t length;
+			const char *name = excimer_log_snapshot_get_string(snapshot,
+				node_names[chain[depth]], &length);
+			smart_str_appendl_ex(dest, name, length, persistent);
+			if (depth) {
+				smart_str_appendc_ex(dest, ';', persistent);
+			}
+		}
+		smart_str_appendc_ex(dest, ' ', persistent);
+		smart_str_append_long_ex(dest, line_counts[i], persistent);
+		smart_str_appendc_ex(dest, '\n', persistent);
+	}
+
+	excimer_log_id_map_destroy(&node_ids);
+	pefree(chain, 1);
+	pefree(line_counts, 1);
+	pefree(line_nodes, 1);
+	pefree(node_lines, 1);
+	pefree(node_parents, 1);
+	pefree(node_names, 1);
+	pefree(frame_nodes, 1);
+}
+
+/* }}} */
+
+/* {{{ pprof encoding */
+
+/* Field numbers in the pprof Profile message (profile.proto) */
+#define EXCIMER_PPROF_SAMPLE_TYPE 1
+#define EXCIMER_PPROF_SAMPLE 2
+#define EXCIMER_PPROF_LOCATION 4
+#define EXCIMER_PPROF_FUNCTION 5
+#define EXCIMER_PPROF_STRING_TABLE 6
+#define EXCIMER_PPROF_DURATION_NANOS 10
+#define EXCIMER_PPROF_PERIOD_TYPE 11
+#define EXCIMER_PPROF_PERIOD 12
+
+/* Protobuf wire types */
+#define EXCIMER_PPROF_VARINT 0
+#define EXCIMER_PPROF_LEN 2
+
+/**
+ * Strings used by the encoder, which are added to the string table after
+ * the strings of the snapshot
+ */
+enum {
+	EXCIMER_PPROF_STR_SAMPLES,
+	EXCIMER_PPROF_STR_COUNT,
+	EXCIMER_PPROF_STR_TIME,
+	EXCIMER_PPROF_STR_NANOSECONDS,
+	EXCIMER_PPROF_STR_CPU,
+	EXCIMER_PPROF_NUM_STRINGS
+};
+
+static const char *excimer_pprof_strings[] = {
+	"samples",
+	"count",
+	"time",
+	"nanoseconds",
+	"cpu"
+};
+
+typedef struct _excimer_pprof_encoder {
+	/** The output buffer */
+	smart_str *out;
+
+	/** A scratch buffer for the message currently being built */
+	smart_str msg;
+
+	/** A scratch buffer for packed repeated fields */
+	smart_str packed;
+
+	/** Whether the buffers use persistent memory */
+	int persistent;
+
+	/** The index in the string table of the first encoder string */
+	uint32_t strings_base;
+} excimer_pprof_encoder;
+
+static void excimer_pprof_append_varint(excimer_pprof_encoder *enc, smart_str *dest,
+	uint64_t value)
+{
+	do {
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+		if (value) {
+			byte |= 0x80;
 		}
-	}
+		smart_str_appendc_ex(dest, byte, enc->persistent);
+	} while (value);
 }
 
-zend_long excimer_log_get_size(excimer_log *log)
+static void excimer_pprof_append_tag(excimer_pprof_encoder *enc, smart_str *dest,
+	uint32_t field, uint32_t wire_type)
 {
-	return log->entries_size;
+	excimer_pprof_append_varint(enc, dest, (field << 3) | wire_type);
 }
 
-excimer_log_entry *excimer_log_get_entry(excimer_log *log, zend_long i)
+static void excimer_pprof_append_uint(excimer_pprof_encoder *enc, smart_str *dest,
+	uint32_t field, uint64_t value)
 {
-	if (i >= 0 && i < log->entries_size) {
-		return &log->entries[i];
-	} else {
-		return NULL;
-	}
+	excimer_pprof_append_tag(enc, dest, field, EXCIMER_PPROF_VARINT);
+	excimer_pprof_append_varint(enc, dest, value);
 }
 
-excimer_log_frame *excimer_log_get_frame(excimer_log *log, zend_long i)
+static void excimer_pprof_append_bytes(excimer_pprof_encoder *enc, smart_str *dest,
+	uint32_t field, const char *data, size_t length)
 {
-	if (i > 0 && i < log->frames_size) {
-		return &log->frames[i];
-	} else {
-		return NULL;
-	}
+	excimer_pprof_append_tag(enc, dest, field, EXCIMER_PPROF_LEN);
+	excimer_pprof_append_varint(enc, dest, length);
+	smart_str_appendl_ex(dest, data, length, enc->persistent);
 }
 
-static void excimer_log_append_no_spaces(smart_str *dest, zend_string *src)
+/**
+ * Append a length-delimited field with the contents of a scratch buffer,
+ * then clear the scratch buffer.
+ */
+static void excimer_pprof_append_buffer(excimer_pprof_encoder *enc, smart_str *dest,
+	uint32_t field, smart_str *src)
 {
-	size_t new_len = smart_str_alloc(dest, ZSTR_LEN(src), 0);
-	size_t prev_len = ZSTR_LEN(dest->s);
-	size_t i;
-	for (i = 0; i < ZSTR_LEN(src); i++) {
-		char c = ZSTR_VAL(src)[i];
-		if (c == ' ' || c == '\0') {
-			c = '_';
-		}
-		ZSTR_VAL(dest->s)[prev_len + i] = c;
+	size_t length = excimer_log_smart_str_get_len(src);
+	excimer_pprof_append_bytes(enc, dest, field, length ? ZSTR_VAL(src->s) : "", length);
+	if (src->s) {
+		ZSTR_LEN(src->s) = 0;
 	}
-	ZSTR_LEN(dest->s) = new_len;
 }
 
-static void excimer_log_append_frame_name(smart_str *ss, excimer_log_frame *frame) {
-	if (frame->closure_line != 0) {
-		/* Annotate anonymous functions with their source location.
-		 * Example: {closure:/path/to/file.php(123)}
-		 */
-		smart_str_appends(ss, "{closure:");
-		excimer_log_append_no_spaces(ss, frame->filename);
-		excimer_log_smart_str_append_printf(ss, "(%d)}", frame->closure_line);
-	} else if (frame->function_name == NULL) {
-		/* For file-scope code, use the file name */
-		excimer_log_append_no_spaces(ss, frame->filename);
-	} else {
-		if (frame->class_name) {
-			excimer_log_append_no_spaces(ss, frame->class_name);
-			smart_str_appends(ss, "::");
-		}
-		excimer_log_append_no_spaces(ss, frame->function_name);
-	}
+/**
+ * Append a ValueType message
+ */
+static void excimer_pprof_append_value_type(excimer_pprof_encoder *enc, uint32_t field,
+	int type, int unit)
+{
+	excimer_pprof_append_uint(enc, &enc->msg, 1, enc->strings_base + type);
+	excimer_pprof_append_uint(enc, &enc->msg, 2, enc->strings_base + unit);
+	excimer_pprof_append_buffer(enc, enc->out, field, &enc->msg);
 }
 
-zend_string *excimer_log_format_collapsed(excimer_log *log)
+void excimer_log_snapshot_format_pprof(excimer_log_snapshot *snapshot,
+	smart_str *dest, int persistent)
 {
-	zend_long entry_index;
-	zend_long frame_index;
-	zval *zp_count;
-	zval z_count;
-	smart_str ss_out = {NULL};
-	HashTable frame_counts_storage, lines_storage;
-	HashTable *ht_frame_counts, *ht_lines;
-
-	ht_frame_counts = &frame_counts_storage;
-	memset(ht_frame_counts, 0, sizeof(HashTable));
-	zend_hash_init(ht_frame_counts, 0, NULL, NULL, 0);
-
-	ht_lines = &lines_storage;
-	memset(ht_lines, 0, sizeof(HashTable));
-	zend_hash_init(ht_lines, 0, NULL, NULL, 0);
-
-	excimer_log_frame ** frame_ptrs = NULL;
-	size_t frames_capacity = 0;
-	zend_string *str_line;
-
-	/* Collate frame counts */
-	for (entry_index = 0; entry_index < log->entries_size; entry_index++) {
-		excimer_log_entry *entry = excimer_log_get_entry(log, entry_index);
-		zp_count = zend_hash_index_find(ht_frame_counts, entry->frame_index);
-		if (!zp_count) {
-			ZVAL_LONG(&z_count, 0);
-			zp_count = zend_hash_index_add(ht_frame_counts, entry->frame_index, &z_count);
-		}
+	excimer_pprof_encoder enc;
+	excimer_log_id_map function_ids, location_ids;
+	uint32_t *frame_locations = pecalloc(snapshot->frames_size, sizeof(uint32_t), 1);
+	size_t i;
 
-		Z_LVAL_P(zp_count) += entry->event_count;
+	memset(&enc, 0, sizeof(enc));
+	enc.out = dest;
+	enc.persistent = persistent;
+	enc.strings_base = snapshot->num_strings;
+	excimer_log_id_map_init(&function_ids, snapshot->frames_size);
+	excimer_log_id_map_init(&location_ids, snapshot->frames_size);
+
+	/* The string table. The first string is the empty string. */
+	for (i = 0; i < snapshot->num_strings; i++) {
+		size_t length;
+		const char *str = excimer_log_snapshot_get_string(snapshot, i, &length);
+		excimer_pprof_append_bytes(&enc, dest, EXCIMER_PPROF_STRING_TABLE, str, length);
+	}
+	for (i = 0; i < EXCIMER_PPROF_NUM_STRINGS; i++) {
+		excimer_pprof_append_bytes(&enc, dest, EXCIMER_PPROF_STRING_TABLE,
+			excimer_pprof_strings[i], strlen(excimer_pprof_strings[i]));
 	}
 
-	/* Format traces, and deduplicate frames that differ only in hidden line numbers */
-	ZEND_HASH_FOREACH_NUM_KEY_VAL(ht_frame_counts, frame_index, zp_count) {
-		zend_long current_frame_index = frame_index;
-		zend_long num_frames = 0;
-		excimer_log_frame *frame;
-		zend_long i;
-		int line_start = 1; /* TODO use bool when PHP 7.4 support is dropped */
-		smart_str ss_line = {NULL};
+	excimer_pprof_append_value_type(&enc, EXCIMER_PPROF_SAMPLE_TYPE,
+		EXCIMER_PPROF_STR_SAMPLES, EXCIMER_PPROF_STR_COUNT);
+	excimer_pprof_append_value_type(&enc, EXCIMER_PPROF_SAMPLE_TYPE,
+		EXCIMER_PPROF_STR_TIME, EXCIMER_PPROF_STR_NANOSECONDS);
+	if (snapshot->has_cpu_time) {
+		excimer_pprof_append_value_type(&enc, EXCIMER_PPROF_SAMPLE_TYPE,
+			EXCIMER_PPROF_STR_CPU, EXCIMER_PPROF_STR_NANOSECONDS);
+	}
+	excimer_pprof_append_value_type(&enc, EXCIMER_PPROF_PERIOD_TYPE,
+		EXCIMER_PPROF_STR_TIME, EXCIMER_PPROF_STR_NANOSECONDS);
+	excimer_pprof_append_uint(&enc, dest, EXCIMER_PPROF_PERIOD, snapshot->period);
+	if (snapshot->samples_size) {
+		excimer_pprof_append_uint(&enc, dest, EXCIMER_PPROF_DURATION_NANOS, snapshot->duration);
+	}
 
-		/* Build the array of frame pointers */
-		while (current_frame_index) {
-			frame = excimer_log_get_frame(log, current_frame_index);
-			if (num_frames >= frames_capacity) {
-				if (frames_capacity >= ZEND_LONG_MAX - 1) {
-					/* Probably unreachable */
-					zend_error_noreturn(E_ERROR, "Too many Excimer frames");
-				}
-				frames_capacity++;
-				frame_ptrs = safe_erealloc(frame_ptrs, frames_capacity, sizeof(*frame_ptrs), 0);
+	/* Write a Function for each unique name and file, and a Location for
+	 * each unique function and line */
+	for (i = 1; i < snapshot->frames_size; i++) {
+		excimer_log_snapshot_frame *frame = &snapshot->frames[i];
+		uint32_t function_id, location_id;
+		int is_new;
+
+		function_id = excimer_log_id_map_get(&function_ids,
+			excimer_log_id_key(frame->name, frame->filename), &is_new);
+		if (is_new) {
+			excimer_pprof_append_uint(&enc, &enc.msg, 1, function_id);
+			excimer_pprof_append_uint(&enc, &enc.msg, 2, frame->name);
+			excimer_pprof_append_uint(&enc, &enc.msg, 3, frame->name);
+			excimer_pprof_append_uint(&enc, &enc.msg, 4, frame->filename);
+			if (frame->closure_line) {
+				excimer_pprof_append_uint(&enc, &enc.msg, 5, frame->closure_line);
 			}
-			frame_ptrs[num_frames++] = frame;
-			current_frame_index = frame->prev_index;
+			excimer_pprof_append_buffer(&enc, dest, EXCIMER_PPROF_FUNCTION, &enc.msg);
 		}
 
-		/* Run through the array in reverse */
-		for (i = num_frames - 1; i >= 0; i--) {
-			frame = frame_ptrs[i];
-
-			if (line_start) {
-				line_start = 0;
-			} else {
-				smart_str_appends(&ss_line, ";");
-			}
-			excimer_log_append_frame_name(&ss_line, frame);
+		location_id = excimer_log_id_map_get(&location_ids,
+			excimer_log_id_key(function_id, frame->lineno), &is_new);
+		if (is_new) {
+			/* Line message */
+			excimer_pprof_append_uint(&enc, &enc.packed, 1, function_id);
+			excimer_pprof_append_uint(&enc, &enc.packed, 2, frame->lineno);
+			/* Location message */
+			excimer_pprof_append_uint(&enc, &enc.msg, 1, location_id);
+			excimer_pprof_append_buffer(&enc, &enc.msg, 4, &enc.packed);
+			excimer_pprof_append_buffer(&enc, dest, EXCIMER_PPROF_LOCATION, &enc.msg);
 		}
+		frame_locations[i] = location_id;
+	}
 
-		/* ht_lines[ss_line] += zp_count */
-		str_line = excimer_log_smart_str_extract(&ss_line);
-		zval *zp_line_count = zend_hash_find(ht_lines, str_line);
-		if (!zp_line_count) {
-			ZVAL_LONG(&z_count, 0);
-			zp_line_count = zend_hash_add(ht_lines, str_line, &z_count);
+	/* Write a Sample for each unique stack */
+	for (i = 0; i < snapshot->samples_size; i++) {
+		excimer_log_snapshot_sample *sample = &snapshot->samples[i];
+		uint32_t frame_index = sample->frame_index;
+
+		/* location_id, leaf first */
+		while (frame_index) {
+			excimer_pprof_append_varint(&enc, &enc.packed, frame_locations[frame_index]);
+			frame_index = snapshot->frames[frame_index].prev_index;
+		}
+		excimer_pprof_append_buffer(&enc, &enc.msg, 1, &enc.packed);
+		/* value */
+		excimer_pprof_append_varint(&enc, &enc.packed, sample->count);
+		excimer_pprof_append_varint(&enc, &enc.packed, sample->count * snapshot->period);
+		if (snapshot->has_cpu_time) {
+			excimer_pprof_append_varint(&enc, &enc.packed, sample->cpu_time);
 		}
-		Z_LVAL_P(zp_line_count) += Z_LVAL_P(zp_count);
+		excimer_pprof_append_buffer(&enc, &enc.msg, 2, &enc.packed);
+		excimer_pprof_append_buffer(&enc, dest, EXCIMER_PPROF_SAMPLE, &enc.msg);
 	}
-	ZEND_HASH_FOREACH_END();
 
-	/* Concatenate lines */
-	ZEND_HASH_FOREACH_STR_KEY_VAL(ht_lines, str_line, zp_count) {
-		smart_str_append(&ss_out, str_line);
-		excimer_log_smart_str_append_printf(&ss_out, " " ZEND_LONG_FMT "\n", Z_LVAL_P(zp_count));
-	}
-	ZEND_HASH_FOREACH_END();
+	smart_str_free_ex(&enc.msg, persistent);
+	smart_str_free_ex(&enc.packed, persistent);
+	excimer_log_id_map_destroy(&function_ids);
+	excimer_log_id_map_destroy(&location_ids);
+	pefree(frame_locations, 1);
+}
 
-	zend_hash_destroy(ht_frame_counts);
-	zend_hash_destroy(ht_lines);
-	efree(frame_ptrs);
+zend_string *excimer_log_format_pprof(excimer_log *log)
+{
+	smart_str ss_out = {NULL};
+	excimer_log_snapshot *snapshot = excimer_log_snapshot_create(log);
+
+	excimer_log_snapshot_format_pprof(snapshot, &ss_out, 0);
+	excimer_log_snapshot_destroy(snapshot);
 	return excimer_log_smart_str_extract(&ss_out);
 }
 
-static HashTable *excimer_log_frame_to_speedscope_array(excimer_log_frame *frame) {
+/* }}} */
+
+static HashTable *excimer_log_frame_to_speedscope_array(excimer_log *log, uint32_t frame_index) {
 	HashTable *ht_func = excimer_log_new_array(0);
+	excimer_log_frame *frame = &log->store->frames[frame_index];
 	zval tmp;
-	smart_str ss_name = {NULL};
-	
-	excimer_log_append_frame_name(&ss_name, frame);
-	ZVAL_STR(&tmp, excimer_log_smart_str_extract(&ss_name));
+
+	ZVAL_STR_COPY(&tmp, excimer_log_get_frame_name(log, frame_index));
 	zend_hash_str_add(ht_func, "name", sizeof("name")-1, &tmp);
 
 	if (frame->filename) {
@@ -434,56 +2567,94 @@ static HashTable *excimer_log_frame_to_speedscope_array(excimer_log_frame *frame
 	return ht_func;
 }
 
-static zend_string *excimer_log_get_speedscope_frame_key(excimer_log_frame *frame) {
+static zend_string *excimer_log_get_speedscope_frame_key(excimer_log *log, uint32_t frame_index) {
+	excimer_log_frame *frame = &log->store->frames[frame_index];
 	smart_str ss = {NULL};
-	
-	excimer_log_append_frame_name(&ss, frame);
+
+	smart_str_append(&ss, excimer_log_get_frame_name(log, frame_index));
 	smart_str_appendc(&ss, '\0');
-	smart_str_append(&ss, frame->filename);
+	if (frame->filename) {
+		smart_str_append(&ss, frame->filename);
+	}
 	return excimer_log_smart_str_extract(&ss);
 }
 
-static uint32_t excimer_log_count_frames(excimer_log *log, uint32_t frame_index) {
+static uint32_t excimer_log_count_frames(excimer_log_local_frames *local, uint32_t frame_index) {
 	uint32_t n = 0;
 	while (frame_index) {
 		n++;
-		frame_index = log->frames[frame_index].prev_index;
+		frame_index = local->prev_indexes[frame_index];
 	}
 	return n;
 }
 
+/**
+ * Deduplicate frames which have the same speedscope name and file.
+ *
+ * @param log The log object
+ * @param local The local frames of the log
+ * @param[out] unique_frames_p Where to put a new array containing the store
+ *   index of the first frame with each key. The caller must free it.
+ * @param[out] num_unique_p Where to put the number of unique frames
+ * @return A new array mapping each local frame index to an index within
+ *   *unique_frames_p. The caller must free it.
+ */
+static uint32_t *excimer_log_dedup_speedscope_frames(excimer_log *log,
+	excimer_log_local_frames *local, uint32_t **unique_frames_p, uint32_t *num_unique_p)
+{
+	HashTable ht_indexes_by_key;
+	uint32_t *frame_indexes = ecalloc(local->size, sizeof(uint32_t));
+	uint32_t *unique_frames = safe_emalloc(local->size, sizeof(uint32_t), 0);
+	uint32_t num_unique = 0;
+	zend_long i;
+	zval *zp_frame_index, z_tmp;
+	zend_string *str_key;
+
+	zend_hash_init(&ht_indexes_by_key, 0, NULL, NULL, 0);
+	for (i = 1; i < local->size; i++) {
+		str_key = excimer_log_get_speedscope_frame_key(log, local->store_indexes[i]);
+		zp_frame_index = zend_hash_find(&ht_indexes_by_key, str_key);
+		if (!zp_frame_index) {
+			unique_frames[num_unique] = local->store_indexes[i];
+			ZVAL_LONG(&z_tmp, num_unique);
+			zp_frame_index = zend_hash_add_new(&ht_indexes_by_key, str_key, &z_tmp);
+			num_unique++;
+		}
+		frame_indexes[i] = Z_LVAL_P(zp_frame_index);
+		zend_string_release(str_key);
+	}
+	zend_hash_destroy(&ht_indexes_by_key);
+
+	*unique_frames_p = unique_frames;
+	*num_unique_p = num_unique;
+	return frame_indexes;
+}
+
 void excimer_log_get_speedscope_data(excimer_log *log, zval *zp_data) {
 	array_init(zp_data);
 	add_assoc_string(zp_data, "$schema", "https://www.speedscope.app/file-format-schema.json");
 	add_assoc_string(zp_data, "exporter", "Excimer");
 
 	HashTable *ht_frames = excimer_log_new_array(0);
-	HashTable *ht_indexes_by_key = excimer_log_new_array(0);
-	zend_long *lp_frame_indexes = ecalloc(log->frames_size, sizeof(zend_long));
+	excimer_log_local_frames local;
+	excimer_log_columns cols;
+	uint32_t *unique_frames, num_unique;
+	uint32_t *lp_frame_indexes;
 	zend_long i;
-	zval *zp_frame_index;
-	zend_string *str_key;
 	zval z_tmp, *zp_tmp;
 
+	excimer_log_local_frames_init(&local, log);
+	excimer_log_columns_init(&cols, log, &local);
+	excimer_log_columns_to_weights(&cols, log->period);
+	lp_frame_indexes = excimer_log_dedup_speedscope_frames(log, &local,
+		&unique_frames, &num_unique);
+
 	/* Build the frames array */
-	for (i = 1; i < log->frames_size; i++) {
-		zend_long index;
-		excimer_log_frame *frame = &log->frames[i];
-		str_key = excimer_log_get_speedscope_frame_key(frame);
-		zp_frame_index = zend_hash_find(ht_indexes_by_key, str_key);
-		if (!zp_frame_index) {
-			/* Add the frame to ht_frames */
-			index = zend_hash_num_elements(ht_frames);
-			ZVAL_ARR(&z_tmp, excimer_log_frame_to_speedscope_array(frame));
-			zend_hash_next_index_insert_new(ht_frames, &z_tmp);
-			/* Add the frame index to ht_indexes_by_key */
-			ZVAL_LONG(&z_tmp, index);
-			zp_frame_index = zend_hash_add_new(ht_indexes_by_key, str_key, &z_tmp);
-		}
-		lp_frame_indexes[i] = Z_LVAL_P(zp_frame_index);
-		zend_string_release(str_key);
+	for (i = 0; i < num_unique; i++) {
+		ZVAL_ARR(&z_tmp, excimer_log_frame_to_speedscope_array(log, unique_frames[i]));
+		zend_hash_next_index_insert_new(ht_frames, &z_tmp);
 	}
-	zend_array_destroy(ht_indexes_by_key);
+	efree(unique_frames);
 
 	/* zp_data["shared"] = ["frames" => ht_frames] */
 	zval z_shared;
@@ -491,56 +2662,69 @@ void excimer_log_get_speedscope_data(excimer_log *log, zval *zp_data) {
 	excimer_log_add_assoc_array(&z_shared, "frames", ht_frames);
 	add_assoc_zval(zp_data, "shared", &z_shared);
 
-	/* Build the samples and weights arrays */
-	HashTable *ht_samples = excimer_log_new_array(log->entries_size);
-	HashTable *ht_weights = excimer_log_new_array(log->entries_size);
-	uint64_t first_timestamp = 0;
-	uint64_t last_timestamp = 0;
-	for (i = 0; i < log->entries_size; i++) {
-		excimer_log_entry *entry = &log->entries[i];
-		uint32_t frame_index = entry->frame_index;
-
-		if (i == 0) {
-			first_timestamp = entry->timestamp;
-		}
-		last_timestamp = entry->timestamp;
-
-		uint32_t num_frames = excimer_log_count_frames(log, frame_index);
-		uint32_t j;
-
-		/* Create the array with ZEND_HASH_FILL_PACKED. This is just a fast way
-		 * to get it into the right state, with num_frames elements. */
-		HashTable *ht_stack = excimer_log_new_array(num_frames);
-		zend_hash_extend(ht_stack, num_frames, 1);
-		ZEND_HASH_FILL_PACKED(ht_stack) {
+	/* Build the samples array. Entries with the same leaf frame share a
+	 * reference to the same stack array. The cache holds no reference of its
+	 * own, it is kept alive by ht_samples. */
+	HashTable *ht_samples = excimer_log_new_array(cols.size);
+	HashTable **stacks = ecalloc(local.size, sizeof(HashTable*));
+	for (i = 0; i < cols.size; i++) {
+		uint32_t frame_index = cols.frame_indexes[i];
+		HashTable *ht_stack = stacks[frame_index];
+
+		if (ht_stack) {
+			excimer_log_array_addref(ht_stack);
+		} else {
+			uint32_t num_frames = excimer_log_count_frames(&local, frame_index);
+			uint32_t j;
+
+			/* Create the array with ZEND_HASH_FILL_PACKED. This is just a fast way
+			 * to get it into the right state, with num_frames elements. */
+			ht_stack = excimer_log_new_array(num_frames);
+			zend_hash_extend(ht_stack, num_frames, 1);
+			ZEND_HASH_FILL_PACKED(ht_stack) {
 #if PHP_VERSION_ID < 70400
-			zval new_val;
+				zval new_val;
 
-			ZVAL_LONG(&new_val, 0);
-			for (j = 0; j < num_frames; j++) {
-				ZEND_HASH_FILL_ADD(&new_val);
-			}
+				ZVAL_LONG(&new_val, 0);
+				for (j = 0; j < num_frames; j++) {
+					ZEND_HASH_FILL_ADD(&new_val);
+				}
 #else
-			for (j = 0; j < num_frames; j++) {
-				ZEND_HASH_FILL_SET_LONG(0);
-				ZEND_HASH_FILL_NEXT();
-			}
+				for (j = 0; j < num_frames; j++) {
+					ZEND_HASH_FILL_SET_LONG(0);
+					ZEND_HASH_FILL_NEXT();
+				}
 #endif
-		} ZEND_HASH_FILL_END();
+			} ZEND_HASH_FILL_END();
 
-		/* Write the values in reverse order */
-		ZEND_HASH_REVERSE_FOREACH_VAL(ht_stack, zp_tmp) {
-			ZVAL_LONG(zp_tmp, lp_frame_indexes[frame_index]);
-			frame_index = log->frames[frame_index].prev_index;
+			/* Write the values in reverse order */
+			ZEND_HASH_REVERSE_FOREACH_VAL(ht_stack, zp_tmp) {
+				ZVAL_LONG(zp_tmp, lp_frame_indexes[frame_index]);
+				frame_index = local.prev_indexes[frame_index];
+			}
+			ZEND_HASH_FOREACH_END();
+			stacks[cols.frame_indexes[i]] = ht_stack;
 		}
-		ZEND_HASH_FOREACH_END();
 
 		ZVAL_ARR(&z_tmp, ht_stack);
 		zend_hash_next_index_insert_new(ht_samples, &z_tmp);
-
-		ZVAL_LONG(&z_tmp, entry->event_count * log->period);
-		zend_hash_next_index_insert_new(ht_weights, &z_tmp);
 	}
+	efree(stacks);
+
+	/* Build the weights array */
+	HashTable *ht_weights = excimer_log_new_array(cols.size);
+	zend_hash_extend(ht_weights, cols.size, 1);
+	ZEND_HASH_FILL_PACKED(ht_weights) {
+		for (i = 0; i < cols.size; i++) {
+#if PHP_VERSION_ID < 70400
+			ZVAL_LONG(&z_tmp, cols.event_counts[i]);
+			ZEND_HASH_FILL_ADD(&z_tmp);
+#else
+			ZEND_HASH_FILL_SET_LONG(cols.event_counts[i]);
+			ZEND_HASH_FILL_NEXT();
+#endif
+		}
+	} ZEND_HASH_FILL_END();
 
 	/* Build the profile array */
 	zval z_profile;
@@ -549,7 +2733,7 @@ void excimer_log_get_speedscope_data(excimer_log *log, zval *zp_data) {
 	add_assoc_string(&z_profile, "name", "");
 	add_assoc_string(&z_profile, "unit", "nanoseconds");
 	add_assoc_long(&z_profile, "startValue", 0);
-	add_assoc_long(&z_profile, "endValue", last_timestamp - first_timestamp);
+	add_assoc_long(&z_profile, "endValue", cols.last_timestamp - cols.first_timestamp);
 	excimer_log_add_assoc_array(&z_profile, "samples", ht_samples);
 	excimer_log_add_assoc_array(&z_profile, "weights", ht_weights);
 
@@ -559,9 +2743,145 @@ void excimer_log_get_speedscope_data(excimer_log *log, zval *zp_data) {
 	add_next_index_zval(&z_profiles, &z_profile);
 	add_assoc_zval(zp_data, "profiles", &z_profiles);
 
+	excimer_log_columns_destroy(&cols);
+	excimer_log_local_frames_destroy(&local);
 	efree(lp_frame_indexes);
 }
 
+/**
+ * Append a string to a smart_str as a quoted JSON string
+ */
+static void excimer_log_append_json_string(smart_str *dest, const char *str, size_t length)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i;
+
+	smart_str_appendc(dest, '"');
+	for (i = 0; i < length; i++) {
+		unsigned char c = (unsigned char)str[i];
+		if (c == '"' || c == '\\') {
+			smart_str_appendc(dest, '\\');
+			smart_str_appendc(dest, c);
+		} else if (c < 0x20) {
+			smart_str_appendl(dest, "\\u00", 4);
+			smart_str_appendc(dest, hex[c >> 4]);
+			smart_str_appendc(dest, hex[c & 0xf]);
+		} else {
+			smart_str_appendc(dest, c);
+		}
+	}
+	smart_str_appendc(dest, '"');
+}
+
+zend_string *excimer_log_format_speedscope(excimer_log *log)
+{
+	smart_str ss = {NULL};
+	excimer_log_local_frames local;
+	excimer_log_columns cols;
+	uint32_t *unique_frames, num_unique;
+	uint32_t *frame_indexes;
+	/* The offset and length of the stack text for each leaf frame, which is
+	 * copied from earlier in the output when the leaf is seen again */
+	size_t *stack_offsets;
+	size_t *stack_lengths;
+	uint32_t *stack = NULL;
+	size_t stack_capacity = 0;
+	zend_long i;
+
+	excimer_log_local_frames_init(&local, log);
+	excimer_log_columns_init(&cols, log, &local);
+	excimer_log_columns_to_weights(&cols, log->period);
+	frame_indexes = excimer_log_dedup_speedscope_frames(log, &local,
+		&unique_frames, &num_unique);
+
+	smart_str_appends(&ss, "{\"$schema\":\"https://www.speedscope.app/file-format-schema.json\","
+		"\"exporter\":\"Excimer\",\"shared\":{\"frames\":[");
+
+	/* The frames array */
+	for (i = 0; i < num_unique; i++) {
+		excimer_log_frame *frame = &log->store->frames[unique_frames[i]];
+		zend_string *str_name = excimer_log_get_frame_name(log, unique_frames[i]);
+		if (i) {
+			smart_str_appendc(&ss, ',');
+		}
+		smart_str_appends(&ss, "{\"name\":");
+		excimer_log_append_json_string(&ss, ZSTR_VAL(str_name), ZSTR_LEN(str_name));
+		if (frame->filename) {
+			smart_str_appends(&ss, ",\"file\":");
+			excimer_log_append_json_string(&ss, ZSTR_VAL(frame->filename),
+				ZSTR_LEN(frame->filename));
+		}
+		smart_str_appendc(&ss, '}');
+	}
+	efree(unique_frames);
+
+	smart_str_appends(&ss, "]},\"profiles\":[{\"type\":\"sampled\",\"name\":\"\","
+		"\"unit\":\"nanoseconds\",\"startValue\":0,\"endValue\":");
+	smart_str_append_long(&ss, (zend_long)(cols.last_timestamp - cols.first_timestamp));
+
+	/* The samples array, each with the root first */
+	smart_str_appends(&ss, ",\"samples\":[");
+	stack_offsets = safe_emalloc(local.size, sizeof(size_t), 0);
+	stack_lengths = ecalloc(local.size, sizeof(size_t));
+	for (i = 0; i < cols.size; i++) {
+		uint32_t leaf_index = cols.frame_indexes[i];
+		uint32_t frame_index = leaf_index;
+		size_t depth = 0;
+		size_t offset;
+
+		if (i) {
+			smart_str_appendc(&ss, ',');
+		}
+		if (stack_lengths[leaf_index]) {
+			size_t length = stack_lengths[leaf_index];
+			smart_str_alloc(&ss, length, 0);
+			memcpy(ZSTR_VAL(ss.s) + ZSTR_LEN(ss.s),
+				ZSTR_VAL(ss.s) + stack_offsets[leaf_index], length);
+			ZSTR_LEN(ss.s) += length;
+			continue;
+		}
+
+		while (frame_index) {
+			if (depth >= stack_capacity) {
+				stack = excimer_log_grow(stack, &stack_capacity, depth + 1, sizeof(uint32_t), 0);
+			}
+			stack[depth++] = frame_indexes[frame_index];
+			frame_index = local.prev_indexes[frame_index];
+		}
+
+		offset = excimer_log_smart_str_get_len(&ss);
+		smart_str_appendc(&ss, '[');
+		while (depth) {
+			smart_str_append_long(&ss, stack[--depth]);
+			if (depth) {
+				smart_str_appendc(&ss, ',');
+			}
+		}
+		smart_str_appendc(&ss, ']');
+		stack_offsets[leaf_index] = offset;
+		stack_lengths[leaf_index] = ZSTR_LEN(ss.s) - offset;
+	}
+	efree(stack_offsets);
+	efree(stack_lengths);
+
+	smart_str_appends(&ss, "],\"weights\":[");
+	for (i = 0; i < cols.size; i++) {
+		if (i) {
+			smart_str_appendc(&ss, ',');
+		}
+		smart_str_append_long(&ss, cols.event_counts[i]);
+	}
+	smart_str_appends(&ss, "]}]}");
+
+	if (stack) {
+		efree(stack);
+	}
+	efree(frame_indexes);
+	excimer_log_columns_destroy(&cols);
+	excimer_log_local_frames_destroy(&local);
+	return excimer_log_smart_str_extract(&ss);
+}
+
 HashTable *excimer_log_frame_to_array(excimer_log_frame *frame) {
 	HashTable *ht_func = excimer_log_new_array(0);
 	zval tmp;
@@ -612,115 +2932,396 @@ HashTable *excimer_log_trace_to_array(excimer_log *log, zend_long l_frame_index)
 }
 
 /**
- * ht[key] += term;
+ * An element of the array sorted by excimer_log_aggr_by_func()
  */
-static void excimer_log_array_incr(HashTable *ht, zend_string *sp_key, zend_long term)
-{
-	zval *zp_value = zend_hash_find(ht, sp_key);
-	if (!zp_value) {
-		zval z_tmp;
-		ZVAL_LONG(&z_tmp, term);
-		zend_hash_add_new(ht, sp_key, &z_tmp);
-	} else {
-		Z_LVAL_P(zp_value) += term;
-	}
-}
+typedef struct _excimer_log_aggr_item {
+	/** The function ID, which is also the order of first appearance */
+	uint32_t func_id;
+	/** The inclusive count */
+	zend_long inclusive;
+} excimer_log_aggr_item;
 
-#if PHP_VERSION_ID < 80000
+/**
+ * Sort by inclusive count descending, then by order of first appearance
+ */
 static int excimer_log_aggr_compare(const void *a, const void *b)
 {
-	zval *zp_a = &((Bucket*)a)->val;
-	zval *zp_b = &((Bucket*)b)->val;
-#else
-static int excimer_log_aggr_compare(Bucket *a, Bucket *b)
-{
-	zval *zp_a = &a->val;
-	zval *zp_b = &b->val;
-#endif
-
-	zval *zp_a_incl = zend_hash_str_find(Z_ARRVAL_P(zp_a), "inclusive", sizeof("inclusive")-1);
-	zval *zp_b_incl = zend_hash_str_find(Z_ARRVAL_P(zp_b), "inclusive", sizeof("inclusive")-1);
+	const excimer_log_aggr_item *item_a = a;
+	const excimer_log_aggr_item *item_b = b;
 
-	return ZEND_NORMALIZE_BOOL(Z_LVAL_P(zp_b_incl) - Z_LVAL_P(zp_a_incl));
+	if (item_a->inclusive != item_b->inclusive) {
+		return item_a->inclusive > item_b->inclusive ? -1 : 1;
+	}
+	return item_a->func_id < item_b->func_id ? -1 : (item_a->func_id > item_b->func_id);
 }
 
 HashTable *excimer_log_aggr_by_func(excimer_log *log)
 {
-	HashTable *ht_result = excimer_log_new_array(0);
-	zend_string *sp_inclusive = zend_string_init("inclusive", sizeof("inclusive")-1, 0);
-	zend_string *sp_self = zend_string_init("self", sizeof("self")-1, 0);
-	HashTable *ht_unique_names = excimer_log_new_array(0);
+	HashTable *ht_result;
+	HashTable ht_ids_by_name;
+	zend_string *sp_inclusive, *sp_self;
+	excimer_log_local_frames local;
+	/* The function ID of each local frame, or UINT32_MAX if not yet assigned */
+	uint32_t *frame_func_ids;
+	/* Per-function arrays, indexed by function ID */
+	uint32_t *func_frames;
+	zend_long *func_self;
+	zend_long *func_inclusive;
+	size_t *func_visited;
+	excimer_log_aggr_item *items;
+	uint32_t num_funcs = 0;
 	size_t entry_index;
-	zval z_zero;
+	uint32_t i;
+	zval z_tmp;
 
-	ZVAL_LONG(&z_zero, 0);
+	/* There are at most as many functions as local frames */
+	excimer_log_local_frames_init(&local, log);
+	frame_func_ids = safe_emalloc(local.size, sizeof(uint32_t), 0);
+	func_frames = safe_emalloc(local.size, sizeof(uint32_t), 0);
+	func_self = ecalloc(local.size, sizeof(zend_long));
+	func_inclusive = ecalloc(local.size, sizeof(zend_long));
+	func_visited = ecalloc(local.size, sizeof(size_t));
+	memset(frame_func_ids, 0xff, local.size * sizeof(uint32_t));
+	zend_hash_init(&ht_ids_by_name, 0, NULL, NULL, 0);
 
 	for (entry_index = 0; entry_index < log->entries_size; entry_index++) {
 		excimer_log_entry *entry = excimer_log_get_entry(log, entry_index);
-		uint32_t frame_index = entry->frame_index;
+		uint32_t frame_index = excimer_log_local_index(&local, entry->frame_index);
 		int is_top = 1;
 
 		while (frame_index) {
-			excimer_log_frame *frame = excimer_log_get_frame(log, frame_index);
-			smart_str ss_name = {NULL};
-			zend_string *sp_name;
-			zval *zp_info;
-			zval z_tmp;
-
-			/* Make a human-readable name */
-			if (frame->closure_line != 0) {
-				/* Annotate anonymous functions with their source location.
-				 * Example: {closure:/path/to/file.php(123)}
-				 */
-				smart_str_appends(&ss_name, "{closure:");
-				smart_str_append(&ss_name, frame->filename);
-				excimer_log_smart_str_append_printf(&ss_name, "(%d)}", frame->closure_line);
-			} else if (frame->function_name == NULL) {
-				/* For file-scope code, use the file name */
-				smart_str_append(&ss_name, frame->filename);
-			} else {
-				if (frame->class_name) {
-					smart_str_append(&ss_name, frame->class_name);
-					smart_str_appends(&ss_name, "::");
+			uint32_t func_id = frame_func_ids[frame_index];
+
+			/* Assign a function ID to the frame. The result uses the frame
+			 * info from the first frame in which the function appeared. */
+			if (func_id == UINT32_MAX) {
+				zend_string *sp_name = excimer_log_get_raw_frame_name(log,
+					local.store_indexes[frame_index]);
+				zval *zp_id = zend_hash_find(&ht_ids_by_name, sp_name);
+				if (zp_id) {
+					func_id = Z_LVAL_P(zp_id);
+				} else {
+					func_id = num_funcs++;
+					func_frames[func_id] = local.store_indexes[frame_index];
+					ZVAL_LONG(&z_tmp, func_id);
+					zend_hash_add_new(&ht_ids_by_name, sp_name, &z_tmp);
 				}
-				smart_str_append(&ss_name, frame->function_name);
-			}
-			sp_name = excimer_log_smart_str_extract(&ss_name);
-
-			/* If it is not in ht_result, add it, along with frame info */
-			zp_info = zend_hash_find(ht_result, sp_name);
-			if (!zp_info) {
-				ZVAL_ARR(&z_tmp, excimer_log_frame_to_array(frame));
-				zend_hash_add_new(Z_ARRVAL(z_tmp), sp_self, &z_zero);
-				zend_hash_add_new(Z_ARRVAL(z_tmp), sp_inclusive, &z_zero);
-				zp_info = zend_hash_add(ht_result, sp_name, &z_tmp);
+				frame_func_ids[frame_index] = func_id;
 			}
 
-			/* If this is the top frame of a log entry, increment the "self" key */
+			/* If this is the top frame of a log entry, increment "self" */
 			if (is_top) {
-				excimer_log_array_incr(Z_ARRVAL_P(zp_info), sp_self, entry->event_count);
+				func_self[func_id] += entry->event_count;
 			}
 
 			/* If this is the first instance of a function in an entry, i.e.
-			 * counting recursive functions only once, increment the "inclusive" key */
-			if (zend_hash_find(ht_unique_names, sp_name) == NULL) {
-				excimer_log_array_incr(Z_ARRVAL_P(zp_info), sp_inclusive, entry->event_count);
-				/* Add the function to the unique_names array */
-				zend_hash_add_new(ht_unique_names, sp_name, &z_zero);
+			 * counting recursive functions only once, increment "inclusive" */
+			if (func_visited[func_id] != entry_index + 1) {
+				func_visited[func_id] = entry_index + 1;
+				func_inclusive[func_id] += entry->event_count;
 			}
 
 			is_top = 0;
-			frame_index = frame->prev_index;
-			zend_string_delref(sp_name);
+			frame_index = local.prev_indexes[frame_index];
 		}
-		zend_hash_clean(ht_unique_names);
 	}
-	zend_hash_destroy(ht_unique_names);
-	zend_string_delref(sp_self);
-	zend_string_delref(sp_inclusive);
+	zend_hash_destroy(&ht_ids_by_name);
+	excimer_log_local_frames_destroy(&local);
+
+	/* Sort the functions in descending order by inclusive */
+	items = safe_emalloc(num_funcs, sizeof(excimer_log_aggr_item), 0);
+	for (i = 0; i < num_funcs; i++) {
+		items[i].func_id = i;
+		items[i].inclusive = func_inclusive[i];
+	}
+	qsort(items, num_funcs, sizeof(excimer_log_aggr_item), excimer_log_aggr_compare);
+
+	/* Build the result */
+	ht_result = excimer_log_new_array(num_funcs);
+	sp_self = zend_string_init("self", sizeof("self")-1, 0);
+	sp_inclusive = zend_string_init("inclusive", sizeof("inclusive")-1, 0);
+	for (i = 0; i < num_funcs; i++) {
+		uint32_t func_id = items[i].func_id;
+		uint32_t frame_index = func_frames[func_id];
+		HashTable *ht_info = excimer_log_frame_to_array(&log->store->frames[frame_index]);
+
+		ZVAL_LONG(&z_tmp, func_self[func_id]);
+		zend_hash_add_new(ht_info, sp_self, &z_tmp);
+		ZVAL_LONG(&z_tmp, func_inclusive[func_id]);
+		zend_hash_add_new(ht_info, sp_inclusive, &z_tmp);
+
+		ZVAL_ARR(&z_tmp, ht_info);
+		zend_hash_add_new(ht_result, excimer_log_get_raw_frame_name(log, frame_index), &z_tmp);
+	}
+	zend_string_release(sp_self);
+	zend_string_release(sp_inclusive);
+
+	efree(items);
+	efree(frame_func_ids);
+	efree(func_frames);
+	efree(func_self);
+	efree(func_inclusive);
+	efree(func_visited);
+	return ht_result;
+}
 
-	/* Sort the result in descending order by inclusive */
-	zend_hash_sort(ht_result, excimer_log_aggr_compare, 0);
+/* {{{ Serialization */
 
-	return ht_result;
+static const char excimer_log_serial_magic[] = "EXCL";
+
+static void excimer_log_smart_str_append_varint(smart_str *dest, uint64_t value)
+{
+	char buf[10];
+	size_t n = 0;
+
+	while (value >= 0x80) {
+		buf[n++] = (char)(value | 0x80);
+		value >>= 7;
+	}
+	buf[n++] = (char)value;
+	smart_str_appendl(dest, buf, n);
+}
+
+/**
+ * Get the ID of a string in the string table of a serialized log, adding it
+ * if necessary. NULL has ID zero.
+ */
+static uint32_t excimer_log_serial_string_id(HashTable *ids, zend_string *str)
+{
+	zval *zp_id, z_id;
+
+	if (!str) {
+		return 0;
+	}
+	zp_id = zend_hash_find(ids, str);
+	if (zp_id) {
+		return (uint32_t)Z_LVAL_P(zp_id);
+	}
+	ZVAL_LONG(&z_id, zend_hash_num_elements(ids) + 1);
+	zend_hash_add_new(ids, str, &z_id);
+	return (uint32_t)Z_LVAL(z_id);
+}
+
+zend_string *excimer_log_serialize(excimer_log *log)
+{
+	excimer_log_frame_store *store = log->store;
+	excimer_log_local_frames local;
+	uint64_t prev_timestamp = 0;
+	HashTable string_ids;
+	smart_str ss = {NULL};
+	zend_string *str;
+	size_t i;
+
+	/* The frame IDs are the local frame indexes. Number their strings in
+	 * order. */
+	excimer_log_local_frames_init(&local, log);
+	zend_hash_init(&string_ids, 0, NULL, NULL, 0);
+	for (i = 1; i < local.size; i++) {
+		excimer_log_frame *frame = &store->frames[local.store_indexes[i]];
+		excimer_log_serial_string_id(&string_ids, frame->filename);
+		excimer_log_serial_string_id(&string_ids, frame->class_name);
+		excimer_log_serial_string_id(&string_ids, frame->function_name);
+	}
+
+	smart_str_appendl(&ss, excimer_log_serial_magic, sizeof(excimer_log_serial_magic) - 1);
+	excimer_log_smart_str_append_varint(&ss, EXCIMER_LOG_SERIAL_VERSION);
+	excimer_log_smart_str_append_varint(&ss, log->has_cpu_time ? EXCIMER_LOG_SERIAL_CPU_TIME : 0);
+	excimer_log_smart_str_append_varint(&ss, log->period);
+	excimer_log_smart_str_append_varint(&ss, log->epoch);
+
+	excimer_log_smart_str_append_varint(&ss, zend_hash_num_elements(&string_ids));
+	ZEND_HASH_FOREACH_STR_KEY(&string_ids, str) {
+		excimer_log_smart_str_append_varint(&ss, ZSTR_LEN(str));
+		smart_str_appendl(&ss, ZSTR_VAL(str), ZSTR_LEN(str));
+	} ZEND_HASH_FOREACH_END();
+
+	excimer_log_smart_str_append_varint(&ss, local.size - 1);
+	excimer_log_smart_str_append_varint(&ss,
+		store->truncation_index ? excimer_log_local_index(&local, store->truncation_index) : 0);
+	for (i = 1; i < local.size; i++) {
+		excimer_log_frame *frame = &store->frames[local.store_indexes[i]];
+		excimer_log_smart_str_append_varint(&ss,
+			excimer_log_serial_string_id(&string_ids, frame->filename));
+		excimer_log_smart_str_append_varint(&ss,
+			excimer_log_serial_string_id(&string_ids, frame->class_name));
+		excimer_log_smart_str_append_varint(&ss,
+			excimer_log_serial_string_id(&string_ids, frame->function_name));
+		excimer_log_smart_str_append_varint(&ss, frame->lineno);
+		excimer_log_smart_str_append_varint(&ss, frame->closure_line);
+		excimer_log_smart_str_append_varint(&ss, local.prev_indexes[i]);
+		excimer_log_smart_str_append_varint(&ss, frame->opline);
+	}
+
+	excimer_log_smart_str_append_varint(&ss, log->entries_size);
+	for (i = 0; i < log->entries_size; i++) {
+		excimer_log_entry *entry = excimer_log_get_entry(log, i);
+		excimer_log_smart_str_append_varint(&ss,
+			((uint64_t)excimer_log_local_index(&local, entry->frame_index) << 2)
+			| (entry->event_count != 1) | ((entry->cpu_time != 0) << 1));
+		if (entry->event_count != 1) {
+			excimer_log_smart_str_append_varint(&ss, excimer_log_zigzag_encode(entry->event_count));
+		}
+		excimer_log_smart_str_append_varint(&ss,
+			excimer_log_zigzag_encode((int64_t)(entry->timestamp - prev_timestamp)));
+		if (entry->cpu_time) {
+			excimer_log_smart_str_append_varint(&ss, entry->cpu_time);
+		}
+		prev_timestamp = entry->timestamp;
+	}
+
+	zend_hash_destroy(&string_ids);
+	excimer_log_local_frames_destroy(&local);
+	return excimer_log_smart_str_extract(&ss);
+}
+
+/**
+ * A bounds-checked cursor over a serialized log
+ */
+typedef struct _excimer_log_reader {
+	const unsigned char *p;
+	const unsigned char *end;
+
+	/** Set if a read went past the end of the input */
+	int error;
+} excimer_log_reader;
+
+static uint64_t excimer_log_reader_varint(excimer_log_reader *reader)
+{
+	uint64_t value = 0;
+	int shift;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		unsigned char c;
+		if (reader->p >= reader->end) {
+			break;
+		}
+		c = *reader->p++;
+		value |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			return value;
+		}
+	}
+	reader->error = 1;
+	return 0;
+}
+
+/**
+ * Read a count of items which each take at least min_size bytes, so that a
+ * corrupt count cannot cause a huge allocation
+ */
+static size_t excimer_log_reader_count(excimer_log_reader *reader, size_t min_size)
+{
+	uint64_t count = excimer_log_reader_varint(reader);
+	if (count > (uint64_t)(reader->end - reader->p) / min_size) {
+		reader->error = 1;
+		return 0;
+	}
+	return (size_t)count;
+}
+
+const char *excimer_log_unserialize(excimer_log *log, const char *data, size_t length)
+{
+	excimer_log_reader reader = {(const unsigned char*)data, (const unsigned char*)data + length, 0};
+	size_t magic_length = sizeof(excimer_log_serial_magic) - 1;
+	zend_string **strings = NULL;
+	uint32_t *map = NULL;
+	size_t num_strings = 0, num_frames, num_entries, i;
+	uint64_t flags, truncation_id, timestamp = 0;
+	const char *error = NULL;
+
+	if (length < magic_length || memcmp(data, excimer_log_serial_magic, magic_length) != 0) {
+		return "Invalid serialized log";
+	}
+	reader.p += magic_length;
+	if (excimer_log_reader_varint(&reader) != EXCIMER_LOG_SERIAL_VERSION) {
+		return "Unsupported serialized log version";
+	}
+	flags = excimer_log_reader_varint(&reader);
+	log->has_cpu_time = (flags & EXCIMER_LOG_SERIAL_CPU_TIME) ? 1 : 0;
+	log->period = excimer_log_reader_varint(&reader);
+	log->epoch = excimer_log_reader_varint(&reader);
+
+	/* The string table. Index zero is the absent string. */
+	num_strings = excimer_log_reader_count(&reader, 1);
+	strings = ecalloc(num_strings + 1, sizeof(zend_string*));
+	for (i = 1; i <= num_strings && !reader.error; i++) {
+		uint64_t str_length = excimer_log_reader_varint(&reader);
+		if (str_length > (uint64_t)(reader.end - reader.p)) {
+			reader.error = 1;
+			break;
+		}
+		strings[i] = zend_string_init((const char*)reader.p, (size_t)str_length, 0);
+		reader.p += str_length;
+	}
+
+	/* The frames, mapped to frame indexes in the log */
+	num_frames = excimer_log_reader_count(&reader, 7);
+	truncation_id = excimer_log_reader_varint(&reader);
+	map = safe_emalloc(num_frames + 1, sizeof(uint32_t), 0);
+	map[0] = 0;
+	for (i = 1; i <= num_frames && !reader.error; i++) {
+		excimer_log_frame frame;
+		uint64_t filename_id = excimer_log_reader_varint(&reader);
+		uint64_t class_id = excimer_log_reader_varint(&reader);
+		uint64_t function_id = excimer_log_reader_varint(&reader);
+		uint64_t prev_id;
+
+		frame.lineno = (uint32_t)excimer_log_reader_varint(&reader);
+		frame.closure_line = (uint32_t)excimer_log_reader_varint(&reader);
+		prev_id = excimer_log_reader_varint(&reader);
+		frame.opline = (uint32_t)excimer_log_reader_varint(&reader);
+		if (reader.error) {
+			break;
+		}
+		/* A frame must follow its caller, and an internal function frame
+		 * must have a function name */
+		if (filename_id > num_strings || class_id > num_strings || function_id > num_strings
+			|| prev_id >= i || (!filename_id && !function_id))
+		{
+			error = "Invalid frame in serialized log";
+			break;
+		}
+		if (i == truncation_id) {
+			map[i] = excimer_log_get_truncation_marker(log);
+			continue;
+		}
+		frame.filename = strings[filename_id];
+		frame.class_name = strings[class_id];
+		frame.function_name = strings[function_id];
+		map[i] = excimer_log_import_frame(log, &frame, map[prev_id]);
+	}
+
+	num_entries = error ? 0 : excimer_log_reader_count(&reader, 2);
+	for (i = 0; i < num_entries && !reader.error; i++) {
+		uint64_t header = excimer_log_reader_varint(&reader);
+		zend_long event_count = 1;
+		uint64_t cpu_time = 0;
+
+		if (header & 1) {
+			event_count = (zend_long)excimer_log_zigzag_decode(excimer_log_reader_varint(&reader));
+		}
+		timestamp += (uint64_t)excimer_log_zigzag_decode(excimer_log_reader_varint(&reader));
+		if (header & 2) {
+			cpu_time = excimer_log_reader_varint(&reader);
+		}
+		if ((header >> 2) > num_frames || event_count < 1) {
+			error = "Invalid entry in serialized log";
+			break;
+		}
+		excimer_log_append_entry(log, map[header >> 2], event_count, timestamp, cpu_time);
+	}
+
+	if (!error && (reader.error || reader.p != reader.end)) {
+		error = "Invalid serialized log";
+	}
+	for (i = 1; i <= num_strings; i++) {
+		if (strings[i]) {
+			zend_string_release(strings[i]);
+		}
+	}
+	efree(strings);
+	efree(map);
+	return error;
 }
+
+/* }}} */
@@ -16,16 +16,37 @@
 #ifndef EXCIMER_LOG_H
 #define EXCIMER_LOG_H
 
+enum {
+	/** Frame granularity: one frame per function call, ignoring lines */
+	EXCIMER_GRANULARITY_FUNCTION,
+	/** Frame granularity: one frame per executing line */
+	EXCIMER_GRANULARITY_LINE,
+	/** Frame granularity: one frame per executing opcode */
+	EXCIMER_GRANULARITY_OPLINE
+};
+
 /**
  * Structure representing a unique location in the code and its backtrace
  */
 typedef struct _excimer_log_frame {
-	/** The filename, or may be fake e.g. "php shell code" */
+	/**
+	 * The filename, or may be fake e.g. "php shell code". This is NULL for
+	 * an internal function frame.
+	 */
 	zend_string *filename;
 
-	/** The executing line number within the filename */
+	/**
+	 * The executing line number within the filename. With function
+	 * granularity, this is the start line of the function.
+	 */
 	uint32_t lineno;
 
+	/**
+	 * With opline granularity, the index of the executing opline within
+	 * the function, otherwise zero
+	 */
+	uint32_t opline;
+
 	/**
 	 * If the function was a closure, the "start line" of its definition.
 	 * Zero if the function was not a closure.
@@ -66,30 +87,324 @@ typedef struct _excimer_log_entry {
 	 * caller-defined, but in Excimer it is the number of nanoseconds since boot.
 	 */
 	uint64_t timestamp;
+
+	/**
+	 * The thread CPU time in nanoseconds which elapsed since the previous
+	 * sample, or zero if the log does not record CPU time
+	 */
+	uint64_t cpu_time;
 } excimer_log_entry;
 
 /**
- * Structure representing the entire log
+ * A slot in the frame deduplication hashtable
  */
-typedef struct _excimer_log {
-	/** Array of log entries */
-	excimer_log_entry *entries;
+typedef struct _excimer_log_frame_slot {
+	/** The hash of the frame key */
+	uint32_t hash;
 
-	/** Size of the "entries" array */
-	size_t entries_size;
+	/** The index within excimer_log.frames, or zero if the slot is empty */
+	uint32_t frame_index;
+} excimer_log_frame_slot;
+
+/**
+ * An open-addressing hashtable mapping a frame key to a frame index. The key
+ * is the filename, line number, opline index and prev_index of the frame. Keys are not
+ * stored in the table, they are compared against the frame itself.
+ */
+typedef struct _excimer_log_frame_table {
+	/** The array of slots */
+	excimer_log_frame_slot *slots;
+
+	/** The number of slots. This is always a power of two. */
+	uint32_t size;
+
+	/** The number of non-empty slots */
+	uint32_t used;
+} excimer_log_frame_table;
 
+/**
+ * The frames of a log and the hashtable used to deduplicate them.
+ *
+ * Normally each log has its own store. If excimer.persistent_frames is set,
+ * all logs in a thread share a store in persistent memory, so frames are
+ * not deduplicated again in each request, and a frame has the same index
+ * in every log of that thread. Under ZTS each thread has its own store, so
+ * frame indexes differ between threads. Strings are copied into the store
+ * unless they live as long as the process, like internal function names.
+ */
+typedef struct _excimer_log_frame_store {
 	/** Array of frames */
 	excimer_log_frame *frames;
 
-	/* Size of the "frames" array */
+	/* Number of used elements in the "frames" array */
 	size_t frames_size;
 
+	/** Number of allocated elements in the "frames" array */
+	size_t frames_capacity;
+
 	/**
 	 * A hashtable where the key is a unique frame identifier combining some
 	 * elements of the frame object, and the value is the frame index. Used
 	 * for deduplication of frames.
 	 */
-	HashTable *reverse_frames;
+	excimer_log_frame_table reverse_frames;
+
+	/** The index of the truncation marker frame, or zero if it was not yet created */
+	uint32_t truncation_index;
+
+	/** Whether the store is persistent and shared by the logs in the thread */
+	int persistent;
+
+	/** The number of logs using the store */
+	uint32_t refcount;
+
+	/**
+	 * The maximum number of frames, or zero for no limit. Once this is
+	 * reached, new frames are replaced by the truncation marker.
+	 */
+	size_t max_frames;
+
+	/**
+	 * Persistent copies of strings, by content. Only used if the store is
+	 * persistent.
+	 */
+	HashTable strings;
+} excimer_log_frame_store;
+
+/**
+ * A cached level of the most recently captured stack
+ */
+typedef struct _excimer_log_stack_frame {
+	/** The execute_data pointer. This is only compared, never dereferenced. */
+	zend_execute_data *execute_data;
+
+	/** The function at the time of capture */
+	zend_function *func;
+
+	/** The opline at the time of capture */
+	const zend_op *opline;
+
+	/** The index within excimer_log.frames which this level resolved to */
+	uint32_t frame_index;
+} excimer_log_stack_frame;
+
+/**
+ * A lazily populated array of formatted frame names. With a persistent frame
+ * store, a log uses few of the store's frames, so the names are kept in a
+ * hashtable instead.
+ */
+typedef struct _excimer_log_name_cache {
+	/** The names indexed by frame index, or NULL if not yet formatted */
+	zend_string **names;
+
+	/** The number of elements in the "names" array */
+	size_t size;
+
+	/** The names by frame index if the store is persistent, or NULL */
+	HashTable *table;
+
+	/** The total size of the cached strings, in bytes */
+	size_t string_bytes;
+} excimer_log_name_cache;
+
+/**
+ * A frame in a log snapshot. Names are indexes into the snapshot's string
+ * table.
+ */
+typedef struct _excimer_log_snapshot_frame {
+	/** The function name, formatted as in the collapsed format */
+	uint32_t name;
+
+	/** The filename */
+	uint32_t filename;
+
+	/** The executing line number */
+	uint32_t lineno;
+
+	/** The closure start line, or zero */
+	uint32_t closure_line;
+
+	/** The index within excimer_log_snapshot.frames of the calling frame */
+	uint32_t prev_index;
+} excimer_log_snapshot_frame;
+
+/**
+ * The aggregated event count of a leaf frame in a log snapshot
+ */
+typedef struct _excimer_log_snapshot_sample {
+	/** The index within excimer_log_snapshot.frames of the leaf frame */
+	uint32_t frame_index;
+
+	/** The sum of the event counts of the entries with this leaf */
+	zend_long count;
+
+	/** The sum of the CPU times of the entries with this leaf */
+	uint64_t cpu_time;
+} excimer_log_snapshot_sample;
+
+/**
+ * A copy of the parts of a log which are needed for serialization. It is
+ * allocated in persistent memory and does not reference any request memory,
+ * so it may be formatted and destroyed by a thread other than the one which
+ * created it.
+ */
+typedef struct _excimer_log_snapshot {
+	/**
+	 * Array of the frames used by the log's entries. The order is the same
+	 * as in the log, but unused frames are omitted.
+	 */
+	excimer_log_snapshot_frame *frames;
+
+	/** Number of elements in the "frames" array */
+	size_t frames_size;
+
+	/** Array of samples, in the order in which their leaves first appeared */
+	excimer_log_snapshot_sample *samples;
+
+	/** Number of elements in the "samples" array */
+	size_t samples_size;
+
+	/** The concatenated contents of the strings */
+	smart_str string_data;
+
+	/**
+	 * The offset of each string in string_data, followed by the total
+	 * length. String 0 is always the empty string.
+	 */
+	uint32_t *string_offsets;
+
+	/** The number of strings */
+	uint32_t num_strings;
+
+	/** The nominal period in nanoseconds */
+	uint64_t period;
+
+	/** The time between the first and last entries in nanoseconds */
+	uint64_t duration;
+
+	/** Whether the samples have CPU times */
+	int has_cpu_time;
+} excimer_log_snapshot;
+
+/** The number of entries in each block of a compact log */
+#define EXCIMER_LOG_BLOCK_ENTRIES 256
+
+/**
+ * A block of entries in a compact log. Each entry is encoded as:
+ *
+ *   - A varint of the frame index shifted left by two, with bit 0 set if the
+ *     event count is not 1, and bit 1 set if the CPU time is not zero.
+ *   - If bit 0 was set, a zigzag varint of the event count.
+ *   - A zigzag varint of the difference between the timestamp and the
+ *     timestamp of the previous entry in the block, or first_timestamp for
+ *     the first entry.
+ *   - If bit 1 was set, a varint of the CPU time.
+ */
+typedef struct _excimer_log_block {
+	/** The encoded entries */
+	unsigned char *data;
+
+	/** Number of used bytes in the "data" array */
+	size_t data_size;
+
+	/** Number of allocated bytes in the "data" array */
+	size_t data_capacity;
+
+	/** The number of entries in the block */
+	uint32_t num_entries;
+
+	/** The offset within "data" of the last entry */
+	size_t last_offset;
+
+	/** The timestamp of the first entry */
+	uint64_t first_timestamp;
+
+	/** The timestamp of the last entry */
+	uint64_t last_timestamp;
+} excimer_log_block;
+
+/**
+ * Counters describing the cost of collecting a log
+ */
+typedef struct _excimer_log_stats {
+	/** The time spent adding entries, in nanoseconds. This is measured by the caller. */
+	uint64_t add_ns;
+
+	/** The number of stack levels walked */
+	uint64_t frames_walked;
+
+	/** The number of walked levels which were reused from the cached stack */
+	uint64_t frames_cached;
+
+	/** The number of lookups of user frames in the reverse_frames table */
+	uint64_t frame_lookups;
+
+	/** The number of lookups which found an existing frame */
+	uint64_t frame_lookup_hits;
+
+	/** The number of frames added to the store */
+	uint64_t frames_added;
+
+	/**
+	 * The number of samples added, including those merged from other logs.
+	 * This may exceed the number of entries if the log is aggregated or
+	 * coalesced.
+	 */
+	uint64_t samples;
+
+	/** The number of samples which were added to the previous entry */
+	uint64_t samples_coalesced;
+
+	/** The number of events which reservoir sampling kept by evicting another */
+	uint64_t events_replaced;
+
+	/** The number of events which reservoir sampling discarded */
+	uint64_t events_dropped;
+} excimer_log_stats;
+
+/**
+ * Structure representing the entire log
+ */
+typedef struct _excimer_log {
+	/** Array of log entries */
+	excimer_log_entry *entries;
+
+	/** Number of used elements in the "entries" array */
+	size_t entries_size;
+
+	/** Number of allocated elements in the "entries" array */
+	size_t entries_capacity;
+
+	/** The frames, which may be shared with other logs */
+	excimer_log_frame_store *store;
+
+	/**
+	 * The stack captured by the previous call to excimer_log_add(), ordered
+	 * from the root to the leaf. The unchanged part of the stack is reused
+	 * by the next capture.
+	 */
+	excimer_log_stack_frame *stack;
+
+	/** Number of used elements in the "stack" array */
+	size_t stack_size;
+
+	/** Number of allocated elements in the "stack" array */
+	size_t stack_capacity;
+
+	/** The prev_index of the root level of the cached stack */
+	uint32_t stack_base;
+
+	/**
+	 * The frame which is used as the caller of the outermost frame of every
+	 * captured stack, or zero if captured stacks start at the root
+	 */
+	uint32_t root_index;
+
+	/** Frame names with spaces replaced, as used by the collapsed format */
+	excimer_log_name_cache frame_names;
+
+	/** Human-readable frame names, as used by aggregateByFunction() */
+	excimer_log_name_cache raw_frame_names;
 
 	/**
 	 * The maximum stack depth of collected frames. If this is exceeded, the
@@ -112,6 +427,123 @@ typedef struct _excimer_log {
 	 * The sum of the event counts of all contained log entries
 	 */
 	zend_long event_count;
+
+	/**
+	 * Whether frames are added for calls to internal functions. Otherwise,
+	 * time spent in an internal function is attributed to the calling line.
+	 */
+	int internal_frames;
+
+	/**
+	 * The granularity of captured frames, for example
+	 * EXCIMER_GRANULARITY_LINE
+	 */
+	int granularity;
+
+	/** Whether entries record the CPU time elapsed between samples */
+	int has_cpu_time;
+
+	/** The sum of the CPU times of all contained log entries */
+	uint64_t cpu_time;
+
+	/**
+	 * If this is true, the log has at most one entry per leaf frame. Adding
+	 * a sample with an existing leaf increments that entry's event count, so
+	 * memory usage is bounded by the number of unique stacks. The entry
+	 * timestamp is the time at which the stack was first seen.
+	 */
+	int aggregate;
+
+	/**
+	 * In aggregate mode, the index within "entries" plus one of the entry
+	 * for each leaf frame index, or zero if there is no such entry
+	 */
+	uint32_t *leaf_entries;
+
+	/** Number of allocated elements in the "leaf_entries" array */
+	size_t leaf_entries_capacity;
+
+	/**
+	 * The leaf entry map as a hashtable, used instead of "leaf_entries" if
+	 * the store is persistent, since its frame indexes are sparse. This is
+	 * NULL until it is needed.
+	 */
+	HashTable *leaf_entry_table;
+
+	/**
+	 * If this is true, a sample with the same stack as the last entry
+	 * increments that entry's event count instead of adding an entry. In
+	 * compact mode, the last entry is re-encoded.
+	 */
+	int coalesce;
+
+	/**
+	 * If this is non-zero, the log is in aggregate mode and its entries are
+	 * a uniform sample of this many of the events added, with each event
+	 * being one unit of an event count. Events beyond the first
+	 * reservoir_size are chosen with the skips of Algorithm L, and each
+	 * replaces a random kept event. Since the kept events are exchangeable,
+	 * the replaced event is drawn from the entries in proportion to their
+	 * event counts.
+	 */
+	uint64_t reservoir_size;
+
+	/** The number of events which have been offered to the reservoir */
+	uint64_t reservoir_seen;
+
+	/** The position of the next event which the reservoir will accept */
+	uint64_t reservoir_next;
+
+	/** The W variable of Algorithm L */
+	double reservoir_w;
+
+	/**
+	 * A Fenwick tree over the entry event counts, for weighted selection in
+	 * logarithmic time. Element i+1 covers the entries from
+	 * i + 1 - lowbit(i + 1) to i. This is NULL unless the reservoir is
+	 * active.
+	 */
+	zend_long *reservoir_tree;
+
+	/** The number of elements in the Fenwick tree, a power of two */
+	size_t reservoir_tree_size;
+
+	/**
+	 * If this is true, no frames are added to the store. A stack which
+	 * would need a new frame resolves to the truncation marker instead.
+	 */
+	int frames_frozen;
+
+	/**
+	 * If this is true and the log is not in aggregate mode, entries are
+	 * stored in "blocks" instead of "entries", using a variable-length
+	 * encoding which is typically 4-6 times smaller.
+	 */
+	int compact;
+
+	/** The blocks of a compact log */
+	excimer_log_block *blocks;
+
+	/** Number of used elements in the "blocks" array */
+	size_t blocks_size;
+
+	/** Number of allocated elements in the "blocks" array */
+	size_t blocks_capacity;
+
+	/** The sum of the data_capacity of all blocks */
+	size_t blocks_data_bytes;
+
+	/**
+	 * The entries of one block of a compact log, decoded on demand by
+	 * excimer_log_get_entry()
+	 */
+	excimer_log_entry *decoded;
+
+	/** The index plus one of the block in "decoded", or zero if none */
+	size_t decoded_block;
+
+	/** Overhead counters */
+	excimer_log_stats stats;
 } excimer_log;
 
 /**
@@ -129,6 +561,18 @@ void excimer_log_init(excimer_log *log);
  */
 void excimer_log_destroy(excimer_log *log);
 
+/**
+ * Empty the thread's shared frame store if it is full. This is called at
+ * the start of each request.
+ */
+void excimer_log_request_init(void);
+
+/**
+ * Free the thread's shared frame store, if there is one. No logs may be
+ * using it.
+ */
+void excimer_log_shutdown_shared_store(void);
+
 /**
  * Set the max depth
  *
@@ -137,6 +581,51 @@ void excimer_log_destroy(excimer_log *log);
  */
 void excimer_log_set_max_depth(excimer_log *log, zend_long depth);
 
+/**
+ * Enable or disable recording of internal function frames
+ *
+ * @param log The log object
+ * @param enable Whether to add frames for internal functions
+ */
+void excimer_log_set_internal_frames(excimer_log *log, int enable);
+
+/**
+ * Set the granularity of captured frames. Frames already in the log are not
+ * changed.
+ *
+ * @param log The log object
+ * @param granularity EXCIMER_GRANULARITY_FUNCTION, EXCIMER_GRANULARITY_LINE
+ *   or EXCIMER_GRANULARITY_OPLINE
+ */
+void excimer_log_set_granularity(excimer_log *log, int granularity);
+
+/**
+ * Enable or disable compact storage of entries. Existing entries are
+ * converted. Compact storage is not used while the log is in aggregate
+ * mode, since aggregation updates entries in place.
+ *
+ * @param log The log object
+ * @param compact Whether to use compact storage
+ */
+void excimer_log_set_compact(excimer_log *log, int compact);
+
+/**
+ * Enable or disable aggregate mode. When it is enabled, existing entries
+ * with the same leaf frame are merged.
+ *
+ * @param log The log object
+ * @param aggregate Whether to aggregate
+ */
+void excimer_log_set_aggregate(excimer_log *log, int aggregate);
+
+/**
+ * Enable or disable coalescing of consecutive samples with the same stack
+ *
+ * @param log The log object
+ * @param coalesce Whether to coalesce
+ */
+void excimer_log_set_coalesce(excimer_log *log, int coalesce);
+
 /**
  * Copy persistent options to another log. This is used during log rotation.
  *
@@ -146,15 +635,145 @@ void excimer_log_set_max_depth(excimer_log *log, zend_long depth);
 void excimer_log_copy_options(excimer_log *dest, excimer_log *src);
 
 /**
- * Add a log entry
+ * Get the number of bytes allocated for the log's entries
+ *
+ * @param log The log object
+ */
+size_t excimer_log_get_entry_bytes(excimer_log *log);
+
+/**
+ * Get the number of bytes of request memory used by the log's entries,
+ * frames, frame name caches and stack cache. A persistent frame store is not
+ * counted.
+ *
+ * @param log The log object
+ */
+size_t excimer_log_get_memory_usage(excimer_log *log);
+
+/**
+ * Free the unused capacity of the entries array
+ *
+ * @param log The log object
+ */
+void excimer_log_trim(excimer_log *log);
+
+/**
+ * Keep the current total event count, sampling further events with a
+ * reservoir, and stop adding frames. This switches the log to aggregate
+ * mode. The reservoir is removed, and frames may be added again, if
+ * aggregate mode is disabled.
+ *
+ * @param log The log object
+ */
+void excimer_log_start_reservoir(excimer_log *log);
+
+/**
+ * Get the number of bytes allocated for the frames and the frame hashtable.
+ * If the frame store is shared, this is the size of the shared store.
+ *
+ * @param log The log object
+ */
+size_t excimer_log_get_frame_bytes(excimer_log *log);
+
+/**
+ * Reserve memory for the given number of entries and frames, so that the
+ * arrays will not need to be reallocated while the log is growing to that
+ * size. This does not shrink the log.
+ *
+ * @param log The log object
+ * @param entries The number of entries to reserve space for
+ * @param frames The number of frames to reserve space for
+ */
+void excimer_log_reserve(excimer_log *log, size_t entries, size_t frames);
+
+/**
+ * Add a log entry. In aggregate mode, if there is already an entry with the
+ * same leaf frame, its event count is incremented instead. If coalescing is
+ * enabled and the last entry has the same leaf frame, its event count is
+ * incremented.
  *
  * @param log The log object
  * @param execute_data The VM state
  * @param event_count The number of times the timer expired
  * @param timestamp The timestamp to store in the log entry
+ * @param cpu_time The CPU time since the previous entry, or zero
  */
 void excimer_log_add(excimer_log *log, zend_execute_data *execute_data,
-		zend_long event_count, uint64_t timestamp);
+		zend_long event_count, uint64_t timestamp, uint64_t cpu_time);
+
+/**
+ * Append the entries of another log. Frames of the source log are added to
+ * the destination, unless the logs share a frame store. In aggregate mode,
+ * entries with a leaf frame already in the destination are combined with
+ * the existing entry. The source log is not modified, unless it is the
+ * destination.
+ *
+ * @param dest The destination log object
+ * @param src The source log object
+ */
+void excimer_log_merge(excimer_log *dest, excimer_log *src);
+
+/**
+ * Find or add a frame named {thread:N}, which identifies the thread of the
+ * frames below it when logs of several threads are merged. The frame has no
+ * filename and a zero line number.
+ *
+ * @param log The log object
+ * @param thread_id The thread number
+ * @return The index of the frame
+ */
+uint32_t excimer_log_get_thread_frame(excimer_log *log, zend_long thread_id);
+
+/** The version of the serialized log format */
+#define EXCIMER_LOG_SERIAL_VERSION 1
+
+/** Serialized log flag: the entries have CPU times */
+#define EXCIMER_LOG_SERIAL_CPU_TIME 1
+
+/**
+ * Serialize a log. All integers are varints, so the format does not depend on
+ * the byte order. The format is:
+ *
+ *   - The magic string "EXCL".
+ *   - The version, EXCIMER_LOG_SERIAL_VERSION.
+ *   - Flags, the period and the epoch.
+ *   - The number of strings, then each string as a length and the bytes.
+ *     String IDs start from 1, and zero means there is no string.
+ *   - The number of frames, then the ID of the truncation marker frame or
+ *     zero, then each frame as the filename, class name and function name
+ *     string IDs, the line number, the closure line and the ID of the calling
+ *     frame, and the opline index. Frame IDs start from 1, and a frame always
+ *     follows its caller.
+ *     Only frames used by the entries are included.
+ *   - The number of entries, then each entry, encoded as in
+ *     excimer_log_block, except that timestamp deltas start from zero.
+ *
+ * @param log The log object
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_serialize(excimer_log *log);
+
+/**
+ * Load a serialized log into an empty log. Frames are added to the log's
+ * store as with excimer_log_merge().
+ *
+ * @param log The log object
+ * @param data The serialized log
+ * @param length The length of the serialized log
+ * @return NULL on success, otherwise an error message. On error the log may
+ *   contain some of the data.
+ */
+const char *excimer_log_unserialize(excimer_log *log, const char *data, size_t length);
+
+/**
+ * Resolve the current stack to a frame, adding any new frames to the log,
+ * without adding a log entry
+ *
+ * @param log The log object
+ * @param execute_data The VM state
+ * @return The index of the leaf frame
+ */
+uint32_t excimer_log_capture(excimer_log *log, zend_execute_data *execute_data);
 
 /**
  * Get the number of entries in the log
@@ -165,7 +784,9 @@ void excimer_log_add(excimer_log *log, zend_execute_data *execute_data,
 zend_long excimer_log_get_size(excimer_log *log);
 
 /**
- * Get a log entry
+ * Get a log entry. In a compact log, the entry is decoded into a buffer
+ * which is overwritten by the next call for an entry in a different block,
+ * or by adding an entry.
  *
  * @param log The log object
  * @param i The index of the entry
@@ -182,6 +803,15 @@ excimer_log_entry *excimer_log_get_entry(excimer_log *log, zend_long i);
  */
 excimer_log_frame *excimer_log_get_frame(excimer_log *log, zend_long i);
 
+/**
+ * Get the name of a frame with spaces replaced, as used in collapsed output
+ *
+ * @param log The log object
+ * @param frame_index The frame index, which must be in range
+ * @return The name, owned by the log
+ */
+zend_string *excimer_log_get_frame_name(excimer_log *log, uint32_t frame_index);
+
 /**
  * Format the log in flamegraph.pl collapsed format
  *
@@ -190,6 +820,53 @@ excimer_log_frame *excimer_log_get_frame(excimer_log *log, zend_long i);
  */
 zend_string *excimer_log_format_collapsed(excimer_log *log);
 
+/**
+ * Format the log as a pprof Profile protobuf message. The output is not
+ * compressed.
+ *
+ * @param log The log object
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_format_pprof(excimer_log *log);
+
+/**
+ * Copy the log into a new snapshot in persistent memory
+ *
+ * @param log The log object
+ * @return A new snapshot, to be destroyed with excimer_log_snapshot_destroy()
+ */
+excimer_log_snapshot *excimer_log_snapshot_create(excimer_log *log);
+
+/**
+ * Destroy and free a snapshot. This may be called from any thread.
+ *
+ * @param snapshot The snapshot
+ */
+void excimer_log_snapshot_destroy(excimer_log_snapshot *snapshot);
+
+/**
+ * Append a snapshot to a buffer in flamegraph.pl collapsed format. The
+ * result is the same as excimer_log_format_collapsed() for the original log.
+ * If persistent is non-zero, this may be called from any thread.
+ *
+ * @param snapshot The snapshot
+ * @param dest The destination buffer
+ * @param persistent Whether the buffer uses persistent memory
+ */
+void excimer_log_snapshot_format_collapsed(excimer_log_snapshot *snapshot,
+		smart_str *dest, int persistent);
+
+/**
+ * Append a snapshot to a buffer as a pprof Profile protobuf message. If
+ * persistent is non-zero, this may be called from any thread.
+ *
+ * @param snapshot The snapshot
+ * @param dest The destination buffer
+ * @param persistent Whether the buffer uses persistent memory
+ */
+void excimer_log_snapshot_format_pprof(excimer_log_snapshot *snapshot,
+		smart_str *dest, int persistent);
+
 /**
  * Get an array in speedscope format
  *
@@ -198,6 +875,15 @@ zend_string *excimer_log_format_collapsed(excimer_log *log);
  */
 void excimer_log_get_speedscope_data(excimer_log *log, zval *zp_data);
 
+/**
+ * Format the log as a JSON document in speedscope format. The result is
+ * equivalent to JSON-encoding the result of excimer_log_get_speedscope_data().
+ *
+ * @param log The log object
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_format_speedscope(excimer_log *log);
+
 /**
  * Aggregate the log producing self/inclusive statistics as an array
  */
@@ -0,0 +1,321 @@
+/* Copyright 2026 Wikimedia Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "php.h"
+#include "php_excimer.h"
+#include "excimer_ring.h"
+
+#define excimer_ring_atomic_load(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define excimer_ring_atomic_store(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define excimer_ring_atomic_add(ptr, value) __atomic_fetch_add(ptr, value, __ATOMIC_RELAXED)
+#define excimer_ring_atomic_cas(ptr, expected, desired) \
+	__atomic_compare_exchange_n(ptr, expected, desired, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+#define EXCIMER_RING_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+/** The mapping, or NULL if the ring is disabled */
+static excimer_ring_header *excimer_ring_mapping;
+
+/** The size of the mapping */
+static size_t excimer_ring_mapping_size;
+
+/** The last stream ID allocated, excluding the process ID */
+static uint32_t excimer_ring_last_stream;
+
+static inline char *excimer_ring_data(void)
+{
+	return (char*)excimer_ring_mapping + EXCIMER_RING_HEADER_SIZE;
+}
+
+int excimer_ring_module_init(const char *path, size_t size)
+{
+	size_t data_size = EXCIMER_RING_MIN_SIZE;
+	size_t mapping_size;
+	struct stat st;
+	excimer_ring_header *header;
+	excimer_ring_header existing;
+	int initialised = 0;
+	int fd;
+
+	if (!path || !*path) {
+		return SUCCESS;
+	}
+	while (data_size < size && data_size <= SIZE_MAX / 4) {
+		data_size *= 2;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		php_error_docref(NULL, E_WARNING, "Unable to open ring file \"%s\": %s",
+			path, strerror(errno));
+		return FAILURE;
+	}
+
+	/* Serialize initialisation with other processes mapping the file */
+	flock(fd, LOCK_EX);
+	if (fstat(fd, &st) != 0) {
+		php_error_docref(NULL, E_WARNING, "Unable to stat ring file \"%s\": %s",
+			path, strerror(errno));
+		close(fd);
+		return FAILURE;
+	}
+
+	/* A valid ring may be in use by other processes, so it must not be
+	 * resized or reset */
+	if ((size_t)st.st_size >= sizeof(existing)
+		&& pread(fd, &existing, sizeof(existing), 0) == sizeof(existing)
+		&& existing.magic == EXCIMER_RING_MAGIC)
+	{
+		if (existing.version != EXCIMER_RING_VERSION
+			|| existing.size < EXCIMER_RING_MIN_SIZE
+			|| (existing.size & (existing.size - 1))
+			|| (uint64_t)st.st_size < EXCIMER_RING_HEADER_SIZE + existing.size)
+		{
+			php_error_docref(NULL, E_WARNING, "Ring file \"%s\" has an unsupported "
+				"version or an invalid size, it must be deleted to be reinitialised", path);
+			close(fd);
+			return FAILURE;
+		}
+		if (existing.size != data_size) {
+			php_error_docref(NULL, E_WARNING, "Ring file \"%s\" already has a data area "
+				"of %zu bytes, excimer.ring_size is ignored until it is deleted",
+				path, (size_t)existing.size);
+			data_size = existing.size;
+		}
+		initialised = 1;
+	}
+	mapping_size = EXCIMER_RING_HEADER_SIZE + data_size;
+
+	if (!initialised && (size_t)st.st_size != mapping_size && ftruncate(fd, mapping_size) != 0) {
+		php_error_docref(NULL, E_WARNING, "Unable to resize ring file \"%s\": %s",
+			path, strerror(errno));
+		close(fd);
+		return FAILURE;
+	}
+	header = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED) {
+		php_error_docref(NULL, E_WARNING, "Unable to map ring file \"%s\": %s",
+			path, strerror(errno));
+		close(fd);
+		return FAILURE;
+	}
+	if (!initialised) {
+		memset(header, 0, mapping_size);
+		header->version = EXCIMER_RING_VERSION;
+		header->size = data_size;
+		excimer_ring_atomic_store(&header->magic, EXCIMER_RING_MAGIC);
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	excimer_ring_mapping = header;
+	excimer_ring_mapping_size = mapping_size;
+	return SUCCESS;
+}
+
+void excimer_ring_module_shutdown(void)
+{
+	if (excimer_ring_mapping) {
+		munmap(excimer_ring_mapping, excimer_ring_mapping_size);
+		excimer_ring_mapping = NULL;
+	}
+}
+
+int excimer_ring_is_enabled(void)
+{
+	return excimer_ring_mapping != NULL;
+}
+
+uint64_t excimer_ring_new_stream(void)
+{
+	uint32_t id = excimer_ring_atomic_add(&excimer_ring_last_stream, 1) + 1;
+	return ((uint64_t)getpid() << 32) | id;
+}
+
+/**
+ * Commit a record whose length has been stored
+ *
+ * @return SUCCESS, or FAILURE if the consumer has abandoned the record
+ */
+static inline int excimer_ring_commit(excimer_ring_record_header *record, uint32_t type)
+{
+	uint32_t expected = 0;
+	while (!excimer_ring_atomic_cas(&record->type, &expected, type)) {
+		/* The weak compare-and-swap may fail spuriously */
+		if (expected) {
+			return FAILURE;
+		}
+	}
+	return SUCCESS;
+}
+
+int excimer_ring_write(uint32_t type,
+	const void *part1, size_t part1_length,
+	const void *part2, size_t part2_length,
+	const void *part3, size_t part3_length)
+{
+	excimer_ring_header *header = excimer_ring_mapping;
+	size_t payload_length = part1_length + part2_length + part3_length;
+	size_t length = EXCIMER_RING_ALIGN(sizeof(excimer_ring_record_header) + payload_length);
+	uint64_t size, head, tail, offset, padding;
+	excimer_ring_record_header *record, *padding_record = NULL;
+	uint32_t pid;
+	char *dest;
+
+	if (!header) {
+		return FAILURE;
+	}
+	size = header->size;
+	if (length > size / 2) {
+		excimer_ring_atomic_add(&header->dropped, 1);
+		return FAILURE;
+	}
+
+	/* Reserve space */
+	head = excimer_ring_atomic_load(&header->head);
+	do {
+		tail = excimer_ring_atomic_load(&header->tail);
+		offset = head & (size - 1);
+		padding = offset + length > size ? size - offset : 0;
+		if (head + padding + length - tail > size) {
+			excimer_ring_atomic_add(&header->dropped, 1);
+			return FAILURE;
+		}
+	} while (!excimer_ring_atomic_cas(&header->head, &head, head + padding + length));
+
+	/* Store the process ID and lengths first, so that the consumer can skip
+	 * the records if this process dies before committing them */
+	pid = (uint32_t)getpid();
+	if (padding) {
+		padding_record = (excimer_ring_record_header*)(excimer_ring_data() + offset);
+		excimer_ring_atomic_store(&padding_record->pid, pid);
+		excimer_ring_atomic_store(&padding_record->length, padding);
+		offset = 0;
+	}
+	record = (excimer_ring_record_header*)(excimer_ring_data() + offset);
+	excimer_ring_atomic_store(&record->pid, pid);
+	excimer_ring_atomic_store(&record->length, length);
+	if (padding) {
+		excimer_ring_commit(padding_record, EXCIMER_RING_PADDING);
+	}
+
+	/* Write the payload, then commit */
+	dest = excimer_ring_data() + offset + sizeof(excimer_ring_record_header);
+	memcpy(dest, part1, part1_length);
+	if (part2_length) {
+		memcpy(dest + part1_length, part2, part2_length);
+	}
+	if (part3_length) {
+		memcpy(dest + part1_length + part2_length, part3, part3_length);
+	}
+	return excimer_ring_commit(record, type);
+}
+
+/**
+ * Check whether a process may still exist. A process which exists but
+ * belongs to another user is reported as existing.
+ */
+static int excimer_ring_process_exists(uint32_t pid)
+{
+	return kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+}
+
+int excimer_ring_lock_reader(void)
+{
+	excimer_ring_header *header = excimer_ring_mapping;
+	uint32_t pid = (uint32_t)getpid();
+	uint32_t owner = 0;
+
+	if (!header) {
+		return FAILURE;
+	}
+	while (!excimer_ring_atomic_cas(&header->reader, &owner, pid)) {
+		/* Take over the lock of a consumer which died, but not that of
+		 * another thread in this process */
+		if (owner && (owner == pid || excimer_ring_process_exists(owner))) {
+			return FAILURE;
+		}
+	}
+	return SUCCESS;
+}
+
+void excimer_ring_unlock_reader(void)
+{
+	if (excimer_ring_mapping) {
+		excimer_ring_atomic_store(&excimer_ring_mapping->reader, 0);
+	}
+}
+
+int excimer_ring_read(void (*callback)(uint32_t type, const char *payload,
+	size_t length, void *arg), void *arg)
+{
+	excimer_ring_header *header = excimer_ring_mapping;
+	excimer_ring_record_header *record;
+	uint64_t tail, offset;
+	uint32_t type, length;
+
+	if (!header) {
+		return 0;
+	}
+	while (1) {
+		tail = header->tail;
+		if (tail == excimer_ring_atomic_load(&header->head)) {
+			return 0;
+		}
+		offset = tail & (header->size - 1);
+		record = (excimer_ring_record_header*)(excimer_ring_data() + offset);
+		type = excimer_ring_atomic_load(&record->type);
+		length = excimer_ring_atomic_load(&record->length);
+		if (!type) {
+			/* Without a length, the extent of the record is unknown, so it
+			 * can only be waited for. A live producer is always waited for. */
+			uint32_t pid = excimer_ring_atomic_load(&record->pid);
+			if (!length || length > header->size - offset
+				|| !pid || excimer_ring_process_exists(pid))
+			{
+				return 0;
+			}
+			if (!excimer_ring_atomic_cas(&record->type, &type, EXCIMER_RING_ABANDONED)) {
+				/* Committed just now */
+				continue;
+			}
+			excimer_ring_atomic_add(&header->dropped, 1);
+			type = EXCIMER_RING_ABANDONED;
+		}
+		if (type != EXCIMER_RING_PADDING && type != EXCIMER_RING_ABANDONED) {
+			callback(type, (const char*)(record + 1),
+				length - sizeof(excimer_ring_record_header), arg);
+		}
+		memset(record, 0, length);
+		excimer_ring_atomic_store(&header->tail, tail + length);
+		if (type != EXCIMER_RING_PADDING && type != EXCIMER_RING_ABANDONED) {
+			return 1;
+		}
+	}
+}
+
+uint64_t excimer_ring_get_dropped(void)
+{
+	return excimer_ring_mapping ? excimer_ring_atomic_load(&excimer_ring_mapping->dropped) : 0;
+}
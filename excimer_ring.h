@@ -0,0 +1,241 @@
+/* Copyright 2026 Wikimedia Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EXCIMER_RING_H
+#define EXCIMER_RING_H
+
+#include <stdint.h>
+
+/*
+ * A multi-producer, single-consumer ring buffer of records, in a shared
+ * memory mapping of the file named by excimer.ring_path. The file is mapped
+ * during module startup, so with a pre-forking SAPI like FPM, all workers
+ * write to the same ring.
+ *
+ * Each record starts with an excimer_ring_record_header and is padded to a
+ * multiple of 8 bytes. A producer reserves space by advancing "head" with a
+ * compare-and-swap, and immediately stores its process ID and then the
+ * record length. It then writes the payload and commits the record by
+ * changing the type from zero to a non-zero type with a compare-and-swap. If
+ * a record would cross the end of the buffer, a padding record is written up
+ * to the end, and the record starts at the beginning. If there is not enough
+ * free space, the record is dropped and "dropped" is incremented.
+ *
+ * The consumer reads records from "tail" until it finds one with a zero
+ * type, which is not yet committed. It must zero each record it consumes
+ * before advancing "tail" past it, so that reserved space never contains a
+ * stale record. A slow producer is waited for. Only if the record at "tail"
+ * has a length and its producer process no longer exists does the consumer
+ * abandon it, by setting its type to EXCIMER_RING_ABANDONED, counting it as
+ * dropped and skipping it. So all processes using a ring must share a PID
+ * namespace.
+ *
+ * There is one consumer at a time. A consumer holds the lock by storing its
+ * process ID in "reader" with a compare-and-swap, and the lock may be taken
+ * over if that process no longer exists.
+ *
+ * A ring file is initialised by the first process to map it, and is never
+ * resized or reset while its header is valid. To change the size or the
+ * version, the file must be deleted while no process has it mapped.
+ *
+ * All integers are in the native byte order.
+ */
+
+/** The magic number at the start of the header: "EXRB" */
+#define EXCIMER_RING_MAGIC 0x42525845
+
+/** The version of the record format */
+#define EXCIMER_RING_VERSION 2
+
+/** The offset of the data area. The header is padded to this size. */
+#define EXCIMER_RING_HEADER_SIZE 256
+
+/** The minimum size of the data area */
+#define EXCIMER_RING_MIN_SIZE 65536
+
+/** Record type: padding up to the end of the data area */
+#define EXCIMER_RING_PADDING 1
+
+/** Record type: a frame, with an excimer_ring_frame payload */
+#define EXCIMER_RING_FRAME 2
+
+/** Record type: a sample, with an excimer_ring_sample payload */
+#define EXCIMER_RING_SAMPLE 3
+
+/** Record type: a record whose producer died before committing it */
+#define EXCIMER_RING_ABANDONED 4
+
+typedef struct _excimer_ring_header {
+	/** EXCIMER_RING_MAGIC, stored last during initialisation */
+	uint32_t magic;
+
+	/** EXCIMER_RING_VERSION */
+	uint32_t version;
+
+	/** The size of the data area. This is a power of two. */
+	uint64_t size;
+
+	/** The number of records dropped because the ring was full */
+	uint64_t dropped;
+
+	/** The process ID of the consumer holding the lock, or zero */
+	uint32_t reader;
+
+	char pad1[36];
+
+	/** The total number of bytes reserved by producers */
+	uint64_t head;
+
+	char pad2[56];
+
+	/** The total number of bytes consumed */
+	uint64_t tail;
+} excimer_ring_header;
+
+typedef struct _excimer_ring_record_header {
+	/** The length of the record including the header and padding */
+	uint32_t length;
+
+	/** The record type, or zero if the record is not yet committed */
+	uint32_t type;
+
+	/** The process ID of the producer */
+	uint32_t pid;
+
+	uint32_t reserved;
+} excimer_ring_record_header;
+
+/**
+ * A frame record. The name and filename follow the fixed-size part, without
+ * terminators. Frame IDs are only unique within a stream. A stream is a log
+ * in one process, and a frame is always written to the ring before any
+ * frame or sample which refers to it.
+ */
+typedef struct _excimer_ring_frame {
+	/** The stream ID. The high 32 bits are the process ID. */
+	uint64_t stream;
+
+	/** The frame ID */
+	uint32_t frame_id;
+
+	/** The ID of the calling frame, or zero if there is none */
+	uint32_t prev_id;
+
+	/** The line number */
+	uint32_t lineno;
+
+	/** The closure start line, or zero */
+	uint32_t closure_line;
+
+	/** The length of the function name, as formatted in collapsed output */
+	uint32_t name_length;
+
+	/** The length of the filename */
+	uint32_t filename_length;
+} excimer_ring_frame;
+
+/**
+ * A sample record. The stack is the leaf frame followed by its prev_id
+ * chain.
+ */
+typedef struct _excimer_ring_sample {
+	/** The stream ID */
+	uint64_t stream;
+
+	/** The ID of the leaf frame, or zero if no frames were captured */
+	uint32_t frame_id;
+
+	uint32_t reserved;
+
+	/** The event count */
+	int64_t event_count;
+
+	/** The wall clock time in nanoseconds */
+	uint64_t timestamp;
+} excimer_ring_sample;
+
+/**
+ * Map the ring. This is called during module startup. If path is empty, the
+ * ring is disabled. If the file already contains a ring of a different
+ * size, a warning is raised and the existing size is used.
+ *
+ * @param path The filename
+ * @param size The requested size of the data area, which is rounded up to
+ *   a power of two
+ * @return SUCCESS or FAILURE. On failure a warning has been raised.
+ */
+int excimer_ring_module_init(const char *path, size_t size);
+
+/**
+ * Unmap the ring
+ */
+void excimer_ring_module_shutdown(void);
+
+/**
+ * Check whether the ring is mapped
+ */
+int excimer_ring_is_enabled(void);
+
+/**
+ * Get a new stream ID for the current process
+ */
+uint64_t excimer_ring_new_stream(void);
+
+/**
+ * Write a record to the ring. This never blocks.
+ *
+ * @param type The record type
+ * @param part1 The fixed-size part of the payload
+ * @param part1_length The length of part1
+ * @param part2 Data to append to the payload, or NULL
+ * @param part2_length The length of part2
+ * @param part3 More data to append to the payload, or NULL
+ * @param part3_length The length of part3
+ * @return SUCCESS, or FAILURE if the record was dropped
+ */
+int excimer_ring_write(uint32_t type,
+	const void *part1, size_t part1_length,
+	const void *part2, size_t part2_length,
+	const void *part3, size_t part3_length);
+
+/**
+ * Take the consumer lock of the ring
+ *
+ * @return SUCCESS, or FAILURE if another consumer holds the lock
+ */
+int excimer_ring_lock_reader(void);
+
+/**
+ * Release the consumer lock of the ring
+ */
+void excimer_ring_unlock_reader(void);
+
+/**
+ * Consume one record from the ring. The caller must hold the consumer lock.
+ *
+ * @param callback A function which is called with the record type, payload
+ *   and payload length. The payload is only valid during the call.
+ * @param arg An argument to pass to the callback
+ * @return 1 if a record was consumed, 0 if there was no committed record
+ */
+int excimer_ring_read(void (*callback)(uint32_t type, const char *payload,
+	size_t length, void *arg), void *arg);
+
+/**
+ * Get the total number of records dropped because the ring was full
+ */
+uint64_t excimer_ring_get_dropped(void);
+
+#endif
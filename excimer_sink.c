@@ -0,0 +1,481 @@
+/* Copyright 2026 Wikimedia Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "php.h"
+#include "Zend/zend_smart_str.h"
+#include "php_excimer.h"
+#include "excimer_sink.h"
+
+/**
+ * The maximum payload of a UDP datagram. Collapsed output larger than this
+ * is split into several datagrams at line boundaries.
+ */
+#define EXCIMER_SINK_MAX_DATAGRAM 65507
+
+/** A snapshot waiting to be written */
+typedef struct _excimer_sink_job {
+	/** The snapshot, owned by the job */
+	excimer_log_snapshot *snapshot;
+
+	/** The output format */
+	int format;
+
+	/** The target, in persistent memory */
+	char *target;
+
+	/** The next job in the queue */
+	struct _excimer_sink_job *next;
+} excimer_sink_job;
+
+/**
+ * The process-wide state of the background thread. All members are
+ * protected by the mutex.
+ */
+static struct {
+	pthread_mutex_t mutex;
+
+	/** Signalled when a job is queued or the thread should exit */
+	pthread_cond_t cond;
+
+	/** The background thread */
+	pthread_t thread;
+
+	/** Whether the thread was started and not yet joined */
+	int thread_valid;
+
+	/** Whether the thread should exit once the queue is empty */
+	int shutdown;
+
+	/** Whether the fork handlers have been registered */
+	int atfork_registered;
+
+	/** The queue */
+	excimer_sink_job *head, *tail;
+
+	/**
+	 * The number of jobs in the queue, plus the number of slots reserved by
+	 * submitters which are still preparing a job
+	 */
+	size_t num_queued;
+} excimer_sink = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER
+};
+
+static void excimer_sink_job_free(excimer_sink_job *job)
+{
+	excimer_log_snapshot_destroy(job->snapshot);
+	pefree(job->target, 1);
+	pefree(job, 1);
+}
+
+/**
+ * Write a whole buffer to a file descriptor or connected socket
+ */
+static int excimer_sink_write_all(int fd, const char *data, size_t length)
+{
+	while (length) {
+		ssize_t n = write(fd, data, length);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return FAILURE;
+		}
+		data += n;
+		length -= n;
+	}
+	return SUCCESS;
+}
+
+static int excimer_sink_write_udp(const char *address, int format,
+	const char *data, size_t length)
+{
+	char host[256];
+	const char *colon = strrchr(address, ':');
+	size_t host_length = colon - address;
+	struct addrinfo hints, *res, *ai;
+	int fd = -1;
+	int status = SUCCESS;
+
+	/* Strip the brackets from an IPv6 address */
+	if (host_length >= 2 && address[0] == '[' && colon[-1] == ']') {
+		address++;
+		host_length -= 2;
+	}
+	if (host_length >= sizeof(host)) {
+		return FAILURE;
+	}
+	memcpy(host, address, host_length);
+	host[host_length] = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, colon + 1, &hints, &res) != 0) {
+		return FAILURE;
+	}
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		return FAILURE;
+	}
+
+	while (length) {
+		size_t chunk = length;
+		/* A pprof message can't be split, but collapsed lines can */
+		if (format == EXCIMER_FORMAT_COLLAPSED && chunk > EXCIMER_SINK_MAX_DATAGRAM) {
+			const char *end = data + EXCIMER_SINK_MAX_DATAGRAM;
+			while (end > data && end[-1] != '\n') {
+				end--;
+			}
+			if (end > data) {
+				chunk = end - data;
+			}
+		}
+		if (send(fd, data, chunk, 0) < 0) {
+			status = FAILURE;
+			break;
+		}
+		data += chunk;
+		length -= chunk;
+	}
+	close(fd);
+	return status;
+}
+
+static int excimer_sink_write_unix(const char *path, const char *data, size_t length)
+{
+	struct sockaddr_un addr;
+	int fd;
+	int status = SUCCESS;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return FAILURE;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return FAILURE;
+	}
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		/* The listener may be a datagram socket instead */
+		int error = errno;
+		close(fd);
+		if (error != EPROTOTYPE) {
+			return FAILURE;
+		}
+		fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (fd < 0) {
+			return FAILURE;
+		}
+		if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+			|| send(fd, data, length, 0) < 0)
+		{
+			status = FAILURE;
+		}
+		close(fd);
+		return status;
+	}
+	status = excimer_sink_write_all(fd, data, length);
+	close(fd);
+	return status;
+}
+
+static int excimer_sink_write_file(const char *path, int format,
+	const char *data, size_t length)
+{
+	char *tmp_path;
+	size_t tmp_path_size;
+	int fd;
+	int status;
+
+	if (format == EXCIMER_FORMAT_COLLAPSED) {
+		/* Collapsed output can be concatenated, so append it */
+		fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+		if (fd < 0) {
+			return FAILURE;
+		}
+		status = excimer_sink_write_all(fd, data, length);
+		close(fd);
+		return status;
+	}
+
+	/* Concatenated protobuf messages are merged by the reader, which
+	 * would corrupt the string table. So atomically replace the file. */
+	tmp_path_size = strlen(path) + sizeof(".4294967295.tmp");
+	tmp_path = pemalloc(tmp_path_size, 1);
+	snprintf(tmp_path, tmp_path_size, "%s.%lu.tmp", path, (unsigned long)getpid());
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		pefree(tmp_path, 1);
+		return FAILURE;
+	}
+	status = excimer_sink_write_all(fd, data, length);
+	if (close(fd) != 0) {
+		status = FAILURE;
+	}
+	if (status == SUCCESS && rename(tmp_path, path) != 0) {
+		status = FAILURE;
+	}
+	if (status == FAILURE) {
+		unlink(tmp_path);
+	}
+	pefree(tmp_path, 1);
+	return status;
+}
+
+static void excimer_sink_process(excimer_sink_job *job)
+{
+	smart_str ss_out = {NULL};
+	const char *target = job->target;
+	const char *data;
+	size_t length;
+
+	if (job->format == EXCIMER_FORMAT_PPROF) {
+		excimer_log_snapshot_format_pprof(job->snapshot, &ss_out, 1);
+	} else {
+		excimer_log_snapshot_format_collapsed(job->snapshot, &ss_out, 1);
+	}
+	if (!ss_out.s) {
+		return;
+	}
+	data = ZSTR_VAL(ss_out.s);
+	length = ZSTR_LEN(ss_out.s);
+
+	/* There is no way to report a write error from here, and the next
+	 * snapshot may succeed, so errors are ignored. */
+	if (!strncmp(target, "udp://", sizeof("udp://") - 1)) {
+		excimer_sink_write_udp(target + sizeof("udp://") - 1, job->format, data, length);
+	} else if (!strncmp(target, "unix://", sizeof("unix://") - 1)) {
+		excimer_sink_write_unix(target + sizeof("unix://") - 1, data, length);
+	} else if (!strncmp(target, "fd://", sizeof("fd://") - 1)) {
+		excimer_sink_write_all(atoi(target + sizeof("fd://") - 1), data, length);
+	} else {
+		excimer_sink_write_file(target, job->format, data, length);
+	}
+	smart_str_free_ex(&ss_out, 1);
+}
+
+static void *excimer_sink_thread_main(void *arg)
+{
+	pthread_mutex_lock(&excimer_sink.mutex);
+	while (1) {
+		excimer_sink_job *job;
+
+		while (!excimer_sink.head && !excimer_sink.shutdown) {
+			pthread_cond_wait(&excimer_sink.cond, &excimer_sink.mutex);
+		}
+		job = excimer_sink.head;
+		if (!job) {
+			break;
+		}
+		excimer_sink.head = job->next;
+		if (!excimer_sink.head) {
+			excimer_sink.tail = NULL;
+		}
+		excimer_sink.num_queued--;
+
+		pthread_mutex_unlock(&excimer_sink.mutex);
+		excimer_sink_process(job);
+		excimer_sink_job_free(job);
+		pthread_mutex_lock(&excimer_sink.mutex);
+	}
+	pthread_mutex_unlock(&excimer_sink.mutex);
+	return NULL;
+}
+
+static void excimer_sink_atfork_prepare(void)
+{
+	pthread_mutex_lock(&excimer_sink.mutex);
+}
+
+static void excimer_sink_atfork_parent(void)
+{
+	pthread_mutex_unlock(&excimer_sink.mutex);
+}
+
+/**
+ * The thread does not exist in the child. Discard the queue, which belongs
+ * to the parent, and let the thread be started again on demand.
+ */
+static void excimer_sink_atfork_child(void)
+{
+	excimer_sink_job *job, *next;
+
+	for (job = excimer_sink.head; job; job = next) {
+		next = job->next;
+		excimer_sink_job_free(job);
+	}
+	excimer_sink.head = excimer_sink.tail = NULL;
+	excimer_sink.num_queued = 0;
+	excimer_sink.thread_valid = 0;
+	pthread_mutex_init(&excimer_sink.mutex, NULL);
+	pthread_cond_init(&excimer_sink.cond, NULL);
+}
+
+/**
+ * Start the thread if it is not running. The mutex must be held.
+ */
+static int excimer_sink_start_thread(void)
+{
+	sigset_t all_signals, old_signals;
+	int error;
+
+	if (excimer_sink.thread_valid) {
+		return SUCCESS;
+	}
+	if (!excimer_sink.atfork_registered) {
+		if (pthread_atfork(excimer_sink_atfork_prepare,
+			excimer_sink_atfork_parent,
+			excimer_sink_atfork_child) != 0)
+		{
+			return FAILURE;
+		}
+		excimer_sink.atfork_registered = 1;
+	}
+
+	/* Block signals in the new thread so that they are delivered to a
+	 * request thread */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	error = pthread_create(&excimer_sink.thread, NULL, excimer_sink_thread_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if (error) {
+		return FAILURE;
+	}
+	excimer_sink.thread_valid = 1;
+	excimer_sink.shutdown = 0;
+	return SUCCESS;
+}
+
+const char *excimer_sink_check_target(const char *target)
+{
+	if (!strncmp(target, "udp://", sizeof("udp://") - 1)) {
+		const char *address = target + sizeof("udp://") - 1;
+		const char *colon = strrchr(address, ':');
+		if (!colon || colon == address || !colon[1]) {
+			return "UDP target must be of the form udp://host:port";
+		}
+	} else if (!strncmp(target, "unix://", sizeof("unix://") - 1)) {
+		if (!target[sizeof("unix://") - 1]) {
+			return "Unix socket target must have a path";
+		}
+		if (strlen(target + sizeof("unix://") - 1) >= sizeof(((struct sockaddr_un*)0)->sun_path)) {
+			return "Unix socket path is too long";
+		}
+	} else if (!strncmp(target, "fd://", sizeof("fd://") - 1)) {
+		const char *p = target + sizeof("fd://") - 1;
+		if (!*p) {
+			return "File descriptor target must have a number";
+		}
+		for (; *p; p++) {
+			if (*p < '0' || *p > '9') {
+				return "File descriptor target must have a number";
+			}
+		}
+	} else if (!*target) {
+		return "Target must not be empty";
+	}
+	return NULL;
+}
+
+int excimer_sink_submit(excimer_log *log, int format, const char *target)
+{
+	excimer_sink_job *job;
+
+	pthread_mutex_lock(&excimer_sink.mutex);
+	if (excimer_sink.num_queued >= EXCIMER_SINK_MAX_QUEUED
+		|| excimer_sink_start_thread() == FAILURE)
+	{
+		pthread_mutex_unlock(&excimer_sink.mutex);
+		return FAILURE;
+	}
+	/* Reserve a slot, so that concurrent submitters can't exceed the limit */
+	excimer_sink.num_queued++;
+	pthread_mutex_unlock(&excimer_sink.mutex);
+
+	/* Take the snapshot without holding the mutex */
+	job = pemalloc(sizeof(excimer_sink_job), 1);
+	job->snapshot = excimer_log_snapshot_create(log);
+	if (!job->snapshot) {
+		pefree(job, 1);
+		pthread_mutex_lock(&excimer_sink.mutex);
+		excimer_sink.num_queued--;
+		pthread_mutex_unlock(&excimer_sink.mutex);
+		return FAILURE;
+	}
+	job->format = format;
+	job->target = pestrdup(target, 1);
+	job->next = NULL;
+
+	pthread_mutex_lock(&excimer_sink.mutex);
+	if (excimer_sink.tail) {
+		excimer_sink.tail->next = job;
+	} else {
+		excimer_sink.head = job;
+	}
+	excimer_sink.tail = job;
+	pthread_cond_signal(&excimer_sink.cond);
+	pthread_mutex_unlock(&excimer_sink.mutex);
+	return SUCCESS;
+}
+
+void excimer_sink_shutdown(void)
+{
+	pthread_t thread;
+
+	pthread_mutex_lock(&excimer_sink.mutex);
+	if (!excimer_sink.thread_valid) {
+		pthread_mutex_unlock(&excimer_sink.mutex);
+		return;
+	}
+	excimer_sink.shutdown = 1;
+	thread = excimer_sink.thread;
+	pthread_cond_signal(&excimer_sink.cond);
+	pthread_mutex_unlock(&excimer_sink.mutex);
+
+	pthread_join(thread, NULL);
+
+	pthread_mutex_lock(&excimer_sink.mutex);
+	excimer_sink.thread_valid = 0;
+	excimer_sink.shutdown = 0;
+	pthread_mutex_unlock(&excimer_sink.mutex);
+}
@@ -0,0 +1,65 @@
+/* Copyright 2026 Wikimedia Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EXCIMER_SINK_H
+#define EXCIMER_SINK_H
+
+#include "excimer_log.h"
+
+enum {
+	/** Output format: flamegraph.pl collapsed format */
+	EXCIMER_FORMAT_COLLAPSED,
+	/** Output format: pprof Profile protobuf message */
+	EXCIMER_FORMAT_PPROF
+};
+
+/**
+ * The maximum number of snapshots waiting to be written. If a snapshot is
+ * submitted while the queue is full, it is dropped.
+ */
+#define EXCIMER_SINK_MAX_QUEUED 16
+
+/**
+ * Check whether a target string is valid. The target may be:
+ *
+ *   - udp://host:port to send datagrams to a UDP socket,
+ *   - unix:///path to connect to a Unix domain socket,
+ *   - fd://N to write to a file descriptor inherited by the process,
+ *   - anything else is a filename.
+ *
+ * @param target The target string
+ * @return NULL if the target is valid, otherwise an error message
+ */
+const char *excimer_sink_check_target(const char *target);
+
+/**
+ * Snapshot a log and queue it for formatting and writing by the background
+ * thread. The thread is started if necessary.
+ *
+ * @param log The log to snapshot. It is not modified.
+ * @param format EXCIMER_FORMAT_COLLAPSED or EXCIMER_FORMAT_PPROF
+ * @param target A valid target string
+ * @return SUCCESS, or FAILURE if the queue was full or the thread could not
+ *   be started. No error message is raised.
+ */
+int excimer_sink_submit(excimer_log *log, int format, const char *target);
+
+/**
+ * Wait for queued snapshots to be written, then stop the background thread.
+ * This should be called during module shutdown.
+ */
+void excimer_sink_shutdown(void);
+
+#endif
@@ -0,0 +1,338 @@
+/* Copyright 2026 Wikimedia Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "php.h"
+#include "php_excimer.h"
+#include "excimer_mutex.h"
+#include "excimer_threads.h"
+
+#define excimer_threads_atomic_load(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define excimer_threads_atomic_store(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define excimer_threads_atomic_add(ptr, value) __atomic_fetch_add(ptr, value, __ATOMIC_RELAXED)
+
+/**
+ * A serialized log of samples of one thread, waiting to be merged
+ */
+typedef struct _excimer_threads_batch {
+	/** The next batch in the queue */
+	struct _excimer_threads_batch *next;
+
+	/** The length of the data */
+	size_t length;
+
+	/** The serialized log */
+	char data[1];
+} excimer_threads_batch;
+
+static struct {
+	/** The group of threads which are executing a request */
+	excimer_timer_group group;
+
+	/** A mutex protecting the fields below */
+	pthread_mutex_t mutex;
+
+	/** The timer which is sampling all threads, or NULL */
+	excimer_timer *owner;
+
+	/**
+	 * A counter which is incremented when the owner changes, so that
+	 * threads can discard samples collected for a previous owner. This is
+	 * also read atomically without the mutex.
+	 */
+	uint64_t generation;
+
+	/** The options for new thread logs */
+	excimer_threads_options options;
+
+	/**
+	 * The factor by which the owner's period has been multiplied. This is
+	 * read atomically without the mutex.
+	 */
+	zend_long period_multiplier;
+
+	/** The first queued batch, or NULL */
+	excimer_threads_batch *queue_head;
+
+	/** The last queued batch, or NULL */
+	excimer_threads_batch *queue_tail;
+
+	/** The number of queued batches. This is also read atomically without the mutex. */
+	size_t queue_size;
+} excimer_threads;
+
+/** The last thread number assigned */
+static zend_long excimer_threads_last_id;
+
+/**
+ * Take all batches from the queue. The mutex must be held.
+ */
+static excimer_threads_batch *excimer_threads_take_queue(void)
+{
+	excimer_threads_batch *head = excimer_threads.queue_head;
+	excimer_threads.queue_head = NULL;
+	excimer_threads.queue_tail = NULL;
+	excimer_threads_atomic_store(&excimer_threads.queue_size, 0);
+	return head;
+}
+
+static void excimer_threads_free_batches(excimer_threads_batch *batch)
+{
+	while (batch) {
+		excimer_threads_batch *next = batch->next;
+		pefree(batch, 1);
+		batch = next;
+	}
+}
+
+/**
+ * Destroy the log of the current thread
+ */
+static void excimer_threads_free_log(void)
+{
+	excimer_log_destroy(EXCIMER_G(threads_log));
+	efree(EXCIMER_G(threads_log));
+	EXCIMER_G(threads_log) = NULL;
+}
+
+/**
+ * Create the log of the current thread with the owner's options
+ *
+ * @return The log, or NULL if there is no owner
+ */
+static excimer_log *excimer_threads_new_log(void)
+{
+	excimer_threads_options options;
+	excimer_log *log;
+
+	excimer_mutex_lock(&excimer_threads.mutex);
+	if (!excimer_threads.owner) {
+		excimer_mutex_unlock(&excimer_threads.mutex);
+		return NULL;
+	}
+	options = excimer_threads.options;
+	EXCIMER_G(threads_generation) = excimer_threads.generation;
+	excimer_mutex_unlock(&excimer_threads.mutex);
+
+	log = emalloc(sizeof(excimer_log));
+	excimer_log_init(log);
+	log->period = options.period;
+	log->max_depth = options.max_depth;
+	excimer_log_set_granularity(log, options.granularity);
+	excimer_log_set_internal_frames(log, options.internal_frames);
+	excimer_log_set_aggregate(log, options.aggregate);
+	excimer_log_set_coalesce(log, options.coalesce);
+	log->has_cpu_time = options.has_cpu_time;
+	log->root_index = excimer_log_get_thread_frame(log, excimer_threads_get_id());
+	EXCIMER_G(threads_log) = log;
+	EXCIMER_G(threads_samples) = 0;
+	return log;
+}
+
+/**
+ * Queue the samples of the current thread for the owner, and destroy its log
+ */
+static void excimer_threads_submit(void)
+{
+	excimer_log *log = EXCIMER_G(threads_log);
+	excimer_threads_batch *batch = NULL;
+	zend_string *data;
+
+	if (!log) {
+		return;
+	}
+	if (log->entries_size) {
+		data = excimer_log_serialize(log);
+		batch = pemalloc(offsetof(excimer_threads_batch, data) + ZSTR_LEN(data), 1);
+		batch->next = NULL;
+		batch->length = ZSTR_LEN(data);
+		memcpy(batch->data, ZSTR_VAL(data), ZSTR_LEN(data));
+		zend_string_release(data);
+
+		excimer_mutex_lock(&excimer_threads.mutex);
+		if (excimer_threads.owner
+			&& excimer_threads.generation == EXCIMER_G(threads_generation)
+			&& excimer_threads.queue_size < EXCIMER_THREADS_MAX_QUEUED)
+		{
+			if (excimer_threads.queue_tail) {
+				excimer_threads.queue_tail->next = batch;
+			} else {
+				excimer_threads.queue_head = batch;
+			}
+			excimer_threads.queue_tail = batch;
+			excimer_threads_atomic_store(&excimer_threads.queue_size,
+				excimer_threads.queue_size + 1);
+			batch = NULL;
+		}
+		excimer_mutex_unlock(&excimer_threads.mutex);
+		if (batch) {
+			pefree(batch, 1);
+		}
+	}
+	excimer_threads_free_log();
+}
+
+/**
+ * The event callback of the group member of each thread
+ */
+static void excimer_threads_event(zend_long event_count, void *user_data)
+{
+	uint64_t generation = excimer_threads_atomic_load(&excimer_threads.generation);
+	excimer_log *log = EXCIMER_G(threads_log);
+	struct timespec now_ts;
+
+	if (log && EXCIMER_G(threads_generation) != generation) {
+		excimer_threads_free_log();
+		log = NULL;
+	}
+	if (!log) {
+		log = excimer_threads_new_log();
+		if (!log) {
+			return;
+		}
+	}
+
+	/* Keep the event count in units of the configured period */
+	event_count *= excimer_threads_atomic_load(&excimer_threads.period_multiplier);
+
+	timerlib_clock_get_time(TIMERLIB_REAL, &now_ts);
+	excimer_log_add(log, EG(current_execute_data), event_count,
+		timerlib_timespec_to_ns(&now_ts), 0);
+
+	/* Count samples rather than entries, which may be aggregated */
+	if (++EXCIMER_G(threads_samples) >= EXCIMER_THREADS_BATCH_SIZE) {
+		excimer_threads_submit();
+	}
+}
+
+// Note: functions with external linkage are documented in the header
+
+void excimer_threads_module_init(void)
+{
+	excimer_timer_group_init(&excimer_threads.group);
+	excimer_mutex_init(&excimer_threads.mutex);
+}
+
+void excimer_threads_module_shutdown(void)
+{
+	excimer_threads_free_batches(excimer_threads_take_queue());
+	excimer_mutex_destroy(&excimer_threads.mutex);
+	excimer_timer_group_destroy(&excimer_threads.group);
+}
+
+void excimer_threads_request_init(void)
+{
+	excimer_timer_init_member(&EXCIMER_G(threads_timer), excimer_threads_event, NULL);
+	excimer_timer_group_add(&excimer_threads.group, &EXCIMER_G(threads_timer));
+}
+
+void excimer_threads_request_shutdown(void)
+{
+	excimer_timer_group_remove(&excimer_threads.group, &EXCIMER_G(threads_timer));
+	excimer_threads_submit();
+	excimer_timer_destroy(&EXCIMER_G(threads_timer));
+}
+
+zend_long excimer_threads_get_id(void)
+{
+	if (!EXCIMER_G(thread_id)) {
+		EXCIMER_G(thread_id) = excimer_threads_atomic_add(&excimer_threads_last_id, 1) + 1;
+	}
+	return EXCIMER_G(thread_id);
+}
+
+int excimer_threads_start(excimer_timer *timer, excimer_threads_options *options)
+{
+	excimer_threads_batch *discarded = NULL;
+
+	excimer_mutex_lock(&excimer_threads.mutex);
+	if (excimer_threads.owner && excimer_threads.owner != timer) {
+		excimer_mutex_unlock(&excimer_threads.mutex);
+		php_error_docref(NULL, E_WARNING, "Another profiler is already sampling all threads");
+		return FAILURE;
+	}
+	if (!excimer_threads.owner) {
+		excimer_threads.owner = timer;
+		excimer_threads_atomic_store(&excimer_threads.generation,
+			excimer_threads.generation + 1);
+		discarded = excimer_threads_take_queue();
+	}
+	excimer_threads.options = *options;
+	excimer_threads_atomic_store(&excimer_threads.period_multiplier, 1);
+	excimer_mutex_unlock(&excimer_threads.mutex);
+
+	excimer_threads_free_batches(discarded);
+	excimer_timer_set_group(timer, &excimer_threads.group);
+	return SUCCESS;
+}
+
+void excimer_threads_set_period_multiplier(excimer_timer *timer, zend_long multiplier)
+{
+	excimer_mutex_lock(&excimer_threads.mutex);
+	if (excimer_threads.owner == timer) {
+		excimer_threads_atomic_store(&excimer_threads.period_multiplier, multiplier);
+	}
+	excimer_mutex_unlock(&excimer_threads.mutex);
+}
+
+void excimer_threads_stop(excimer_timer *timer)
+{
+	excimer_timer_set_group(timer, NULL);
+}
+
+void excimer_threads_release(excimer_timer *timer)
+{
+	excimer_threads_batch *discarded = NULL;
+
+	excimer_timer_set_group(timer, NULL);
+	excimer_mutex_lock(&excimer_threads.mutex);
+	if (excimer_threads.owner == timer) {
+		excimer_threads.owner = NULL;
+		excimer_threads_atomic_store(&excimer_threads.generation,
+			excimer_threads.generation + 1);
+		discarded = excimer_threads_take_queue();
+	}
+	excimer_mutex_unlock(&excimer_threads.mutex);
+	excimer_threads_free_batches(discarded);
+}
+
+void excimer_threads_collect(excimer_timer *timer, excimer_log *dest)
+{
+	excimer_threads_batch *batch;
+
+	if (!excimer_threads_atomic_load(&excimer_threads.queue_size)) {
+		return;
+	}
+	excimer_mutex_lock(&excimer_threads.mutex);
+	if (excimer_threads.owner != timer) {
+		excimer_mutex_unlock(&excimer_threads.mutex);
+		return;
+	}
+	batch = excimer_threads_take_queue();
+	excimer_mutex_unlock(&excimer_threads.mutex);
+
+	while (batch) {
+		excimer_threads_batch *next = batch->next;
+		excimer_log src;
+
+		excimer_log_init(&src);
+		/* The data was produced by excimer_log_serialize(), so it is valid */
+		if (!excimer_log_unserialize(&src, batch->data, batch->length)) {
+			excimer_log_merge(dest, &src);
+		}
+		excimer_log_destroy(&src);
+		pefree(batch, 1);
+		batch = next;
+	}
+}
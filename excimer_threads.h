@@ -0,0 +1,148 @@
+/* Copyright 2026 Wikimedia Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EXCIMER_THREADS_H
+#define EXCIMER_THREADS_H
+
+#include "excimer_log.h"
+#include "excimer_timer.h"
+
+/*
+ * Sampling of all PHP threads in the process by one profiler.
+ *
+ * Every thread joins a process-wide timer group while it is executing a
+ * request. When a profiler samples all threads, the group is attached to the
+ * profiler's timer, so each expiry of that one timer interrupts every thread.
+ * The profiler's own thread is sampled into the profiler's log as usual.
+ * Each other thread captures its samples into a log of its own, which is
+ * serialized and queued for the profiler when it has
+ * EXCIMER_THREADS_BATCH_SIZE entries, and when the thread's request ends.
+ * The profiler merges the queued batches into its log.
+ *
+ * The stacks of each thread are placed under a {thread:N} frame, where N is a
+ * number assigned to the thread when it first handles a request.
+ */
+
+/** The number of samples a thread collects before queueing them */
+#define EXCIMER_THREADS_BATCH_SIZE 100
+
+/**
+ * The maximum number of batches waiting to be merged. If a batch is
+ * submitted while the queue is full, it is dropped.
+ */
+#define EXCIMER_THREADS_MAX_QUEUED 1024
+
+/**
+ * The log options which the profiler passes to the other threads
+ */
+typedef struct _excimer_threads_options {
+	/** The sampling period in nanoseconds */
+	zend_long period;
+
+	/** The maximum stack depth, or zero for no limit */
+	zend_long max_depth;
+
+	/** The granularity, EXCIMER_GRANULARITY_* */
+	int granularity;
+
+	/** Whether internal function frames are collected */
+	int internal_frames;
+
+	/** Whether entries with the same stack are aggregated */
+	int aggregate;
+
+	/** Whether consecutive samples with the same stack are coalesced */
+	int coalesce;
+
+	/** Whether the entries include CPU time */
+	int has_cpu_time;
+} excimer_threads_options;
+
+/**
+ * Global initialisation
+ */
+void excimer_threads_module_init(void);
+
+/**
+ * Global shutdown
+ */
+void excimer_threads_module_shutdown(void);
+
+/**
+ * Add the current thread to the group. This is called during request startup.
+ */
+void excimer_threads_request_init(void);
+
+/**
+ * Queue any samples of the current thread and remove it from the group. This
+ * is called during request shutdown.
+ */
+void excimer_threads_request_shutdown(void);
+
+/**
+ * Get the number identifying the current thread
+ */
+zend_long excimer_threads_get_id(void);
+
+/**
+ * Start sampling all threads with the given timer. Only one timer may do so
+ * at a time. If the timer is the current owner, sampling is resumed and any
+ * queued samples are kept. Otherwise, samples queued for a previous owner are
+ * discarded.
+ *
+ * @param timer The initialised timer of the profiler
+ * @param options The options for the logs of the other threads
+ * @return SUCCESS, or FAILURE if another timer is sampling all threads. On
+ *   failure a warning has been raised.
+ */
+int excimer_threads_start(excimer_timer *timer, excimer_threads_options *options);
+
+/**
+ * Set the factor by which the period of the timer has been multiplied since
+ * it was started, so that the samples of the other threads are weighted in
+ * units of the configured period, like those of the profiler's own thread.
+ * This has no effect if the timer is not the owner.
+ *
+ * @param timer The timer
+ * @param multiplier The period multiplier
+ */
+void excimer_threads_set_period_multiplier(excimer_timer *timer, zend_long multiplier);
+
+/**
+ * Stop interrupting other threads. The timer remains the owner, so samples
+ * sent by threads which finish their requests later may still be collected.
+ *
+ * @param timer The timer
+ */
+void excimer_threads_stop(excimer_timer *timer);
+
+/**
+ * Stop sampling other threads and discard any queued samples, if the timer
+ * is the owner. This is called before the timer is destroyed.
+ *
+ * @param timer The timer
+ */
+void excimer_threads_release(excimer_timer *timer);
+
+/**
+ * Merge the queued samples of other threads into a log, if the timer is the
+ * owner
+ *
+ * @param timer The timer
+ * @param dest The destination log
+ */
+void excimer_threads_collect(excimer_timer *timer, excimer_log *dest);
+
+#endif
@@ -21,8 +21,9 @@
 #include <stdlib.h>
 
 #include "php.h"
-#include "excimer_mutex.h"
+#include "php_excimer.h"
 #include "excimer_timer.h"
+#include "excimer_mutex.h"
 #include "zend_types.h"
 
 #if PHP_VERSION_ID >= 80200
@@ -31,6 +32,13 @@
 #define excimer_timer_atomic_bool_store(dest, value) *dest = value
 #endif
 
+#define excimer_timer_atomic_load(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define excimer_timer_atomic_store(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define excimer_timer_atomic_exchange(ptr, value) __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL)
+#define excimer_timer_atomic_add(ptr, value) __atomic_fetch_add(ptr, value, __ATOMIC_ACQ_REL)
+#define excimer_timer_atomic_cas(ptr, expected, desired) \
+	__atomic_compare_exchange_n(ptr, expected, desired, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+
 excimer_timer_globals_t excimer_timer_globals;
 ZEND_TLS excimer_timer_tls_t excimer_timer_tls;
 
@@ -38,8 +46,8 @@ static void excimer_timer_handle(void * data, int overrun_count);
 static void excimer_timer_interrupt(zend_execute_data *execute_data);
 
 /**
- * Add a timer to the pending list. Unsynchronised, i.e. the caller is
- * responsible for locking the mutex if required.
+ * Add a timer to the pending list. This may only be called from the thread
+ * which owns the list.
  */
 static void excimer_timer_list_enqueue(excimer_timer *timer, excimer_timer_tls_t *tls)
 {
@@ -60,7 +68,7 @@ static void excimer_timer_list_enqueue(excimer_timer *timer, excimer_timer_tls_t
 
 /**
  * Remove the first (FIFO) timer from the pending list and provide a pointer
- * to it. (unsynchronised)
+ * to it.
  *
  * @param[out] timer_pp
  * @return True if a timer was returned, false if the list was empty
@@ -90,7 +98,7 @@ static int excimer_timer_list_dequeue(excimer_timer **timer_pp)
 
 /**
  * Remove the specified timer from the pending list, if it is in there. If it
- * is not in the list, do nothing. (unsynchronised)
+ * is not in the list, do nothing.
  */
 static void excimer_timer_list_remove(excimer_timer *timer)
 {
@@ -111,9 +119,34 @@ static void excimer_timer_list_remove(excimer_timer *timer)
 }
 
 /**
- * Atomically dequeue a timer and get its event count at the time of removal
- * from the queue. The timer may be immediately re-added to the queue by the
- * event handler.
+ * Take all timers from the incoming stack, which is shared with the handler
+ * threads, and add them to the end of the pending list in the order in which
+ * they were pushed.
+ */
+static void excimer_timer_pending_drain()
+{
+	excimer_timer *timer = excimer_timer_atomic_exchange(
+		&excimer_timer_tls.incoming_head, NULL);
+	excimer_timer *reversed = NULL;
+
+	/* The stack is LIFO, so reverse it */
+	while (timer) {
+		excimer_timer *next = timer->incoming_next;
+		timer->incoming_next = reversed;
+		reversed = timer;
+		timer = next;
+	}
+	while (reversed) {
+		timer = reversed;
+		reversed = timer->incoming_next;
+		timer->incoming_next = NULL;
+		excimer_timer_list_enqueue(timer, &excimer_timer_tls);
+	}
+}
+
+/**
+ * Dequeue a timer and get its event count at the time of removal from the
+ * queue. The timer may be immediately pushed again by the event handler.
  *
  * @param[out] timer_pp Where to put the pointer to the timer
  * @param[out] event_count_p Where to put the event count
@@ -121,14 +154,86 @@ static void excimer_timer_list_remove(excimer_timer *timer)
  */
 static int excimer_timer_pending_dequeue(excimer_timer **timer_pp, zend_long *event_count_p)
 {
-	excimer_mutex_lock(&excimer_timer_tls.mutex);
-	int ret = excimer_timer_list_dequeue(timer_pp);
-	if (ret) {
-		*event_count_p = (*timer_pp)->event_count;
-		(*timer_pp)->event_count = 0;
-	}
-	excimer_mutex_unlock(&excimer_timer_tls.mutex);
-	return ret;
+	if (!excimer_timer_tls.pending_head) {
+		excimer_timer_pending_drain();
+	}
+	if (!excimer_timer_list_dequeue(timer_pp)) {
+		return 0;
+	}
+	/* Clear the flag before taking the count, so that an event which
+	 * arrives after the count is taken will push the timer again. */
+	excimer_timer_atomic_store(&(*timer_pp)->is_pending, 0);
+	*event_count_p = excimer_timer_atomic_exchange(&(*timer_pp)->event_count, 0);
+	return 1;
+}
+
+/**
+ * Get a timerlib timer for the given excimer timer, either from the pool or
+ * by initialising a new one.
+ *
+ * @return The timer, or NULL on error
+ */
+static timerlib_timer_t *excimer_timer_pool_get(excimer_timer *timer)
+{
+	excimer_timer_pool_t *pool = &EXCIMER_G(timer_pool);
+	timerlib_timer_t *tl_timer;
+	int i;
+
+	for (i = 0; i < pool->size; i++) {
+		if (pool->event_types[i] == timer->event_type
+			&& timerlib_timer_unpark(pool->timers[i], &excimer_timer_handle, timer) == SUCCESS)
+		{
+			tl_timer = pool->timers[i];
+			pool->size--;
+			memmove(&pool->timers[i], &pool->timers[i + 1],
+				(pool->size - i) * sizeof(pool->timers[0]));
+			memmove(&pool->event_types[i], &pool->event_types[i + 1],
+				(pool->size - i) * sizeof(pool->event_types[0]));
+			return tl_timer;
+		}
+	}
+
+	tl_timer = pemalloc(sizeof(timerlib_timer_t), 1);
+	if (timerlib_timer_init(tl_timer, timer->event_type, &excimer_timer_handle, timer) == FAILURE) {
+		timerlib_timer_destroy(tl_timer);
+		pefree(tl_timer, 1);
+		return NULL;
+	}
+	return tl_timer;
+}
+
+/**
+ * Destroy a timerlib timer and free it
+ */
+static void excimer_timer_pool_free(timerlib_timer_t *tl_timer)
+{
+	timerlib_timer_destroy(tl_timer);
+	pefree(tl_timer, 1);
+}
+
+/**
+ * Stop a timerlib timer and return it to the pool. If the pool is full, the
+ * oldest timer is destroyed. When this returns, the callback will not be
+ * called again.
+ */
+static void excimer_timer_pool_put(timerlib_timer_t *tl_timer, int event_type)
+{
+	excimer_timer_pool_t *pool = &EXCIMER_G(timer_pool);
+
+	if (timerlib_timer_park(tl_timer) == FAILURE) {
+		excimer_timer_pool_free(tl_timer);
+		return;
+	}
+	if (pool->size >= EXCIMER_TIMER_POOL_SIZE) {
+		excimer_timer_pool_free(pool->timers[0]);
+		pool->size--;
+		memmove(&pool->timers[0], &pool->timers[1], pool->size * sizeof(pool->timers[0]));
+		memmove(&pool->event_types[0], &pool->event_types[1],
+			pool->size * sizeof(pool->event_types[0]));
+	}
+	pool->timers[pool->size] = tl_timer;
+	pool->event_types[pool->size] = event_type;
+	pool->size++;
 }
 
 // Note: functions with external linkage are documented in the header
@@ -141,13 +246,24 @@ void excimer_timer_module_init()
 
 void excimer_timer_module_shutdown()
 {
+	excimer_timer_pool_shutdown();
+	/* Stop the timer handler thread before the extension is unloaded */
+	timerlib_shutdown();
+}
+
+void excimer_timer_pool_shutdown()
+{
+	excimer_timer_pool_t *pool = &EXCIMER_G(timer_pool);
+	int i;
+	for (i = 0; i < pool->size; i++) {
+		excimer_timer_pool_free(pool->timers[i]);
+	}
+	pool->size = 0;
 }
 
 void excimer_timer_thread_init()
 {
-	excimer_timer_tls = (excimer_timer_tls_t){
-		.mutex = PTHREAD_MUTEX_INITIALIZER
-	};
+	excimer_timer_tls = (excimer_timer_tls_t){0};
 }
 
 void excimer_timer_thread_shutdown()
@@ -155,29 +271,33 @@ void excimer_timer_thread_shutdown()
 	if (excimer_timer_tls.timers_active) {
 		// If this ever happens, it means we've got the logic wrong and we need
 		// to rethink. It's very bad for timers to keep existing after thread
-		// termination, because the mutex will be a dangling pointer. It's not
-		// much help to avoid excimer_mutex_destroy() here because the whole TLS
-		// segment will be destroyed and reused.
+		// termination, because the TLS pointer will be dangling, since the
+		// whole TLS segment will be destroyed and reused.
 		php_error_docref(NULL, E_WARNING, "Timer still active at thread termination");
-	} else {
-		excimer_mutex_destroy(&excimer_timer_tls.mutex);
 	}
 }
 
-int excimer_timer_init(excimer_timer *timer, int event_type,
+/**
+ * Set up the fields of a timer which are common to all timer types
+ */
+static void excimer_timer_init_common(excimer_timer *timer,
 	excimer_timer_callback callback, void *user_data)
 {
-	zval z_timer;
-
 	memset(timer, 0, sizeof(excimer_timer));
-	ZVAL_PTR(&z_timer, timer);
 	timer->vm_interrupt_ptr = &EG(vm_interrupt);
 	timer->callback = callback;
 	timer->user_data = user_data;
 	timer->tls = &excimer_timer_tls;
+}
+
+int excimer_timer_init(excimer_timer *timer, int event_type,
+	excimer_timer_callback callback, void *user_data)
+{
+	excimer_timer_init_common(timer, callback, user_data);
+	timer->event_type = event_type;
 
-	if (timerlib_timer_init(&timer->tl_timer, event_type, &excimer_timer_handle, timer) == FAILURE) {
-		timerlib_timer_destroy(&timer->tl_timer);
+	timer->tl_timer = excimer_timer_pool_get(timer);
+	if (!timer->tl_timer) {
 		return FAILURE;
 	}
 
@@ -187,6 +307,64 @@ int excimer_timer_init(excimer_timer *timer, int event_type,
 	return SUCCESS;
 }
 
+void excimer_timer_init_member(excimer_timer *timer,
+	excimer_timer_callback callback, void *user_data)
+{
+	excimer_timer_init_common(timer, callback, user_data);
+	excimer_timer_tls.timers_active++;
+	timer->is_valid = 1;
+}
+
+void excimer_timer_group_init(excimer_timer_group *group)
+{
+	excimer_mutex_init(&group->mutex);
+	group->members = NULL;
+	group->members_size = 0;
+	group->members_capacity = 0;
+}
+
+void excimer_timer_group_destroy(excimer_timer_group *group)
+{
+	excimer_mutex_destroy(&group->mutex);
+	if (group->members) {
+		pefree(group->members, 1);
+		group->members = NULL;
+	}
+	group->members_size = 0;
+	group->members_capacity = 0;
+}
+
+void excimer_timer_group_add(excimer_timer_group *group, excimer_timer *timer)
+{
+	excimer_mutex_lock(&group->mutex);
+	if (group->members_size >= group->members_capacity) {
+		group->members_capacity = group->members_capacity ? group->members_capacity * 2 : 8;
+		group->members = safe_perealloc(group->members, group->members_capacity,
+			sizeof(excimer_timer*), 0, 1);
+	}
+	group->members[group->members_size++] = timer;
+	excimer_mutex_unlock(&group->mutex);
+}
+
+void excimer_timer_group_remove(excimer_timer_group *group, excimer_timer *timer)
+{
+	size_t i;
+
+	excimer_mutex_lock(&group->mutex);
+	for (i = 0; i < group->members_size; i++) {
+		if (group->members[i] == timer) {
+			group->members[i] = group->members[--group->members_size];
+			break;
+		}
+	}
+	excimer_mutex_unlock(&group->mutex);
+}
+
+void excimer_timer_set_group(excimer_timer *timer, excimer_timer_group *group)
+{
+	excimer_timer_atomic_store(&timer->group, group);
+}
+
 void excimer_timer_start(excimer_timer *timer,
 	struct timespec *period, struct timespec *initial)
 {
@@ -207,7 +385,7 @@ void excimer_timer_start(excimer_timer *timer,
 		return;
 	}
 
-	if (timerlib_timer_start(&timer->tl_timer, period, initial) == SUCCESS) {
+	if (timerlib_timer_start(timer->tl_timer, period, initial) == SUCCESS) {
 		timer->is_running = 1;
 	}
 }
@@ -219,7 +397,7 @@ void excimer_timer_stop(excimer_timer *timer)
 		return;
 	}
 	if (timer->is_running) {
-		if (timerlib_timer_stop(&timer->tl_timer) == SUCCESS) {
+		if (timerlib_timer_stop(timer->tl_timer) == SUCCESS) {
 			timer->is_running = 0;
 		}
 	}
@@ -238,41 +416,81 @@ void excimer_timer_destroy(excimer_timer *timer)
 		return;
 	}
 
-	/* Stop the timer */
-	if (timer->is_running) {
-		timer->is_running = 0;
-		timerlib_timer_stop(&timer->tl_timer);
+	/* Stop the timer and return it to the pool. This will wait until any
+	 * events are done. A group member has no timerlib timer, the caller
+	 * must already have removed it from its group. */
+	timer->is_running = 0;
+	if (timer->tl_timer) {
+		excimer_timer_pool_put(timer->tl_timer, timer->event_type);
+		timer->tl_timer = NULL;
 	}
-	/* Destroy the timer. This will wait until any events are done. */
-	timerlib_timer_destroy(&timer->tl_timer);
 	excimer_timer_tls.timers_active--;
 
-	/* Remove the timer from the pending list */
-	excimer_mutex_lock(&excimer_timer_tls.mutex);
+	/* Remove the timer from the pending list. The handler will not push it
+	 * again, so after draining the incoming stack, the timer is either in
+	 * the pending list or nowhere. */
+	excimer_timer_pending_drain();
 	excimer_timer_list_remove(timer);
-	excimer_mutex_unlock(&excimer_timer_tls.mutex);
 
 	timer->is_valid = 0;
 	timer->tls = NULL;
 }
 
-static void excimer_timer_handle(void * data, int overrun_count)
+/**
+ * Deliver events to a timer and interrupt its thread. This is called from a
+ * handler thread.
+ */
+static void excimer_timer_notify(excimer_timer *timer, int overrun_count)
 {
-	excimer_timer *timer = (excimer_timer*)data;
 	excimer_timer_tls_t *tls = timer->tls;
-	excimer_mutex_lock(&tls->mutex);
-	timer->event_count += overrun_count + 1;
-	excimer_timer_list_enqueue(timer, tls);
-	excimer_mutex_unlock(&tls->mutex);
+
+	excimer_timer_atomic_add(&timer->event_count, overrun_count + 1);
+	if (overrun_count) {
+		excimer_timer_atomic_add(&timer->overrun_count, overrun_count);
+	}
+	if (!excimer_timer_atomic_exchange(&timer->is_pending, 1)) {
+		/* Push the timer on to the incoming stack. Only the owning thread
+		 * pops, and it takes the whole stack at once, so there is no ABA
+		 * problem. */
+		excimer_timer *head = excimer_timer_atomic_load(&tls->incoming_head);
+		do {
+			timer->incoming_next = head;
+		} while (!excimer_timer_atomic_cas(&tls->incoming_head, &head, timer));
+	}
 	excimer_timer_atomic_bool_store(timer->vm_interrupt_ptr, 1);
 }
 
+static void excimer_timer_handle(void * data, int overrun_count)
+{
+	excimer_timer *timer = (excimer_timer*)data;
+	excimer_timer_group *group = excimer_timer_atomic_load(&timer->group);
+
+	excimer_timer_notify(timer, overrun_count);
+	if (group) {
+		size_t i;
+
+		/* The owning thread of the timer is already interrupted, so skip its
+		 * members. Members are only removed while the mutex is held, so each
+		 * is valid during the call. */
+		excimer_mutex_lock(&group->mutex);
+		for (i = 0; i < group->members_size; i++) {
+			if (group->members[i]->tls != timer->tls) {
+				excimer_timer_notify(group->members[i], overrun_count);
+			}
+		}
+		excimer_mutex_unlock(&group->mutex);
+	}
+}
+
 static void excimer_timer_interrupt(zend_execute_data *execute_data)
 {
 	excimer_timer *timer = NULL;
 	zend_long count = 0;
 	while (excimer_timer_pending_dequeue(&timer, &count)) {
-		timer->callback(count, timer->user_data);
+		/* The count may be zero if the events were already delivered */
+		if (count) {
+			timer->callback(count, timer->user_data);
+		}
 	}
 
 	if (excimer_timer_globals.old_zend_interrupt_function) {
@@ -288,5 +506,13 @@ void excimer_timer_get_time(excimer_timer *timer, struct timespec *remaining)
 		return;
 	}
 
-	timerlib_timer_get_time(&timer->tl_timer, remaining);
+	timerlib_timer_get_time(timer->tl_timer, remaining);
+}
+
+zend_long excimer_timer_get_overrun_count(excimer_timer *timer)
+{
+	if (!timer->is_valid) {
+		return 0;
+	}
+	return excimer_timer_atomic_load(&timer->overrun_count);
 }
@@ -16,13 +16,16 @@
 #ifndef EXCIMER_TIMER_H
 #define EXCIMER_TIMER_H
 
+#include <pthread.h>
+
 #include "excimer_events.h"
 #include "timerlib/timerlib.h"
 
 typedef void (*excimer_timer_callback)(zend_long, void *);
 
-/* Forward declaration */
+/* Forward declarations */
 typedef struct _excimer_timer_tls_t excimer_timer_tls_t;
+typedef struct _excimer_timer_group excimer_timer_group;
 
 typedef struct _excimer_timer {
 	/** True if the object has been initialised and not destroyed */
@@ -38,8 +41,21 @@ typedef struct _excimer_timer {
 	zend_bool *vm_interrupt_ptr;
 #endif
 
-	/** The underlying timerlib timer */
-	timerlib_timer_t tl_timer;
+	/**
+	 * The underlying timerlib timer. This is persistently allocated, since
+	 * it may be returned to the pool and reused by a later request. It is
+	 * NULL for a group member, which receives the events of another timer.
+	 */
+	timerlib_timer_t *tl_timer;
+
+	/**
+	 * A group whose members also receive the events of this timer, or NULL.
+	 * This is accessed atomically.
+	 */
+	excimer_timer_group *group;
+
+	/** The event type, EXCIMER_REAL or EXCIMER_CPU */
+	int event_type;
 
 	/** The event callback. */
 	excimer_timer_callback callback;
@@ -55,12 +71,70 @@ typedef struct _excimer_timer {
 	/** The previous pending timer */
 	struct _excimer_timer *pending_prev;
 
+	/** The next timer in the incoming stack */
+	struct _excimer_timer *incoming_next;
+
+	/**
+	 * The number of events not yet delivered to the callback. This is
+	 * accessed atomically.
+	 */
 	zend_long event_count;
 
+	/**
+	 * True if the timer is in the incoming stack or the pending list, so
+	 * that the handler does not need to push it again. This is accessed
+	 * atomically.
+	 */
+	int is_pending;
+
 	/** The thread-local data associated with the thread that created the timer */
 	excimer_timer_tls_t *tls;
+
+	/**
+	 * The total number of overruns reported by timerlib, that is, expirations
+	 * which were merged into a later notification. This is accessed
+	 * atomically.
+	 */
+	zend_long overrun_count;
 } excimer_timer;
 
+/** The maximum number of idle timers kept in the pool of each thread */
+#define EXCIMER_TIMER_POOL_SIZE 8
+
+/**
+ * A pool of initialised but unused timerlib timers belonging to the current
+ * thread. This persists across requests.
+ */
+typedef struct _excimer_timer_pool_t {
+	/** The parked timers, oldest first */
+	timerlib_timer_t *timers[EXCIMER_TIMER_POOL_SIZE];
+
+	/** The event type of each timer */
+	int event_types[EXCIMER_TIMER_POOL_SIZE];
+
+	/** The number of timers in the pool */
+	int size;
+} excimer_timer_pool_t;
+
+/**
+ * A set of timers, typically one per thread, which receive the events of any
+ * timer which has the group attached. This allows one timerlib timer to
+ * interrupt several PHP threads.
+ */
+struct _excimer_timer_group {
+	/** A mutex protecting the members array */
+	pthread_mutex_t mutex;
+
+	/** The member timers */
+	excimer_timer **members;
+
+	/** The number of members */
+	size_t members_size;
+
+	/** The number of allocated elements in the members array */
+	size_t members_capacity;
+};
+
 typedef struct _excimer_timer_globals_t {
 	/**
 	 * The old value of the zend_interrupt_function hook. If set, this must be
@@ -70,11 +144,16 @@ typedef struct _excimer_timer_globals_t {
 } excimer_timer_globals_t;
 
 typedef struct _excimer_timer_tls_t {
-	/** The mutex protecting the pending list */
-	pthread_mutex_t mutex;
+	/**
+	 * A lock-free stack of timers which have received events. Handler
+	 * threads push to it, and the owning thread moves all of its members to
+	 * the pending list at once.
+	 */
+	excimer_timer *incoming_head;
 
 	/**
-	 * The head of the list of pending timers. This is a doubly-linked list
+	 * The head of the list of pending timers, which is only accessed by the
+	 * owning thread. This is a doubly-linked list
 	 * because we need to randomly delete members when timers are destroyed.
 	 * It's circular, with the last element pointing back to the first element,
 	 * because that makes it a bit easier to check whether an element is in the
@@ -97,6 +176,12 @@ void excimer_timer_module_init();
  */
 void excimer_timer_module_shutdown();
 
+/**
+ * Destroy all timers in the pool of the current thread. This should be
+ * called before the thread exits.
+ */
+void excimer_timer_pool_shutdown();
+
 /**
  * Thread-local initialisation of the timer module. This must be called before
  * any timer objects are created.
@@ -121,6 +206,60 @@ void excimer_timer_thread_shutdown();
 int excimer_timer_init(excimer_timer *timer, int event_type,
 	excimer_timer_callback callback, void *user_data);
 
+/**
+ * Initialise a group member timer allocated by the caller. The timer has no
+ * clock of its own, it receives events only while it is a member of a group
+ * which is attached to a running timer.
+ *
+ * @param timer The timer object pointer
+ * @param callback The callback to call during VM interrupt
+ * @param user_data An arbitrary pointer passed to the callback
+ */
+void excimer_timer_init_member(excimer_timer *timer,
+	excimer_timer_callback callback, void *user_data);
+
+/**
+ * Initialise a timer group
+ *
+ * @param group The group, memory owned by the caller
+ */
+void excimer_timer_group_init(excimer_timer_group *group);
+
+/**
+ * Destroy a timer group. It must not have any members or be attached to a
+ * timer.
+ *
+ * @param group The group
+ */
+void excimer_timer_group_destroy(excimer_timer_group *group);
+
+/**
+ * Add a member timer to a group. This may be called from any thread.
+ *
+ * @param group The group
+ * @param timer A timer initialised with excimer_timer_init_member()
+ */
+void excimer_timer_group_add(excimer_timer_group *group, excimer_timer *timer);
+
+/**
+ * Remove a member timer from a group. When this returns, the timer will not
+ * receive any more events from the group.
+ *
+ * @param group The group
+ * @param timer The member timer
+ */
+void excimer_timer_group_remove(excimer_timer_group *group, excimer_timer *timer);
+
+/**
+ * Attach a group to a timer, or detach it. While a group is attached, each
+ * event of the timer is also delivered to every member of the group, except
+ * members belonging to the thread of the timer.
+ *
+ * @param timer The timer object
+ * @param group The group, or NULL to detach
+ */
+void excimer_timer_set_group(excimer_timer *timer, excimer_timer_group *group);
+
 /**
  * Start a timer. If there is no error, timer->is_running will be set to 1.
  *
@@ -153,4 +292,11 @@ void excimer_timer_destroy(excimer_timer *timer);
  */
 void excimer_timer_get_time(excimer_timer *timer, struct timespec *remaining);
 
+/**
+ * Get the total number of overruns since the timer was initialised
+ *
+ * @param timer The timer object
+ */
+zend_long excimer_timer_get_overrun_count(excimer_timer *timer);
+
 #endif
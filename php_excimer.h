@@ -37,6 +37,41 @@ extern zend_module_entry excimer_module_entry;
 ZEND_TSRMLS_CACHE_EXTERN()
 #endif
 
+#include "excimer_timer.h"
+
+ZEND_BEGIN_MODULE_GLOBALS(excimer)
+	/** Idle timers which may be reused by later requests in this thread */
+	excimer_timer_pool_t timer_pool;
+
+	/** The frame store shared by logs if excimer.persistent_frames is set */
+	struct _excimer_log_frame_store *frame_store;
+
+	/** The profiler started by excimer.auto_sample_rate, or undefined */
+	zval auto_profiler;
+
+	/** The member of the process-wide group of threads, during a request */
+	excimer_timer threads_timer;
+
+	/** The samples of this thread for a profiler in another thread, or NULL */
+	struct _excimer_log *threads_log;
+
+	/** The sampling generation of threads_log */
+	uint64_t threads_generation;
+
+	/** The number of samples taken into threads_log */
+	zend_long threads_samples;
+
+	/** The number identifying this thread, or zero if not yet assigned */
+	zend_long thread_id;
+
+	/** True if this thread holds the consumer lock of the shared ring */
+	int ring_reader_locked;
+ZEND_END_MODULE_GLOBALS(excimer)
+
+ZEND_EXTERN_MODULE_GLOBALS(excimer)
+
+#define EXCIMER_G(v) ZEND_MODULE_GLOBALS_ACCESSOR(excimer, v)
+
 static inline uint32_t excimer_safe_uint32(zend_long i) {
 	if (i < 0 || i > UINT32_MAX) {
 		zend_error_noreturn(E_ERROR, "Integer out of range");
@@ -34,6 +34,21 @@ class ExcimerLog implements ArrayAccess, Iterator {
 	function formatCollapsed() {
 	}
 
+	/**
+	 * Aggregate the stack traces and encode them as a pprof Profile protobuf
+	 * message, as understood by "go tool pprof" and various continuous
+	 * profiling services. The result is uncompressed; most consumers expect
+	 * it to be passed through gzencode().
+	 *
+	 * There is a sample for each unique stack, with two values: the number of
+	 * events, and the estimated time in nanoseconds, which is the number of
+	 * events multiplied by the period.
+	 *
+	 * @return string
+	 */
+	function formatPprof() {
+	}
+
 	/**
 	 * Produce an array with an element for every function which appears in
 	 * the log. The key is a human-readable unique identifier for the function,
@@ -72,6 +87,16 @@ class ExcimerLog implements ArrayAccess, Iterator {
 	function getSpeedscopeData() {
 	}
 
+	/**
+	 * Get a JSON document for import into speedscope. This is equivalent to
+	 * json_encode( $log->getSpeedscopeData() ), but is faster and uses less
+	 * memory for large logs.
+	 *
+	 * @return string
+	 */
+	function formatSpeedscope() {
+	}
+
 	/**
 	 * Get the total number of profiling periods represented by this log.
 	 *
@@ -80,6 +105,96 @@ class ExcimerLog implements ArrayAccess, Iterator {
 	function getEventCount() {
 	}
 
+	/**
+	 * Get the total CPU time in seconds recorded in this log. This is zero
+	 * unless the profiler used EXCIMER_REAL_CPU.
+	 *
+	 * @return float
+	 */
+	function getCpuTime() {
+	}
+
+	/**
+	 * Get counters describing the cost of collecting this log. The array
+	 * has the following keys:
+	 *
+	 *   - entries: The number of log entries.
+	 *   - events: The event count, as returned by getEventCount().
+	 *   - add_ns: The time spent capturing samples, in nanoseconds.
+	 *   - frames_walked: The number of stack levels walked while capturing.
+	 *   - frames_cached: The number of walked levels which were unchanged
+	 *     since the previous sample, so did not need to be resolved.
+	 *   - frame_lookups: The number of user frames looked up in the frame
+	 *     deduplication table.
+	 *   - frame_lookup_hits: The number of lookups which found an existing
+	 *     frame.
+	 *   - frames_added: The number of new frames.
+	 *   - samples: The number of samples added, including those merged from
+	 *     other logs. In aggregate or coalesce mode this may exceed the
+	 *     number of entries.
+	 *   - samples_coalesced: The number of samples which were added to the
+	 *     previous entry, as enabled by ExcimerProfiler::setCoalesce().
+	 *   - events_replaced: The number of events which reservoir sampling
+	 *     kept in place of another, see ExcimerProfiler::setMemoryLimit().
+	 *   - events_dropped: The number of events which reservoir sampling
+	 *     discarded.
+	 *   - entry_bytes: The memory allocated for entries.
+	 *   - frame_bytes: The memory allocated for frames and the deduplication
+	 *     table. If excimer.persistent_frames is set, this is the size of
+	 *     the shared frame store.
+	 *
+	 * @return array
+	 */
+	function getStats() {
+	}
+
+	/**
+	 * Append the entries of other logs to this log, for example to combine
+	 * the logs passed to a flush callback. The frames of each log are added
+	 * to this log's frames, so the cost is proportional to the number of
+	 * frames and entries in the other logs. If this log is in aggregate
+	 * mode, entries with the same stack are combined.
+	 *
+	 * The other logs are not modified.
+	 *
+	 * @param ExcimerLog ...$others
+	 */
+	function merge( ExcimerLog ...$others ) {
+	}
+
+	/**
+	 * Create a new log containing the entries of all the given logs, in
+	 * order. The new log has the options of the first log, including
+	 * aggregate mode and compact storage.
+	 *
+	 * @param ExcimerLog[] $logs
+	 * @return ExcimerLog
+	 */
+	static function mergeAll( array $logs ) {
+	}
+
+	/**
+	 * Serialize the log to a compact binary string, which can be loaded
+	 * with ExcimerLog::fromString(). The string contains the frames used by
+	 * the entries, the entries themselves, and the period, so the loaded log
+	 * can be formatted in the same ways as the original.
+	 *
+	 * @return string
+	 */
+	function serialize() {
+	}
+
+	/**
+	 * Load a log from a string produced by ExcimerLog::serialize(). If the
+	 * string is invalid or has an unsupported version, a warning is raised
+	 * and false is returned.
+	 *
+	 * @param string $data
+	 * @return ExcimerLog|false
+	 */
+	static function fromString( $data ) {
+	}
+
 	/**
 	 * Get the current ExcimerLogEntry object. Part of the Iterator interface.
 	 *
@@ -25,6 +25,15 @@ class ExcimerLogEntry {
 	public function getEventCount() {
 	}
 
+	/**
+	 * Get the CPU time in seconds consumed by the thread since the previous
+	 * sample. This is zero unless the profiler used EXCIMER_REAL_CPU.
+	 *
+	 * @return float
+	 */
+	public function getCpuTime() {
+	}
+
 	/**
 	 * Get an array of associative arrays describing the stack trace at the time
 	 * of the event. The first element in the array is the function which was
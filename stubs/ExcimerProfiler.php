@@ -23,6 +23,13 @@ class ExcimerProfiler {
 	 * Set the event type. May be either EXCIMER_REAL, for real (wall-clock)
 	 * time, or EXCIMER_CPU, for CPU time. The default is EXCIMER_REAL.
 	 *
+	 * EXCIMER_REAL_CPU samples on the real clock like EXCIMER_REAL, and also
+	 * records the CPU time consumed by the thread since the previous sample
+	 * in each log entry. So one log gives both the wall time and the on-CPU
+	 * time of each stack. The CPU time is available from
+	 * ExcimerLogEntry::getCpuTime() and ExcimerLog::getCpuTime(), and as an
+	 * additional "cpu" sample type in formatPprof().
+	 *
 	 * This will take effect the next time start() is called.
 	 *
 	 * @param int $eventType
@@ -45,9 +52,164 @@ class ExcimerProfiler {
 	public function setMaxDepth( $maxDepth ) {
 	}
 
+	/**
+	 * Set the maximum fraction of the sampled time which may be spent
+	 * capturing samples, for example 0.01 for 1%. If this is non-zero, the
+	 * period is adapted while the profiler is running. When the measured
+	 * overhead exceeds the maximum, the period is doubled, and when it falls
+	 * below a quarter of the maximum, the period is halved, but never below
+	 * the period passed to setPeriod(). The period is reset when the
+	 * profiler is started.
+	 *
+	 * The period is always a multiple of the configured period, and event
+	 * counts are scaled accordingly, so an event count is always the number
+	 * of configured periods which elapsed. Weights in the collapsed,
+	 * speedscope and pprof output therefore stay correct.
+	 *
+	 * The default is zero, which gives a fixed period.
+	 *
+	 * @param float $maxOverhead
+	 */
+	public function setMaxOverhead( $maxOverhead ) {
+	}
+
+	/**
+	 * Limit the memory used by the current log.
+	 *
+	 * The limit applies to the request memory allocated for entries and
+	 * frames, as reported by the entry_bytes and frame_bytes keys of
+	 * ExcimerLog::getStats(), together with the log's caches of formatted
+	 * frame names and of the captured stack. A shared frame store enabled by
+	 * excimer.persistent_frames is not counted.
+	 *
+	 * When a sample takes the log over the limit, collection degrades in
+	 * stages, moving to the next stage each time the log grows further:
+	 *
+	 *   1. The log switches to aggregate mode, as with setAggregate(), so
+	 *      that only new stacks use memory.
+	 *   2. The maximum stack depth is reduced, to 64 if there was no limit
+	 *      or a higher one, such as the default of excimer.default_max_depth,
+	 *      and otherwise by half. It is then halved again each time, down to
+	 *      8. Deeper stacks are truncated as with setMaxDepth().
+	 *   3. No new frames are added, so a sample with a new stack is counted
+	 *      against the "[truncated]" pseudo-frame. The total event count is
+	 *      fixed: each new event either replaces a random kept event or is
+	 *      discarded, so that the log is a uniform sample of the events.
+	 *
+	 * The current stage is reported by getStats(). Flushing the log restores
+	 * the configured options for the new log.
+	 *
+	 * The default is zero, which means no limit.
+	 *
+	 * @param int $bytes
+	 */
+	public function setMemoryLimit( $bytes ) {
+	}
+
+	/**
+	 * Enable or disable frames for internal functions.
+	 *
+	 * By default, only user code has frames, so a sample taken during a
+	 * call to an internal function such as curl_exec() or usleep() is
+	 * attributed to the calling line. If this is enabled, a frame is added
+	 * for the internal function. It has a function name and possibly a class
+	 * name, but no file or line. With EXCIMER_REAL, this shows how much time
+	 * is spent blocked in I/O and other internal calls.
+	 *
+	 * Samples can only be taken inside an internal function in PHP 8.4 and
+	 * later. In earlier versions, the timer interrupt is handled after the
+	 * internal function returns, so this has no effect.
+	 *
+	 * This takes effect immediately and applies to new logs created by
+	 * flushing.
+	 *
+	 * @param bool $enable
+	 */
+	public function setInternalFrames( $enable ) {
+	}
+
+	/**
+	 * Set how precisely the location of each sample is recorded, as one of
+	 * the EXCIMER_GRANULARITY_* constants.
+	 *
+	 * By default, each distinct line in a call stack has its own frame.
+	 * With EXCIMER_GRANULARITY_FUNCTION, the line is ignored, so there is
+	 * one frame per distinct call stack of functions. This uses much less
+	 * memory for frames on large codebases and makes formatting faster, and
+	 * most formats discard the line anyway. With EXCIMER_GRANULARITY_OPLINE,
+	 * samples on the same line are further divided by opcode.
+	 *
+	 * This takes effect immediately and applies to new logs created by
+	 * flushing. Frames already in the log are not changed.
+	 *
+	 * @param int $granularity
+	 */
+	public function setGranularity( $granularity ) {
+	}
+
+	/**
+	 * Enable or disable compact storage of log entries.
+	 *
+	 * In compact mode, entries are stored in blocks of 256 with a
+	 * variable-length encoding: the frame index, the event count only if it
+	 * is not 1, and the time since the previous entry. This typically uses
+	 * 4-6 times less memory than the default, which matters for profiles
+	 * with a short period that are kept until the end of the request.
+	 * Accessing an entry decodes its whole block, so sequential access is
+	 * efficient but random access is slower.
+	 *
+	 * This takes effect immediately, converting the entries of the current
+	 * log. Compact storage is not used in aggregate mode.
+	 *
+	 * @param bool $compact
+	 */
+	public function setCompact( $compact ) {
+	}
+
+	/**
+	 * Enable or disable aggregate mode.
+	 *
+	 * In aggregate mode, the log has at most one entry per unique stack.
+	 * When a sample has the same stack as an existing entry, the event count
+	 * of that entry is incremented instead of adding a new entry. So memory
+	 * usage is bounded by the number of unique stacks rather than the
+	 * duration of the profile, which is useful for long-running processes
+	 * when only a flame graph or other aggregate output is needed.
+	 *
+	 * The timestamp of each entry is the time at which its stack was first
+	 * seen. The maxSamples limit passed to setFlushCallback() applies to the
+	 * number of entries, that is, the number of unique stacks.
+	 *
+	 * This takes effect immediately. Existing entries in the current log
+	 * with the same stack are merged.
+	 *
+	 * @param bool $aggregate
+	 */
+	public function setAggregate( $aggregate ) {
+	}
+
+	/**
+	 * Enable or disable coalescing of consecutive samples.
+	 *
+	 * When coalescing is enabled, a sample with the same stack as the last
+	 * entry in the log increments the event count of that entry instead of
+	 * adding a new entry. This keeps a profile with a short period compact
+	 * when the program stays at the same place for several samples, for
+	 * example in a tight loop or a long call to an internal function, while
+	 * preserving the order of entries, unlike aggregate mode.
+	 *
+	 * The timestamp of a coalesced entry is the time of its first sample.
+	 * This takes effect for samples collected after it is called.
+	 *
+	 * @param bool $coalesce
+	 */
+	public function setCoalesce( $coalesce ) {
+	}
+
 	/**
 	 * Set a callback which will be called once the specified number of samples
-	 * has been collected.
+	 * has been collected. Samples are counted even if they were added to an
+	 * existing entry, as in aggregate mode.
 	 *
 	 * When the ExcimerProfiler object is destroyed, the callback will also
 	 * be called, unless no samples have been collected.
@@ -65,12 +227,152 @@ class ExcimerProfiler {
 	}
 
 	/**
-	 * Clear the flush callback. No callback will be called regardless of
-	 * how many samples are collected.
+	 * Clear the flush callback or asynchronous flush target. No callback will
+	 * be called regardless of how many samples are collected.
 	 */
 	public function clearFlushCallback() {
 	}
 
+	/**
+	 * Flush the log at fixed intervals of time, for long-running processes
+	 * which need a profile per minute, for example. Intervals are aligned to
+	 * the creation time of the profiler. When a sample is taken in a new
+	 * interval, the log of the previous interval is flushed to the flush
+	 * callback or asynchronous flush target, if there is one, before the
+	 * sample is added to the new log. Intervals with no samples are skipped.
+	 *
+	 * This may be combined with the sample limit passed to
+	 * setFlushCallback(), which may be zero to flush only by time. Logs
+	 * flushed by the sample limit or by flush() are still included in the
+	 * window of their interval.
+	 *
+	 * If $windows is non-zero, aggregated copies of the logs of that many of
+	 * the most recent intervals are kept in memory, and can be retrieved
+	 * with getWindows(). The memory used by each copy is proportional to
+	 * the number of unique stacks in its interval.
+	 *
+	 * Setting the interval discards any kept windows.
+	 *
+	 * @param float $interval The interval in seconds, or zero to disable
+	 *   flushing by time
+	 * @param int $windows The number of windows to keep
+	 */
+	public function setFlushInterval( $interval, $windows = 0 ) {
+	}
+
+	/**
+	 * Get the kept windows, as configured with setFlushInterval(), from
+	 * oldest to newest. The log of the current interval is not included,
+	 * use getLog() for that.
+	 *
+	 * Each element is an array with the following keys:
+	 *
+	 *   - start: The start of the interval, in seconds since the creation
+	 *     of the profiler, as in ExcimerLogEntry::getTimestamp().
+	 *   - end: The end of the interval.
+	 *   - log: An ExcimerLog in aggregate mode, containing the samples of
+	 *     the interval.
+	 *
+	 * @return array
+	 */
+	public function getWindows() {
+	}
+
+	/**
+	 * Write the log to a target from a background thread once the specified
+	 * number of samples has been collected. This replaces any flush callback.
+	 *
+	 * When the log is flushed, a copy of it is queued, and a native thread
+	 * formats it and writes it to the target. So the request being profiled
+	 * does not wait for formatting or I/O. The log is also written when
+	 * flush() is called or the ExcimerProfiler object is destroyed, unless
+	 * it is empty.
+	 *
+	 * The target may be:
+	 *
+	 *   - udp://host:port: Each log is sent as a datagram. Collapsed output
+	 *     which is too large for one datagram is split at line boundaries.
+	 *   - unix:///path: A connection is made to a Unix domain socket for
+	 *     each log.
+	 *   - fd://N: The log is written to file descriptor N.
+	 *   - Anything else is a filename. Collapsed output is appended to the
+	 *     file. A pprof profile replaces the file atomically, since pprof
+	 *     profiles can't be concatenated.
+	 *
+	 * Errors writing to the target are ignored. If too many logs are waiting
+	 * to be written, the log is dropped and a warning is raised.
+	 *
+	 * @param string $target
+	 * @param int $maxSamples
+	 * @param int $format EXCIMER_FORMAT_COLLAPSED or EXCIMER_FORMAT_PPROF
+	 */
+	public function setAsyncFlush( $target, $maxSamples, $format = EXCIMER_FORMAT_COLLAPSED ) {
+	}
+
+	/**
+	 * Write samples to the shared ring instead of the log.
+	 *
+	 * The shared ring is a lock-free ring buffer in a memory-mapped file,
+	 * configured with the excimer.ring_path and excimer.ring_size ini
+	 * settings. It is mapped at startup, so all FPM workers on a host write
+	 * to the same ring, and a single agent process can drain it with
+	 * excimer_ring_read().
+	 *
+	 * Each sample is written as a record holding the ID of the leaf frame. A
+	 * record for each frame is written before the first record which
+	 * refers to it. Frame IDs are only unique within a stream, which is a
+	 * log in one process. Flushing starts a new stream.
+	 *
+	 * In this mode, the log holds the frames but no entries, so it never
+	 * reaches the flush callback's maxSamples. If the ring is full, samples
+	 * are dropped.
+	 *
+	 * @param bool $enable
+	 */
+	public function setSharedRing( $enable ) {
+	}
+
+	/**
+	 * Reserve memory for the given number of samples. Memory will be reserved
+	 * in the current log, and also in each new log created when the log is
+	 * flushed, so that the log does not need to be reallocated while it is
+	 * growing to that size. Space for frames in a new log will be reserved
+	 * according to the number of frames in the log it replaces.
+	 *
+	 * This is typically set to the max_samples value passed to
+	 * setFlushCallback(). If it is zero, which is the default, memory is
+	 * allocated on demand.
+	 *
+	 * @param int $expectedSamples
+	 */
+	public function setExpectedSamples( $expectedSamples ) {
+	}
+
+	/**
+	 * Sample all PHP threads in the process, for example all request threads
+	 * of a thread-safe server, instead of only the thread which created the
+	 * profiler. This takes effect when the profiler is next started.
+	 *
+	 * The profiler's timer interrupts every thread which is executing a
+	 * request, so the overhead does not depend on the number of threads. Each
+	 * stack is placed under a {thread:N} frame, where N is a number identifying
+	 * the thread. Other threads capture their samples into logs of their own,
+	 * which are merged into this profiler's log in batches of 100 samples, and
+	 * when the thread's request ends. So the log may not yet contain the most
+	 * recent samples of other threads, and the entries of different threads
+	 * are not in timestamp order.
+	 *
+	 * Only one profiler in the process may sample all threads at a time. The
+	 * event type must be EXCIMER_REAL. The period, maximum depth, granularity,
+	 * internal frames, aggregate and coalesce options are passed to the other
+	 * threads when the profiler starts. If setMaxOverhead() lengthens the
+	 * period, the samples of other threads are weighted by the same factor.
+	 *
+	 * @param bool $enable
+	 */
+	public function setAllThreads( $enable ) {
+	}
+
 	/**
 	 * Start the profiler. If the profiler was already running, it will be
 	 * stopped and restarted with new options.
@@ -108,4 +410,30 @@ class ExcimerProfiler {
 	 */
 	public function flush() {
 	}
+
+	/**
+	 * Get counters describing the overhead of the profiler since it was
+	 * created. The array has the following keys:
+	 *
+	 *   - samples: The number of times a sample was captured.
+	 *   - events: The number of timer expirations delivered. This is more
+	 *     than "samples" if the timer expired more than once before the VM
+	 *     interrupt was handled.
+	 *   - overruns: The number of timer expirations which the kernel merged
+	 *     into a later notification.
+	 *   - interrupt_ns: The time spent handling samples during VM
+	 *     interrupts, including any flush, in nanoseconds.
+	 *   - flushes: The number of logs flushed.
+	 *   - flush_ns: The time spent in the flush callback or submitting logs
+	 *     to the asynchronous writer, in nanoseconds.
+	 *   - memory_stage: The degradation stage of the current log for the
+	 *     limit set by setMemoryLimit(), from 0 (none) to 3 (reservoir
+	 *     sampling).
+	 *   - log: The counters of the current log, as returned by
+	 *     ExcimerLog::getStats().
+	 *
+	 * @return array
+	 */
+	public function getStats() {
+	}
 }
@@ -6,6 +6,30 @@ define( 'EXCIMER_REAL', 0 );
 /** CPU time (user and system) consumed by the thread during execution */
 define( 'EXCIMER_CPU', 1 );
 
+/**
+ * Real (wall-clock) time, also recording the CPU time consumed by the thread
+ * between samples. Only supported by ExcimerProfiler.
+ */
+define( 'EXCIMER_REAL_CPU', 2 );
+
+/** Output format: flamegraph.pl collapsed format, as in ExcimerLog::formatCollapsed() */
+define( 'EXCIMER_FORMAT_COLLAPSED', 0 );
+
+/** Output format: pprof protobuf, as in ExcimerLog::formatPprof() */
+define( 'EXCIMER_FORMAT_PPROF', 1 );
+
+/**
+ * Frame granularity: one frame per function call. The line number of a frame
+ * is the line on which the function starts.
+ */
+define( 'EXCIMER_GRANULARITY_FUNCTION', 0 );
+
+/** Frame granularity: one frame per executing line. This is the default. */
+define( 'EXCIMER_GRANULARITY_LINE', 1 );
+
+/** Frame granularity: one frame per executing opcode */
+define( 'EXCIMER_GRANULARITY_OPLINE', 2 );
+
 /**
  * Abbreviated interface for starting a wall-clock timer. Equivalent to:
  *
@@ -26,3 +50,57 @@ define( 'EXCIMER_CPU', 1 );
  */
 function excimer_set_timeout( $callback, $interval ) {
 }
+
+/**
+ * Consume records from the shared ring, which is written to by
+ * ExcimerProfiler objects with setSharedRing() enabled. There can be only
+ * one reader of a ring at a time. If another process or thread is reading
+ * the ring, a warning is raised and false is returned.
+ *
+ * Each record is an array with a "type" key, which is either "frame" or
+ * "sample", and a "stream" key. A frame record also has "id", "prev_id",
+ * "name", "file", "line" and, for closures, "closure_line". A sample record
+ * has "id", which is the ID of the leaf frame or zero, "event_count" and
+ * "timestamp".
+ *
+ * The reader waits for a record which is still being written. If the writer
+ * process has died, the record is skipped.
+ *
+ * If the ring is not configured, a warning is raised and false is returned.
+ *
+ * @param int $limit The maximum number of records to return, or zero for
+ *   no limit
+ * @return array|false
+ */
+function excimer_ring_read( $limit = 0 ) {
+}
+
+/**
+ * Get the profiler which was started automatically for the current request,
+ * or null if there is none.
+ *
+ * Automatic profiling is configured with ini settings, and a profiler is
+ * started before any PHP code runs, so there is no PHP overhead for requests
+ * which are not profiled:
+ *
+ *   - excimer.auto_sample_rate: The probability of profiling a request,
+ *     from 0 to 1. The default is 0, which disables automatic profiling.
+ *   - excimer.auto_period: The sampling period in seconds. The default is
+ *     0.01.
+ *   - excimer.auto_event_type: "real", "cpu" or "real_cpu", as in
+ *     ExcimerProfiler::setEventType(). The default is "real".
+ *   - excimer.auto_target: Where to write the profile, in the same form as
+ *     the target of ExcimerProfiler::setAsyncFlush(). Automatic profiling is
+ *     disabled if this is empty.
+ *   - excimer.auto_format: "collapsed" or "pprof". The default is
+ *     "collapsed".
+ *
+ * The log is written by the background thread when the profiler is
+ * destroyed at the end of the request. The returned profiler may be
+ * reconfigured, for example by calling setAsyncFlush() with a different
+ * target, or stopped to skip the rest of the request.
+ *
+ * @return ExcimerProfiler|null
+ */
+function excimer_get_auto_profiler() {
+}
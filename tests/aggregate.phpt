@@ -0,0 +1,66 @@
+--TEST--
+ExcimerProfiler aggregate mode
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	global $profiler;
+	while ($profiler->getLog()->getEventCount() < 50) {
+		usleep(1000);
+	}
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+
+// Merge entries collected before aggregate mode was enabled
+$profiler->start();
+foo();
+$profiler->stop();
+$profiler->setAggregate(true);
+$log = $profiler->flush();
+echo "merged: " . (count($log) < 10 ? 'OK' : 'FAILED') . "\n";
+
+// The new log inherits the option
+$profiler->start();
+foo();
+$profiler->stop();
+$log = $profiler->flush();
+echo "entries: " . (count($log) < 10 ? 'OK' : 'FAILED') . "\n";
+
+$total = 0;
+foreach ($log as $entry) {
+	$total += $entry->getEventCount();
+}
+echo "total: " . ($total === $log->getEventCount() ? 'OK' : 'FAILED') . "\n";
+
+$collapsedTotal = 0;
+foreach (explode("\n", trim($log->formatCollapsed())) as $line) {
+	$collapsedTotal += (int)substr($line, strrpos($line, ' ') + 1);
+}
+echo "collapsed: " . ($collapsedTotal === $log->getEventCount() ? 'OK' : 'FAILED') . "\n";
+echo "foo: " . (strpos($log->formatCollapsed(), 'foo') !== false ? 'OK' : 'FAILED') . "\n";
+
+// The flush callback counts samples, not aggregated entries
+$flushed = 0;
+$profiler->setFlushCallback(function ($log) use (&$flushed) {
+	$flushed++;
+}, 10);
+$profiler->start();
+$start = microtime(true);
+while (!$flushed && microtime(true) - $start < 10) {
+	usleep(1000);
+}
+$profiler->stop();
+echo "flush: " . ($flushed ? 'OK' : 'FAILED') . "\n";
+
+--EXPECT--
+merged: OK
+entries: OK
+total: OK
+collapsed: OK
+foo: OK
+flush: OK
@@ -0,0 +1,40 @@
+--TEST--
+ExcimerLog::aggregateByFunction
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function recurse($n) {
+	global $profiler;
+	if ($n > 0) {
+		recurse($n - 1);
+	} else {
+		$profiler->start();
+		while (count($profiler->getLog()) < 5) {
+			usleep(1000);
+		}
+		$profiler->stop();
+	}
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.01);
+recurse(3);
+$log = $profiler->flush();
+
+$aggr = $log->aggregateByFunction();
+$count = $log->getEventCount();
+$info = $aggr['recurse'];
+echo "function: {$info['function']}\n";
+echo "self: " . ($info['self'] === $count ? 'OK' : 'FAILED') . "\n";
+echo "inclusive: " . ($info['inclusive'] === $count ? 'OK' : 'FAILED') . "\n";
+$first = reset($aggr);
+echo "sorted: " . ($first['inclusive'] === $count ? 'OK' : 'FAILED') . "\n";
+
+--EXPECT--
+function: recurse
+self: OK
+inclusive: OK
+sorted: OK
@@ -0,0 +1,52 @@
+--TEST--
+ExcimerProfiler::setAllThreads
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	global $profiler;
+	while (count($profiler->getLog()) < 5) {
+		usleep(1000);
+	}
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setAllThreads(true);
+$profiler->start();
+
+$other = new ExcimerProfiler;
+$other->setEventType(EXCIMER_REAL);
+$other->setAllThreads(true);
+$other->start();
+$other = null;
+
+foo();
+$profiler->stop();
+$log = $profiler->flush();
+
+$ok = true;
+foreach (explode("\n", trim($log->formatCollapsed())) as $line) {
+	if (!preg_match('/^\{thread:\d+\};/', $line)) {
+		$ok = false;
+	}
+}
+echo "thread frames: " . ($ok ? 'OK' : 'FAILED') . "\n";
+echo "foo: " . (strpos($log->formatCollapsed(), ';foo ') !== false ? 'OK' : 'FAILED') . "\n";
+
+// Another profiler may sample all threads once the first is destroyed
+$profiler = null;
+$profiler = new ExcimerProfiler;
+$profiler->setAllThreads(true);
+$profiler->start();
+$profiler->stop();
+echo "restart: OK\n";
+
+--EXPECTF--
+Warning: ExcimerProfiler::start(): Another profiler is already sampling all threads in %s on line %d
+thread frames: OK
+foo: OK
+restart: OK
@@ -0,0 +1,57 @@
+--TEST--
+ExcimerProfiler::setAsyncFlush
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	bar();
+}
+
+function bar() {
+	global $profiler;
+	$profiler->start();
+	while (count($profiler->getLog()) < 5) {
+		usleep(1000);
+	}
+	$profiler->stop();
+}
+
+function waitForFile($file, $size) {
+	$t = microtime(true);
+	do {
+		clearstatcache();
+		if (file_exists($file) && filesize($file) >= $size) {
+			return file_get_contents($file);
+		}
+		usleep(1000);
+	} while (microtime(true) - $t < 10);
+	return false;
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setAsyncFlush('udp://localhost', 10);
+
+$formats = [
+	'collapsed' => EXCIMER_FORMAT_COLLAPSED,
+	'pprof' => EXCIMER_FORMAT_PPROF
+];
+foreach ($formats as $name => $format) {
+	$file = tempnam(sys_get_temp_dir(), 'excimer');
+	unlink($file);
+	$profiler->setAsyncFlush($file, 1000, $format);
+	foo();
+	$log = $profiler->flush();
+	$expected = $format === EXCIMER_FORMAT_PPROF ? $log->formatPprof() : $log->formatCollapsed();
+	$result = waitForFile($file, strlen($expected));
+	echo "$name: " . ($result === $expected ? 'OK' : 'FAILED') . "\n";
+	@unlink($file);
+}
+
+--EXPECTF--
+Warning: ExcimerProfiler::setAsyncFlush(): UDP target must be of the form udp://host:port in %s on line %d
+collapsed: OK
+pprof: OK
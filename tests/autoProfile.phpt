@@ -0,0 +1,61 @@
+--TEST--
+Automatic profiling with excimer.auto_sample_rate
+--SKIPIF--
+<?php
+if (!extension_loaded("excimer")) print "skip";
+if (!file_exists(ini_get('extension_dir') . '/excimer.' . PHP_SHLIB_SUFFIX)) print "skip excimer is not a shared extension";
+?>
+--FILE--
+<?php
+
+$script = __DIR__ . '/autoProfile.child.tmp';
+$target = __DIR__ . '/autoProfile.tmp';
+@unlink($target);
+
+file_put_contents($script, <<<'PHP'
+<?php
+function foo() {
+	$profiler = excimer_get_auto_profiler();
+	while (count($profiler->getLog()) < 10) {
+		usleep(1000);
+	}
+}
+echo get_class(excimer_get_auto_profiler()) . "\n";
+foo();
+PHP
+);
+
+// The profile is written at request shutdown, so run the request in a
+// child process and read the target after it exits
+$cmd = implode(' ', array_map('escapeshellarg', [
+	PHP_BINARY, '-n',
+	'-d', 'extension_dir=' . ini_get('extension_dir'),
+	'-d', 'extension=excimer',
+	'-d', 'excimer.auto_sample_rate=1',
+	'-d', 'excimer.auto_period=0.001',
+	'-d', 'excimer.auto_target=' . $target,
+	'-d', 'excimer.auto_format=collapsed',
+	$script
+]));
+echo shell_exec($cmd);
+
+$profile = (string)@file_get_contents($target);
+echo "written: " . ($profile !== '' ? 'OK' : 'FAILED') . "\n";
+echo "foo: " . (strpos($profile, 'foo') !== false ? 'OK' : 'FAILED') . "\n";
+
+$total = 0;
+foreach (explode("\n", trim($profile)) as $line) {
+	$total += (int)substr($line, strrpos($line, ' ') + 1);
+}
+echo "samples: " . ($total >= 10 ? 'OK' : 'FAILED') . "\n";
+
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/autoProfile.tmp');
+@unlink(__DIR__ . '/autoProfile.child.tmp');
+?>
+--EXPECT--
+ExcimerProfiler
+written: OK
+foo: OK
+samples: OK
@@ -0,0 +1,80 @@
+--TEST--
+ExcimerProfiler::setCoalesce()
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function spin($events) {
+	global $profiler;
+	$target = $profiler->getLog()->getEventCount() + $events;
+	while ($profiler->getLog()->getEventCount() < $target) {
+		usleep(1000);
+	}
+}
+
+function foo() {
+	spin(20);
+}
+
+function bar() {
+	spin(20);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setGranularity(EXCIMER_GRANULARITY_FUNCTION);
+$profiler->setCoalesce(true);
+$profiler->start();
+foo();
+bar();
+foo();
+$profiler->stop();
+$log = $profiler->flush();
+
+$total = 0;
+$prev = null;
+$adjacent = false;
+$callers = [];
+foreach ($log as $entry) {
+	$total += $entry->getEventCount();
+	$trace = $entry->getTrace();
+	$key = json_encode($trace);
+	if ($key === $prev) {
+		$adjacent = true;
+	}
+	$prev = $key;
+	if (($trace[0]['function'] ?? '') === 'spin') {
+		$callers[] = $trace[1]['function'];
+	}
+}
+$callers = array_values(array_unique($callers));
+
+echo "entries: " . (count($log) < $log->getEventCount() ? 'OK' : 'FAILED') . "\n";
+echo "total: " . ($total === $log->getEventCount() ? 'OK' : 'FAILED') . "\n";
+echo "adjacent: " . (!$adjacent ? 'OK' : 'FAILED') . "\n";
+echo "order: " . implode(',', array_slice($callers, 0, 2)) . "\n";
+echo "stats: " . ($log->getStats()['samples_coalesced'] > 0 ? 'OK' : 'FAILED') . "\n";
+
+// Compact entries are coalesced in place
+$profiler->setCompact(true);
+$profiler->start();
+foo();
+$profiler->stop();
+$log = $profiler->flush();
+$total = 0;
+foreach ($log as $entry) {
+	$total += $entry->getEventCount();
+}
+echo "compact entries: " . (count($log) < $log->getEventCount() ? 'OK' : 'FAILED') . "\n";
+echo "compact total: " . ($total === $log->getEventCount() ? 'OK' : 'FAILED') . "\n";
+
+--EXPECT--
+entries: OK
+total: OK
+adjacent: OK
+order: foo,bar
+stats: OK
+compact entries: OK
+compact total: OK
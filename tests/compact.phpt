@@ -0,0 +1,56 @@
+--TEST--
+ExcimerProfiler compact entry storage
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo($n) {
+	global $profiler;
+	while (count($profiler->getLog()) < $n) {
+		usleep(100);
+	}
+}
+
+function dump($log) {
+	$result = [];
+	foreach ($log as $entry) {
+		$result[] = [$entry->getTimestamp(), $entry->getEventCount(), $entry->getTrace()];
+	}
+	return $result;
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.0001);
+$profiler->setCompact(true);
+$profiler->start();
+foo(300);
+$profiler->stop();
+
+$log = $profiler->getLog();
+$compact = dump($log);
+$collapsed = $log->formatCollapsed();
+$last = $log[count($log) - 1]->getTimestamp();
+
+// Convert back to the plain representation and compare
+$profiler->setCompact(false);
+$plain = dump($log);
+echo "entries: " . ($compact === $plain ? 'OK' : 'FAILED') . "\n";
+echo "collapsed: " . ($collapsed === $log->formatCollapsed() ? 'OK' : 'FAILED') . "\n";
+echo "offset: " . ($last === $plain[count($plain) - 1][0] ? 'OK' : 'FAILED') . "\n";
+
+// The option is inherited by new logs. A plain entry takes 24 bytes.
+$profiler->setCompact(true);
+$profiler->flush();
+$profiler->start();
+foo(1000);
+$profiler->stop();
+$stats = $profiler->getLog()->getStats();
+echo "memory: " . ($stats['entry_bytes'] < count($profiler->getLog()) * 12 ? 'OK' : 'FAILED') . "\n";
+
+--EXPECT--
+entries: OK
+collapsed: OK
+offset: OK
+memory: OK
@@ -0,0 +1,38 @@
+--TEST--
+ExcimerProfiler::setExpectedSamples
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setExpectedSamples(20);
+$sizes = [];
+$profiler->setFlushCallback(function ($log) use (&$sizes) {
+	$sizes[] = count($log);
+	foreach ($log as $entry) {
+		$entry->getTrace();
+	}
+}, 20);
+
+$profiler->start();
+$t = microtime(true);
+while (count($sizes) < 3 && microtime(true) - $t < 10) {
+	foo();
+}
+$profiler->stop();
+
+foreach ($sizes as $i => $size) {
+	echo "$i: " . ($size === 20 ? "OK" : "FAILED: $size") . "\n";
+}
+
+--EXPECT--
+0: OK
+1: OK
+2: OK
@@ -0,0 +1,91 @@
+--TEST--
+ExcimerProfiler::setFlushInterval()
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+$logs = [];
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setFlushCallback(function ($log) use (&$logs) {
+	$logs[] = $log;
+}, 0);
+$profiler->setFlushInterval(0.05, 3);
+$profiler->start();
+
+function foo() {
+	global $logs;
+	while (count($logs) < 5) {
+		usleep(1000);
+	}
+}
+foo();
+$profiler->stop();
+
+$windows = $profiler->getWindows();
+echo "windows: " . count($windows) . "\n";
+
+// Each flushed log is within its own interval
+$ok = true;
+foreach ($logs as $log) {
+	$first = $log[0]->getTimestamp();
+	$last = $log[count($log) - 1]->getTimestamp();
+	$ok = $ok && floor($first / 0.05) === floor($last / 0.05);
+}
+echo "aligned: " . ($ok ? 'OK' : 'FAILED') . "\n";
+
+// The windows are aggregated copies of the last flushed logs
+$ok = true;
+foreach ($windows as $i => $window) {
+	$log = $logs[count($logs) - count($windows) + $i];
+	$ok = $ok && $window['log']->getEventCount() === $log->getEventCount()
+		&& count($window['log']) <= count($log)
+		&& $window['end'] - $window['start'] > 0.049
+		&& $log[0]->getTimestamp() >= $window['start']
+		&& $log[0]->getTimestamp() < $window['end'];
+}
+echo "windows match: " . ($ok ? 'OK' : 'FAILED') . "\n";
+echo "increasing: " . ($windows[0]['start'] < $windows[2]['start'] ? 'OK' : 'FAILED') . "\n";
+
+// Logs flushed by the sample limit are merged into the window
+$limitLogs = [];
+$limited = new ExcimerProfiler;
+$limited->setEventType(EXCIMER_REAL);
+$limited->setPeriod(0.001);
+$limited->setFlushCallback(function ($log) use (&$limitLogs) {
+	$limitLogs[] = $log;
+}, 10);
+$limited->setFlushInterval(0.05, 100);
+$limited->start();
+$end = microtime(true) + 0.2;
+while (microtime(true) < $end) {
+	usleep(1000);
+}
+$limited->stop();
+$ok = count($limited->getWindows()) > 0;
+foreach ($limited->getWindows() as $window) {
+	$count = 0;
+	foreach ($limitLogs as $log) {
+		if ($log[0]->getTimestamp() >= $window['start'] && $log[0]->getTimestamp() < $window['end']) {
+			$count += $log->getEventCount();
+		}
+	}
+	$ok = $ok && $count === $window['log']->getEventCount();
+}
+echo "sample limit: " . ($ok ? 'OK' : 'FAILED') . "\n";
+
+$profiler->setFlushInterval(0);
+echo "cleared: " . count($profiler->getWindows()) . "\n";
+$profiler->setFlushInterval(1, -1);
+
+--EXPECTF--
+windows: 3
+aligned: OK
+windows match: OK
+increasing: OK
+sample limit: OK
+cleared: 0
+
+Warning: ExcimerProfiler::setFlushInterval(): The number of windows must be between 0 and 100000 in %s on line %d
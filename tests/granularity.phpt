@@ -0,0 +1,60 @@
+--TEST--
+ExcimerProfiler::setGranularity()
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	global $profiler;
+	while ($profiler->getLog()->getEventCount() < 50) {
+		usleep(100);
+		usleep(100);
+		usleep(100);
+	}
+}
+
+function run($granularity) {
+	global $profiler;
+	$profiler = new ExcimerProfiler;
+	$profiler->setEventType(EXCIMER_REAL);
+	$profiler->setPeriod(0.0001);
+	if ($granularity !== null) {
+		$profiler->setGranularity($granularity);
+	}
+	$profiler->start();
+	foo();
+	$profiler->stop();
+	return $profiler->flush();
+}
+
+function getLines($log) {
+	$lines = [];
+	foreach ($log as $entry) {
+		$frame = $entry->getTrace()[0] ?? [];
+		if (($frame['function'] ?? '') === 'foo') {
+			$lines[$frame['line']] = true;
+		}
+	}
+	return $lines;
+}
+
+$log = run(EXCIMER_GRANULARITY_FUNCTION);
+echo "function lines: " . implode(',', array_keys(getLines($log))) . "\n";
+echo "function collapsed: " . (strpos($log->formatCollapsed(), 'foo') !== false ? 'OK' : 'FAILED') . "\n";
+
+$log = run(null);
+echo "line: " . (count(getLines($log)) > 1 ? 'OK' : 'FAILED') . "\n";
+
+$log = run(EXCIMER_GRANULARITY_OPLINE);
+echo "opline: " . (count(getLines($log)) > 1 ? 'OK' : 'FAILED') . "\n";
+
+$profiler->setGranularity(3);
+
+--EXPECTF--
+function lines: 3
+function collapsed: OK
+line: OK
+opline: OK
+
+Warning: ExcimerProfiler::setGranularity(): Invalid granularity in %s on line %d
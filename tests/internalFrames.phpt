@@ -0,0 +1,49 @@
+--TEST--
+ExcimerProfiler internal function frames
+--SKIPIF--
+<?php
+if (!extension_loaded("excimer")) print "skip";
+// Before PHP 8.4, the interrupt is handled after the internal call returns
+if (PHP_VERSION_ID < 80400) print "skip PHP 8.4+ only";
+?>
+--FILE--
+<?php
+
+function foo() {
+	global $profiler;
+	while (count($profiler->getLog()) < 5) {
+		usleep(10000);
+	}
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.01);
+$profiler->setInternalFrames(true);
+$profiler->start();
+foo();
+$profiler->stop();
+$log = $profiler->flush();
+
+$found = false;
+foreach ($log as $entry) {
+	$trace = $entry->getTrace();
+	if ($trace[0]['function'] === 'usleep') {
+		$found = true;
+		echo "file: " . (isset($trace[0]['file']) ? 'FAILED' : 'OK') . "\n";
+		echo "caller: " . $trace[1]['function'] . "\n";
+		break;
+	}
+}
+echo "found: " . ($found ? 'OK' : 'FAILED') . "\n";
+echo "collapsed: " . (strpos($log->formatCollapsed(), 'foo;usleep ') !== false ? 'OK' : 'FAILED') . "\n";
+echo "speedscope: " . (strpos($log->formatSpeedscope(), '"usleep"') !== false ? 'OK' : 'FAILED') . "\n";
+echo "pprof: " . (strpos($log->formatPprof(), 'usleep') !== false ? 'OK' : 'FAILED') . "\n";
+
+--EXPECT--
+file: OK
+caller: foo
+found: OK
+collapsed: OK
+speedscope: OK
+pprof: OK
@@ -0,0 +1,30 @@
+--TEST--
+ExcimerProfiler adaptive period
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setMaxOverhead(2);
+
+// Any measurable overhead exceeds this, so the period keeps doubling
+$profiler->setMaxOverhead(1e-12);
+$profiler->start();
+$start = microtime(true);
+while (microtime(true) - $start < 0.4) {
+	usleep(1000);
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+// The event count is still in units of the configured period
+echo "events: " . ($log->getEventCount() >= 200 ? 'OK' : 'FAILED') . "\n";
+echo "samples: " . (count($log) < $log->getEventCount() / 2 ? 'OK' : 'FAILED') . "\n";
+
+--EXPECTF--
+Warning: ExcimerProfiler::setMaxOverhead(): The maximum overhead must be at least 0 and less than 1 in %s on line %d
+events: OK
+samples: OK
@@ -0,0 +1,75 @@
+--TEST--
+ExcimerProfiler::setMemoryLimit()
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function recurse($n) {
+	if ($n > 0) {
+		recurse($n - 1);
+	} else {
+		usleep(100);
+	}
+}
+
+function runUntil($condition) {
+	$start = microtime(true);
+	for ($i = 0; !$condition() && microtime(true) - $start < 10; $i++) {
+		recurse($i % 200);
+	}
+}
+
+function getStage() {
+	global $profiler;
+	return $profiler->getStats()['memory_stage'];
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.0001);
+$profiler->setMemoryLimit(1);
+$profiler->start();
+
+runUntil(function () {
+	return getStage() >= 1;
+});
+echo "aggregate: " . (getStage() >= 1 ? 'OK' : 'FAILED') . "\n";
+
+runUntil(function () {
+	return getStage() >= 3;
+});
+echo "reservoir: " . (getStage() === 3 ? 'OK' : 'FAILED') . "\n";
+
+$log = $profiler->getLog();
+$events = $log->getEventCount();
+$frames = $log->getStats()['frames_added'];
+$deadline = microtime(true) + 0.5;
+runUntil(function () use ($deadline) {
+	return microtime(true) > $deadline;
+});
+$profiler->stop();
+$log = $profiler->getLog();
+echo "events: " . ($log->getEventCount() === $events ? 'OK' : 'FAILED') . "\n";
+echo "frames: " . ($log->getStats()['frames_added'] === $frames ? 'OK' : 'FAILED') . "\n";
+
+$total = 0;
+foreach ($log as $entry) {
+	$total += $entry->getEventCount();
+}
+echo "total: " . ($total === $log->getEventCount() ? 'OK' : 'FAILED') . "\n";
+
+$profiler->flush();
+echo "reset: " . getStage() . "\n";
+
+$profiler->setMemoryLimit(-1);
+
+--EXPECTF--
+aggregate: OK
+reservoir: OK
+events: OK
+frames: OK
+total: OK
+reset: 0
+
+Warning: ExcimerProfiler::setMemoryLimit(): The memory limit must not be negative in %s on line %d
@@ -0,0 +1,101 @@
+--TEST--
+ExcimerLog::merge() and ExcimerLog::mergeAll()
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	global $profiler;
+	while ($profiler->getLog()->getEventCount() < 20) {
+		usleep(1000);
+	}
+}
+
+function bar() {
+	global $profiler;
+	while ($profiler->getLog()->getEventCount() < 20) {
+		usleep(1000);
+	}
+}
+
+function collect($function) {
+	global $profiler;
+	$profiler = new ExcimerProfiler;
+	$profiler->setEventType(EXCIMER_REAL);
+	$profiler->setPeriod(0.001);
+	$profiler->start();
+	$function();
+	$profiler->stop();
+	return $profiler->flush();
+}
+
+function getCounts($log) {
+	$counts = [];
+	foreach (explode("\n", trim($log->formatCollapsed())) as $line) {
+		if ($line === '') {
+			continue;
+		}
+		$pos = strrpos($line, ' ');
+		$stack = substr($line, 0, $pos);
+		$counts[$stack] = ($counts[$stack] ?? 0) + (int)substr($line, $pos + 1);
+	}
+	ksort($counts);
+	return $counts;
+}
+
+$fooLog = collect('foo');
+$barLog = collect('bar');
+$fooCount = count($fooLog);
+$expected = getCounts($fooLog);
+foreach (getCounts($barLog) as $stack => $count) {
+	$expected[$stack] = ($expected[$stack] ?? 0) + $count;
+}
+ksort($expected);
+
+$merged = ExcimerLog::mergeAll([$fooLog, $barLog]);
+echo "mergeAll count: " . (count($merged) === $fooCount + count($barLog) ? 'OK' : 'FAILED') . "\n";
+echo "mergeAll events: " .
+	($merged->getEventCount() === $fooLog->getEventCount() + $barLog->getEventCount() ? 'OK' : 'FAILED') . "\n";
+echo "mergeAll collapsed: " . (getCounts($merged) === $expected ? 'OK' : 'FAILED') . "\n";
+$ok = false;
+for ($i = 0; $i < count($merged); $i++) {
+	$function = $merged[$i]->getTrace()[0]['function'] ?? '';
+	if ($function === 'bar') {
+		$ok = $i >= $fooCount;
+		break;
+	}
+}
+echo "trace: " . ($ok ? 'OK' : 'FAILED') . "\n";
+
+$fooLog->merge($barLog);
+echo "merge collapsed: " . (getCounts($fooLog) === $expected ? 'OK' : 'FAILED') . "\n";
+echo "source unchanged: " . (count($barLog) === count($merged) - $fooCount ? 'OK' : 'FAILED') . "\n";
+
+// Merging a log with itself doubles it
+$before = getCounts($barLog);
+$barLog->merge($barLog);
+$after = getCounts($barLog);
+$ok = true;
+foreach ($before as $stack => $count) {
+	$ok = $ok && $after[$stack] === $count * 2;
+}
+echo "self: " . ($ok ? 'OK' : 'FAILED') . "\n";
+
+echo "empty: " . count(ExcimerLog::mergeAll([])) . "\n";
+ExcimerLog::mergeAll([$fooLog, 1]);
+$fooLog->merge(new stdClass);
+
+--EXPECTF--
+mergeAll count: OK
+mergeAll events: OK
+mergeAll collapsed: OK
+trace: OK
+merge collapsed: OK
+source unchanged: OK
+self: OK
+empty: 0
+
+Warning: ExcimerLog::mergeAll(): The array must contain only ExcimerLog objects in %s on line %d
+
+Warning: ExcimerLog::merge(): Argument 1 must be an ExcimerLog in %s on line %d
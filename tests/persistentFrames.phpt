@@ -0,0 +1,61 @@
+--TEST--
+excimer.persistent_frames
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--INI--
+excimer.persistent_frames=1000
+--FILE--
+<?php
+
+function foo() {
+	bar();
+}
+
+function bar() {
+	baz();
+}
+
+function baz() {
+	global $profiler;
+	$profiler->start();
+	while (count($profiler->getLog()) < 5) {
+		usleep(1000);
+	}
+	$profiler->stop();
+}
+
+function qux() {
+	baz();
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+
+foo();
+$log1 = $profiler->flush();
+qux();
+$log2 = $profiler->flush();
+
+// Both logs share the frames, but each is formatted with its own entries
+echo "log1: " . (strpos($log1->formatCollapsed(), "foo;bar;baz ") !== false ? 'OK' : 'FAILED') . "\n";
+$collapsed = $log2->formatCollapsed();
+echo "log2: " . (strpos($collapsed, "qux;baz ") !== false ? 'OK' : 'FAILED') . "\n";
+echo "collapsed: " . (strpos($collapsed, 'bar') === false ? 'OK' : 'FAILED') . "\n";
+echo "speedscope: " . (strpos($log2->formatSpeedscope(), '"bar"') === false ? 'OK' : 'FAILED') . "\n";
+echo "pprof: " . (strpos($log2->formatPprof(), 'bar') === false ? 'OK' : 'FAILED') . "\n";
+echo "serialize: " . (strpos($log2->serialize(), 'bar') === false ? 'OK' : 'FAILED') . "\n";
+echo "aggregate: " . (!isset($log2->aggregateByFunction()['bar']) ? 'OK' : 'FAILED') . "\n";
+
+$trace = $log2[0]->getTrace();
+echo "trace: " . $trace[0]['function'] . "\n";
+
+--EXPECT--
+log1: OK
+log2: OK
+collapsed: OK
+speedscope: OK
+pprof: OK
+serialize: OK
+aggregate: OK
+trace: baz
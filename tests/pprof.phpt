@@ -0,0 +1,105 @@
+--TEST--
+ExcimerLog::formatPprof
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function readVarint($data, &$pos) {
+	$value = 0;
+	$shift = 0;
+	do {
+		$byte = ord($data[$pos++]);
+		$value |= ($byte & 0x7f) << $shift;
+		$shift += 7;
+	} while ($byte & 0x80);
+	return $value;
+}
+
+/**
+ * Decode a protobuf message into an array of field number => list of values.
+ * Length-delimited fields are returned as strings.
+ */
+function decode($data) {
+	$fields = [];
+	$pos = 0;
+	while ($pos < strlen($data)) {
+		$tag = readVarint($data, $pos);
+		if (($tag & 7) === 0) {
+			$fields[$tag >> 3][] = readVarint($data, $pos);
+		} elseif (($tag & 7) === 2) {
+			$length = readVarint($data, $pos);
+			$fields[$tag >> 3][] = substr($data, $pos, $length);
+			$pos += $length;
+		} else {
+			throw new Exception("Unexpected wire type");
+		}
+	}
+	return $fields;
+}
+
+function decodePacked($data) {
+	$values = [];
+	$pos = 0;
+	while ($pos < strlen($data)) {
+		$values[] = readVarint($data, $pos);
+	}
+	return $values;
+}
+
+function foo() {
+	bar();
+}
+
+function bar() {
+	global $profiler;
+	$profiler->start();
+	while (count($profiler->getLog()) < 5) {
+		usleep(1000);
+	}
+	$profiler->stop();
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.01);
+foo();
+$log = $profiler->flush();
+
+$profile = decode($log->formatPprof());
+$strings = $profile[6];
+echo "first string: " . var_export($strings[0], true) . "\n";
+
+$functionNames = [];
+foreach ($profile[5] as $function) {
+	$function = decode($function);
+	$functionNames[$function[1][0]] = $strings[$function[2][0]];
+}
+$locationFunctions = [];
+foreach ($profile[4] as $location) {
+	$location = decode($location);
+	$line = decode($location[4][0]);
+	$locationFunctions[$location[1][0]] = $functionNames[$line[1][0]];
+}
+
+$total = 0;
+foreach ($profile[2] as $sample) {
+	$sample = decode($sample);
+	$stack = array_map(function ($id) use ($locationFunctions) {
+		return $locationFunctions[$id];
+	}, decodePacked($sample[1][0]));
+	$values = decodePacked($sample[2][0]);
+	if (array_slice($stack, 0, 2) === ['bar', 'foo']) {
+		$total += $values[0];
+	}
+	if ($values[1] !== $values[0] * 10000000) {
+		echo "Wrong time value\n";
+	}
+}
+echo "period: " . $profile[12][0] . "\n";
+echo "event count: " . ($total === $log->getEventCount() ? 'OK' : 'FAILED') . "\n";
+
+--EXPECT--
+first string: ''
+period: 10000000
+event count: OK
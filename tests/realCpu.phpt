@@ -0,0 +1,53 @@
+--TEST--
+ExcimerProfiler EXCIMER_REAL_CPU
+--SKIPIF--
+<?php
+if (!extension_loaded("excimer")) print "skip";
+if (!defined("EXCIMER_REAL_CPU")) print "skip CPU profiling not supported";
+?>
+--FILE--
+<?php
+
+function spin() {
+	$end = microtime(true) + 0.2;
+	while (microtime(true) < $end);
+}
+
+function idle() {
+	$end = microtime(true) + 0.2;
+	while (microtime(true) < $end) {
+		usleep(1000);
+	}
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL_CPU);
+$profiler->setPeriod(0.01);
+$profiler->start();
+spin();
+idle();
+$profiler->stop();
+$log = $profiler->flush();
+
+$cpu = ['spin' => 0, 'idle' => 0];
+$wall = ['spin' => 0, 'idle' => 0];
+$total = 0;
+foreach ($log as $entry) {
+	$trace = $entry->getTrace();
+	$total += $entry->getCpuTime();
+	if (isset($trace[0]['function']) && isset($cpu[$trace[0]['function']])) {
+		$cpu[$trace[0]['function']] += $entry->getCpuTime();
+		$wall[$trace[0]['function']] += $entry->getEventCount() * 0.01;
+	}
+}
+
+echo "total: " . (abs($total - $log->getCpuTime()) < 1e-6 ? 'OK' : 'FAILED') . "\n";
+echo "spin: " . ($cpu['spin'] > $wall['spin'] / 2 ? 'OK' : 'FAILED') . "\n";
+echo "idle: " . ($cpu['idle'] < $wall['idle'] / 2 ? 'OK' : 'FAILED') . "\n";
+echo "pprof: " . (strpos($log->formatPprof(), 'cpu') !== false ? 'OK' : 'FAILED') . "\n";
+
+--EXPECT--
+total: OK
+spin: OK
+idle: OK
+pprof: OK
@@ -0,0 +1,65 @@
+--TEST--
+ExcimerProfiler::setSharedRing
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--INI--
+excimer.ring_path={PWD}/ring.tmp
+--FILE--
+<?php
+
+function foo() {
+	bar();
+}
+
+function bar() {
+	$t = microtime(true);
+	while (microtime(true) - $t < 0.1) {
+		usleep(1000);
+	}
+}
+
+// Discard anything left by a previous run
+excimer_ring_read();
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.01);
+$profiler->setSharedRing(true);
+$profiler->start();
+foo();
+$profiler->stop();
+echo "log size: " . count($profiler->getLog()) . "\n";
+
+$frames = [];
+$found = 0;
+foreach (excimer_ring_read() as $record) {
+	if ($record['type'] === 'frame') {
+		$frames[$record['stream']][$record['id']] = $record;
+	} elseif ($record['type'] === 'sample') {
+		$stack = [];
+		$id = $record['id'];
+		while ($id) {
+			if (!isset($frames[$record['stream']][$id])) {
+				echo "Missing frame\n";
+				break;
+			}
+			$frame = $frames[$record['stream']][$id];
+			$stack[] = $frame['name'];
+			$id = $frame['prev_id'];
+		}
+		if (array_slice($stack, 0, 2) === ['bar', 'foo']) {
+			$found += $record['event_count'];
+		}
+	}
+}
+echo "samples: " . ($found > 0 ? 'OK' : 'FAILED') . "\n";
+echo "drained: " . (excimer_ring_read() === [] ? 'OK' : 'FAILED') . "\n";
+
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/ring.tmp');
+?>
+--EXPECT--
+log size: 0
+samples: OK
+drained: OK
@@ -0,0 +1,71 @@
+--TEST--
+ExcimerProfiler::setSharedRing with excimer.persistent_frames
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--INI--
+excimer.ring_path={PWD}/ringPersistentFrames.tmp
+excimer.persistent_frames=1000
+--FILE--
+<?php
+
+function foo() {
+	bar();
+}
+
+function bar() {
+	spin();
+}
+
+function baz() {
+	spin();
+}
+
+function spin() {
+	$t = microtime(true);
+	while (microtime(true) - $t < 0.1) {
+		usleep(1000);
+	}
+}
+
+function sample($function) {
+	$profiler = new ExcimerProfiler;
+	$profiler->setEventType(EXCIMER_REAL);
+	$profiler->setPeriod(0.01);
+	$profiler->setSharedRing(true);
+	$profiler->start();
+	$function();
+	$profiler->stop();
+}
+
+// Discard anything left by a previous run
+excimer_ring_read();
+
+sample('foo');
+excimer_ring_read();
+
+// The frames of foo() are still in the store, but only the frames reached
+// by the samples of the new stream are written
+sample('baz');
+$names = [];
+$ids = [];
+$ok = true;
+foreach (excimer_ring_read() as $record) {
+	if ($record['type'] === 'frame') {
+		$names[] = $record['name'];
+		$ok = $ok && !isset($ids[$record['id']])
+			&& (!$record['prev_id'] || isset($ids[$record['prev_id']]));
+		$ids[$record['id']] = true;
+	}
+}
+echo "baz: " . (in_array('baz', $names) ? 'OK' : 'FAILED') . "\n";
+echo "no foo: " . (!in_array('foo', $names) && !in_array('bar', $names) ? 'OK' : 'FAILED') . "\n";
+echo "callers first: " . ($ok ? 'OK' : 'FAILED') . "\n";
+
+--CLEAN--
+<?php
+@unlink(__DIR__ . '/ringPersistentFrames.tmp');
+?>
+--EXPECT--
+baz: OK
+no foo: OK
+callers first: OK
@@ -0,0 +1,71 @@
+--TEST--
+ExcimerLog::serialize() and ExcimerLog::fromString()
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	global $profiler;
+	while ($profiler->getLog()->getEventCount() < 20) {
+		$f = function () {
+			usleep(1000);
+		};
+		$f();
+	}
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setMaxDepth(3);
+$profiler->start();
+foo();
+$profiler->stop();
+$log = $profiler->flush();
+
+$data = $log->serialize();
+$loaded = ExcimerLog::fromString($data);
+echo "class: " . get_class($loaded) . "\n";
+echo "count: " . (count($loaded) === count($log) ? 'OK' : 'FAILED') . "\n";
+echo "events: " . ($loaded->getEventCount() === $log->getEventCount() ? 'OK' : 'FAILED') . "\n";
+echo "collapsed: " . ($loaded->formatCollapsed() === $log->formatCollapsed() ? 'OK' : 'FAILED') . "\n";
+echo "aggregate: " . ($loaded->aggregateByFunction() === $log->aggregateByFunction() ? 'OK' : 'FAILED') . "\n";
+$ok = true;
+foreach ($log as $i => $entry) {
+	$ok = $ok && $loaded[$i]->getTimestamp() === $entry->getTimestamp()
+		&& $loaded[$i]->getTrace() === $entry->getTrace();
+}
+echo "entries: " . ($ok ? 'OK' : 'FAILED') . "\n";
+echo "round trip: " . ($loaded->serialize() === $data ? 'OK' : 'FAILED') . "\n";
+
+var_dump(ExcimerLog::fromString('nonsense'));
+var_dump(ExcimerLog::fromString(substr($data, 0, -1)));
+
+// A log with no frames and one entry, followed by the event count if any
+$header = "EXCL\x01\x00\x00\x00\x00\x00\x00\x01";
+echo "one event: " . ExcimerLog::fromString("$header\x00\x00")->getEventCount() . "\n";
+var_dump(ExcimerLog::fromString("$header\x01\x00\x00"));
+var_dump(ExcimerLog::fromString("$header\x01\x01\x00"));
+
+--EXPECTF--
+class: ExcimerLog
+count: OK
+events: OK
+collapsed: OK
+aggregate: OK
+entries: OK
+round trip: OK
+
+Warning: ExcimerLog::fromString(): Invalid serialized log in %s on line %d
+bool(false)
+
+Warning: ExcimerLog::fromString(): Invalid serialized log in %s on line %d
+bool(false)
+one event: 1
+
+Warning: ExcimerLog::fromString(): Invalid entry in serialized log in %s on line %d
+bool(false)
+
+Warning: ExcimerLog::fromString(): Invalid entry in serialized log in %s on line %d
+bool(false)
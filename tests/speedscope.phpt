@@ -0,0 +1,33 @@
+--TEST--
+ExcimerLog::formatSpeedscope
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	bar();
+}
+
+function bar() {
+	global $profiler;
+	$profiler->start();
+	while (count($profiler->getLog()) < 5) {
+		usleep(1000);
+	}
+	$profiler->stop();
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.01);
+foo();
+$log = $profiler->flush();
+
+$decoded = json_decode($log->formatSpeedscope(), true);
+echo "equal: " . ($decoded === $log->getSpeedscopeData() ? 'OK' : 'FAILED') . "\n";
+echo "frames: " . implode(',', array_column($decoded['shared']['frames'], 'name')) . "\n";
+
+--EXPECTF--
+equal: OK
+frames: %sspeedscope.php,foo,bar
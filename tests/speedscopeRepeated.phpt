@@ -0,0 +1,57 @@
+--TEST--
+ExcimerLog speedscope formatting with repeated stacks
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	global $profiler;
+	$profiler->start();
+	while (count($profiler->getLog()) < 20) {
+		usleep(1000);
+	}
+	$profiler->stop();
+}
+
+foreach ([false, true] as $compact) {
+	$profiler = new ExcimerProfiler;
+	$profiler->setEventType(EXCIMER_REAL);
+	$profiler->setPeriod(0.001);
+	$profiler->setCompact($compact);
+	foo();
+	$log = $profiler->flush();
+
+	$data = $log->getSpeedscopeData();
+	$samples = $data['profiles'][0]['samples'];
+	$weights = $data['profiles'][0]['weights'];
+	echo "equal: " . (json_decode($log->formatSpeedscope(), true) === $data ? 'OK' : 'FAILED') . "\n";
+	echo "counts: " . (count($samples) === count($log) && count($weights) === count($log) ? 'OK' : 'FAILED') . "\n";
+
+	// Modifying one sample does not affect another with the same stack
+	$first = json_encode($samples[0]);
+	$data['profiles'][0]['samples'][0][] = -1;
+	$same = 0;
+	foreach ($data['profiles'][0]['samples'] as $i => $sample) {
+		if ($i && json_encode($sample) === $first) {
+			$same++;
+		}
+	}
+	echo "shared: " . ($same > 0 ? 'OK' : 'FAILED') . "\n";
+
+	$total = 0;
+	foreach ($log as $entry) {
+		$total += $entry->getEventCount();
+	}
+	echo "weights: " . (array_sum($weights) === $total * 1000000 ? 'OK' : 'FAILED') . "\n";
+}
+
+--EXPECT--
+equal: OK
+counts: OK
+shared: OK
+weights: OK
+equal: OK
+counts: OK
+shared: OK
+weights: OK
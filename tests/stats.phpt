@@ -0,0 +1,53 @@
+--TEST--
+ExcimerProfiler and ExcimerLog stats
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	global $profiler, $flushed;
+	while ($flushed < 2 || !count($profiler->getLog())) {
+		usleep(1000);
+	}
+}
+
+$flushed = 0;
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setFlushCallback(function ($log) use (&$flushed) {
+	$flushed++;
+}, 5);
+$profiler->start();
+foo();
+$profiler->stop();
+
+$stats = $profiler->getStats();
+echo "samples: " . ($stats['samples'] >= 10 ? 'OK' : 'FAILED') . "\n";
+echo "events: " . ($stats['events'] >= $stats['samples'] ? 'OK' : 'FAILED') . "\n";
+echo "overruns: " . ($stats['overruns'] >= 0 ? 'OK' : 'FAILED') . "\n";
+echo "interrupt_ns: " . ($stats['interrupt_ns'] > 0 ? 'OK' : 'FAILED') . "\n";
+echo "flushes: " . ($stats['flushes'] === $flushed ? 'OK' : 'FAILED') . "\n";
+
+$log = $profiler->getLog();
+$logStats = $log->getStats();
+echo "log: " . ($stats['log']['entries'] === count($log) ? 'OK' : 'FAILED') . "\n";
+echo "entries: " . ($logStats['entries'] === count($log) ? 'OK' : 'FAILED') . "\n";
+echo "walked: " . ($logStats['frames_walked'] >= $logStats['frames_cached'] ? 'OK' : 'FAILED') . "\n";
+echo "hits: " . ($logStats['frame_lookups'] >= $logStats['frame_lookup_hits'] ? 'OK' : 'FAILED') . "\n";
+echo "entry_bytes: " . ($logStats['entry_bytes'] > 0 ? 'OK' : 'FAILED') . "\n";
+echo "frame_bytes: " . ($logStats['frame_bytes'] > 0 ? 'OK' : 'FAILED') . "\n";
+
+--EXPECT--
+samples: OK
+events: OK
+overruns: OK
+interrupt_ns: OK
+flushes: OK
+log: OK
+entries: OK
+walked: OK
+hits: OK
+entry_bytes: OK
+frame_bytes: OK
@@ -99,6 +99,35 @@ int timerlib_timer_stop(timerlib_timer_t *timer);
  */
 void timerlib_timer_destroy(timerlib_timer_t *timer);
 
+/**
+ * Stop a timer and detach its callback, so that it can be reused later with
+ * timerlib_timer_unpark(). This is cheaper than destroying the timer and
+ * initialising a new one.
+ *
+ * When this returns, the callback will not be called again until the timer is
+ * unparked. If this fails, the timer is still valid and should be destroyed.
+ *
+ * @param[in,out] timer
+ * @return TIMERLIB_SUCCESS if the timer was parked, TIMERLIB_FAILURE if
+ *   parking is not supported or an error occurred.
+ */
+int timerlib_timer_park(timerlib_timer_t *timer);
+
+/**
+ * Reattach a parked timer to a new callback. This fails if stale expiration
+ * events from before the timer was parked may still be delivered, in which
+ * case the caller may try again later, or destroy the timer.
+ *
+ * It is not possible to change the clock of a parked timer.
+ *
+ * @param[in,out] timer
+ * @param notify_function Function to be called when the timer expires
+ * @param notify_data The first parameter sent to notify_function
+ * @return TIMERLIB_SUCCESS if the timer is ready to be started, TIMERLIB_FAILURE otherwise
+ */
+int timerlib_timer_unpark(timerlib_timer_t *timer,
+		timerlib_notify_function_t *notify_function, void *notify_data);
+
 /**
  * Get the remaining time until the next scheduled expiratioh of a timer.
  * This is an estimate based on the last reported firing time of the timer and the configured period.
@@ -109,6 +138,13 @@ void timerlib_timer_destroy(timerlib_timer_t *timer);
  */
 int timerlib_timer_get_time(timerlib_timer_t *timer, timerlib_timespec_t *remaining);
 
+/**
+ * Release global resources, e.g. stop the shared handler thread if there is
+ * one. This should be called before the library is unloaded. Timers may be
+ * created again afterwards.
+ */
+void timerlib_shutdown(void);
+
 //--------------------------------------------------------------------------------
 // Clock functions
 //--------------------------------------------------------------------------------
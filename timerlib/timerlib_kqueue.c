@@ -15,187 +15,517 @@
 
 #include "timerlib.h"
 
+#include <errno.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <sys/event.h>
 
 #include "timerlib_pthread_mutex.h"
 
 /**
- * Handle a single timer event from a kqueue-based timer.
- * @param timer The timer instance holding the kqueue-based timer.
- * @param event Pointer to a kevent struct to store the event in.
- * @return TIMERLIB_SUCCESS if event processing may continue, TIMERLIB_FAILURE otherwise.
+ * All timers in the process are EVFILT_TIMER events in a single shared
+ * kqueue, which is waited on by a single handler thread. The event ident
+ * identifies the timer by its slot in a registry, combined with a generation
+ * number. The generation number is incremented when a slot is released or the
+ * timer is parked, so an event which the handler thread had already received
+ * will not be delivered to a new timer or callback.
+ *
+ * The handler thread receives up to TIMERLIB_KQUEUE_BATCH_SIZE events per
+ * kevent() call, and dispatches them all with a single acquisition of the
+ * registry mutex.
  */
-static int timerlib_handle_timer_event(timerlib_timer_t *timer, struct kevent* event) {
-	int ret = kevent(timer->kq, NULL, 0, event, 1, NULL);
-	if (ret == -1) {
-		// EINTR merely implies that a signal was delivered before the timeout expired, so ignore it if it shows up.
-		if (errno != EINTR) {
-			// EBADF implies that the kqueue was closed, so we should exit the thread.
-			if (errno != EBADF) {
-				timerlib_abort("kevent", errno);
-			}
 
-			return TIMERLIB_FAILURE;
-		}
-	} else if (ret > 0) {
-		// Help emulate POSIX timer_gettime by keeping track of each moment the timer fires.
-		timerlib_mutex_lock(&timer->last_fired_at_mutex);
-		timerlib_clock_get_time(0, &timer->last_fired_at);
-		timerlib_mutex_unlock(&timer->last_fired_at_mutex);
+// The number of bits of the timer ID which hold the slot index
+#define TIMERLIB_SLOT_BITS 16
+#define TIMERLIB_SLOT_MASK ((1 << TIMERLIB_SLOT_BITS) - 1)
+#define TIMERLIB_MAX_SLOTS (1 << TIMERLIB_SLOT_BITS)
+
+// A marker for the end of the free list
+#define TIMERLIB_NO_SLOT ((uint32_t)-1)
+
+// The maximum number of events received by one kevent() call
+#define TIMERLIB_KQUEUE_BATCH_SIZE 64
+
+// The ident of the EVFILT_USER event used to wake the handler thread
+#define TIMERLIB_KQUEUE_WAKE_IDENT 0
+
+typedef struct {
+	// The registered timer, or NULL if the slot is free
+	timerlib_timer_t *timer;
+	// The timer ID, including the generation number
+	uintptr_t id;
+	// If the slot is free, the index of the next free slot
+	uint32_t next_free;
+} timerlib_slot_t;
+
+static struct {
+	// Protects all other members, and is held while callbacks are running
+	pthread_mutex_t mutex;
+	// The shared kqueue, or -1
+	int kq;
+	// The handler thread
+	pthread_t thread;
+	// True if the thread is running and kq is valid
+	int thread_valid;
+	// Set to notify the handler thread that it should exit
+	int killed;
+	// True if the fork handlers have been registered
+	int atfork_registered;
+	// The slot array
+	timerlib_slot_t *slots;
+	// The number of used elements in the slot array
+	uint32_t size;
+	// The number of allocated elements in the slot array
+	uint32_t capacity;
+	// The index of the first free slot
+	uint32_t free_head;
+	// The number of registered timers
+	uint32_t num_registered;
+} timerlib_registry = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.kq = -1,
+	.free_head = TIMERLIB_NO_SLOT
+};
 
-		// Match the behavior of POSIX's timer_getoverrun, which only counts additional timer expirations.
-		int overrun_count = (int)event->data - 1;
+/**
+ * Fork handlers. A kqueue is not inherited by the child, and neither is the
+ * handler thread, so forget about them, and start a new thread when a timer
+ * is next started. The registered timers are disarmed, but they remain
+ * registered until they are destroyed.
+ */
+static void timerlib_atfork_prepare(void)
+{
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+}
 
-		timer->notify_function(timer->notify_data, overrun_count);
-	}
+static void timerlib_atfork_parent(void)
+{
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+}
 
-	return TIMERLIB_SUCCESS;
+static void timerlib_atfork_child(void)
+{
+	uint32_t i;
+	for (i = 0; i < timerlib_registry.size; i++) {
+		if (timerlib_registry.slots[i].timer) {
+			timerlib_registry.slots[i].timer->armed = 0;
+		}
+	}
+	timerlib_registry.mutex = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	timerlib_registry.kq = -1;
+	timerlib_registry.thread_valid = 0;
+	timerlib_registry.killed = 0;
 }
 
 /**
- * Configure a kqueue-based timer using the given flags and period.
- * @param timer Pointer to the timer this timer belongs to.
+ * Add or modify the kqueue event of a timer. The registry mutex must be held.
+ * @param timer The timer
  * @param flags Flags to use when configuring the kqueue timer.
  * @param period Period to use for the timer.
  * @return TIMERLIB_SUCCESS if the timer was successfully setup, TIMERLIB_FAILURE otherwise.
  */
 static int timerlib_setup_kqueue_timer(timerlib_timer_t *timer, int flags, timerlib_timespec_t* period) {
 	struct kevent kev;
-	EV_SET(&kev, 1, EVFILT_TIMER, flags, 
-			NOTE_NSECONDS, timerlib_timespec_to_ns(period), (void*)timer);
+	EV_SET(&kev, timer->id, EVFILT_TIMER, flags,
+			NOTE_NSECONDS, timerlib_timespec_to_ns(period), NULL);
 
-	int ret = kevent(timer->kq, &kev, 1, NULL, 0, NULL);
-	if (ret == -1) {
+	if (kevent(timerlib_registry.kq, &kev, 1, NULL, 0, NULL) == -1) {
 		timerlib_report_errno("kevent", errno);
 		return TIMERLIB_FAILURE;
 	}
+	timer->armed = 1;
+	return TIMERLIB_SUCCESS;
+}
+
+/**
+ * Delete the kqueue event of a timer, if it is armed. Pending events are
+ * removed from the kqueue along with it. The registry mutex must be held.
+ * @param timer The timer
+ * @return TIMERLIB_SUCCESS or TIMERLIB_FAILURE
+ */
+static int timerlib_disarm(timerlib_timer_t *timer) {
+	struct kevent kev;
 
+	if (!timer->armed) {
+		return TIMERLIB_SUCCESS;
+	}
+	timer->armed = 0;
+	EV_SET(&kev, timer->id, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+	// ENOENT means that a one-shot event already fired and deleted itself
+	if (kevent(timerlib_registry.kq, &kev, 1, NULL, 0, NULL) == -1 && errno != ENOENT) {
+		timerlib_report_errno("kevent", errno);
+		return TIMERLIB_FAILURE;
+	}
 	return TIMERLIB_SUCCESS;
 }
 
 /**
- * Main loop for a kqueue-based timer handler thread.
- * @param arg Pointer to the timer this handler belongs to.
+ * Deliver a timer expiration to the timer it belongs to, if it still exists.
+ * The registry mutex must be held.
+ * @param event The event received from the kqueue
  */
-static void* timerlib_kqueue_handle(void *arg) {
-	struct kevent event;
+static void timerlib_dispatch(struct kevent *event)
+{
+	uintptr_t id = event->ident;
+	uint32_t index = id & TIMERLIB_SLOT_MASK;
+	timerlib_timer_t *timer;
 
-	timerlib_timer_t *timer = (timerlib_timer_t*)arg;
+	if (index >= timerlib_registry.size) {
+		return;
+	}
+	timer = timerlib_registry.slots[index].timer;
+	if (!timer || timerlib_registry.slots[index].id != id || timer->parked) {
+		return;
+	}
 
-	// kqueue supports either periodic or one-shot timers, but not periodic timers with a delayed initial expiration.
-	// So, if the initial delay is non-zero, wait for the one-shot initial timer to expire,
-	// then - if needed - reconfigure the underlying kqueue as a periodic timer with the proper period going forward.
-	if (!timerlib_timespec_is_zero(&timer->initial)) {
-		if (timerlib_handle_timer_event(timer, &event) == TIMERLIB_FAILURE) {
-			return NULL;
+	// kqueue supports either periodic or one-shot timers, but not periodic
+	// timers with a delayed initial expiration. So, if the one-shot initial
+	// expiration was configured, replace it with the periodic timer.
+	if (timer->initial_pending) {
+		timer->initial_pending = 0;
+		timer->armed = 0;
+		if (!timerlib_timespec_is_zero(&timer->period)) {
+			timerlib_setup_kqueue_timer(timer, EV_ADD | EV_ENABLE, &timer->period);
 		}
+	}
 
-		if (timerlib_timespec_is_zero(&timer->period)) {
-			return NULL;
+	// Help emulate POSIX timer_gettime by keeping track of each moment the timer fires.
+	timerlib_clock_get_time(0, &timer->last_fired_at);
+
+	// Match the behavior of POSIX's timer_getoverrun, which only counts additional timer expirations.
+	timer->notify_function(timer->notify_data, (int)event->data - 1);
+}
+
+/**
+ * The start routine of the handler thread
+ * @param arg The kqueue file descriptor
+ */
+static void* timerlib_timer_thread_main(void *arg)
+{
+	struct kevent events[TIMERLIB_KQUEUE_BATCH_SIZE];
+	int kq = (int)(intptr_t)arg;
+
+	while (1) {
+		int i, n;
+
+		n = kevent(kq, NULL, 0, events, TIMERLIB_KQUEUE_BATCH_SIZE, NULL);
+		if (n == -1) {
+			// EINTR merely implies that a signal was delivered, so ignore it.
+			if (errno == EINTR) {
+				continue;
+			}
+			timerlib_abort("kevent", errno);
 		}
 
-		int ret = timerlib_setup_kqueue_timer(timer, EV_ADD | EV_ENABLE, &timer->period);
-		if (ret == TIMERLIB_FAILURE) {
+		// Holding the mutex while the callbacks run means that
+		// timerlib_timer_destroy() will wait for them to finish.
+		timerlib_mutex_lock(&timerlib_registry.mutex);
+		if (timerlib_registry.killed) {
+			timerlib_mutex_unlock(&timerlib_registry.mutex);
 			return NULL;
 		}
+		for (i = 0; i < n; i++) {
+			if (events[i].filter == EVFILT_TIMER) {
+				timerlib_dispatch(&events[i]);
+			}
+		}
+		timerlib_mutex_unlock(&timerlib_registry.mutex);
 	}
+}
+
+/**
+ * Create the kqueue and start the handler thread if it is not already
+ * running. The registry mutex must be held.
+ */
+static int timerlib_start_thread(void)
+{
+	struct kevent kev;
+	int kq, error;
 
-	while (timerlib_handle_timer_event(timer, &event) == TIMERLIB_SUCCESS) {}
+	if (timerlib_registry.thread_valid) {
+		return TIMERLIB_SUCCESS;
+	}
+
+	if (!timerlib_registry.atfork_registered) {
+		error = pthread_atfork(timerlib_atfork_prepare, timerlib_atfork_parent,
+			timerlib_atfork_child);
+		if (error) {
+			timerlib_report_errno("pthread_atfork", error);
+			return TIMERLIB_FAILURE;
+		}
+		timerlib_registry.atfork_registered = 1;
+	}
+
+	kq = kqueue();
+	if (kq == -1) {
+		timerlib_report_errno("kqueue", errno);
+		return TIMERLIB_FAILURE;
+	}
+
+	// Add the event which timerlib_shutdown() triggers to wake the thread
+	EV_SET(&kev, TIMERLIB_KQUEUE_WAKE_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+	if (kevent(kq, &kev, 1, NULL, 0, NULL) == -1) {
+		timerlib_report_errno("kevent", errno);
+		close(kq);
+		return TIMERLIB_FAILURE;
+	}
+
+	// Block all signals in the new thread, so that it does not receive
+	// process-directed signals which are normally handled by the main thread.
+	sigset_t sigmask, old_sigmask;
+	sigfillset(&sigmask);
+	pthread_sigmask(SIG_BLOCK, &sigmask, &old_sigmask);
+	timerlib_registry.killed = 0;
+	error = pthread_create(&timerlib_registry.thread, NULL,
+		timerlib_timer_thread_main, (void*)(intptr_t)kq);
+	pthread_sigmask(SIG_SETMASK, &old_sigmask, NULL);
+	if (error) {
+		timerlib_report_errno("pthread_create", error);
+		close(kq);
+		return TIMERLIB_FAILURE;
+	}
 
-	return NULL;
+	timerlib_registry.kq = kq;
+	timerlib_registry.thread_valid = 1;
+	return TIMERLIB_SUCCESS;
+}
+
+/**
+ * Allocate a registry slot for a timer and set timer->id. The registry mutex
+ * must be held.
+ */
+static int timerlib_register(timerlib_timer_t *timer)
+{
+	uint32_t index;
+	timerlib_slot_t *slot;
+
+	if (timerlib_registry.free_head != TIMERLIB_NO_SLOT) {
+		index = timerlib_registry.free_head;
+		slot = &timerlib_registry.slots[index];
+		timerlib_registry.free_head = slot->next_free;
+	} else {
+		if (timerlib_registry.size >= TIMERLIB_MAX_SLOTS) {
+			timerlib_report_errno("timerlib_register", EAGAIN);
+			return TIMERLIB_FAILURE;
+		}
+		if (timerlib_registry.size >= timerlib_registry.capacity) {
+			uint32_t new_capacity = timerlib_registry.capacity ?
+				timerlib_registry.capacity * 2 : 16;
+			timerlib_slot_t *new_slots = realloc(timerlib_registry.slots,
+				new_capacity * sizeof(timerlib_slot_t));
+			if (!new_slots) {
+				timerlib_report_errno("realloc", ENOMEM);
+				return TIMERLIB_FAILURE;
+			}
+			timerlib_registry.slots = new_slots;
+			timerlib_registry.capacity = new_capacity;
+		}
+		index = timerlib_registry.size++;
+		slot = &timerlib_registry.slots[index];
+		slot->id = index;
+	}
+	slot->timer = timer;
+	slot->next_free = TIMERLIB_NO_SLOT;
+	timer->id = slot->id;
+	timer->registered = 1;
+	timerlib_registry.num_registered++;
+	return TIMERLIB_SUCCESS;
+}
+
+/**
+ * Increment the generation number of a timer's slot, so that events already
+ * received by the handler thread will be ignored. The registry mutex must be
+ * held, and the timer must be disarmed.
+ */
+static void timerlib_renumber(timerlib_timer_t *timer)
+{
+	timerlib_slot_t *slot = &timerlib_registry.slots[timer->id & TIMERLIB_SLOT_MASK];
+	slot->id += TIMERLIB_MAX_SLOTS;
+	timer->id = slot->id;
+}
+
+/**
+ * Release the registry slot belonging to a timer. After this returns, the
+ * callback will not be called again. The registry mutex must be held.
+ */
+static void timerlib_unregister(timerlib_timer_t *timer)
+{
+	uint32_t index = timer->id & TIMERLIB_SLOT_MASK;
+	timerlib_slot_t *slot = &timerlib_registry.slots[index];
+
+	slot->timer = NULL;
+	// Increment the generation number
+	slot->id += TIMERLIB_MAX_SLOTS;
+	slot->next_free = timerlib_registry.free_head;
+	timerlib_registry.free_head = index;
+	timerlib_registry.num_registered--;
+	timer->registered = 0;
 }
 
 int timerlib_timer_init(timerlib_timer_t *timer, int clock,
 		timerlib_notify_function_t *notify_function, void *notify_data)
 {
+	int ret;
+
 	*timer = (timerlib_timer_t){
-		.kq = -1,
 		.notify_function = notify_function,
-		.notify_data = notify_data,
-		.last_fired_at_mutex = PTHREAD_MUTEX_INITIALIZER
+		.notify_data = notify_data
 	};
-	return TIMERLIB_SUCCESS;
+
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	ret = timerlib_register(timer);
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+	return ret;
 }
 
 int timerlib_timer_start(timerlib_timer_t* timer, timerlib_timespec_t *period, timerlib_timespec_t *initial) {
-	timer->period = *period;
-	timer->initial = *initial;
+	int ret = TIMERLIB_FAILURE;
 
-	int kq = kqueue();
-	if (kq == -1) {
-		timerlib_report_errno("kqueue", errno);
+	if (!timer->registered) {
 		return TIMERLIB_FAILURE;
 	}
-	timer->kq = kq;
 
-	timerlib_clock_get_time(0, &timer->last_fired_at);
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	if (timerlib_start_thread() == TIMERLIB_SUCCESS
+		&& timerlib_disarm(timer) == TIMERLIB_SUCCESS)
+	{
+		timer->period = *period;
+		timerlib_clock_get_time(0, &timer->last_fired_at);
+
+		// Use a one-shot event if an initial expiration was provided
+		if (!timerlib_timespec_is_zero(initial)) {
+			timer->initial_pending = 1;
+			ret = timerlib_setup_kqueue_timer(timer, EV_ADD | EV_ENABLE | EV_ONESHOT, initial);
+		} else {
+			timer->initial_pending = 0;
+			ret = timerlib_setup_kqueue_timer(timer, EV_ADD | EV_ENABLE, period);
+		}
+	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+	return ret;
+}
 
-	int flags = EV_ADD | EV_ENABLE;
+int timerlib_timer_stop(timerlib_timer_t* timer) {
 	int ret;
 
-	// Use a non-periodic timer if an initial expiration was provided
-	if (!timerlib_timespec_is_zero(initial)) {
-		flags |= EV_ONESHOT;
-		ret = timerlib_setup_kqueue_timer(timer, flags, initial);
-	} else {
-		ret = timerlib_setup_kqueue_timer(timer, flags, period);
+	if (!timer->registered) {
+		return TIMERLIB_FAILURE;
 	}
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	timer->period.tv_sec = 0;
+	timer->period.tv_nsec = 0;
+	timer->initial_pending = 0;
+	ret = timerlib_disarm(timer);
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+	return ret;
+}
 
-	if (ret == TIMERLIB_FAILURE) {
-		return TIMERLIB_FAILURE;
+void timerlib_timer_destroy(timerlib_timer_t *timer) {
+	if (timer->registered) {
+		timerlib_mutex_lock(&timerlib_registry.mutex);
+		timerlib_disarm(timer);
+		timerlib_unregister(timer);
+		timerlib_mutex_unlock(&timerlib_registry.mutex);
 	}
+}
+
+int timerlib_timer_park(timerlib_timer_t *timer) {
+	int ret = TIMERLIB_FAILURE;
 
-	ret = pthread_create(&timer->handler_thread_id, NULL, timerlib_kqueue_handle, timer);
-	if (ret != 0) {
-		timerlib_report_errno("pthread_create", ret);
+	if (!timer->registered) {
 		return TIMERLIB_FAILURE;
 	}
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	timer->initial_pending = 0;
+	if (timerlib_disarm(timer) == TIMERLIB_SUCCESS) {
+		// Events for the old ID which the handler thread is about to
+		// dispatch are ignored, so the timer can be unparked immediately.
+		timerlib_renumber(timer);
+		timer->parked = 1;
+		ret = TIMERLIB_SUCCESS;
+	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+	return ret;
+}
 
-	return TIMERLIB_SUCCESS;
+int timerlib_timer_unpark(timerlib_timer_t *timer,
+		timerlib_notify_function_t *notify_function, void *notify_data) {
+	int ret = TIMERLIB_FAILURE;
+
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	if (timer->registered && timer->parked) {
+		timer->notify_function = notify_function;
+		timer->notify_data = notify_data;
+		timer->parked = 0;
+		ret = TIMERLIB_SUCCESS;
+	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+	return ret;
 }
 
-int timerlib_timer_stop(timerlib_timer_t* timer) {
-	if (timer->kq != -1) {
-		timer->period.tv_sec = 0;
-		timer->period.tv_nsec = 0;
+void timerlib_shutdown(void) {
+	struct kevent kev;
 
-		if (close(timer->kq) == -1) {
-			timerlib_report_errno("close", errno);
-			return TIMERLIB_FAILURE;
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	int thread_valid = timerlib_registry.thread_valid;
+	int kq = timerlib_registry.kq;
+	pthread_t thread = timerlib_registry.thread;
+	if (thread_valid) {
+		timerlib_registry.killed = 1;
+		timerlib_registry.thread_valid = 0;
+		timerlib_registry.kq = -1;
+		EV_SET(&kev, TIMERLIB_KQUEUE_WAKE_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+		if (kevent(kq, &kev, 1, NULL, 0, NULL) == -1) {
+			timerlib_report_errno("kevent", errno);
+			thread_valid = 0;
 		}
-
-		// Wait for the signal handler thread to finish.
-		int ret = pthread_join(timer->handler_thread_id, NULL);
-		if (ret != 0) {
-			timerlib_report_errno("pthread_join", ret);
-			return TIMERLIB_FAILURE;
+		// Timers which are still registered are no longer armed
+		for (uint32_t i = 0; i < timerlib_registry.size; i++) {
+			if (timerlib_registry.slots[i].timer) {
+				timerlib_registry.slots[i].timer->armed = 0;
+			}
 		}
 	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+
+	// Join the handler thread, wait for it to exit. This is done without the
+	// mutex since the thread may be waiting for it to dispatch events. The
+	// kqueue is closed afterwards, since the thread is still using it.
+	if (thread_valid) {
+		int error = pthread_join(thread, NULL);
+		if (error) {
+			timerlib_report_errno("pthread_join", error);
+		}
+	}
+	if (kq != -1 && close(kq) == -1) {
+		timerlib_report_errno("close", errno);
+	}
 
-	return TIMERLIB_SUCCESS;
-}
-
-void timerlib_timer_destroy(timerlib_timer_t *timer) {
-
-	int ret = pthread_mutex_destroy(&timer->last_fired_at_mutex);
-	if (ret != 0) {
-		timerlib_report_errno("pthread_mutex_destroy", ret);
+	// Free the registry, unless some timers were not destroyed
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	if (!timerlib_registry.num_registered) {
+		free(timerlib_registry.slots);
+		timerlib_registry.slots = NULL;
+		timerlib_registry.size = 0;
+		timerlib_registry.capacity = 0;
+		timerlib_registry.free_head = TIMERLIB_NO_SLOT;
 	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
 }
 
 int timerlib_timer_get_time(timerlib_timer_t *timer, timerlib_timespec_t *remaining) {
 	// Get the time at which the timer last fired
-	timerlib_mutex_lock(&timer->last_fired_at_mutex);
+	timerlib_mutex_lock(&timerlib_registry.mutex);
 	timerlib_timespec_t last_fired_at = timer->last_fired_at;
-	timerlib_mutex_unlock(&timer->last_fired_at_mutex);
+	timerlib_timespec_t will_fire_at = timer->period;
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
 
 	// Add the period to get the next expiry time
-	timerlib_timespec_t will_fire_at = timer->period;
 	timerlib_timespec_add(&will_fire_at, &last_fired_at);
 
 	// Subtract the current time to get the remaining time
@@ -214,4 +544,3 @@ int timerlib_clock_get_time(int clock, timerlib_timespec_t* time) {
 	}
 	return TIMERLIB_SUCCESS;
 }
-
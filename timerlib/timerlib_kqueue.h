@@ -1,32 +1,32 @@
 #ifndef TIMERLIB_KQUEUE_H
 #define TIMERLIB_KQUEUE_H
 
+#include <stdint.h>
 #include <sys/event.h>
 #include <sys/time.h>
 
 typedef struct timespec timerlib_timespec_t;
 
-/** Represents a timer backed by kqueue. */
+/** Represents a timer backed by an EVFILT_TIMER event in the shared kqueue. */
 typedef struct {
-	/** File descriptor of the kqueue backing this timer */
-	int kq;
-	/** The overrun count for this timer */
-	volatile int overrun_count;
+	/** The ident of the kqueue event, identifying the registry slot and its generation */
+	uintptr_t id;
+	/** True if the timer is registered with the handler thread */
+	int registered;
+	/** True if the timer has been parked by timerlib_timer_park() */
+	int parked;
+	/** True if the kqueue event has been added and not yet deleted */
+	int armed;
+	/** True if the event is the one-shot initial expiration, to be followed by the period */
+	int initial_pending;
 	/** The period of this timer */
 	struct timespec period;
-	/** The initial expiration time of this timer */
-	struct timespec initial;
 	/** Pointer to a callback to be invoked when this timer fires. */
 	timerlib_notify_function_t *notify_function;
 	/** Data to be passed to the callback */
 	void *notify_data;
-
-	/** Thread ID of the kqueue signal handler thread for this timer. */
-	pthread_t handler_thread_id;
-	/** The time at which this timer last fired. */
+	/** The time at which this timer last fired, protected by the registry mutex. */
 	struct timespec last_fired_at;
-	/** Mutex to protect last_fired_at from concurrent access */
-	pthread_mutex_t last_fired_at_mutex;
 } timerlib_timer_t;
 
 #endif
@@ -20,6 +20,7 @@
 
 #include "timerlib.h"
 
+#include <errno.h>
 #include <signal.h>
 #include <unistd.h>
 
@@ -64,50 +65,99 @@ static inline void timerlib_unblock_signals(sigset_t *old_sigmask)
 
 #include "timerlib_pthread_mutex.h"
 
+#include <stdint.h>
+#include <stdlib.h>
+
 /**
- * This is called by the handler thread to notify the main thread that
- * timer->tid is valid.
+ * All timers in the process deliver their signals to a single shared handler
+ * thread. The signal value identifies the timer by its slot in a registry,
+ * combined with a generation number. The generation number is incremented
+ * when a slot is released, so a signal which was queued before the timer was
+ * deleted will not be delivered to a new timer which reused the slot.
+ *
+ * A parked timer keeps its slot. To know when it is safe to reuse, parking
+ * queues a signal with the timer ID to the handler thread. Real-time signals
+ * are delivered in FIFO order, so when the handler thread receives it, any
+ * expiration signal queued before the timer was stopped has been discarded.
  */
-static void timerlib_notify_ready(timerlib_timer_t *timer)
-{
-	timerlib_mutex_lock(&timer->ready_mutex);
-	timer->ready = 1;
-	int error = pthread_cond_broadcast(&timer->ready_cond);
-	if (error) {
-		timerlib_abort("pthread_cond_broadcast", error);
-	}
-	timerlib_mutex_unlock(&timer->ready_mutex);
-}
+
+// The number of bits of the timer ID which hold the slot index
+#define TIMERLIB_SLOT_BITS 16
+#define TIMERLIB_SLOT_MASK ((1 << TIMERLIB_SLOT_BITS) - 1)
+#define TIMERLIB_MAX_SLOTS (1 << TIMERLIB_SLOT_BITS)
+
+// A marker for the end of the free list
+#define TIMERLIB_NO_SLOT ((uint32_t)-1)
+
+typedef struct {
+	// The registered timer, or NULL if the slot is free
+	timerlib_timer_t *timer;
+	// The timer ID, including the generation number
+	uintptr_t id;
+	// If the slot is free, the index of the next free slot
+	uint32_t next_free;
+} timerlib_slot_t;
+
+static struct {
+	// Protects all other members, and is held while callbacks are running
+	pthread_mutex_t mutex;
+	// Signalled by the handler thread when tid is valid
+	pthread_cond_t ready_cond;
+	// The handler thread
+	pthread_t thread;
+	// The handler thread ID
+	pid_t tid;
+	// True if the thread is running and tid is valid
+	int thread_valid;
+	// Set to notify the handler thread that it should exit
+	int killed;
+	// True if the fork handlers have been registered
+	int atfork_registered;
+	// The slot array
+	timerlib_slot_t *slots;
+	// The number of used elements in the slot array
+	uint32_t size;
+	// The number of allocated elements in the slot array
+	uint32_t capacity;
+	// The index of the first free slot
+	uint32_t free_head;
+	// The number of registered timers
+	uint32_t num_registered;
+} timerlib_registry = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.ready_cond = PTHREAD_COND_INITIALIZER,
+	.free_head = TIMERLIB_NO_SLOT
+};
 
 /**
- * Stop the handler thread (called from the main thread)
+ * Fork handlers. The handler thread does not exist in the child, so forget
+ * about it, and start a new one when a timer is next created. POSIX timers
+ * are not inherited by the child either, so the registered timers will never
+ * fire, but they remain registered until they are destroyed.
  */
-static int timerlib_graceful_exit(timerlib_timer_t *timer)
+static void timerlib_atfork_prepare(void)
 {
-	// We share TIMERLIB_SIGNAL between timer expiration and shutdown, mostly
-	// to be less intrusive on the application. But if an expiration signal
-	// is already pending, sending another will be ignored. We set a variable
-	// so that the thread will terminate anyway in that case.
-	timer->killed = 1;
-	int error = pthread_kill(timer->thread, TIMERLIB_SIGNAL);
-	if (error) {
-		timerlib_report_errno("pthread_kill", error);
-		return TIMERLIB_FAILURE;
-	}
-	return TIMERLIB_SUCCESS;
+	timerlib_mutex_lock(&timerlib_registry.mutex);
 }
 
-/**
- * Join the handler thread, wait for it to exit.
- */
-static int timerlib_join(timerlib_timer_t *timer)
+static void timerlib_atfork_parent(void)
 {
-	int error = pthread_join(timer->thread, NULL);
-	if (error) {
-		timerlib_report_errno("pthread_join", error);
-		return TIMERLIB_FAILURE;
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+}
+
+static void timerlib_atfork_child(void)
+{
+	uint32_t i;
+	for (i = 0; i < timerlib_registry.size; i++) {
+		if (timerlib_registry.slots[i].timer) {
+			timerlib_registry.slots[i].timer->timer_valid = 0;
+		}
 	}
-	return TIMERLIB_SUCCESS;
+	timerlib_registry.mutex = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+	timerlib_registry.ready_cond = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+	timerlib_registry.thread_valid = 0;
+	timerlib_registry.tid = 0;
+	timerlib_registry.killed = 0;
 }
 
 /**
@@ -128,16 +178,45 @@ static clockid_t timerlib_map_clock(int clock)
 	}
 }
 
+/**
+ * Deliver a timer expiration to the timer it belongs to, if it still exists.
+ */
+static void timerlib_dispatch(siginfo_t *si)
+{
+	uintptr_t id = (uintptr_t)si->si_value.sival_ptr;
+	uint32_t index = id & TIMERLIB_SLOT_MASK;
+
+	// Holding the mutex while the callback runs means that
+	// timerlib_timer_destroy() will wait for it to finish.
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	if (index < timerlib_registry.size) {
+		timerlib_slot_t *slot = &timerlib_registry.slots[index];
+		if (slot->timer && slot->id == id) {
+			if (si->si_code == SI_QUEUE) {
+				// The barrier sent by timerlib_timer_park()
+				slot->timer->drained = slot->timer->parked;
+			} else if (!slot->timer->parked) {
+				slot->timer->notify_function(slot->timer->notify_data, si->si_overrun);
+			}
+		}
+	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+}
+
 /**
  * The start routine of the handler thread
  */
 static void* timerlib_timer_thread_main(void *data)
 {
-	timerlib_timer_t *timer = data;
-	timer->tid = gettid();
-
 	// Tell the main thread we are ready to start
-	timerlib_notify_ready(timer);
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	timerlib_registry.tid = gettid();
+	timerlib_registry.thread_valid = 1;
+	int error = pthread_cond_broadcast(&timerlib_registry.ready_cond);
+	if (error) {
+		timerlib_abort("pthread_cond_broadcast", error);
+	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
 
 	// Receive only our signal
 	sigset_t sigset;
@@ -150,28 +229,36 @@ static void* timerlib_timer_thread_main(void *data)
 		// implementation. The documentation indicates that EINTR is the only
 		// possible error.
 		while (sigwaitinfo(&sigset, &si) < 0);
-		// If timer_stop() has been called, exit the thread
-		if (timer->killed) {
+		// If timerlib_shutdown() has been called, exit the thread
+		if (timerlib_registry.killed) {
 			return NULL;
 		}
 		// If signal occurred due to a timer expiration, call the callback.
-		if (si.si_code == SI_TIMER) {
-			timer->notify_function(timer->notify_data, si.si_overrun);
+		if (si.si_code == SI_TIMER || si.si_code == SI_QUEUE) {
+			timerlib_dispatch(&si);
 		}
 	}
 }
 
-int timerlib_timer_init(timerlib_timer_t *timer, int clock,
-		timerlib_notify_function_t *notify_function, void *notify_data)
+/**
+ * Start the handler thread if it is not already running, and wait for it to
+ * be ready. The registry mutex must be held.
+ */
+static int timerlib_start_thread(void)
 {
-	// Initialise the data. Fields that are not named are automatically zeroed.
-	*timer = (timerlib_timer_t){
-		.clock = clock,
-		.notify_function = notify_function,
-		.notify_data = notify_data,
-		.ready_cond = PTHREAD_COND_INITIALIZER,
-		.ready_mutex = PTHREAD_MUTEX_INITIALIZER,
-	};
+	if (timerlib_registry.thread_valid) {
+		return TIMERLIB_SUCCESS;
+	}
+
+	if (!timerlib_registry.atfork_registered) {
+		int error = pthread_atfork(timerlib_atfork_prepare, timerlib_atfork_parent,
+			timerlib_atfork_child);
+		if (error) {
+			timerlib_report_errno("pthread_atfork", error);
+			return TIMERLIB_FAILURE;
+		}
+		timerlib_registry.atfork_registered = 1;
+	}
 
 	// Block all signals. This prevents the thread from receiving process-directed
 	// signals which are normally handled by the main thread.
@@ -181,25 +268,105 @@ int timerlib_timer_init(timerlib_timer_t *timer, int clock,
 	timerlib_block_signals(&attr, &old_sigset);
 
 	// Create the thread
-	int error = pthread_create(&timer->thread, &attr, timerlib_timer_thread_main, timer);
+	timerlib_registry.killed = 0;
+	int error = pthread_create(&timerlib_registry.thread, &attr,
+		timerlib_timer_thread_main, NULL);
 	timerlib_unblock_signals(&old_sigset);
 	pthread_attr_destroy(&attr);
 	if (error) {
 		timerlib_report_errno("pthread_create", error);
 		return TIMERLIB_FAILURE;
 	}
-	timer->thread_valid = 1;
 
-	// Wait for timer->tid to become valid
-	timerlib_mutex_lock(&timer->ready_mutex);
-	while (!timer->ready) {
-		error = pthread_cond_wait(&timer->ready_cond, &timer->ready_mutex);
+	// Wait for the tid to become valid
+	while (!timerlib_registry.thread_valid) {
+		error = pthread_cond_wait(&timerlib_registry.ready_cond, &timerlib_registry.mutex);
 		if (error) {
-			timerlib_report_errno("pthread_cond_wait", error);
+			timerlib_abort("pthread_cond_wait", error);
+		}
+	}
+	return TIMERLIB_SUCCESS;
+}
+
+/**
+ * Allocate a registry slot for a timer and set timer->id. The registry mutex
+ * must be held.
+ */
+static int timerlib_register(timerlib_timer_t *timer)
+{
+	uint32_t index;
+	timerlib_slot_t *slot;
+
+	if (timerlib_registry.free_head != TIMERLIB_NO_SLOT) {
+		index = timerlib_registry.free_head;
+		slot = &timerlib_registry.slots[index];
+		timerlib_registry.free_head = slot->next_free;
+	} else {
+		if (timerlib_registry.size >= TIMERLIB_MAX_SLOTS) {
+			timerlib_report_errno("timerlib_register", EAGAIN);
 			return TIMERLIB_FAILURE;
 		}
+		if (timerlib_registry.size >= timerlib_registry.capacity) {
+			uint32_t new_capacity = timerlib_registry.capacity ?
+				timerlib_registry.capacity * 2 : 16;
+			timerlib_slot_t *new_slots = realloc(timerlib_registry.slots,
+				new_capacity * sizeof(timerlib_slot_t));
+			if (!new_slots) {
+				timerlib_report_errno("realloc", ENOMEM);
+				return TIMERLIB_FAILURE;
+			}
+			timerlib_registry.slots = new_slots;
+			timerlib_registry.capacity = new_capacity;
+		}
+		index = timerlib_registry.size++;
+		slot = &timerlib_registry.slots[index];
+		slot->id = index;
 	}
-	timerlib_mutex_unlock(&timer->ready_mutex);
+	slot->timer = timer;
+	slot->next_free = TIMERLIB_NO_SLOT;
+	timer->id = slot->id;
+	timer->registered = 1;
+	timerlib_registry.num_registered++;
+	return TIMERLIB_SUCCESS;
+}
+
+/**
+ * Release the registry slot belonging to a timer. After this returns, the
+ * callback will not be called again. The registry mutex must be held.
+ */
+static void timerlib_unregister(timerlib_timer_t *timer)
+{
+	uint32_t index = timer->id & TIMERLIB_SLOT_MASK;
+	timerlib_slot_t *slot = &timerlib_registry.slots[index];
+
+	slot->timer = NULL;
+	// Increment the generation number
+	slot->id += TIMERLIB_MAX_SLOTS;
+	slot->next_free = timerlib_registry.free_head;
+	timerlib_registry.free_head = index;
+	timerlib_registry.num_registered--;
+	timer->registered = 0;
+}
+
+int timerlib_timer_init(timerlib_timer_t *timer, int clock,
+		timerlib_notify_function_t *notify_function, void *notify_data)
+{
+	// Initialise the data. Fields that are not named are automatically zeroed.
+	*timer = (timerlib_timer_t){
+		.clock = clock,
+		.notify_function = notify_function,
+		.notify_data = notify_data,
+	};
+
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	if (timerlib_start_thread() == TIMERLIB_FAILURE
+		|| timerlib_register(timer) == TIMERLIB_FAILURE)
+	{
+		timerlib_mutex_unlock(&timerlib_registry.mutex);
+		return TIMERLIB_FAILURE;
+	}
+	pid_t tid = timerlib_registry.tid;
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
 
 	// Create the timer
 	// This needs to be done in the main thread, otherwise it silently fails
@@ -207,7 +374,8 @@ int timerlib_timer_init(timerlib_timer_t *timer, int clock,
 	struct sigevent sev = {
 		.sigev_signo = TIMERLIB_SIGNAL,
 		.sigev_notify = SIGEV_THREAD_ID,
-		.sigev_notify_thread_id = timer->tid
+		.sigev_notify_thread_id = tid,
+		.sigev_value.sival_ptr = (void*)timer->id
 	};
 	if (timer_create(timerlib_map_clock(timer->clock), &sev, &timer->timer)) {
 		timerlib_report_errno("timer_create", errno);
@@ -264,18 +432,100 @@ int timerlib_timer_stop(timerlib_timer_t * timer)
 
 void timerlib_timer_destroy(timerlib_timer_t * timer)
 {
-	if (timer->thread_valid) {
-		timer->thread_valid = 0;
-		if (timerlib_graceful_exit(timer) == TIMERLIB_SUCCESS) {
-			timerlib_join(timer);
-		}
-	}
+	// Delete the timer first so that no more signals will be queued
 	if (timer->timer_valid) {
 		timer->timer_valid = 0;
 		if (timer_delete(timer->timer)) {
 			timerlib_report_errno("timer_delete", errno);
 		}
 	}
+	if (timer->registered) {
+		timerlib_mutex_lock(&timerlib_registry.mutex);
+		timerlib_unregister(timer);
+		timerlib_mutex_unlock(&timerlib_registry.mutex);
+	}
+}
+
+int timerlib_timer_park(timerlib_timer_t *timer)
+{
+#ifdef HAVE_PTHREAD_SIGQUEUE
+	int ret = TIMERLIB_FAILURE;
+	if (!timer->registered || timerlib_timer_stop(timer) == TIMERLIB_FAILURE) {
+		return TIMERLIB_FAILURE;
+	}
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	if (timerlib_registry.thread_valid) {
+		timer->parked = 1;
+		timer->drained = 0;
+		int error = pthread_sigqueue(timerlib_registry.thread, TIMERLIB_SIGNAL,
+			(union sigval){.sival_ptr = (void*)timer->id});
+		if (error) {
+			timerlib_report_errno("pthread_sigqueue", error);
+		} else {
+			ret = TIMERLIB_SUCCESS;
+		}
+	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+	return ret;
+#else
+	return TIMERLIB_FAILURE;
+#endif
+}
+
+int timerlib_timer_unpark(timerlib_timer_t *timer,
+		timerlib_notify_function_t *notify_function, void *notify_data)
+{
+	int ret = TIMERLIB_FAILURE;
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	if (timer->timer_valid && timer->parked && timer->drained) {
+		timer->notify_function = notify_function;
+		timer->notify_data = notify_data;
+		timer->parked = 0;
+		timer->drained = 0;
+		ret = TIMERLIB_SUCCESS;
+	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+	return ret;
+}
+
+void timerlib_shutdown(void)
+{
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	int thread_valid = timerlib_registry.thread_valid;
+	pthread_t thread = timerlib_registry.thread;
+	if (thread_valid) {
+		// We share TIMERLIB_SIGNAL between timer expiration and shutdown, mostly
+		// to be less intrusive on the application. Set a variable so that the
+		// thread can distinguish the shutdown signal.
+		timerlib_registry.killed = 1;
+		timerlib_registry.thread_valid = 0;
+		int error = pthread_kill(thread, TIMERLIB_SIGNAL);
+		if (error) {
+			timerlib_report_errno("pthread_kill", error);
+			thread_valid = 0;
+		}
+	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
+
+	// Join the handler thread, wait for it to exit. This is done without the
+	// mutex since the thread may be waiting for it in timerlib_dispatch().
+	if (thread_valid) {
+		int error = pthread_join(thread, NULL);
+		if (error) {
+			timerlib_report_errno("pthread_join", error);
+		}
+	}
+
+	// Free the registry, unless some timers were not destroyed
+	timerlib_mutex_lock(&timerlib_registry.mutex);
+	if (!timerlib_registry.num_registered) {
+		free(timerlib_registry.slots);
+		timerlib_registry.slots = NULL;
+		timerlib_registry.size = 0;
+		timerlib_registry.capacity = 0;
+		timerlib_registry.free_head = TIMERLIB_NO_SLOT;
+	}
+	timerlib_mutex_unlock(&timerlib_registry.mutex);
 }
 
 int timerlib_timer_get_time(timerlib_timer_t *timer, timerlib_timespec_t *remaining)
@@ -14,6 +14,7 @@
  */
 
 #include <pthread.h>
+#include <stdint.h>
 #include <time.h>
 
 #define TIMERLIB_HAVE_CPU_CLOCK
@@ -25,24 +26,20 @@ typedef struct {
 	timer_t timer;
 	// True if timer is valid will need to be deleted
 	int timer_valid;
-	// The handler thread
-	pthread_t thread;
-	// True if the thread is valid
-	int thread_valid;
-	// The handler thread ID
-	pid_t tid;
+	// The ID sent as the signal value, identifying the handler thread's
+	// registry slot and its generation
+	uintptr_t id;
+	// True if the timer is registered with the handler thread
+	int registered;
+	// True if the timer has been parked by timerlib_timer_park()
+	int parked;
+	// True if the handler thread has processed all signals queued before
+	// the timer was parked
+	int drained;
 	// The clock type, TIMERLIB_REAL or TIMERLIB_CPU
 	int clock;
 	// Pointer to a callback to be invoked when this timer fires.
 	timerlib_notify_function_t *notify_function;
 	// Data to be passed to notify_function as the first argument
 	void *notify_data;
-	// The handler thread sets this when it is ready to receive events
-	int ready;
-	// A condition variable associated with "ready"
-	pthread_cond_t ready_cond;
-	// A mutex associated with "ready"
-	pthread_mutex_t ready_mutex;
-	// The main thread sets this to notify the handler thread that it should exit
-	int killed;
 } timerlib_timer_t;